@@ -0,0 +1,458 @@
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "area_table.h"
+#include "error.h"
+#include "memory.h"
+#include "parallel.h"
+#include "pixel_convert.h"
+
+/* columns per task of the vertical prefix pass */
+#define STRIP_COLUMNS 256
+
+static size_t table_index(Area_Table const * table, int row, int column)
+{
+    return (size_t) row * (table->size.x + 1) + column;
+}
+
+/* pixels of a row as packed float; channel and planar views are gathered a sample at a time */
+static void convert_pixels(Image_View const * view, int row, int column, float target[], int count)
+{
+    GLenum type = view->format.type;
+    int channels = format_to_size(view->format.format);
+    int sample_size = image_type_to_size(type);
+
+    if (view->stride.x == (size_t) channels * sample_size && view->channel_stride == (size_t) sample_size)
+    {
+        pixel_convert(image_view_pixel(view, 0, row, column), type, target, GL_FLOAT, count * channels);
+        return;
+    }
+
+    for (int j = 0; j != count; ++ j)
+    for (int c = 0; c != channels; ++ c)
+    {
+        unsigned char const * sample = (unsigned char const *) image_view_pixel(view, 0, row, column + j) + c * view->channel_stride;
+        pixel_convert(sample, type, &target[j * channels + c], GL_FLOAT, 1);
+    }
+}
+
+static int pixel_finite(float const pixel[], int channels, int * nan)
+{
+    for (int c = 0; c != channels; ++ c)
+    {
+        if (isfinite(pixel[c]))
+            continue;
+
+        * nan = isnan(pixel[c]);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* pass 1: every row becomes its own running sum, independently */
+static void prefix_rows(void * context, int first_row, int last_row)
+{
+    Area_Table * table = (Area_Table *) context;
+    Size size = table->size;
+    int channels = table->channels;
+
+    for (int i = first_row; i != last_row; ++ i)
+    {
+        float * row = malloc_array(float, size.x * channels);
+        size_t first = table_index(table, i + 1, 1);
+        double * sums = &table->sums[first * channels];
+        double * squares = table->squares ? &table->squares[first * channels] : NULL;
+        double sum[AREA_TABLE_CHANNELS] = {0}, square[AREA_TABLE_CHANNELS] = {0};
+        int nans = 0, infs = 0;
+
+        convert_pixels(&table->view, i, 0, row, size.x);
+
+        for (int j = 0; j != size.x; ++ j)
+        {
+            float const * pixel = &row[j * channels];
+            int nan;
+
+            if (table->nans && ! pixel_finite(pixel, channels, &nan))
+            {
+                nans += nan;
+                infs += ! nan;
+            }
+            else
+            {
+                for (int c = 0; c != channels; ++ c)
+                {
+                    double value = pixel[c] - table->offset[c];
+
+                    sum[c] += value;
+                    square[c] += value * value;
+                }
+            }
+
+            memcpy(&sums[j * channels], sum, channels * sizeof(double));
+
+            if (squares)
+                memcpy(&squares[j * channels], square, channels * sizeof(double));
+
+            if (table->nans)
+            {
+                table->nans[first + j] = nans;
+                table->infs[first + j] = infs;
+            }
+        }
+
+        free(row);
+    }
+}
+
+typedef struct {Area_Table const * table; void * values; int row_count;} Prefix_Task;
+
+/* pass 2: add each row to the next, strips of columns in parallel */
+static void prefix_strips(void * context, int first_strip, int last_strip)
+{
+    Prefix_Task const * task = (Prefix_Task const *) context;
+    int row_count = task->row_count;
+    int first = first_strip * STRIP_COLUMNS;
+    int last = last_strip * STRIP_COLUMNS < row_count ? last_strip * STRIP_COLUMNS : row_count;
+
+    for (int i = 2; i <= task->table->size.y; ++ i)
+    {
+        double const * above = (double const *) task->values + (size_t) (i - 1) * row_count;
+        double * row = (double *) task->values + (size_t) i * row_count;
+
+        for (int j = first; j != last; ++ j)
+            row[j] += above[j];
+    }
+}
+
+static void prefix_count_strips(void * context, int first_strip, int last_strip)
+{
+    Prefix_Task const * task = (Prefix_Task const *) context;
+    int row_count = task->row_count;
+    int first = first_strip * STRIP_COLUMNS;
+    int last = last_strip * STRIP_COLUMNS < row_count ? last_strip * STRIP_COLUMNS : row_count;
+
+    for (int i = 2; i <= task->table->size.y; ++ i)
+    {
+        int const * above = (int const *) task->values + (size_t) (i - 1) * row_count;
+        int * row = (int *) task->values + (size_t) i * row_count;
+
+        for (int j = first; j != last; ++ j)
+            row[j] += above[j];
+    }
+}
+
+static void prefix_columns(Area_Table const * table, double * values, int channels)
+{
+    Prefix_Task task = {table, values, (table->size.x + 1) * channels};
+    parallel_for((task.row_count + STRIP_COLUMNS - 1) / STRIP_COLUMNS, 1, prefix_strips, &task);
+}
+
+static void prefix_counts(Area_Table const * table, int * values, int channels)
+{
+    Prefix_Task task = {table, values, (table->size.x + 1) * channels};
+    parallel_for((task.row_count + STRIP_COLUMNS - 1) / STRIP_COLUMNS, 1, prefix_count_strips, &task);
+}
+
+static void range_cell(float const * minima, float const * maxima, int channels, float min[], float max[])
+{
+    for (int c = 0; c != channels; ++ c)
+    {
+        if (minima[c] < min[c]) min[c] = minima[c];
+        if (maxima[c] > max[c]) max[c] = maxima[c];
+    }
+}
+
+typedef struct {Area_Table * table; int level;} Range_Task;
+
+static void range_rows(void * context, int first, int last)
+{
+    Range_Task const * task = (Range_Task const *) context;
+    Area_Table * table = task->table;
+    int k = task->level;
+    Area_Range_Level * level = &table->levels[k];
+    Size size = table->size;
+    Size below = k ? table->levels[k - 1].size : size;
+    Size cells = level->size;
+    int channels = table->channels;
+
+    for (int i = first; i != last; ++ i)
+    {
+        float * rows = k ? NULL : malloc_array(float, 2 * size.x * channels);
+
+        if (rows)
+        {
+            for (int r = 0; r != 2 && 2 * i + r < size.y; ++ r)
+                convert_pixels(&table->view, 2 * i + r, 0, &rows[r * size.x * channels], size.x);
+        }
+
+        for (int j = 0; j != cells.x; ++ j)
+        {
+            float * min = &level->minima[((size_t) i * cells.x + j) * channels];
+            float * max = &level->maxima[((size_t) i * cells.x + j) * channels];
+
+            for (int c = 0; c != channels; ++ c)
+            {
+                min[c] = + FLT_MAX;
+                max[c] = - FLT_MAX;
+            }
+
+            for (int y = 2 * i; y != 2 * i + 2 && y < below.y; ++ y)
+            for (int x = 2 * j; x != 2 * j + 2 && x < below.x; ++ x)
+            {
+                int nan;
+
+                if (rows)
+                {
+                    float const * pixel = &rows[((y - 2 * i) * size.x + x) * channels];
+
+                    if (pixel_finite(pixel, channels, &nan))
+                        range_cell(pixel, pixel, channels, min, max);
+                }
+                else
+                {
+                    size_t index = ((size_t) y * below.x + x) * channels;
+                    range_cell(&table->levels[k - 1].minima[index], &table->levels[k - 1].maxima[index], channels, min, max);
+                }
+            }
+        }
+
+        free(rows);
+    }
+}
+
+/* level 1 from pixel pairs, every further level from the one below */
+static void build_range(Area_Table * table)
+{
+    Size size = table->size;
+    int channels = table->channels;
+    int count = 0;
+
+    for (Size s = size; s.x > 1 || s.y > 1; s.x = (s.x + 1) / 2, s.y = (s.y + 1) / 2)
+        ++ count;
+
+    table->level_count = count;
+    table->levels = calloc(count ? count : 1, sizeof(Area_Range_Level));
+
+    for (int k = 0; k != count; ++ k)
+    {
+        Area_Range_Level * level = &table->levels[k];
+        Size below = k ? table->levels[k - 1].size : size;
+        Size cells = {(below.x + 1) / 2, (below.y + 1) / 2, 1};
+        size_t cell_count = (size_t) cells.x * cells.y * channels;
+        Range_Task task = {table, k};
+
+        level->size = cells;
+        level->minima = malloc_array(float, cell_count);
+        level->maxima = malloc_array(float, cell_count);
+
+        parallel_for(cells.y, 1, range_rows, &task);
+    }
+}
+
+Area_Table * area_table_new(Image_View const * view, int flags)
+{
+    Image_Format format = view->format;
+    int channels = format_to_size(format.format);
+
+    error_check(channels > AREA_TABLE_CHANNELS, "too many channels for area table");
+
+    Area_Table * table = calloc(1, sizeof(Area_Table));
+    size_t count = (size_t) (format.size.x + 1) * (format.size.y + 1);
+
+    table->view = * view;
+    table->size = format.size;
+    table->size.z = 1;
+    table->channels = channels;
+    table->sums = calloc(count * channels, sizeof(double));
+    table->squares = flags & AREA_TABLE_SQUARES ? calloc(count * channels, sizeof(double)) : NULL;
+
+    if (format.type == GL_FLOAT || format.type == GL_HALF_FLOAT_ARB)
+    {
+        table->nans = calloc(count, sizeof(int));
+        table->infs = calloc(count, sizeof(int));
+    }
+
+    if (format.size.x && format.size.y)
+    {
+        float centre[AREA_TABLE_CHANNELS];
+        convert_pixels(view, format.size.y / 2, format.size.x / 2, centre, 1);
+
+        for (int c = 0; c != channels; ++ c)
+            table->offset[c] = isfinite(centre[c]) ? centre[c] : 0;
+    }
+
+    pixel_convert_isa();
+
+    parallel_for(table->size.y, 1, prefix_rows, table);
+    prefix_columns(table, table->sums, channels);
+
+    if (table->squares)
+        prefix_columns(table, table->squares, channels);
+
+    if (table->nans)
+    {
+        prefix_counts(table, table->nans, 1);
+        prefix_counts(table, table->infs, 1);
+    }
+
+    if (flags & AREA_TABLE_RANGE)
+        build_range(table);
+
+    return table;
+}
+
+void area_table_destroy(Area_Table * table)
+{
+    if (! table)
+        return;
+
+    for (int k = 0; k != table->level_count; ++ k)
+    {
+        free(table->levels[k].minima);
+        free(table->levels[k].maxima);
+    }
+
+    free(table->levels);
+    free(table->nans);
+    free(table->infs);
+    free(table->sums);
+    free(table->squares);
+    free(table);
+}
+
+typedef struct {int x0, y0, x1, y1;} Rectangle;
+
+/* rectangle clamped to the table, empty if nothing is left */
+static int clip(Area_Table const * table, Size position, Size size, Rectangle * r)
+{
+    r->x0 = position.x < 0 ? 0 : position.x;
+    r->y0 = position.y < 0 ? 0 : position.y;
+    r->x1 = position.x + size.x > table->size.x ? table->size.x : position.x + size.x;
+    r->y1 = position.y + size.y > table->size.y ? table->size.y : position.y + size.y;
+
+    return r->x1 > r->x0 && r->y1 > r->y0;
+}
+
+static void corners(Area_Table const * table, double const * values, Rectangle r, double result[])
+{
+    int channels = table->channels;
+    double const * a = &values[table_index(table, r.y0, r.x0) * channels];
+    double const * b = &values[table_index(table, r.y0, r.x1) * channels];
+    double const * c = &values[table_index(table, r.y1, r.x0) * channels];
+    double const * d = &values[table_index(table, r.y1, r.x1) * channels];
+
+    for (int i = 0; i != channels; ++ i)
+        result[i] = d[i] - b[i] - c[i] + a[i];
+}
+
+static int corner_count(Area_Table const * table, int const * counts, Rectangle r)
+{
+    if (! counts)
+        return 0;
+
+    return counts[table_index(table, r.y1, r.x1)] - counts[table_index(table, r.y0, r.x1)]
+         - counts[table_index(table, r.y1, r.x0)] + counts[table_index(table, r.y0, r.x0)];
+}
+
+/* descends from cells overlapping the border, whole cells come from the pyramid */
+static void range_query(Area_Table const * table, int level, int x, int y, Rectangle r, float min[], float max[])
+{
+    int x0 = x << level, y0 = y << level;
+    int x1 = (x + 1) << level, y1 = (y + 1) << level;
+
+    if (x1 > table->size.x) x1 = table->size.x;
+    if (y1 > table->size.y) y1 = table->size.y;
+
+    if (x0 >= r.x1 || y0 >= r.y1 || x1 <= r.x0 || y1 <= r.y0 || x0 >= x1 || y0 >= y1)
+        return;
+
+    if (level == 0)
+    {
+        float pixel[AREA_TABLE_CHANNELS];
+        int nan;
+
+        convert_pixels(&table->view, y, x, pixel, 1);
+
+        if (pixel_finite(pixel, table->channels, &nan))
+            range_cell(pixel, pixel, table->channels, min, max);
+
+        return;
+    }
+
+    if (x0 >= r.x0 && x1 <= r.x1 && y0 >= r.y0 && y1 <= r.y1)
+    {
+        Area_Range_Level const * cells = &table->levels[level - 1];
+        size_t index = ((size_t) y * cells->size.x + x) * table->channels;
+
+        range_cell(&cells->minima[index], &cells->maxima[index], table->channels, min, max);
+        return;
+    }
+
+    for (int i = 0; i != 2; ++ i)
+    for (int j = 0; j != 2; ++ j)
+        range_query(table, level - 1, 2 * x + j, 2 * y + i, r, min, max);
+}
+
+Area_Statistics area_table_statistics(Area_Table const * table, Size position, Size size)
+{
+    Area_Statistics statistics = {0};
+    double squares[AREA_TABLE_CHANNELS] = {0};
+    Rectangle r;
+
+    if (! clip(table, position, size, &r))
+        return statistics;
+
+    corners(table, table->sums, r, statistics.sum);
+
+    if (table->squares)
+        corners(table, table->squares, r, squares);
+
+    statistics.nan_count = corner_count(table, table->nans, r);
+    statistics.inf_count = corner_count(table, table->infs, r);
+    statistics.count = (r.x1 - r.x0) * (r.y1 - r.y0) - statistics.nan_count - statistics.inf_count;
+
+    for (int c = 0; c != table->channels; ++ c)
+    {
+        double shifted = statistics.count ? statistics.sum[c] / statistics.count : 0;
+
+        statistics.sum[c] += statistics.count * table->offset[c];
+        statistics.mean[c] = statistics.count ? shifted + table->offset[c] : 0;
+
+        if (statistics.count)
+        {
+            double variance = squares[c] / statistics.count - shifted * shifted;
+            statistics.variance[c] = variance > 0 ? variance : 0;
+        }
+
+        statistics.min[c] = + FLT_MAX;
+        statistics.max[c] = - FLT_MAX;
+    }
+
+    if (table->levels)
+        range_query(table, table->level_count, 0, 0, r, statistics.min, statistics.max);
+
+    return statistics;
+}
+
+void area_table_sum(Area_Table const * table, Size position, Size size, double sums[])
+{
+    Area_Statistics statistics = area_table_statistics(table, position, size);
+    memcpy(sums, statistics.sum, table->channels * sizeof(double));
+}
+
+void area_table_mean(Area_Table const * table, Size position, Size size, double means[])
+{
+    Area_Statistics statistics = area_table_statistics(table, position, size);
+    memcpy(means, statistics.mean, table->channels * sizeof(double));
+}
+
+void area_table_variance(Area_Table const * table, Size position, Size size, double variances[])
+{
+    error_check(! table->squares, "area table has no squared sums");
+
+    Area_Statistics statistics = area_table_statistics(table, position, size);
+    memcpy(variances, statistics.variance, table->channels * sizeof(double));
+}
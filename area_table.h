@@ -0,0 +1,51 @@
+#ifndef AREA_TABLE_H
+#define AREA_TABLE_H
+
+#include "image_view.h"
+
+#define AREA_TABLE_CHANNELS 4
+
+enum {AREA_TABLE_SQUARES = 1, AREA_TABLE_RANGE = 2};
+
+typedef struct {Size size; float * minima, * maxima;} Area_Range_Level;
+
+/*
+ * Summed-area table of one layer, in double precision and relative to a
+ * per channel offset so squared sums keep their significant digits.
+ * Entry (i, j) holds the sum over rows [0, i) and columns [0, j).
+ * Pixels with a NaN or Inf channel are left out of the sums and counted
+ * instead. The optional range pyramid keeps min and max of 2^k blocks;
+ * its queries read border pixels through the view, so the image has to
+ * outlive the table.
+ */
+typedef struct
+{
+    Image_View view;
+    Size size;
+    int channels;
+    double offset[AREA_TABLE_CHANNELS];
+    double * sums;
+    double * squares;   /* NULL unless requested */
+    int * nans, * infs; /* NULL for integer types */
+    int level_count;
+    Area_Range_Level * levels;
+}
+Area_Table;
+
+typedef struct
+{
+    int count, nan_count, inf_count;
+    double sum[AREA_TABLE_CHANNELS], mean[AREA_TABLE_CHANNELS], variance[AREA_TABLE_CHANNELS];
+    float min[AREA_TABLE_CHANNELS], max[AREA_TABLE_CHANNELS];
+}
+Area_Statistics;
+
+Area_Table *    area_table_new(Image_View const *, int flags);
+void            area_table_destroy(Area_Table *);
+
+Area_Statistics area_table_statistics(Area_Table const *, Size position, Size size);
+void            area_table_sum(Area_Table const *, Size position, Size size, double sums[]);
+void            area_table_mean(Area_Table const *, Size position, Size size, double means[]);
+void            area_table_variance(Area_Table const *, Size position, Size size, double variances[]);
+
+#endif
@@ -0,0 +1,455 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "blur.h"
+#include "convolve.h"
+#include "error.h"
+#include "kernel.h"
+#include "math_.h"
+#include "memory.h"
+#include "parallel.h"
+#include "pixel_convert.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#define PASSES_MAX 8
+#define STRIP_FLOATS 64
+#define BLOCK_ROWS 8
+#define KERNEL_SIGMA_MAX 2.0
+
+typedef struct
+{
+    int recursive;
+    float B, b1, b2, b3;
+    int passes;
+    int radii[PASSES_MAX];
+    int pad;
+}
+Line_Filter;
+
+static int use_avx2 = -1;
+
+/*
+ * Lines are width floats each and addressed through pointer arrays, so
+ * image rows are filtered in place and only the border lines are copied.
+ * The inner loops run across a line, so several rows or columns advance
+ * together in vector registers.
+ */
+
+static inline __attribute__((always_inline)) void box_pass(float * const source[], float * const target[], double * restrict sums, int count, int width, int radius)
+{
+    int size = 2 * radius + 1;
+    float scale = 1.0 / size;
+
+    for (int i = 0; i != width; ++ i)
+        sums[i] = 0;
+
+    for (int k = 0; k != size; ++ k)
+    {
+        float const * restrict line = source[k];
+
+        for (int i = 0; i != width; ++ i)
+            sums[i] += line[i];
+    }
+
+    for (int n = 0; n != count; ++ n)
+    {
+        float * restrict line = target[n];
+
+        if (n)
+        {
+            float const * restrict enter = source[n + size - 1];
+            float const * restrict leave = source[n - 1];
+
+            for (int i = 0; i != width; ++ i)
+                sums[i] += enter[i] - leave[i];
+        }
+
+        for (int i = 0; i != width; ++ i)
+            line[i] = sums[i] * scale;
+    }
+}
+
+/* lines has three history lines on either side of count */
+static inline __attribute__((always_inline)) void recursive_pass(float * const lines[], int count, int width, Line_Filter const * filter)
+{
+    float B = filter->B, b1 = filter->b1, b2 = filter->b2, b3 = filter->b3;
+
+    for (int k = 0; k != 3; ++ k)
+        memcpy(lines[k], lines[3], width * sizeof(float));
+
+    for (int n = 3; n != count + 3; ++ n)
+    {
+        float * restrict line = lines[n];
+        float const * restrict h1 = lines[n - 1];
+        float const * restrict h2 = lines[n - 2];
+        float const * restrict h3 = lines[n - 3];
+
+        for (int i = 0; i != width; ++ i)
+            line[i] = B * line[i] + b1 * h1[i] + b2 * h2[i] + b3 * h3[i];
+    }
+
+    for (int k = 0; k != 3; ++ k)
+        memcpy(lines[count + 3 + k], lines[count + 2], width * sizeof(float));
+
+    for (int n = count + 2; n != 2; -- n)
+    {
+        float * restrict line = lines[n];
+        float const * restrict h1 = lines[n + 1];
+        float const * restrict h2 = lines[n + 2];
+        float const * restrict h3 = lines[n + 3];
+
+        for (int i = 0; i != width; ++ i)
+            line[i] = B * line[i] + b1 * h1[i] + b2 * h2[i] + b3 * h3[i];
+    }
+}
+
+static void box_pass_portable(float * const source[], float * const target[], double * sums, int count, int width, int radius)
+{
+    box_pass(source, target, sums, count, width, radius);
+}
+
+static void recursive_pass_portable(float * const lines[], int count, int width, Line_Filter const * filter)
+{
+    recursive_pass(lines, count, width, filter);
+}
+
+#ifdef X86
+TARGET("avx2,fma") static void box_pass_avx2(float * const source[], float * const target[], double * sums, int count, int width, int radius)
+{
+    box_pass(source, target, sums, count, width, radius);
+}
+
+TARGET("avx2,fma") static void recursive_pass_avx2(float * const lines[], int count, int width, Line_Filter const * filter)
+{
+    recursive_pass(lines, count, width, filter);
+}
+#endif
+
+static void filter_lines(float * lines, int count, int stride, int width, Line_Filter const * filter, Border border)
+{
+    int pad = filter->pad;
+    int length = count + 2 * pad;
+
+    /* recursive filters keep three history lines at either end */
+    int margin = filter->recursive ? 3 : 0;
+    int total = length + 2 * margin;
+    int edge_count = 2 * (pad + margin);
+
+    float * edges = malloc_array(float, (size_t) edge_count * width + 1);
+    float ** pointers = malloc_array(float *, total);
+
+    for (int n = 0, e = 0; n != total; ++ n)
+    {
+        int index = n - margin - pad;
+
+        if (index >= 0 && index < count)
+        {
+            pointers[n] = &lines[(size_t) index * stride];
+            continue;
+        }
+
+        float * line = pointers[n] = &edges[(size_t) e ++ * width];
+
+        if (n < margin || n >= margin + length)
+            continue;
+
+        index = border_index(index, count, border);
+
+        if (index < 0)
+            memset(line, 0, width * sizeof(float));
+        else
+            memcpy(line, &lines[(size_t) index * stride], width * sizeof(float));
+    }
+
+    if (filter->recursive)
+    {
+#ifdef X86
+        if (use_avx2)
+            recursive_pass_avx2(pointers, length, width, filter);
+        else
+#endif
+            recursive_pass_portable(pointers, length, width, filter);
+    }
+    else
+    {
+        /* intermediate passes go through scratch lines, the last one lands in the image */
+        float * scratch = malloc_array(float, (size_t) 2 * length * width);
+        float ** input = malloc_array(float *, length);
+        float ** output = malloc_array(float *, length);
+        double * sums = malloc_array(double, width);
+        int passes = filter->passes;
+
+        memcpy(input, pointers, length * sizeof(float *));
+
+        for (int p = 0; p != passes; ++ p)
+        {
+            int radius = filter->radii[p];
+            float * base = &scratch[(size_t) (p % 2) * length * width];
+
+            length -= 2 * radius;
+
+            for (int n = 0; n != length; ++ n)
+                output[n] = p == passes - 1 && passes > 1 ? &lines[(size_t) n * stride] : &base[(size_t) n * width];
+#ifdef X86
+            if (use_avx2)
+                box_pass_avx2(input, output, sums, length, width, radius);
+            else
+#endif
+                box_pass_portable(input, output, sums, length, width, radius);
+
+            float ** swap = input;
+            input = output;
+            output = swap;
+        }
+
+        if (passes == 1)
+        {
+            for (int n = 0; n != count; ++ n)
+                memcpy(&lines[(size_t) n * stride], input[n], width * sizeof(float));
+        }
+
+        free(sums);
+        free(output);
+        free(input);
+        free(scratch);
+    }
+
+    free(pointers);
+    free(edges);
+}
+
+typedef struct {float * pixels; int width, height, channels; Line_Filter const * filter; Border border;} Layer_Task;
+
+static void filter_strips(void * context, int first_strip, int last_strip)
+{
+    Layer_Task const * task = (Layer_Task const *) context;
+    int row_floats = task->width * task->channels;
+
+    for (int i = first_strip; i != last_strip; ++ i)
+    {
+        int first = i * STRIP_FLOATS;
+        int count = row_floats - first < STRIP_FLOATS ? row_floats - first : STRIP_FLOATS;
+
+        filter_lines(&task->pixels[first], task->height, row_floats, count, task->filter, task->border);
+    }
+}
+
+static void filter_blocks(void * context, int first_block, int last_block)
+{
+    Layer_Task const * task = (Layer_Task const *) context;
+    float * pixels = task->pixels;
+    int width = task->width, channels = task->channels;
+    int row_floats = width * channels;
+    int stride = BLOCK_ROWS * channels;
+    float * columns = malloc_array(float, (size_t) width * stride);
+
+    for (int i = first_block; i != last_block; ++ i)
+    {
+        int first = i * BLOCK_ROWS;
+        int rows = task->height - first < BLOCK_ROWS ? task->height - first : BLOCK_ROWS;
+
+        for (int y = 0; y != rows; ++ y)
+        {
+            float const * row = &pixels[(size_t) (first + y) * row_floats];
+
+            for (int x = 0; x != width; ++ x)
+            for (int c = 0; c != channels; ++ c)
+                columns[x * stride + y * channels + c] = row[x * channels + c];
+        }
+
+        filter_lines(columns, width, stride, rows * channels, task->filter, task->border);
+
+        for (int y = 0; y != rows; ++ y)
+        {
+            float * row = &pixels[(size_t) (first + y) * row_floats];
+
+            for (int x = 0; x != width; ++ x)
+            for (int c = 0; c != channels; ++ c)
+                row[x * channels + c] = columns[x * stride + y * channels + c];
+        }
+    }
+
+    free(columns);
+}
+
+static void filter_layer(float * pixels, int width, int height, int channels, Line_Filter const * filter, Border border)
+{
+    Layer_Task task = {pixels, width, height, channels, filter, border};
+
+    parallel_for((width * channels + STRIP_FLOATS - 1) / STRIP_FLOATS, 1, filter_strips, &task);
+    parallel_for((height + BLOCK_ROWS - 1) / BLOCK_ROWS, 1, filter_blocks, &task);
+}
+
+typedef struct {Image const * source; Image * target; float * pixels; int layer, row_floats;} Convert_Task;
+
+static void rows_to_float(void * context, int first, int last)
+{
+    Convert_Task const * task = (Convert_Task const *) context;
+
+    for (int y = first; y != last; ++ y)
+        pixel_convert(image_row(task->source, task->layer, y), task->source->format.type, &task->pixels[(size_t) y * task->row_floats], GL_FLOAT, task->row_floats);
+}
+
+static void rows_from_float(void * context, int first, int last)
+{
+    Convert_Task const * task = (Convert_Task const *) context;
+
+    for (int y = first; y != last; ++ y)
+        pixel_convert(&task->pixels[(size_t) y * task->row_floats], GL_FLOAT, image_row(task->target, task->layer, y), task->target->format.type, task->row_floats);
+}
+
+static void blur(Image const * source, Image * target, Line_Filter const * filter, Border border)
+{
+    Image_Format format = source->format;
+    Size size = format.size;
+    int channels = format_to_size(format.format);
+    int row_floats = size.x * channels;
+
+    error_check(target->format.type != format.type || target->format.format != format.format, "source and target must have same type and format");
+    error_check(! size_equal(size, target->format.size), "source and target must have same size");
+    error_check(format.layout != IMAGE_INTERLEAVED || target->format.layout != IMAGE_INTERLEAVED, "blur needs interleaved images");
+
+    if (use_avx2 < 0)
+    {
+        use_avx2 = 0;
+#ifdef X86
+        __builtin_cpu_init();
+        use_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    }
+
+    pixel_convert_isa();
+
+    float * pixels = malloc_array(float, (size_t) row_floats * size.y);
+
+    for (int z = 0; z != size.z; ++ z)
+    {
+        Convert_Task task = {source, target, pixels, z, row_floats};
+
+        parallel_for(size.y, 1, rows_to_float, &task);
+        filter_layer(pixels, size.x, size.y, channels, filter, border);
+        parallel_for(size.y, 1, rows_from_float, &task);
+    }
+
+    free(pixels);
+}
+
+/* Young and van Vliet, Recursive implementation of the Gaussian filter, 1995 */
+static Line_Filter recursive_filter(float sigma)
+{
+    float q = sigma >= 2.5 ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * sqrt(1 - 0.26891 * sigma);
+    float q2 = q * q, q3 = q2 * q;
+
+    float b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+    float b1 = 2.44413 * q + 2.85619 * q2 + 1.26661 * q3;
+    float b2 = - (1.4281 * q2 + 1.26661 * q3);
+    float b3 = 0.422205 * q3;
+
+    Line_Filter filter = {1};
+    filter.b1 = b1 / b0;
+    filter.b2 = b2 / b0;
+    filter.b3 = b3 / b0;
+    filter.B = 1 - (filter.b1 + filter.b2 + filter.b3);
+    filter.pad = (int) ceilf(4 * sigma);
+
+    return filter;
+}
+
+/* radii of three boxes whose variances add up to sigma^2 (Kovesi) */
+static Line_Filter box_filter(float sigma)
+{
+    int const n = 3;
+    float ideal = sqrtf(12 * SQ(sigma) / n + 1);
+
+    int lower = (int) ideal;
+    if (lower % 2 == 0)
+        -- lower;
+
+    int upper = lower + 2;
+    int m = (int) roundf((12 * SQ(sigma) - n * SQ(lower) - 4 * n * lower - 3 * n) / (- 4 * lower - 4));
+
+    Line_Filter filter = {0};
+    filter.passes = n;
+
+    for (int i = 0; i != n; ++ i)
+    {
+        filter.radii[i] = (i < m ? lower : upper) / 2;
+        filter.pad += filter.radii[i];
+    }
+
+    return filter;
+}
+
+void image_blur_into(Image const * source, Image * target, float sigma, Blur_Method method, Border border)
+{
+    error_check(sigma <= 0, "blur sigma must be positive");
+
+    if (method == BLUR_AUTO)
+        method = sigma < KERNEL_SIGMA_MAX ? BLUR_KERNEL : BLUR_RECURSIVE;
+
+    switch (method)
+    {
+        case BLUR_AUTO:
+        case BLUR_KERNEL:
+        {
+            int size = 2 * (int) ceilf(3 * sigma) + 1;
+            float * weights = malloc_array(float, size);
+
+            kernel_gaussian_1d(weights, size, sigma);
+            image_convolve_separable_into(source, target, weights, size, weights, size, border);
+            free(weights);
+            break;
+        }
+
+        case BLUR_RECURSIVE:
+        {
+            Line_Filter filter = recursive_filter(sigma);
+            blur(source, target, &filter, border);
+            break;
+        }
+
+        case BLUR_BOX:
+        {
+            Line_Filter filter = box_filter(sigma);
+            blur(source, target, &filter, border);
+            break;
+        }
+    }
+}
+
+Image * image_blur(Image const * source, float sigma, Blur_Method method, Border border)
+{
+    Image * target = image_new_uninitialized(source->format);
+    image_blur_into(source, target, sigma, method, border);
+
+    return target;
+}
+
+void image_blur_box_into(Image const * source, Image * target, int radius, int passes, Border border)
+{
+    error_check(radius < 0, "box radius must not be negative");
+    error_check(passes < 1 || passes > PASSES_MAX, "box passes out of range");
+
+    Line_Filter filter = {0};
+    filter.passes = passes;
+
+    for (int i = 0; i != passes; ++ i)
+    {
+        filter.radii[i] = radius;
+        filter.pad += radius;
+    }
+
+    blur(source, target, &filter, border);
+}
+
+Image * image_blur_box(Image const * source, int radius, int passes, Border border)
+{
+    Image * target = image_new_uninitialized(source->format);
+    image_blur_box_into(source, target, radius, passes, border);
+
+    return target;
+}
@@ -0,0 +1,21 @@
+#ifndef BLUR_H
+#define BLUR_H
+
+#include "image.h"
+#include "size.h"
+
+/*
+ * BLUR_RECURSIVE is the Young-van Vliet third order filter, BLUR_BOX three
+ * box passes of matched variance; both cost the same for every sigma.
+ * BLUR_AUTO uses sampled kernels for small sigmas where those are exact.
+ * Filtering is done in float; integer targets are rounded to the nearest code.
+ */
+
+typedef enum {BLUR_AUTO, BLUR_KERNEL, BLUR_RECURSIVE, BLUR_BOX} Blur_Method;
+
+void    image_blur_into(Image const * source, Image * target, float sigma, Blur_Method, Border);
+Image * image_blur(Image const *, float sigma, Blur_Method, Border);
+void    image_blur_box_into(Image const * source, Image * target, int radius, int passes, Border);
+Image * image_blur_box(Image const *, int radius, int passes, Border);
+
+#endif
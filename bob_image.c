@@ -71,7 +71,7 @@ Image * bob_load(char const name[])
 
     Image * image = image_new(format);
 
-    unsigned const byte_count = image_format_bytes(format);
+    size_t const byte_count = image_format_bytes(format);
     fread(image->pixels, 1, byte_count, file);
     fclose(file);
 
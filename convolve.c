@@ -0,0 +1,387 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "convolve.h"
+#include "error.h"
+#include "kernel.h"
+#include "memory.h"
+#include "parallel.h"
+#include "pixel_convert.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* output rows per task, the horizontal pass of a band stays in cache */
+#define BAND_ROWS 32
+
+static int use_fma = -1;
+
+/* -1 for samples outside a black border */
+int border_index(int index, int count, Border border)
+{
+    if (index >= 0 && index < count)
+        return index;
+
+    switch (border)
+    {
+        case BORDER_BLACK:
+            return -1;
+
+        case BORDER_CLAMP:
+            return index < 0 ? 0 : count - 1;
+
+        case BORDER_WRAP:
+            index %= count;
+            return index < 0 ? index + count : index;
+
+        case BORDER_MIRROR:
+        {
+            int period = 2 * count;
+            index %= period;
+            if (index < 0)
+                index += period;
+
+            return index < count ? index : period - 1 - index;
+        }
+    }
+
+    return -1;
+}
+
+/* target[i] += sum of weights[k] * source[i + k * step] */
+static void span_portable(float const * source, int step, float const weights[], int size, float * target, int count)
+{
+    for (int k = 0; k != size; ++ k)
+    {
+        float weight = weights[k];
+        float const * s = &source[k * step];
+
+        if (weight == 0)
+            continue;
+
+        for (int i = 0; i != count; ++ i)
+            target[i] += weight * s[i];
+    }
+}
+
+/* target[i] = sum of weights[k] * rows[k][i] */
+static void rows_portable(float const * const rows[], float const weights[], int size, float * target, int count)
+{
+    for (int i = 0; i != count; ++ i)
+        target[i] = 0;
+
+    for (int k = 0; k != size; ++ k)
+    {
+        float weight = weights[k];
+        float const * row = rows[k];
+
+        if (weight == 0)
+            continue;
+
+        for (int i = 0; i != count; ++ i)
+            target[i] += weight * row[i];
+    }
+}
+
+#ifdef X86
+TARGET("avx2,fma") static void span_fma(float const * source, int step, float const weights[], int size, float * target, int count)
+{
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256 a0 = _mm256_loadu_ps(&target[i + 0]);
+        __m256 a1 = _mm256_loadu_ps(&target[i + 8]);
+
+        for (int k = 0; k != size; ++ k)
+        {
+            __m256 w = _mm256_set1_ps(weights[k]);
+            float const * s = &source[i + k * step];
+
+            a0 = _mm256_fmadd_ps(w, _mm256_loadu_ps(&s[0]), a0);
+            a1 = _mm256_fmadd_ps(w, _mm256_loadu_ps(&s[8]), a1);
+        }
+
+        _mm256_storeu_ps(&target[i + 0], a0);
+        _mm256_storeu_ps(&target[i + 8], a1);
+    }
+
+    if (i != count)
+        span_portable(&source[i], step, weights, size, &target[i], count - i);
+}
+
+TARGET("avx2,fma") static void rows_fma(float const * const rows[], float const weights[], int size, float * target, int count)
+{
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256 a0 = _mm256_setzero_ps();
+        __m256 a1 = _mm256_setzero_ps();
+
+        for (int k = 0; k != size; ++ k)
+        {
+            __m256 w = _mm256_set1_ps(weights[k]);
+
+            a0 = _mm256_fmadd_ps(w, _mm256_loadu_ps(&rows[k][i + 0]), a0);
+            a1 = _mm256_fmadd_ps(w, _mm256_loadu_ps(&rows[k][i + 8]), a1);
+        }
+
+        _mm256_storeu_ps(&target[i + 0], a0);
+        _mm256_storeu_ps(&target[i + 8], a1);
+    }
+
+    for (; i != count; ++ i)
+    {
+        float accumulator = 0;
+
+        for (int k = 0; k != size; ++ k)
+            accumulator += weights[k] * rows[k][i];
+
+        target[i] = accumulator;
+    }
+}
+#endif
+
+static void detect(void)
+{
+    use_fma = 0;
+#ifdef X86
+    __builtin_cpu_init();
+    use_fma = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+static void span(float const * source, int step, float const weights[], int size, float * target, int count)
+{
+#ifdef X86
+    if (use_fma)
+    {
+        span_fma(source, step, weights, size, target, count);
+        return;
+    }
+#endif
+    span_portable(source, step, weights, size, target, count);
+}
+
+static void rows(float const * const rows_[], float const weights[], int size, float * target, int count)
+{
+#ifdef X86
+    if (use_fma)
+    {
+        rows_fma(rows_, weights, size, target, count);
+        return;
+    }
+#endif
+    rows_portable(rows_, weights, size, target, count);
+}
+
+/* source row as float, with before and after border pixels on either side */
+static void load_row(Image const * source, int layer, int row, Border border, int before, int after, float * target)
+{
+    Image_Format format = source->format;
+    int width = format.size.x;
+    int channels = format_to_size(format.format);
+    float * pixels = &target[before * channels];
+
+    row = border_index(row, format.size.y, border);
+
+    if (row < 0)
+    {
+        memset(target, 0, (before + width + after) * channels * sizeof(float));
+        return;
+    }
+
+    pixel_convert(image_row(source, layer, row), format.type, pixels, GL_FLOAT, width * channels);
+
+    for (int x = - before; x != 0; ++ x)
+    {
+        int index = border_index(x, width, border);
+        float * pixel = &pixels[x * channels];
+
+        if (index < 0)
+            memset(pixel, 0, channels * sizeof(float));
+        else
+            memcpy(pixel, &pixels[index * channels], channels * sizeof(float));
+    }
+
+    for (int x = width; x != width + after; ++ x)
+    {
+        int index = border_index(x, width, border);
+        float * pixel = &pixels[x * channels];
+
+        if (index < 0)
+            memset(pixel, 0, channels * sizeof(float));
+        else
+            memcpy(pixel, &pixels[index * channels], channels * sizeof(float));
+    }
+}
+
+/* rows [first, last) of one layer; the kernel is either separable or a full grid */
+static void convolve_band(Image const * source, Image * target, int layer, int first, int last,
+    float const row_weights[], int row_size, float const column_weights[], int column_size,
+    float const * grid, Border border)
+{
+    Image_Format format = source->format;
+    int width = format.size.x;
+    int channels = format_to_size(format.format);
+    int count = width * channels;
+
+    int before = row_size / 2;
+    int after  = row_size - 1 - before;
+    int above  = column_size / 2;
+    int padded = (before + width + after) * channels;
+    int band   = last - first + column_size - 1;
+
+    /* horizontal results for the separable case, padded source rows for the grid */
+    int stride = grid ? padded : count;
+    float * buffer = malloc_array(float, (size_t) band * stride + count);
+    float * output = &buffer[(size_t) band * stride];
+    float * line = grid ? NULL : malloc_array(float, padded);
+    float const ** taps = malloc_array(float const *, column_size);
+
+    for (int i = 0; i != band; ++ i)
+    {
+        int row = first - above + i;
+        float * target_row = &buffer[(size_t) i * stride];
+
+        if (grid)
+        {
+            load_row(source, layer, row, border, before, after, target_row);
+            continue;
+        }
+
+        load_row(source, layer, row, border, before, after, line);
+        memset(target_row, 0, count * sizeof(float));
+        span(line, channels, row_weights, row_size, target_row, count);
+    }
+
+    for (int y = first; y != last; ++ y)
+    {
+        float const * band_row = &buffer[(size_t) (y - first) * stride];
+
+        if (grid)
+        {
+            memset(output, 0, count * sizeof(float));
+
+            for (int k = 0; k != column_size; ++ k)
+                span(&band_row[(size_t) k * stride], channels, &grid[k * row_size], row_size, output, count);
+        }
+        else
+        {
+            for (int k = 0; k != column_size; ++ k)
+                taps[k] = &band_row[(size_t) k * stride];
+
+            rows(taps, column_weights, column_size, output, count);
+        }
+
+        pixel_convert(output, GL_FLOAT, image_row(target, layer, y), format.type, count);
+    }
+
+    free(taps);
+    free(line);
+    free(buffer);
+}
+
+typedef struct
+{
+    Image const * source;
+    Image * target;
+    float const * row_weights, * column_weights, * grid;
+    int row_size, column_size;
+    Border border;
+}
+Convolve_Task;
+
+static void convolve_bands(void * context, int first_task, int last_task)
+{
+    Convolve_Task const * task = (Convolve_Task const *) context;
+    Size size = task->source->format.size;
+    int band_count = (size.y + BAND_ROWS - 1) / BAND_ROWS;
+
+    for (int i = first_task; i != last_task; ++ i)
+    {
+        int layer = i / band_count;
+        int first = i % band_count * BAND_ROWS;
+        int last  = first + BAND_ROWS < size.y ? first + BAND_ROWS : size.y;
+
+        convolve_band(task->source, task->target, layer, first, last,
+            task->row_weights, task->row_size, task->column_weights, task->column_size, task->grid, task->border);
+    }
+}
+
+static void convolve(Image const * source, Image * target,
+    float const row_weights[], int row_size, float const column_weights[], int column_size,
+    float const * grid, Border border)
+{
+    Image_Format format = source->format;
+    Size size = format.size;
+
+    error_check(target->format.type != format.type || target->format.format != format.format, "source and target must have same type and format");
+    error_check(! size_equal(size, target->format.size), "source and target must have same size");
+    error_check(source->pixels == target->pixels, "convolution cannot work in place");
+    error_check(format.layout != IMAGE_INTERLEAVED || target->format.layout != IMAGE_INTERLEAVED, "convolution needs interleaved images");
+
+    if (use_fma < 0)
+        detect();
+
+    pixel_convert_isa();
+
+    Convolve_Task task = {source, target, row_weights, column_weights, grid, row_size, column_size, border};
+    int band_count = (size.y + BAND_ROWS - 1) / BAND_ROWS;
+
+    parallel_for(band_count * size.z, 1, convolve_bands, &task);
+}
+
+void image_convolve_separable_into(Image const * source, Image * target, float const row_weights[], int row_size, float const column_weights[], int column_size, Border border)
+{
+    static float const identity[] = {1};
+
+    if (! row_weights)
+    {
+        row_weights = identity;
+        row_size = 1;
+    }
+
+    if (! column_weights)
+    {
+        column_weights = identity;
+        column_size = 1;
+    }
+
+    convolve(source, target, row_weights, row_size, column_weights, column_size, NULL, border);
+}
+
+Image * image_convolve_separable(Image const * source, float const row_weights[], int row_size, float const column_weights[], int column_size, Border border)
+{
+    Image * target = image_new_uninitialized(source->format);
+    image_convolve_separable_into(source, target, row_weights, row_size, column_weights, column_size, border);
+
+    return target;
+}
+
+void image_convolve_kernel_into(Image const * source, Image * target, Image const * kernel, Border border)
+{
+    Size size = kernel->format.size;
+    float * row_weights = malloc_array(float, size.x);
+    float * column_weights = malloc_array(float, size.y);
+
+    if (kernel_separate(kernel, row_weights, column_weights))
+        convolve(source, target, row_weights, size.x, column_weights, size.y, NULL, border);
+    else
+        convolve(source, target, NULL, size.x, NULL, size.y, (float const *) kernel->pixels, border);
+
+    free(row_weights);
+    free(column_weights);
+}
+
+Image * image_convolve_kernel(Image const * source, Image const * kernel, Border border)
+{
+    Image * target = image_new_uninitialized(source->format);
+    image_convolve_kernel_into(source, target, kernel, border);
+
+    return target;
+}
@@ -0,0 +1,19 @@
+#ifndef CONVOLVE_H
+#define CONVOLVE_H
+
+#include "image.h"
+#include "size.h"
+
+/*
+ * Weights are centered on tap size / 2 and applied as a correlation to
+ * every channel. NULL weights leave that axis alone. Any pixel type is
+ * accepted, arithmetic is done in float.
+ */
+
+void    image_convolve_separable_into(Image const * source, Image * target, float const row_weights[], int row_size, float const column_weights[], int column_size, Border);
+Image * image_convolve_separable(Image const *, float const row_weights[], int row_size, float const column_weights[], int column_size, Border);
+void    image_convolve_kernel_into(Image const * source, Image * target, Image const * kernel, Border);
+Image * image_convolve_kernel(Image const *, Image const * kernel, Border);
+int     border_index(int index, int count, Border);
+
+#endif
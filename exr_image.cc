@@ -1,4 +1,5 @@
 #include <cstdio>
+#include <exception>
 #include <set>
 
 #ifdef EXR
@@ -7,6 +8,7 @@
 #include <ImfOutputFile.h>
 #include <ImfRgbaFile.h>
 #include <ImfStringAttribute.h>
+#include <ImfTestFile.h>
 #include <ImfIntAttribute.h>
 #include <ImfFloatAttribute.h>
 
@@ -17,6 +19,7 @@ extern "C"
 {
     #include "error.h"
     #include "file_image.h"
+    #include "half.h"
     #include "memory.h"
 }
 
@@ -120,7 +123,7 @@ static Image * exr_load_single(char const name[])
     return image;
 }
 #else
-static Image * exr_load_single(char const name[])
+static Image * exr_load_single(char const name[], Image_Layout layout)
 {
     InputFile file(name);
     Header const & header = file.header();
@@ -140,31 +143,33 @@ static Image * exr_load_single(char const name[])
 
     Image_Format format = {GL_HALF_FLOAT_ARB, GL_LUMINANCE, {width, height, 1}};
     format.format = size_to_format(channel_count);
+    format.layout = layout;
     Image * image = image_new(format);
 
-    unsigned short * pixels = (unsigned short *) image->pixels;
-    Size stride = image_format_stride(image->format);
+    char * pixels = (char *) image->pixels;
+    Image_Stride stride = image_format_stride(image->format);
+    size_t channel_stride = image_format_channel_stride(image->format);
 //printf("stride.x = %d\n", stride.x);
     FrameBuffer buffer;
 
     switch (channel_count)
     {
-        case 1: buffer.insert("Y", Slice(HALF, (char *) &pixels[0], stride.x, stride.y));
+        case 1: buffer.insert("Y", Slice(HALF, &pixels[0], stride.x, stride.y));
                 break;
 
-        case 2: buffer.insert("Y", Slice(HALF, (char *) &pixels[0], stride.x, stride.y));
-                buffer.insert("A", Slice(HALF, (char *) &pixels[1], stride.x, stride.y));
+        case 2: buffer.insert("Y", Slice(HALF, &pixels[0], stride.x, stride.y));
+                buffer.insert("A", Slice(HALF, &pixels[channel_stride], stride.x, stride.y));
                 break;
 
-        case 3: buffer.insert("R", Slice(HALF, (char *) &pixels[0], stride.x, stride.y));
-                buffer.insert("G", Slice(HALF, (char *) &pixels[1], stride.x, stride.y));
-                buffer.insert("B", Slice(HALF, (char *) &pixels[2], stride.x, stride.y));
+        case 3: buffer.insert("R", Slice(HALF, &pixels[0], stride.x, stride.y));
+                buffer.insert("G", Slice(HALF, &pixels[channel_stride], stride.x, stride.y));
+                buffer.insert("B", Slice(HALF, &pixels[2 * channel_stride], stride.x, stride.y));
                 break;
 
-        case 4: buffer.insert("R", Slice(HALF, (char *) &pixels[0], stride.x, stride.y));
-                buffer.insert("G", Slice(HALF, (char *) &pixels[1], stride.x, stride.y));
-                buffer.insert("B", Slice(HALF, (char *) &pixels[2], stride.x, stride.y));
-                buffer.insert("A", Slice(HALF, (char *) &pixels[3], stride.x, stride.y));
+        case 4: buffer.insert("R", Slice(HALF, &pixels[0], stride.x, stride.y));
+                buffer.insert("G", Slice(HALF, &pixels[channel_stride], stride.x, stride.y));
+                buffer.insert("B", Slice(HALF, &pixels[2 * channel_stride], stride.x, stride.y));
+                buffer.insert("A", Slice(HALF, &pixels[3 * channel_stride], stride.x, stride.y));
                 break;
     }
     file.setFrameBuffer(buffer);
@@ -188,15 +193,27 @@ void exr_save_with_properties_single(Image const * image, char const name[], Pro
 {
     Image_Format format = image->format;
 
-    error_check(format.type != GL_HALF_FLOAT_ARB, "image type must be half");
+    error_check(format.type != GL_HALF_FLOAT_ARB && format.type != GL_FLOAT, "image type must be half or float");
     error_check(format.format != GL_RGB && format.format != GL_RGBA && format.format != GL_LUMINANCE && format.format != GL_LUMINANCE_ALPHA, "image format must be rgb, rgba, luminance or luminance alpha");
 
-    // TODO retype if float
     // TODO flip image
 
-    short * pixels = (short *) image->pixels;
+    unsigned short * half_pixels = NULL;
 
-    Size stride = image_format_stride(format);
+    if (format.type == GL_FLOAT)
+    {
+        int count = image_format_bytes(format) / sizeof(float);
+
+        half_pixels = malloc_array(unsigned short, count);
+        half_from_float_n((float const *) image->pixels, half_pixels, count);
+
+        format.type = GL_HALF_FLOAT_ARB;
+        format.row_stride /= 2;
+    }
+
+    short * pixels = half_pixels ? (short *) half_pixels : (short *) image->pixels;
+
+    Image_Stride stride = image_format_stride(format);
     Size size = format.size;
     int width = size.x;
     int height = size.y;
@@ -234,6 +251,8 @@ void exr_save_with_properties_single(Image const * image, char const name[], Pro
     OutputFile file(name, header);
     file.setFrameBuffer(frame_buffer);
     file.writePixels(height);
+
+    free(half_pixels);
 }
 #if 0
 void exr_save_with_properties_single(Image const * image, char const name[], Property const properties[], int property_count)
@@ -264,21 +283,21 @@ void exr_save_with_properties_single(Image const * image, char const name[], Pro
 
 static void add_load_buffer(FrameBuffer & frame_buffer, char const name[], Image * image, int depth, int channel)
 {
-    Size stride = image_format_stride(image->format);
-    int channel_size = image_type_to_size(image->format.type);
+    Image_Stride stride = image_format_stride(image->format);
+    size_t channel_stride = image_format_channel_stride(image->format);
     char * pixels = (char *) image->pixels;
 
-    frame_buffer.insert(name, Slice(HALF, &pixels[depth * stride.z + channel * channel_size], stride.x, stride.y));
+    frame_buffer.insert(name, Slice(HALF, &pixels[depth * stride.z + channel * channel_stride], stride.x, stride.y));
 }
 
 static void add_save_buffer(Header & header, FrameBuffer & frame_buffer, char const name[], Image const * image, int depth, int channel)
 {
-    Size stride = image_format_stride(image->format);
-    int channel_size = image_type_to_size(image->format.type);
+    Image_Stride stride = image_format_stride(image->format);
+    size_t channel_stride = image_format_channel_stride(image->format);
     char * pixels = (char *) image->pixels;
 
     header.channels().insert(name, Channel(HALF));
-    frame_buffer.insert(name, Slice(HALF, &pixels[depth * stride.z + channel * channel_size], stride.x, stride.y));
+    frame_buffer.insert(name, Slice(HALF, &pixels[depth * stride.z + channel * channel_stride], stride.x, stride.y));
 }
 
 void exr_save_with_properties(Image const * image, char const name[], Property const properties[], int property_count, char const * layer_names[])
@@ -299,7 +318,7 @@ void exr_save_with_properties(Image const * image, char const name[], Property c
     int height = size.y;
     int depth  = size.z;
 
-    Size stride = image_format_stride(format);
+    Image_Stride stride = image_format_stride(format);
     int channel_size = image_type_to_size(format.type);
 
     Header header(width, height);
@@ -662,7 +681,7 @@ static void setup_frame_buffer_for_load(FrameBuffer & frame_buffer, ChannelList
     unsigned char * pixels = (unsigned char *) image->pixels;
 
     Image_Format format = image->format;
-    Size stride = image_format_stride(format);
+    Image_Stride stride = image_format_stride(format);
 //    int channel_size = image_type_to_size(format.type);
 
     set<string> layer_names;
@@ -693,7 +712,7 @@ static void setup_frame_buffer_for_load_layer(FrameBuffer & frame_buffer, Channe
     unsigned char * pixels = (unsigned char *) image->pixels;
 
     Image_Format format = image->format;
-    Size stride = image_format_stride(format);
+    Image_Stride stride = image_format_stride(format);
     //int channel_size = image_type_to_size(format.type);
 
     ChannelList::ConstIterator begin, end, i;
@@ -711,7 +730,8 @@ static void setup_frame_buffer_for_load_layer(FrameBuffer & frame_buffer, Channe
     }
 }
 
-Image * exr_load(char const name[])
+/* planar images take every channel straight into its plane */
+static Image * load(char const name[], Image_Layout layout)
 {
     InputFile file(name);
     Header const & header = file.header();
@@ -721,7 +741,7 @@ Image * exr_load(char const name[])
     channels.layers(layer_names);
 
     if (layer_names.size() == 0)
-        return exr_load_single(name);
+        return exr_load_single(name, layout);
 
     Box2i box = header.dataWindow();
     int width  = box.max.x - box.min.x + 1;
@@ -730,8 +750,8 @@ Image * exr_load(char const name[])
     Size size = {width, height, depth};
 
     Image_Format format = {GL_HALF_FLOAT, GL_RGBA, size};
+    format.layout = layout;
     Image * image = image_new(format);
-    unsigned short * pixels = (unsigned short *) image->pixels;
 
     FrameBuffer frame_buffer;
     setup_frame_buffer_for_load(frame_buffer, channels, image);
@@ -744,6 +764,16 @@ Image * exr_load(char const name[])
     return image;
 }
 
+Image * exr_load(char const name[])
+{
+    return load(name, IMAGE_INTERLEAVED);
+}
+
+Image * exr_load_planar(char const name[])
+{
+    return load(name, IMAGE_PLANAR);
+}
+
 Image * exr_load_layer(char const name[], char const layer_name[])
 {
     InputFile file(name);
@@ -769,6 +799,84 @@ Image * exr_load_layer(char const name[], char const layer_name[])
     return image;
 }
 
+struct Exr_Reader
+{
+    InputFile file;
+    Box2i box;
+    int channel_count;
+
+    Exr_Reader(char const name[]) : file(name) {}
+};
+
+/* the channels exr_load_single takes for each count */
+static char const * const reader_channels[4][4] =
+{
+    {"Y"}, {"Y", "A"}, {"R", "G", "B"}, {"R", "G", "B", "A"},
+};
+
+Exr_Reader * exr_reader_open(char const name[], Image_Format * format)
+{
+    if (! isOpenExrFile(name))
+        return NULL;
+
+    Exr_Reader * reader = new Exr_Reader(name);
+    ChannelList const & channels = reader->file.header().channels();
+    set<string> layer_names;
+    channels.layers(layer_names);
+
+    int channel_count = 0;
+    for (ChannelList::ConstIterator i = channels.begin(); i != channels.end(); ++ i)
+        ++ channel_count;
+
+    if (layer_names.size() || channel_count < 1 || channel_count > 4)
+    {
+        delete reader;
+        return NULL;
+    }
+
+    Box2i box = reader->file.header().dataWindow();
+    Image_Format reader_format = {GL_HALF_FLOAT_ARB, size_to_format(channel_count), {box.max.x - box.min.x + 1, box.max.y - box.min.y + 1, 1}};
+
+    reader->box = box;
+    reader->channel_count = channel_count;
+    * format = reader_format;
+
+    return reader;
+}
+
+/* rows count down from the top of the data window and land packed and interleaved */
+int exr_reader_read(Exr_Reader * reader, int first_row, int row_count, void * pixels)
+{
+    Box2i const & box = reader->box;
+    ptrdiff_t x_stride = reader->channel_count * sizeof(unsigned short);
+    ptrdiff_t y_stride = x_stride * (box.max.x - box.min.x + 1);
+    int y = box.min.y + first_row;
+
+    // slices address pixels by data window coordinates
+    char * base = (char *) pixels - box.min.x * x_stride - y * y_stride;
+    FrameBuffer buffer;
+
+    for (int c = 0; c != reader->channel_count; ++ c)
+        buffer.insert(reader_channels[reader->channel_count - 1][c], Slice(HALF, base + c * sizeof(unsigned short), x_stride, y_stride));
+
+    try
+    {
+        reader->file.setFrameBuffer(buffer);
+        reader->file.readPixels(y, y + row_count - 1);
+    }
+    catch (std::exception const &)
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+void exr_reader_close(Exr_Reader * reader)
+{
+    delete reader;
+}
+
 Property * exr_image_properties(char const name[], unsigned * count)
 {
     InputFile file(name);
@@ -807,6 +915,10 @@ Property * exr_image_properties(char const name[], unsigned * count)
 Image * exr_load(char const name[]) {return NULL;}
 void exr_save_with_properties(Image const * image, char const name[], Property const properties[], int property_count) {}
 
+Exr_Reader * exr_reader_open(char const name[], Image_Format * format) {return NULL;}
+int exr_reader_read(Exr_Reader * reader, int first_row, int row_count, void * pixels) {return 0;}
+void exr_reader_close(Exr_Reader * reader) {}
+
 #endif
 
 void exr_save(Image const * image, char const name[])
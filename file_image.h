@@ -10,6 +10,7 @@
 Image * bob_load(char const filename[]);
 
 Image * exr_load(char const name[]);
+Image * exr_load_planar(char const name[]);
 void    exr_save(Image const *, char const name[]);
 // TODO first name!
 void    exr_save_with_properties(Image const *, char const name[], Property const properties[], int property_count, char const * layer_names[]);
@@ -42,6 +43,12 @@ Property * exr_image_properties(char const name[], unsigned * count);
 int          exr_layer_count(char const file_name[]);
 char const * exr_layer_name(char const file_name[], int index);
 
+/* half float scanlines of a single layer file, top row first, for inputs too large to load whole */
+typedef struct Exr_Reader Exr_Reader;
+Exr_Reader * exr_reader_open(char const name[], Image_Format *);
+int          exr_reader_read(Exr_Reader *, int first_row, int row_count, void * pixels);
+void         exr_reader_close(Exr_Reader *);
+
 Image * gif_load(FILE *);
 void    gif_save(Image const *, FILE *, int loop_count, float delay);
 
@@ -90,11 +90,17 @@ Font_ * font_create(char const name[], size_t size)
     font->texture = 0;
     font->texture_width = 0;
     font->texture_height = 0;
+    font->atlas = 0;
+    font->glyphs = NULL;
     return font;
 }
 
 void font_destroy(Font_ * font)
 {
+    if (font->atlas)
+        glDeleteTextures(1, &font->atlas);
+
+    free(font->glyphs);
     FT_Done_Face(font->face);
     free(font);
 }
@@ -440,6 +446,254 @@ void font_render_exact_shadow(Font_ * font, char const string[], Vector raster_p
     font_render_exact(font, string, raster_position, anchor);
 }
 
+#define GLYPH_FIRST (32)
+#define GLYPH_LAST  (126)
+#define ATLAS_WIDTH (256)
+
+static Font_Glyph const * font_glyph(Font_ const * font, char c)
+{
+    if (c < GLYPH_FIRST || c > GLYPH_LAST)
+        return NULL;
+
+    return &font->glyphs[c - GLYPH_FIRST];
+}
+
+/* renders all printable ASCII glyphs once into a single alpha texture */
+static void font_create_atlas(Font_ * font)
+{
+    FT_Face face = font->face;
+    FT_GlyphSlot glyph = face->glyph;
+    int const glyph_count = GLYPH_LAST - GLYPH_FIRST + 1;
+
+    font->glyphs = calloc_array(Font_Glyph, glyph_count);
+
+    int x = 1, y = 1, row_height = 0;
+    for (int i = 0; i != glyph_count; ++ i)
+    {
+        Font_Glyph * g = &font->glyphs[i];
+        g->index = FT_Get_Char_Index(face, GLYPH_FIRST + i);
+
+        if (FT_Load_Glyph(face, g->index, FT_LOAD_DEFAULT))
+            continue;
+
+        /* reserve a pixel of slack, the rendered bitmap may be larger than the metrics */
+        g->width = (glyph->metrics.width  >> 6) + 2;
+        g->rows  = (glyph->metrics.height >> 6) + 2;
+
+        if (x + g->width + 1 > ATLAS_WIDTH)
+        {
+            x = 1;
+            y += row_height + 1;
+            row_height = 0;
+        }
+
+        /* remember position, texture coordinates are fixed up below */
+        g->tex_min = vector(x, y, 0);
+        x += g->width + 1;
+        row_height = imax(row_height, g->rows);
+    }
+
+    int const height = round_to_power_of_two(y + row_height + 1);
+    unsigned char * buffer = calloc_array(unsigned char, ATLAS_WIDTH * height);
+
+    for (int i = 0; i != glyph_count; ++ i)
+    {
+        Font_Glyph * g = &font->glyphs[i];
+        if (FT_Load_Glyph(face, g->index, FT_LOAD_RENDER))
+            continue;
+
+        FT_Bitmap const * bitmap = &glyph->bitmap;
+        int const x0 = g->tex_min.x;
+        int const y0 = g->tex_min.y;
+
+        g->width   = imin((int) bitmap->width, g->width);
+        g->rows    = imin((int) bitmap->rows,  g->rows);
+        g->left    = glyph->bitmap_left;
+        g->top     = glyph->bitmap_top;
+        g->advance = glyph->advance.x >> 6;
+
+        for (int j = 0; j != g->rows; ++ j)
+            memcpy(&buffer[(y0 + j) * ATLAS_WIDTH + x0], &bitmap->buffer[j * bitmap->pitch], g->width);
+
+        g->tex_min = vector((float) x0 / ATLAS_WIDTH, (float) y0 / height, 0);
+        g->tex_max = vector((float) (x0 + g->width) / ATLAS_WIDTH, (float) (y0 + g->rows) / height, 0);
+    }
+
+    glGenTextures(1, &font->atlas);
+    glBindTexture(GL_TEXTURE_2D, font->atlas);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, ATLAS_WIDTH, height, 0, GL_ALPHA, GL_UNSIGNED_BYTE, buffer);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    free(buffer);
+
+    if (font_debug)
+        printf("atlas size = %dx%d\n", ATLAS_WIDTH, height);
+}
+
+static int font_kerning(Font_ const * font, FT_UInt previous, FT_UInt current)
+{
+#ifdef KERNING
+    if (previous && FT_HAS_KERNING(font->face))
+    {
+        FT_Vector delta;
+        FT_Get_Kerning(font->face, previous, current, FT_KERNING_DEFAULT, &delta);
+        return delta.x >> 6;
+    }
+#endif
+
+    return 0;
+}
+
+/* same bounds as font_bounds(), but from cached glyph metrics */
+static IBox font_batch_bounds(Font_ * font, char const string[])
+{
+    int x = 0, x1 = 1000, y1 = 1000, x2 = 0, y2 = 0;
+    FT_UInt previous = 0;
+
+    for (char const * c = string; * c; ++ c)
+    {
+        Font_Glyph const * g = font_glyph(font, * c);
+        if (! g)
+            continue;
+
+        x += font_kerning(font, previous, g->index);
+
+        x1 = imin(x1, x + g->left);
+        x2 = imax(x2, x + g->left + g->width);
+        y1 = imin(y1, g->top - g->rows);
+        y2 = imax(y2, g->top);
+
+        x += g->advance;
+        previous = g->index;
+    }
+
+    IBox box = {{x1, y1, 0}, {x2, y2, 0}};
+    return box;
+}
+
+Font_Batch * font_batch_new(void)
+{
+    return calloc_size(Font_Batch);
+}
+
+void font_batch_destroy(Font_Batch * batch)
+{
+    if (! batch)
+        return;
+
+    free(batch->vertices);
+    free(batch->tex_coords);
+    free(batch->colors);
+    free(batch);
+}
+
+void font_batch_clear(Font_Batch * batch)
+{
+    batch->count = 0;
+}
+
+int font_batch_width(Font_ * font, char const string[])
+{
+    if (! font->glyphs)
+        font_create_atlas(font);
+
+    IBox box = font_batch_bounds(font, string);
+    return box.max.x - box.min.x;
+}
+
+static void font_batch_append(Font_Batch * batch, Vector vertex, Vector tex_coord, Color color)
+{
+    if (batch->count == batch->size)
+    {
+        batch->size = batch->size ? 2 * batch->size : 1024;
+        batch->vertices   = realloc_array(Vector, batch->vertices,   batch->size);
+        batch->tex_coords = realloc_array(Vector, batch->tex_coords, batch->size);
+        batch->colors     = realloc_array(Color,  batch->colors,     batch->size);
+    }
+
+    batch->vertices  [batch->count] = vertex;
+    batch->tex_coords[batch->count] = tex_coord;
+    batch->colors    [batch->count] = color;
+    ++ batch->count;
+}
+
+/* places glyph quads exactly where font_render_exact() would draw the string */
+void font_batch_add(Font_Batch * batch, Font_ * font, char const string[], Vector raster_position, Vector anchor, Color color)
+{
+    if (! font->glyphs)
+        font_create_atlas(font);
+
+    IBox box = font_batch_bounds(font, string);
+    int const width  = box.max.x - box.min.x;
+    int const height = box.max.y - box.min.y;
+
+    float delta_x = raster_position.x - (anchor.x + 1) * width  / 2;
+    float delta_y = raster_position.y - (anchor.y + 1) * height / 2;
+
+    if (width % 2 == 1)
+        delta_x = delta_x - 0.5;
+    if (height % 2 == 1)
+        delta_y = delta_y - 0.5;
+
+    int x = 0;
+    FT_UInt previous = 0;
+
+    for (char const * c = string; * c; ++ c)
+    {
+        Font_Glyph const * g = font_glyph(font, * c);
+        if (! g)
+            continue;
+
+        x += font_kerning(font, previous, g->index);
+
+        if (g->width != 0 && g->rows != 0)
+        {
+            float x1 = delta_x + x + g->left - box.min.x;
+            float x2 = x1 + g->width;
+            float y2 = delta_y + g->top;
+            float y1 = y2 - g->rows;
+
+            font_batch_append(batch, vector(x1, y1, 0), vector(g->tex_min.x, g->tex_max.y, 0), color);
+            font_batch_append(batch, vector(x2, y1, 0), vector(g->tex_max.x, g->tex_max.y, 0), color);
+            font_batch_append(batch, vector(x2, y2, 0), vector(g->tex_max.x, g->tex_min.y, 0), color);
+            font_batch_append(batch, vector(x1, y2, 0), vector(g->tex_min.x, g->tex_min.y, 0), color);
+        }
+
+        x += g->advance;
+        previous = g->index;
+    }
+}
+
+/* draws the whole batch with a single call; expects font_begin() */
+void font_batch_draw(Font_ * font, Font_Batch const * batch)
+{
+    if (batch->count == 0)
+        return;
+
+    glBindTexture(GL_TEXTURE_2D, font->atlas);
+
+    glEnableClientState(GL_COLOR_ARRAY);
+    glColorPointer(3, GL_FLOAT, 0, batch->colors);
+
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(3, GL_FLOAT, 0, batch->tex_coords);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, batch->vertices);
+
+    glDrawArrays(GL_QUADS, 0, batch->count);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+}
+
 void font_render(Font_ * font, char const string[], Matrix matrix, Viewport viewport, Vector position, Vector anchor)
 {
     Vector projected_position = matrix_mul(matrix, position);
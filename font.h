@@ -11,20 +11,27 @@
 #endif
 #include <wchar.h>
 
+#include "color.h"
 #include "matrix.h"
 #include "opengl.h"
 #include "size.h"
 #include "vector.h"
 #include "viewport.h"
 
+typedef struct {FT_UInt index; int left, top, width, rows, advance; Vector tex_min, tex_max;} Font_Glyph;
+
 typedef struct
 {
     FT_Face face;
     GLuint texture;
     int texture_width, texture_height; // TODO use Size
+    GLuint atlas;
+    Font_Glyph * glyphs; // printable ASCII, rendered once into atlas
 }
 Font_;
 
+typedef struct {int count, size; Vector * vertices, * tex_coords; Color * colors;} Font_Batch;
+
 typedef struct {Size min, max;} IBox;
 
 extern Vector const
@@ -52,6 +59,13 @@ void   font_render_exact_shadow(Font_ *, char const string[], Vector raster_posi
 IBox   font_bounds(Font_ *, char const string[]);
 IBox   font_bounds_unicode(Font_ *, wchar_t const string[]);
 
+Font_Batch * font_batch_new(void);
+void   font_batch_destroy(Font_Batch *);
+void   font_batch_clear(Font_Batch *);
+int    font_batch_width(Font_ *, char const string[]);
+void   font_batch_add(Font_Batch *, Font_ *, char const string[], Vector raster_position, Vector anchor, Color);
+void   font_batch_draw(Font_ *, Font_Batch const *);
+
 void font_render_text_box(Font_ *, char const string[], Vector position, Vector anchor);
 void font_render_text_circle(Font_ *, char const string[], Vector position, Vector anchor);
 
@@ -1,126 +1,219 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "half.h"
 
-static int initialized;
-static unsigned mantissa[2048], exponent[64], offset[64];
-static unsigned short base[512];
-static unsigned char shift[512];
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
 
-static unsigned convert_mantissa(unsigned i)
+/* half to float tables, generated by the preprocessor */
+
+#define R4(f, i)    f(i) f((i) + 1) f((i) + 2) f((i) + 3)
+#define R16(f, i)   R4(f, i)   R4(f, (i) + 4)   R4(f, (i) + 8)   R4(f, (i) + 12)
+#define R64(f, i)   R16(f, i)  R16(f, (i) + 16) R16(f, (i) + 32) R16(f, (i) + 48)
+#define R256(f, i)  R64(f, i)  R64(f, (i) + 64) R64(f, (i) + 128) R64(f, (i) + 192)
+#define R1024(f, i) R256(f, i) R256(f, (i) + 256) R256(f, (i) + 512) R256(f, (i) + 768)
+
+/* position of the leading bit of a subnormal mantissa */
+#define TOP_BIT(m) \
+    ((m) >= 512 ? 9 : (m) >= 256 ? 8 : (m) >= 128 ? 7 : (m) >= 64 ? 6 : (m) >= 32 ? 5 : \
+     (m) >=  16 ? 4 : (m) >=   8 ? 3 : (m) >=   4 ? 2 : (m) >=  2 ? 1 : 0)
+
+/* subnormals are renormalized, the upper half holds the plain mantissas */
+#define MANTISSA(i) \
+    ((i) == 0 ? 0u : \
+     (i) < 1024 ? ((((unsigned) (i) << (23 - TOP_BIT(i))) & 0x007fffffu) | (0x38800000u - (10u - TOP_BIT(i)) * 0x00800000u)) : \
+     0x38000000u + ((unsigned) ((i) - 1024) << 13)),
+
+#define EXPONENT(i) \
+    ((i) == 0 ? 0u : (i) < 31 ? (unsigned) (i) << 23 : (i) == 31 ? 0x47800000u : \
+     (i) == 32 ? 0x80000000u : (i) < 63 ? 0x80000000u + ((unsigned) ((i) - 32) << 23) : 0xc7800000u),
+
+#define OFFSET(i) ((i) == 0 || (i) == 32 ? 0 : 1024),
+
+static unsigned const mantissa[2048] = {R1024(MANTISSA, 0) R1024(MANTISSA, 1024)};
+static unsigned const exponent[64] = {R16(EXPONENT, 0) R16(EXPONENT, 16) R16(EXPONENT, 32) R16(EXPONENT, 48)};
+static unsigned short const offset[64] = {R64(OFFSET, 0)};
+
+static float bits_to_float(unsigned bits)
 {
-    unsigned m = i << 13;
-    unsigned e = 0;
+    float f;
+    memcpy(&f, &bits, sizeof f);
+    return f;
+}
 
-    while (! (m & 0x00800000))
+static unsigned float_to_bits(float f)
+{
+    unsigned bits;
+    memcpy(&bits, &f, sizeof bits);
+    return bits;
+}
+
+float half_to_float_slow(unsigned short h)
+{
+    // for normal numbers only
+    unsigned f = ((h & 0x8000) << 16) | (((h & 0x7c00) + 0x1C000) << 13) | ((h & 0x03FF) << 13);
+    return bits_to_float(f);
+}
+
+float half_to_float(unsigned short h)
+{
+    unsigned short e = h >> 10;
+    return bits_to_float(exponent[e] + mantissa[(h & 0x3ff) + offset[e]]);
+}
+
+unsigned short half_from_float_slow(float f_)
+{
+    unsigned f = float_to_bits(f_);
+    return ((f >> 16) & 0x8000) | ((((f & 0x7f800000) - 0x38000000) >> 13) & 0x7c00) | ((f >> 13) & 0x03ff);
+}
+
+/* round to nearest even like the hardware, overflow goes to infinity, NaN stays NaN with its payload */
+unsigned short half_from_float(float f_)
+{
+    unsigned f = float_to_bits(f_);
+    unsigned sign = (f >> 16) & 0x8000;
+    unsigned short h;
+
+    f &= 0x7fffffff;
+
+    if (f >= 0x47800000) // beyond the half range, infinity or NaN
+    {
+        h = f > 0x7f800000 ? 0x7e00 | ((f >> 13) & 0x3ff) : 0x7c00; // quiet NaN, the top of the payload kept
+    }
+    else if (f < 0x38800000) // subnormal half or zero, the float addition rounds
     {
-        m <<= 1;
-        e -= 0x00800000;
+        h = float_to_bits(bits_to_float(f) + 0.5f) - 0x3f000000;
+    }
+    else
+    {
+        unsigned odd = (f >> 13) & 1;
+        h = (f - 0x38000000 + 0xfff + odd) >> 13;
     }
 
-    m &= ~0x00800000;
-    e += 0x38800000;
+    return h | sign;
+}
 
-    return m | e;
+static void half_to_float_portable(unsigned short const source[], float target[], int count)
+{
+    for (int i = 0; i != count; ++ i)
+        target[i] = half_to_float(source[i]);
 }
 
-void half_initialize(void)
+static void half_from_float_portable(float const source[], unsigned short target[], int count)
 {
-    if (initialized)
-        return;
+    for (int i = 0; i != count; ++ i)
+        target[i] = half_from_float(source[i]);
+}
 
-    unsigned int i;
+#ifdef X86
+/* tails go through a padded block so that every element is rounded the same way */
 
-    // half to float
+TARGET("avx,f16c") static void half_to_float_f16c(unsigned short const source[], float target[], int count)
+{
+    int i = 0;
 
-    mantissa[0] = 0;
-    for (i =    1; i <= 1023; ++ i) mantissa[i] = convert_mantissa(i);
-    for (i = 1024; i <= 2047; ++ i) mantissa[i] = 0x38000000 + ((i - 1024) << 13);
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(&target[i], _mm256_cvtph_ps(_mm_loadu_si128((__m128i const *) &source[i])));
 
-    exponent[ 0] = 0;
-    exponent[31] = 0x47800000;
-    exponent[32] = 0x80000000;
-    exponent[63] = 0xC7800000;
-    for (i =  1; i <= 30; ++ i) exponent[i] = i << 23;
-    for (i = 33; i <= 62; ++ i) exponent[i] = 0x80000000 + ((i - 32) << 23);
+    if (i != count)
+    {
+        unsigned short block[8] = {0};
+        float result[8];
+
+        memcpy(block, &source[i], (count - i) * sizeof(unsigned short));
+        _mm256_storeu_ps(result, _mm256_cvtph_ps(_mm_loadu_si128((__m128i const *) block)));
+        memcpy(&target[i], result, (count - i) * sizeof(float));
+    }
+}
 
-    offset[ 0] = 0;
-    offset[32] = 0;
-    for (i =  1; i <= 31; ++ i) offset[i] = 1024;
-    for (i = 33; i <= 63; ++ i) offset[i] = 1024;
+TARGET("avx,f16c") static void half_from_float_f16c(float const source[], unsigned short target[], int count)
+{
+    int i = 0;
 
-    // float to half
+    for (; i + 8 <= count; i += 8)
+        _mm_storeu_si128((__m128i *) &target[i], _mm256_cvtps_ph(_mm256_loadu_ps(&source[i]), _MM_FROUND_TO_NEAREST_INT));
 
-    for (i = 0; i < 256; ++ i)
+    if (i != count)
     {
-        int e = i - 127;
+        float block[8] = {0};
+        unsigned short result[8];
 
-        if (e < -24)
-        {    // Very small numbers map to zero basetable[i|0x000]=0x0000;
-            base[i|0x100]=0x8000;
-            shift[i|0x000]=24;
-            shift[i|0x100]=24;
-        }
-        else if (e < -14)
-        {   // Small numbers map to denorms
-            base[i|0x000] = (0x0400>>(18-e));
-            base[i|0x100] = (0x0400>>(18-e)) | 0x8000;
-            shift[i|0x000] = -e-1;
-            shift[i|0x100] = -e-1;
-        }
-        else if (e <= 15)
-        {   // Normal numbers just lose precision
-            base[i|0x000] = ((e+15)<<10);
-            base[i|0x100] = ((e+15)<<10) | 0x8000;
-            shift[i|0x000] = 13;
-            shift[i|0x100] = 13;
-        }
-        else if (e < 128)
-        {   // Large numbers map to Infinity
-            base[i|0x000] = 0x7C00;
-            base[i|0x100] = 0xFC00;
-            shift[i|0x000] = 24;
-            shift[i|0x100] = 24;
-        }
-        else
-        {   // Infinity and NaN's stay Infinity and NaN's
-            base[i|0x000] = 0x7C00;
-            base[i|0x100] = 0xFC00;
-            shift[i|0x000] = 13;
-            shift[i|0x100] = 13;
-        }
+        memcpy(block, &source[i], (count - i) * sizeof(float));
+        _mm_storeu_si128((__m128i *) result, _mm256_cvtps_ph(_mm256_loadu_ps(block), _MM_FROUND_TO_NEAREST_INT));
+        memcpy(&target[i], result, (count - i) * sizeof(unsigned short));
     }
+}
 
-    initialized = 1;
+TARGET("avx512f") static void half_to_float_avx512(unsigned short const source[], float target[], int count)
+{
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+        _mm512_storeu_ps(&target[i], _mm512_cvtph_ps(_mm256_loadu_si256((__m256i const *) &source[i])));
+
+    if (i != count)
+        half_to_float_f16c(&source[i], &target[i], count - i);
 }
 
-float half_to_float_slow(unsigned short h)
+TARGET("avx512f") static void half_from_float_avx512(float const source[], unsigned short target[], int count)
 {
-    // for normal numbers only
-    unsigned f = ((h & 0x8000) << 16) | (((h & 0x7c00) + 0x1C000) << 13) | ((h & 0x03FF) << 13);
-    return * (float *) &f;
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+        _mm256_storeu_si256((__m256i *) &target[i], _mm512_cvtps_ph(_mm512_loadu_ps(&source[i]), _MM_FROUND_TO_NEAREST_INT));
+
+    if (i != count)
+        half_from_float_f16c(&source[i], &target[i], count - i);
 }
+#endif
 
-float half_to_float(unsigned short h)
+typedef void (* Half_To_Float)(unsigned short const [], float [], int);
+typedef void (* Half_From_Float)(float const [], unsigned short [], int);
+
+static Half_To_Float   to_float;
+static Half_From_Float from_float;
+
+static void select_functions(void)
 {
-    unsigned short e = h >> 10;
-    unsigned f = exponent[e] + mantissa[(h & 0x3ff) + offset[e]];
+    Half_To_Float   to   = half_to_float_portable;
+    Half_From_Float from = half_from_float_portable;
+#ifdef X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c"))
+    {
+        to   = half_to_float_f16c;
+        from = half_from_float_f16c;
 
-    return * (float *) &f;
+        if (__builtin_cpu_supports("avx512f"))
+        {
+            to   = half_to_float_avx512;
+            from = half_from_float_avx512;
+        }
+    }
+#endif
+    from_float = from;
+    to_float   = to;
 }
 
-unsigned short half_from_float_slow(float f_)
+void half_to_float_n(unsigned short const source[], float target[], int count)
 {
-    unsigned f = * (unsigned *) &f_;
-    return ((f >> 16) & 0x8000) | ((((f & 0x7f800000) - 0x38000000) >> 13) & 0x7c00) | ((f >> 13) & 0x03ff);
+    if (! to_float)
+        select_functions();
+
+    to_float(source, target, count);
 }
 
-unsigned short half_from_float(float f_)
+void half_from_float_n(float const source[], unsigned short target[], int count)
 {
-    unsigned f = * (unsigned *) &f_;
-    unsigned e = (f >> 23) & 0x1ff;
+    if (! from_float)
+        select_functions();
 
-    return base[e] + ((f & 0x007fffff) >> shift[e]);
+    from_float(source, target, count);
 }
 
 void half_print(unsigned short h)
@@ -151,15 +244,20 @@ void half_print(unsigned short h)
 
 void identity(float f)
 {
-    printf("slow expected = %f, actual = %f\n", f, half_to_float_slow(half_from_float_slow(f)));
+    unsigned short h;
+    float g;
+
+    half_from_float_n(&f, &h, 1);
+    half_to_float_n(&h, &g, 1);
+
     printf("fast expected = %f, actual = %f\n", f, half_to_float(half_from_float(f)));
+    printf("batch expected = %f, actual = %f\n", f, g);
 }
 
 void half_test(void)
 {
-//    identity(0); // fails
+    identity(0);
     identity(1);
     identity(42);
-//    identity(1.0/0.0); // fails
+    identity(1.0/0.0);
 }
-
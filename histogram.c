@@ -0,0 +1,542 @@
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "half.h"
+#include "histogram.h"
+#include "memory.h"
+#include "parallel.h"
+
+#define DEFAULT_BIN_COUNT 1024
+
+/* integer and half samples are tallied by code and binned afterwards */
+static int code_count(GLenum type)
+{
+    switch (type)
+    {
+        case GL_UNSIGNED_BYTE:  return 1 << 8;
+        case GL_UNSIGNED_SHORT:
+        case GL_HALF_FLOAT_ARB: return 1 << 16;
+        default:                return 0;
+    }
+}
+
+static int slot_count(Histogram const * histogram)
+{
+    int codes = code_count(histogram->type);
+    return codes ? codes : histogram->bin_count;
+}
+
+static float scaled(Histogram_Scale scale, float value)
+{
+    if (scale == HISTOGRAM_LINEAR)
+        return value;
+
+    return value > 0 ? log2f(value) : -FLT_MAX;
+}
+
+static inline int bin_index(float scaled, float lower, float factor, int bin_count)
+{
+    float position = (scaled - lower) * factor;
+    return position < 0 ? 0 : position >= bin_count ? bin_count - 1 : (int) position;
+}
+
+int histogram_bin(Histogram const * histogram, float value)
+{
+    float factor = histogram->bin_count / (histogram->upper - histogram->lower);
+    return bin_index(scaled(histogram->scale, value), histogram->lower, factor, histogram->bin_count);
+}
+
+/* value at a fractional bin position, 0 being the lower edge of the first bin */
+float histogram_bin_value(Histogram const * histogram, float bin)
+{
+    float value = histogram->lower + bin * (histogram->upper - histogram->lower) / histogram->bin_count;
+    return histogram->scale == HISTOGRAM_LOG ? exp2f(value) : value;
+}
+
+/* float histograms need their range before any tally */
+void histogram_set_range(Histogram * histogram, float min, float max, float min_positive)
+{
+    if (min > max)
+    {
+        min = 0;
+        max = min_positive = 1;
+    }
+
+    if (histogram->scale == HISTOGRAM_LOG)
+    {
+        if (max <= 0)
+            max = 1;
+
+        min = min_positive <= max ? min_positive : max;
+    }
+
+    histogram->lower = scaled(histogram->scale, min);
+    histogram->upper = scaled(histogram->scale, max);
+
+    if (! (histogram->upper > histogram->lower))
+        histogram->upper = histogram->lower + 1;
+
+    histogram->min = histogram_bin_value(histogram, 0);
+    histogram->max = histogram_bin_value(histogram, histogram->bin_count);
+}
+
+/* integer codes get bins centred on them, so equal counts give exact values */
+static void set_code_range(Histogram * histogram)
+{
+    float last = code_count(histogram->type) - 1;
+
+    histogram->scale = HISTOGRAM_LINEAR;
+    histogram->lower = histogram->min = -0.5 / last;
+    histogram->upper = histogram->max = (last + 0.5) / last;
+}
+
+typedef struct
+{
+    Image_View const * view;
+    float range[3];
+}
+Range_Task;
+
+static void range_rows(void * context, int first, int last)
+{
+    Range_Task * task = (Range_Task *) context;
+    Image_View const * view = task->view;
+    Size size = view->format.size;
+    int channels = format_to_size(view->format.format);
+    float local[3] = {+FLT_MAX, -FLT_MAX, +FLT_MAX};
+
+    for (int r = first; r != last; ++ r)
+    {
+        unsigned char const * row = (unsigned char const *) image_view_pixel(view, r / size.y, r % size.y, 0);
+
+        for (int c = 0; c != channels; ++ c)
+        {
+            unsigned char const * samples = row + (size_t) c * view->channel_stride;
+
+            for (int x = 0; x != size.x; ++ x)
+            {
+                float value = * (float const *) (samples + (size_t) x * view->stride.x);
+                if (! isfinite(value))
+                    continue;
+
+                if (value < local[0]) local[0] = value;
+                if (value > local[1]) local[1] = value;
+                if (value > 0 && value < local[2]) local[2] = value;
+            }
+        }
+    }
+
+    parallel_lock();
+    if (local[0] < task->range[0]) task->range[0] = local[0];
+    if (local[1] > task->range[1]) task->range[1] = local[1];
+    if (local[2] < task->range[2]) task->range[2] = local[2];
+    parallel_unlock();
+}
+
+static void float_range(Image_View const * view, float * min, float * max, float * min_positive)
+{
+    Size size = view->format.size;
+    int row_count = size.y * size.z;
+    Range_Task task = {view, {+FLT_MAX, -FLT_MAX, +FLT_MAX}};
+
+    parallel_for(row_count, parallel_reduction_grain(row_count), range_rows, &task);
+
+    * min = task.range[0];
+    * max = task.range[1];
+    * min_positive = task.range[2];
+}
+
+Histogram_Tally histogram_tally_new(Histogram const * histogram)
+{
+    Histogram_Tally tally = {calloc_array(uint32_t, slot_count(histogram) * histogram->channels)};
+    return tally;
+}
+
+void histogram_tally_row(Histogram const * histogram, Histogram_Tally * tally, void const * pixels, int pixel_stride, int count)
+{
+    int channels = histogram->channels;
+    int slots_per_channel = slot_count(histogram);
+    uint32_t * slots = tally->slots;
+    unsigned char const * row = (unsigned char const *) pixels;
+
+    switch (histogram->type)
+    {
+        case GL_UNSIGNED_BYTE:
+            for (int x = 0; x != count; ++ x)
+            for (int c = 0; c != channels; ++ c)
+                ++ slots[c * slots_per_channel + row[(size_t) x * pixel_stride + c]];
+            break;
+
+        case GL_UNSIGNED_SHORT:
+        case GL_HALF_FLOAT_ARB:
+            for (int x = 0; x != count; ++ x)
+            {
+                unsigned short const * pixel = (unsigned short const *) (row + (size_t) x * pixel_stride);
+
+                for (int c = 0; c != channels; ++ c)
+                    ++ slots[c * slots_per_channel + pixel[c]];
+            }
+            break;
+
+        case GL_FLOAT:
+        {
+            float lower = histogram->lower;
+            float factor = histogram->bin_count / (histogram->upper - histogram->lower);
+
+            for (int x = 0; x != count; ++ x)
+            {
+                float const * pixel = (float const *) (row + (size_t) x * pixel_stride);
+
+                for (int c = 0; c != channels; ++ c)
+                {
+                    float value = pixel[c];
+
+                    if (isnan(value))
+                        ++ tally->nan_count[c];
+                    else if (isinf(value))
+                        ++ tally->inf_count[c];
+                    else
+                        ++ slots[c * slots_per_channel + bin_index(scaled(histogram->scale, value), lower, factor, slots_per_channel)];
+                }
+            }
+        }
+        break;
+    }
+}
+
+/* the samples of one channel side by side, as planar images keep them */
+void histogram_tally_plane(Histogram const * histogram, Histogram_Tally * tally, int channel, void const * samples, int count)
+{
+    uint32_t * slots = &tally->slots[channel * slot_count(histogram)];
+
+    switch (histogram->type)
+    {
+        case GL_UNSIGNED_BYTE:
+        {
+            unsigned char const * codes = (unsigned char const *) samples;
+            for (int x = 0; x != count; ++ x)
+                ++ slots[codes[x]];
+        }
+        break;
+
+        case GL_UNSIGNED_SHORT:
+        case GL_HALF_FLOAT_ARB:
+        {
+            unsigned short const * codes = (unsigned short const *) samples;
+            for (int x = 0; x != count; ++ x)
+                ++ slots[codes[x]];
+        }
+        break;
+
+        case GL_FLOAT:
+        {
+            float const * values = (float const *) samples;
+            float lower = histogram->lower;
+            float factor = histogram->bin_count / (histogram->upper - histogram->lower);
+            int bin_count = histogram->bin_count;
+
+            for (int x = 0; x != count; ++ x)
+            {
+                float value = values[x];
+
+                if (isnan(value))
+                    ++ tally->nan_count[channel];
+                else if (isinf(value))
+                    ++ tally->inf_count[channel];
+                else
+                    ++ slots[bin_index(scaled(histogram->scale, value), lower, factor, bin_count)];
+            }
+        }
+        break;
+    }
+}
+
+/* not thread safe: callers merging from several threads serialize the calls */
+void histogram_tally_merge(Histogram * histogram, Histogram_Tally * tally)
+{
+    int slot_total = slot_count(histogram) * histogram->channels;
+
+    if (! histogram->pending)
+        histogram->pending = calloc_array(uint64_t, slot_total);
+
+    for (int i = 0; i != slot_total; ++ i)
+        histogram->pending[i] += tally->slots[i];
+
+    for (int c = 0; c != histogram->channels; ++ c)
+    {
+        histogram->pending_nans[c] += tally->nan_count[c];
+        histogram->pending_infs[c] += tally->inf_count[c];
+    }
+
+    free(tally->slots);
+    tally->slots = NULL;
+}
+
+typedef struct
+{
+    Histogram * histogram;
+    Image_View const * view;
+}
+Tally_Task;
+
+static void tally_rows(void * context, int first, int last)
+{
+    Tally_Task const * task = (Tally_Task const *) context;
+    Image_View const * view = task->view;
+    Size size = view->format.size;
+    Histogram_Tally local = histogram_tally_new(task->histogram);
+    int planes = view->format.layout == IMAGE_PLANAR ? task->histogram->channels : 0;
+
+    for (int r = first; r != last; ++ r)
+    {
+        unsigned char const * row = (unsigned char const *) image_view_pixel(view, r / size.y, r % size.y, 0);
+
+        if (! planes)
+            histogram_tally_row(task->histogram, &local, row, view->stride.x, size.x);
+
+        for (int c = 0; c != planes; ++ c)
+            histogram_tally_plane(task->histogram, &local, c, row + (size_t) c * view->channel_stride, size.x);
+    }
+
+    parallel_lock();
+    histogram_tally_merge(task->histogram, &local);
+    parallel_unlock();
+}
+
+/* every thread fills its own 32 bit sub-histogram, merged once at the end */
+static void tally(Histogram * histogram, Image_View const * view)
+{
+    Size size = view->format.size;
+    int row_count = size.y * size.z;
+
+    error_check(view->format.type != histogram->type, "view type differs from histogram");
+    error_check(format_to_size(view->format.format) != histogram->channels, "view channels differ from histogram");
+
+    Tally_Task task = {histogram, view};
+    parallel_for(row_count, parallel_reduction_grain(row_count), tally_rows, &task);
+}
+
+static void code_range(Histogram * histogram, uint64_t const * slots)
+{
+    float min = +FLT_MAX, max = -FLT_MAX, min_positive = +FLT_MAX;
+    int codes = code_count(histogram->type);
+
+    for (int c = 0; c != histogram->channels; ++ c)
+    for (int i = 0; i != codes; ++ i)
+    {
+        float value = half_to_float(i);
+
+        if (! slots[c * codes + i] || ! isfinite(value))
+            continue;
+
+        if (value < min) min = value;
+        if (value > max) max = value;
+        if (value > 0 && value < min_positive) min_positive = value;
+    }
+
+    histogram_set_range(histogram, min, max, min_positive);
+}
+
+/* bin of every code, or -1 for NaN and -2 for Inf */
+static int * code_bins(Histogram const * histogram)
+{
+    int codes = code_count(histogram->type);
+    int * bins = malloc_array(int, codes);
+
+    for (int i = 0; i != codes; ++ i)
+    {
+        float value = histogram->type == GL_HALF_FLOAT_ARB ? half_to_float(i) : (float) i / (codes - 1);
+        bins[i] = isnan(value) ? -1 : isinf(value) ? -2 : histogram_bin(histogram, value);
+    }
+
+    return bins;
+}
+
+static void accumulate(Histogram * histogram)
+{
+    int bin_count = histogram->bin_count;
+
+    for (int c = 0; c != histogram->channels; ++ c)
+    {
+        uint64_t const * counts = &histogram->counts[c * bin_count];
+        uint64_t * cumulative = &histogram->cumulative[c * bin_count];
+        uint64_t sum = 0;
+
+        for (int i = 0; i != bin_count; ++ i)
+            cumulative[i] = sum += counts[i];
+
+        histogram->total[c] = sum;
+    }
+}
+
+/* bins the merged tallies; half histograms take their range from the first ones */
+static void apply(Histogram * histogram, int sign)
+{
+    int slots_per_channel = slot_count(histogram);
+    uint64_t const * slots = histogram->pending;
+
+    if (! slots)
+        return;
+
+    if (histogram->type == GL_HALF_FLOAT_ARB && histogram->upper == histogram->lower)
+        code_range(histogram, slots);
+
+    int * bins = code_count(histogram->type) ? code_bins(histogram) : NULL;
+
+    for (int c = 0; c != histogram->channels; ++ c)
+    {
+        uint64_t * counts = &histogram->counts[c * histogram->bin_count];
+
+        histogram->nan_count[c] += sign * histogram->pending_nans[c];
+        histogram->inf_count[c] += sign * histogram->pending_infs[c];
+        histogram->pending_nans[c] = histogram->pending_infs[c] = 0;
+
+        for (int i = 0; i != slots_per_channel; ++ i)
+        {
+            uint64_t count = slots[c * slots_per_channel + i];
+            int bin = bins ? bins[i] : i;
+
+            if (! count)
+                continue;
+
+            if (bin == -1)
+                histogram->nan_count[c] += sign * count;
+            else if (bin == -2)
+                histogram->inf_count[c] += sign * count;
+            else
+                counts[bin] += sign * count;
+        }
+    }
+
+    free(bins);
+    free(histogram->pending);
+    histogram->pending = NULL;
+    accumulate(histogram);
+}
+
+void histogram_finish(Histogram * histogram)
+{
+    apply(histogram, +1);
+}
+
+static void update(Histogram * histogram, Image_View const * view, int sign)
+{
+    tally(histogram, view);
+    apply(histogram, sign);
+}
+
+Histogram * histogram_empty(GLenum type, int channels, int bin_count, Histogram_Scale scale)
+{
+    Histogram * histogram = calloc_size(Histogram);
+
+    error_check(type != GL_UNSIGNED_BYTE && type != GL_UNSIGNED_SHORT && type != GL_HALF_FLOAT_ARB && type != GL_FLOAT,
+        "unsupported type for histogram");
+    error_check(channels > HISTOGRAM_CHANNELS, "too many channels for histogram");
+
+    if (! bin_count)
+        bin_count = type == GL_UNSIGNED_BYTE ? 256 : DEFAULT_BIN_COUNT;
+
+    histogram->type = type;
+    histogram->channels = channels;
+    histogram->bin_count = bin_count;
+    histogram->scale = scale;
+    histogram->counts = calloc_array(uint64_t, bin_count * channels);
+    histogram->cumulative = calloc_array(uint64_t, bin_count * channels);
+
+    if (type == GL_UNSIGNED_BYTE || type == GL_UNSIGNED_SHORT)
+        set_code_range(histogram);
+
+    return histogram;
+}
+
+Histogram * histogram_new(Image_View const * view, int bin_count, Histogram_Scale scale)
+{
+    Histogram * histogram = histogram_empty(view->format.type, format_to_size(view->format.format), bin_count, scale);
+
+    if (histogram->type == GL_FLOAT)
+    {
+        float min, max, min_positive;
+        float_range(view, &min, &max, &min_positive);
+        histogram_set_range(histogram, min, max, min_positive);
+    }
+
+    update(histogram, view, +1);
+    return histogram;
+}
+
+void histogram_destroy(Histogram * histogram)
+{
+    if (! histogram)
+        return;
+
+    free(histogram->counts);
+    free(histogram->cumulative);
+    free(histogram->pending);
+    free(histogram);
+}
+
+/* for a tile about to change: subtract its old contents, then add the new ones */
+void histogram_add(Histogram * histogram, Image_View const * view)
+{
+    update(histogram, view, +1);
+}
+
+void histogram_subtract(Histogram * histogram, Image_View const * view)
+{
+    update(histogram, view, -1);
+}
+
+/* interpolated within the bin, except for bins that hold a single code */
+float histogram_percentile(Histogram const * histogram, int channel, double fraction)
+{
+    int bin_count = histogram->bin_count;
+    uint64_t total = histogram->total[channel];
+    uint64_t const * cumulative = &histogram->cumulative[channel * bin_count];
+
+    if (! total)
+        return NAN;
+
+    double rank = fraction * total;
+    if (rank < 0)
+        rank = 0;
+    if (rank > total - 0.5)
+        rank = total - 0.5;
+
+    int low = 0, high = bin_count - 1;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+
+        if (cumulative[middle] > rank)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+
+    if (code_count(histogram->type) == bin_count && histogram->type != GL_HALF_FLOAT_ARB)
+        return (float) low / (bin_count - 1);
+
+    uint64_t before = low ? cumulative[low - 1] : 0;
+    return histogram_bin_value(histogram, low + (rank - before) / (cumulative[low] - before));
+}
+
+Image * histogram_image(Histogram const * histogram, GLenum format)
+{
+    int bin_count = histogram->bin_count;
+    int channels = histogram->channels;
+
+    error_check(format_to_size(format) != channels, "histogram channels differ from format");
+
+    Image_Format image_format = {GL_FLOAT, format, {bin_count, 1, 1}};
+    Image * image = image_new(image_format);
+    float * target = (float *) image->pixels;
+
+    for (int i = 0; i != bin_count; ++ i)
+    for (int c = 0; c != channels; ++ c)
+        target[i * channels + c] = histogram->counts[c * bin_count + i];
+
+    return image;
+}
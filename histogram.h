@@ -0,0 +1,68 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#include "image_view.h"
+
+#define HISTOGRAM_CHANNELS 4
+
+typedef enum {HISTOGRAM_LINEAR, HISTOGRAM_LOG} Histogram_Scale;
+
+/*
+ * Per channel histogram over normalized values (integer types map to
+ * [0, 1] like pixel_convert). Integer types cover their full range
+ * linearly, with bins centred on the codes; float and half bins span the
+ * finite min and max of the data, or their log2 for HISTOGRAM_LOG. NaN
+ * and Inf samples are counted apart. The range is fixed once built, so
+ * samples added later outside of it land in the end bins.
+ */
+typedef struct
+{
+    GLenum type;
+    int channels, bin_count;
+    Histogram_Scale scale;
+    float min, max;             /* value range of the bins */
+    float lower, upper;         /* the same range after scaling */
+    uint64_t * counts;          /* bin_count per channel, channel after channel */
+    uint64_t * cumulative;      /* running sums of counts, for percentiles */
+    uint64_t total[HISTOGRAM_CHANNELS];     /* finite samples */
+    uint64_t nan_count[HISTOGRAM_CHANNELS], inf_count[HISTOGRAM_CHANNELS];
+    uint64_t * pending;         /* merged tallies, binned by histogram_finish */
+    uint64_t pending_nans[HISTOGRAM_CHANNELS], pending_infs[HISTOGRAM_CHANNELS];
+}
+Histogram;
+
+/* sub-histogram of one thread: sample codes for integer and half types, bins for float */
+typedef struct
+{
+    uint32_t * slots;
+    uint64_t nan_count[HISTOGRAM_CHANNELS], inf_count[HISTOGRAM_CHANNELS];
+}
+Histogram_Tally;
+
+Histogram * histogram_new(Image_View const *, int bin_count, Histogram_Scale);
+void        histogram_destroy(Histogram *);
+
+/*
+ * For passes that tally rows alongside other work: start empty (float
+ * also needs its range), fill one tally per thread, merge them one at a
+ * time and finish.
+ */
+Histogram * histogram_empty(GLenum type, int channels, int bin_count, Histogram_Scale);
+void        histogram_set_range(Histogram *, float min, float max, float min_positive);
+Histogram_Tally histogram_tally_new(Histogram const *);
+void        histogram_tally_row(Histogram const *, Histogram_Tally *, void const * pixels, int pixel_stride, int count);
+void        histogram_tally_plane(Histogram const *, Histogram_Tally *, int channel, void const * samples, int count);
+void        histogram_tally_merge(Histogram *, Histogram_Tally *);
+void        histogram_finish(Histogram *);
+
+void        histogram_add(Histogram *, Image_View const *);
+void        histogram_subtract(Histogram *, Image_View const *);
+
+int         histogram_bin(Histogram const *, float value);
+float       histogram_bin_value(Histogram const *, float bin);
+float       histogram_percentile(Histogram const *, int channel, double fraction);
+Image *     histogram_image(Histogram const *, GLenum format);
+
+#endif
@@ -8,6 +8,9 @@
 #include "file.h"
 #include "file_image.h"
 #include "image.h"
+#include "image_layout.h"
+#include "image_pool.h"
+#include "image_view.h"
 #include "memory.h"
 #include "string.h"
 
@@ -73,7 +76,8 @@ int image_format_dimension(Image_Format format)
     return size_to_dimension(format.size);
 }
 
-static GLint get_modulo(GLint value)
+/* the largest unpack alignment an address or a row length allows */
+GLint image_unpack_alignment(long value)
 {
     if (value % 8 == 0)
         return 8;
@@ -98,34 +102,137 @@ int image_format_pixel_size(Image_Format format)
 }
 
 
+/* a planar row holds the samples of one channel, a tiled one the pixels of one tile */
+static int row_element_size(Image_Format format)
+{
+    return format.layout == IMAGE_PLANAR
+        ? image_type_to_size(format.type)
+        : image_format_pixel_size(format);
+}
+
+static int plane_count(Image_Format format)
+{
+    return format.layout == IMAGE_PLANAR ? format_to_size(format.format) : 1;
+}
+
+Size image_format_tiles(Image_Format format)
+{
+    Size tiles =
+    {
+        (format.size.x + IMAGE_TILE - 1) / IMAGE_TILE,
+        (format.size.y + IMAGE_TILE - 1) / IMAGE_TILE,
+        format.size.z,
+    };
+
+    return tiles;
+}
+
+int image_format_tile_bytes(Image_Format format)
+{
+    return IMAGE_TILE * IMAGE_TILE * image_format_pixel_size(format);
+}
+
+int image_format_row_bytes(Image_Format format)
+{
+    if (format.layout == IMAGE_TILED)
+        return IMAGE_TILE * image_format_pixel_size(format);
+
+    return format.row_stride
+        ? format.row_stride
+        : row_element_size(format) * format.size.x;
+}
+
+/* bytes of one layer, planes or tiles included */
+static size_t layer_bytes(Image_Format format)
+{
+    if (format.layout == IMAGE_TILED)
+    {
+        Size tiles = image_format_tiles(format);
+        return (size_t) tiles.x * tiles.y * image_format_tile_bytes(format);
+    }
+
+    return (size_t) image_format_row_bytes(format) * format.size.y * plane_count(format);
+}
+
+/* size in pixels including the row padding, or the padding of the edge tiles */
+Size image_format_storage(Image_Format format)
+{
+    Size storage = format.size;
+
+    if (format.layout == IMAGE_TILED)
+    {
+        Size tiles = image_format_tiles(format);
+        storage.x = tiles.x * IMAGE_TILE;
+        storage.y = tiles.y * IMAGE_TILE;
+    }
+    else if (format.row_stride)
+        storage.x = format.row_stride / row_element_size(format);
+
+    return storage;
+}
+
+static int gcd(int a, int b)
+{
+    while (b)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/* rows padded to whole cache lines, and to whole pixels so that GL_UNPACK_ROW_LENGTH can express it */
+Image_Format image_format_align(Image_Format format)
+{
+    int pixel_size = row_element_size(format);
+    int unit = IMAGE_ALIGNMENT / gcd(IMAGE_ALIGNMENT, pixel_size) * pixel_size;
+    int row_bytes = pixel_size * format.size.x;
+
+    /* whole tiles are multiples of the alignment already */
+    if (format.layout == IMAGE_TILED)
+        return format;
+
+    format.row_stride = (row_bytes + unit - 1) / unit * unit;
+    return format;
+}
+
 Size image_format_total_size(Image_Format format)
 {
     Size total_size;
 
-    total_size.x = image_type_to_size(format.type) * format_to_size(format.format) * format.size.x;
-    total_size.y = total_size.x * format.size.y;
+    total_size.x = image_format_row_bytes(format);
+    total_size.y = layer_bytes(format);
     total_size.z = total_size.y * format.size.z;
 
     return total_size;
 }
 
-Size image_format_stride(Image_Format format)
+/* the row stride of tiled images holds within a tile only */
+Image_Stride image_format_stride(Image_Format format)
 {
-    Size stride = size_stride(format.size);
-    int pixel_size = image_format_pixel_size(format);
+    Image_Stride stride;
 
-    stride.x *= pixel_size;
-    stride.y *= pixel_size;
-    stride.z *= pixel_size;
+    stride.x = row_element_size(format);
+    stride.y = image_format_row_bytes(format);
+    stride.z = layer_bytes(format);
 
     return stride;
 }
 
+/* bytes from a sample to the one of the next channel in the same pixel */
+size_t image_format_channel_stride(Image_Format format)
+{
+    return format.layout == IMAGE_PLANAR
+        ? (size_t) image_format_row_bytes(format) * format.size.y
+        : image_type_to_size(format.type);
+}
+
 static GLint get_alignment(Image const * image)
 {
-    GLsizei const pixel_size = image_format_pixel_size(image->format);
-    GLint const image_alignment = get_modulo((long) image->pixels);
-    GLint const image_size_alignment = get_modulo(image->format.size.x * pixel_size);
+    GLint const image_alignment = image_unpack_alignment((long) image->pixels);
+    GLint const image_size_alignment = image_unpack_alignment(image_format_row_bytes(image->format));
 
     return image_alignment < image_size_alignment
         ? image_alignment
@@ -175,12 +282,9 @@ GLsizei format_to_size(GLenum const format)
     return 0;
 }
 
-int image_format_bytes(Image_Format format)
+size_t image_format_bytes(Image_Format format)
 {
-    return
-        size_total(format.size) *
-        image_type_to_size(format.type) *
-        format_to_size(format.format);
+    return layer_bytes(format) * format.size.z;
 }
 
 #if 0
@@ -248,7 +352,7 @@ void image_destroy(Image * image)
     if (!image)
         return;
 
-    free(image->pixels);
+    image_pool_free(image->pixels, image_format_bytes(image->format));
     free(image);
 }
 
@@ -279,23 +383,72 @@ void image_print(Image const * image)
 
 void image_draw_layer(Image const * image, int layer)
 {
-    Image_Format format = image->format;
-
-    // cleanup
-    int pixel_size = image_format_pixel_size(image->format);
-    int size_2d = image->format.size.x * format.size.y;
-    unsigned char * pixels = (unsigned char *) image->pixels + size_2d * pixel_size * layer;
+    if (image->format.layout == IMAGE_TILED)
+    {
+        Image * interleaved = image_to_layout(image, IMAGE_INTERLEAVED);
+        image_draw_layer(interleaved, layer);
+        image_destroy(interleaved);
+        return;
+    }
 
-    glPixelStorei(GL_UNPACK_ALIGNMENT, get_alignment(image));
-    glDrawPixels(format.size.x, format.size.y, format.format, format.type, pixels);
+    Image_View view = image_view_layer(image_view(image), layer);
+    image_view_draw(&view);
 }
 
 void image_draw(Image const * image)
 {
     Image_Format format = image->format;
 
+    if (format.layout != IMAGE_INTERLEAVED)
+    {
+        Image * interleaved = image_to_layout(image, IMAGE_INTERLEAVED);
+        image_draw(interleaved);
+        image_destroy(interleaved);
+        return;
+    }
+
     glPixelStorei(GL_UNPACK_ALIGNMENT, get_alignment(image));
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, image_format_storage(format).x);
     glDrawPixels(format.size.x, format.size.y, format.format, format.type, image->pixels);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+void * image_row(Image const * image, int layer, int row)
+{
+    Image_Format format = image->format;
+    error_check(format.layout == IMAGE_TILED, "tiled images have no rows");
+
+    return (unsigned char *) image->pixels + layer * layer_bytes(format) + (size_t) row * image_format_row_bytes(format);
+}
+
+void * image_channel_row(Image const * image, int layer, int channel, int row)
+{
+    return (unsigned char *) image_row(image, layer, row) + channel * image_format_channel_stride(image->format);
+}
+
+void * image_tile(Image const * image, int layer, int tile_x, int tile_y)
+{
+    Image_Format format = image->format;
+    size_t tiles_x = image_format_tiles(format).x;
+
+    return (unsigned char *) image->pixels + layer * layer_bytes(format) + (tile_y * tiles_x + tile_x) * image_format_tile_bytes(format);
+}
+
+/* the first sample of a pixel in any layout; the rows of tiled images only run to the tile edge */
+void * image_pixel(Image const * image, int layer, int row, int column)
+{
+    Image_Format format = image->format;
+
+    if (format.layout == IMAGE_TILED)
+    {
+        Size tiles = image_format_tiles(format);
+        size_t tile = ((size_t) layer * tiles.y + row / IMAGE_TILE) * tiles.x + column / IMAGE_TILE;
+        size_t pixel = (tile * IMAGE_TILE + row % IMAGE_TILE) * IMAGE_TILE + column % IMAGE_TILE;
+
+        return (unsigned char *) image->pixels + pixel * image_format_pixel_size(format);
+    }
+
+    return (unsigned char *) image_row(image, layer, row) + column * row_element_size(format);
 }
 
 #if 0
@@ -327,16 +480,46 @@ Image * image_copy(Image const * image)
 {
     Image_Format format = image->format;
 
-    Image * new_image = image_new(format);
+    Image * new_image = image_new_uninitialized(format);
     memcpy(new_image->pixels, image->pixels, image_format_bytes(format));
 
     return new_image;
 }
 
+/* a row stride asks for aligned storage, padded for the pixel size of this format */
 Image * image_new(Image_Format format)
 {
-    unsigned bytes = image_format_bytes(format);
-    return image_create(format, calloc(1, bytes));
+    if (format.row_stride || format.layout == IMAGE_TILED)
+    {
+        Image * image = image_new_uninitialized(format);
+        image_clear(image);
+        return image;
+    }
+
+    size_t bytes = image_format_bytes(format);
+    return image_create(format, image_pool_calloc(bytes));
+}
+
+/* for targets that are overwritten completely */
+Image * image_new_uninitialized(Image_Format format)
+{
+    if (format.row_stride || format.layout == IMAGE_TILED)
+    {
+        format = image_format_align(format);
+
+        void * pixels = image_pool_malloc_aligned(image_format_bytes(format), IMAGE_ALIGNMENT);
+        error_check(! pixels, "failed to allocate aligned image");
+
+        return image_create(format, pixels);
+    }
+
+    size_t bytes = image_format_bytes(format);
+    return image_create(format, image_pool_malloc(bytes));
+}
+
+Image * image_new_aligned(Image_Format format)
+{
+    return image_new(image_format_align(format));
 }
 
 Image * image_grey_gradient(GLenum type)
@@ -431,7 +614,7 @@ void image_store_unpack(Image const * image)
             /* fall through */
 
         case 2:
-            glPixelStorei(GL_UNPACK_ROW_LENGTH, format.size.x);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, image_format_storage(format).x);
             glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
             /* fall through */
 
@@ -444,6 +627,13 @@ void image_store_unpack(Image const * image)
     }
 }
 
+/* back to the packed defaults other uploads rely on */
+void image_store_unpack_reset(void)
+{
+    glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
 void image_store_unpack_region(Image const image, GLint const position[3], Size const size)
 {
     unsigned const dimension = size_to_dimension(size);
@@ -463,7 +653,7 @@ void image_store_unpack_region(Image const image, GLint const position[3], Size
             /* fall through */
 
         case 2:
-            glPixelStorei(GL_UNPACK_ROW_LENGTH, image_size.x);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, image_format_storage(image_format).x);
             glPixelStorei(GL_UNPACK_SKIP_ROWS, position[1]);
             /* fall through */
 
@@ -714,10 +904,11 @@ Image * image_open(char const name[])
 
 void image_clear(Image * image)
 {
-    int bytes = image_format_bytes(image->format);
+    size_t bytes = image_format_bytes(image->format);
     memset(image->pixels, 0, bytes);
 }
 
+/* rows are swapped a run at a time: whole rows, plane rows or the rows of a tile column */
 void image_flip(Image * image)
 {
     Image_Format format = image->format;
@@ -725,29 +916,28 @@ void image_flip(Image * image)
     int width  = size.x;
     int height = size.y;
     int depth = size.z;
-    int row_size = width * image_format_pixel_size(format);
+    int planes = plane_count(format);
+    int run = format.layout == IMAGE_TILED && width > IMAGE_TILE ? IMAGE_TILE : width;
+    int element_size = row_element_size(format);
+    size_t channel_stride = image_format_channel_stride(format);
 
-    unsigned char * buffer_1 = (unsigned char *) malloc(row_size);
-    unsigned char * buffer_2 = (unsigned char *) malloc(row_size);
+    unsigned char * buffer = (unsigned char *) malloc(run * element_size);
 
     for (int k = 0; k != depth; ++ k)
+    for (int p = 0; p != planes; ++ p)
+    for (int i = 0; i != height / 2; ++ i)
+    for (int j = 0; j < width; j += run)
     {
-        unsigned char * pixels = &((unsigned char *) image->pixels)[k * row_size * height];
-
-        for (int i = 0; i != height / 2; ++ i)
-        {
-            int j = height - 1 - i;
+        unsigned char * row_1 = (unsigned char *) image_pixel(image, k, i, j) + p * channel_stride;
+        unsigned char * row_2 = (unsigned char *) image_pixel(image, k, height - 1 - i, j) + p * channel_stride;
+        int bytes = (j + run < width ? run : width - j) * element_size;
 
-            memcpy(buffer_1, &pixels[i * row_size], row_size);
-            memcpy(buffer_2, &pixels[j * row_size], row_size);
-
-            memcpy(&pixels[i * row_size], buffer_2, row_size);
-            memcpy(&pixels[j * row_size], buffer_1, row_size);
-        }
+        memcpy(buffer, row_1, bytes);
+        memcpy(row_1, row_2, bytes);
+        memcpy(row_2, buffer, bytes);
     }
 
-    free(buffer_1);
-    free(buffer_2);
+    free(buffer);
 }
 
 int image_format_equal(Image_Format format_1, Image_Format format_2)
@@ -758,6 +948,12 @@ int image_format_equal(Image_Format format_1, Image_Format format_2)
     if (format_1.type != format_2.type)
         return 0;
 
+    if (format_1.row_stride != format_2.row_stride)
+        return 0;
+
+    if (format_1.layout != format_2.layout)
+        return 0;
+
     return ! memcmp(& format_1.size, & format_2.size, sizeof(Size));
 }
 
@@ -776,12 +972,12 @@ Image * image_stack(Image const * images[], int count)
         error_check(! image_format_equal(first_format, format), "format must be same");
     }
 
-    int image_size = image_format_bytes(first_format);
+    size_t image_size = image_format_bytes(first_format);
 
     Image_Format target_format = first_format;
     target_format.size.z = count;
 
-    Image * image = image_new(target_format);
+    Image * image = image_new_uninitialized(target_format);
 
     for (int i = 0; i != count; ++ i)
     {
@@ -1,6 +1,8 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include <stddef.h>
+
 #include "opengl.h"
 #include "property.h"
 #include "size.h"
@@ -11,9 +13,24 @@ extern char const * BOB_MIME, * GIF_MIME, * JPEG_MIME, * MPO_MIME, * PNG_MIME, *
 extern char const * EXR_MIME;
 #endif
 
+#define IMAGE_ALIGNMENT 64
+#define IMAGE_TILE 64
+
 struct Image;
 
-typedef struct {GLenum type, format; Size size;} Image_Format;
+typedef enum {IMAGE_INTERLEAVED, IMAGE_PLANAR, IMAGE_TILED} Image_Layout;
+
+/*
+ * row_stride is in bytes, 0 for tightly packed rows. Planar images keep
+ * one plane per channel, the planes of a layer follow each other and
+ * row_stride is that of a plane row. Tiled images keep square tiles of
+ * IMAGE_TILE interleaved pixels, row by row of tiles; edge tiles are
+ * padded to full size and row_stride is unused.
+ */
+typedef struct {GLenum type, format; Size size; int row_stride; Image_Layout layout;} Image_Format;
+/* bytes between neighbouring pixels, rows and layers; layers may exceed 2 GiB */
+typedef struct {size_t x, y, z;} Image_Stride;
+
 typedef struct Image {Image_Format format; void * pixels;
 struct Image * palette; void * device;} Image;
 
@@ -23,14 +40,22 @@ int image_type_to_size(GLenum);
 
 int  image_format_equal(Image_Format, Image_Format);
 void image_format_print(Image_Format);
-int  image_format_bytes(Image_Format);
+size_t image_format_bytes(Image_Format);
+int  image_format_row_bytes(Image_Format);
+Size image_format_storage(Image_Format);
+Image_Format image_format_align(Image_Format);
 int  image_format_pixels(Image_Format);
 int  image_format_pixel_size(Image_Format);
 Size image_format_total_size(Image_Format);
-Size image_format_stride(Image_Format);
+Image_Stride image_format_stride(Image_Format);
+size_t image_format_channel_stride(Image_Format);
+Size image_format_tiles(Image_Format);
+int  image_format_tile_bytes(Image_Format);
 int  image_format_dimension(Image_Format);
 
 Image * image_new(Image_Format);
+Image * image_new_uninitialized(Image_Format);
+Image * image_new_aligned(Image_Format);
 Image * image_copy(Image const *);
 Image * image_create(Image_Format, void * pixels);
 Image * image_open(char const name[]);
@@ -41,6 +66,8 @@ Image * image_grey_gradient(GLenum type);
 void image_destroy(Image *);
 void image_clear(Image *);
 void image_store_unpack(Image const *);
+GLint image_unpack_alignment(long value);
+void image_store_unpack_reset(void);
 void image_store_unpack_region(Image, GLint const position[3], Size);
 void image_store_pack(Image, Size);
 void image_store_pack_region(Image, GLint const position[3], Size);
@@ -50,6 +77,10 @@ void image_draw(Image const *);
 void image_draw_layer(Image const *, int);
 
 void image_flip(Image *);
+void * image_row(Image const *, int layer, int row);
+void * image_channel_row(Image const *, int layer, int channel, int row);
+void * image_pixel(Image const *, int layer, int row, int column);
+void * image_tile(Image const *, int layer, int tile_x, int tile_y);
 
 Property * image_properties(char const name[], unsigned * count);
 
@@ -0,0 +1,410 @@
+#include <float.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "half.h"
+#include "image_analysis.h"
+#include "memory.h"
+#include "parallel.h"
+#include "pixel_convert.h"
+#include "print.h"
+
+typedef struct
+{
+    uint64_t count[ANALYSIS_CHANNELS];
+    double sum[ANALYSIS_CHANNELS], squares[ANALYSIS_CHANNELS];
+    float min[ANALYSIS_CHANNELS], max[ANALYSIS_CHANNELS], min_positive;
+    uint64_t zeros[ANALYSIS_CHANNELS], negatives[ANALYSIS_CHANNELS];
+    uint64_t nans[ANALYSIS_CHANNELS], infs[ANALYSIS_CHANNELS];
+}
+Accumulator;
+
+static void accumulator_clear(Accumulator * accumulator)
+{
+    clear(Accumulator, accumulator);
+
+    for (int c = 0; c != ANALYSIS_CHANNELS; ++ c)
+    {
+        accumulator->min[c] = +FLT_MAX;
+        accumulator->max[c] = -FLT_MAX;
+    }
+
+    accumulator->min_positive = +FLT_MAX;
+}
+
+static void accumulator_merge(Accumulator * target, Accumulator const * source, int channels)
+{
+    for (int c = 0; c != channels; ++ c)
+    {
+        target->count[c] += source->count[c];
+        target->sum[c] += source->sum[c];
+        target->squares[c] += source->squares[c];
+        target->min[c] = fminf(target->min[c], source->min[c]);
+        target->max[c] = fmaxf(target->max[c], source->max[c]);
+        target->zeros[c] += source->zeros[c];
+        target->negatives[c] += source->negatives[c];
+        target->nans[c] += source->nans[c];
+        target->infs[c] += source->infs[c];
+    }
+
+    target->min_positive = fminf(target->min_positive, source->min_positive);
+}
+
+/* sums are taken relative to an offset so the squares keep their digits; planar samples come with a step of 1 */
+static void accumulate_channel(Accumulator * accumulator, int c, float const * samples, int step, int count, double offset)
+{
+    for (int i = 0; i != count; ++ i)
+    {
+        float value = samples[(size_t) i * step];
+
+        if (! isfinite(value))
+        {
+            if (isnan(value))
+                ++ accumulator->nans[c];
+            else
+                ++ accumulator->infs[c];
+            continue;
+        }
+
+        double shifted = value - offset;
+
+        ++ accumulator->count[c];
+        accumulator->sum[c] += shifted;
+        accumulator->squares[c] += shifted * shifted;
+
+        if (value < accumulator->min[c]) accumulator->min[c] = value;
+        if (value > accumulator->max[c]) accumulator->max[c] = value;
+        if (value > 0 && value < accumulator->min_positive) accumulator->min_positive = value;
+
+        if (value == 0)
+            ++ accumulator->zeros[c];
+        else if (value < 0)
+            ++ accumulator->negatives[c];
+    }
+}
+
+static void accumulate_row(Accumulator * accumulator, float const * row, int channels, int count, double const offset[])
+{
+    for (int c = 0; c != channels; ++ c)
+        accumulate_channel(accumulator, c, &row[c], channels, count, offset[c]);
+}
+
+/* RGB gains an opaque alpha channel, which the comparison shaders expect */
+Image_Format image_analysis_display_format(Image_Format format)
+{
+    format.type = GL_FLOAT;
+    if (format.format == GL_RGB)
+        format.format = GL_RGBA;
+
+    return image_format_align(format);
+}
+
+static void widen_row(float const * source, float * target, int count)
+{
+    for (int i = 0; i != count; ++ i)
+    {
+        target[4 * i + 0] = source[3 * i + 0];
+        target[4 * i + 1] = source[3 * i + 1];
+        target[4 * i + 2] = source[3 * i + 2];
+        target[4 * i + 3] = 1;
+    }
+}
+
+/* planes of count samples each into pixels of channels, a missing alpha is opaque */
+static void interleave_planes(float const * planes, float * target, int channels, int target_channels, int count)
+{
+    for (int i = 0; i != count; ++ i)
+    {
+        for (int c = 0; c != channels; ++ c)
+            target[i * target_channels + c] = planes[c * count + i];
+
+        for (int c = channels; c != target_channels; ++ c)
+            target[i * target_channels + c] = 1;
+    }
+}
+
+static int histogram_supported(GLenum type)
+{
+    return type == GL_UNSIGNED_BYTE || type == GL_UNSIGNED_SHORT || type == GL_HALF_FLOAT_ARB || type == GL_FLOAT;
+}
+
+static float code_value(GLenum type, int code)
+{
+    switch (type)
+    {
+        case GL_UNSIGNED_BYTE:  return code / 255.0f;
+        case GL_UNSIGNED_SHORT: return code / 65535.0f;
+        default:                return half_to_float(code);
+    }
+}
+
+/* integer and half images are tallied by code, which is all the moments need */
+static void accumulate_codes(Accumulator * accumulator, uint64_t const * slots, GLenum type, int channels, double const offset[])
+{
+    int code_count = type == GL_UNSIGNED_BYTE ? 1 << 8 : 1 << 16;
+
+    for (int c = 0; c != channels; ++ c)
+    for (int i = 0; i != code_count; ++ i)
+    {
+        uint64_t count = slots[c * code_count + i];
+        float value = code_value(type, i);
+
+        if (! count)
+            continue;
+
+        if (! isfinite(value))
+        {
+            if (isnan(value))
+                accumulator->nans[c] += count;
+            else
+                accumulator->infs[c] += count;
+            continue;
+        }
+
+        double shifted = value - offset[c];
+
+        accumulator->count[c] += count;
+        accumulator->sum[c] += count * shifted;
+        accumulator->squares[c] += count * shifted * shifted;
+
+        if (value < accumulator->min[c]) accumulator->min[c] = value;
+        if (value > accumulator->max[c]) accumulator->max[c] = value;
+        if (value > 0 && value < accumulator->min_positive) accumulator->min_positive = value;
+
+        if (value == 0)
+            accumulator->zeros[c] += count;
+        else if (value < 0)
+            accumulator->negatives[c] += count;
+    }
+}
+
+typedef struct
+{
+    Image const * source;
+    Image * display;
+    Image_Analysis * analysis;
+    Accumulator * total;
+    double const * offset;
+}
+Analysis_Task;
+
+/* every channel is converted, summed and tallied on its own contiguous samples */
+static void analyze_planes(Analysis_Task const * task, Accumulator * local, Histogram_Tally * tally, float * buffer, int z, int y)
+{
+    Image const * source = task->source;
+    Image * display = task->display;
+    Image_Format format = source->format;
+    int width = format.size.x;
+    int channels = format_to_size(format.format);
+
+    for (int c = 0; c != channels; ++ c)
+    {
+        void const * samples = image_channel_row(source, z, c, y);
+        float * plane = &buffer[c * width];
+
+        pixel_convert(samples, format.type, plane, GL_FLOAT, width);
+        if (tally->slots)
+            histogram_tally_plane(task->analysis->histogram, tally, c, samples, width);
+        else
+            accumulate_channel(local, c, plane, 1, width, task->offset[c]);
+    }
+
+    if (display)
+        interleave_planes(buffer, (float *) image_row(display, z, y), channels, format_to_size(display->format.format), width);
+}
+
+static void analyze_rows(void * context, int first, int last)
+{
+    Analysis_Task const * task = (Analysis_Task const *) context;
+    Image const * source = task->source;
+    Image * display = task->display;
+    Histogram * histogram = task->analysis->histogram;
+    Image_Format format = source->format;
+    Size size = format.size;
+    int channels = format_to_size(format.format);
+    int display_channels = display ? format_to_size(display->format.format) : channels;
+
+    Accumulator local;
+    Histogram_Tally tally = {NULL};
+    float * buffer = malloc_array(float, size.x * channels);
+
+    accumulator_clear(&local);
+    if (histogram && format.type != GL_FLOAT)
+        tally = histogram_tally_new(histogram);
+
+    for (int r = first; r != last; ++ r)
+    {
+        int z = r / size.y, y = r % size.y;
+
+        if (format.layout == IMAGE_PLANAR)
+        {
+            analyze_planes(task, &local, &tally, buffer, z, y);
+            continue;
+        }
+
+        void const * pixels = image_row(source, z, y);
+        float * row = display && display_channels == channels ? (float *) image_row(display, z, y) : buffer;
+
+        pixel_convert(pixels, format.type, row, GL_FLOAT, size.x * channels);
+        if (! tally.slots)
+            accumulate_row(&local, row, channels, size.x, task->offset);
+
+        if (row == buffer && display)
+            widen_row(buffer, (float *) image_row(display, z, y), size.x);
+
+        if (tally.slots)
+            histogram_tally_row(histogram, &tally, pixels, channels * image_type_to_size(format.type), size.x);
+    }
+
+    parallel_lock();
+    accumulator_merge(task->total, &local, channels);
+    if (tally.slots)
+        histogram_tally_merge(histogram, &tally);
+    parallel_unlock();
+
+    free(buffer);
+}
+
+static void tally_float_rows(void * context, int first, int last)
+{
+    Analysis_Task const * task = (Analysis_Task const *) context;
+    Image const * source = task->source;
+    Image const * display = task->display;
+    Histogram * histogram = task->analysis->histogram;
+    Size size = source->format.size;
+    int stride = (display ? format_to_size(display->format.format) : histogram->channels) * sizeof(float);
+    Histogram_Tally tally = histogram_tally_new(histogram);
+
+    for (int r = first; r != last; ++ r)
+    {
+        int z = r / size.y, y = r % size.y;
+
+        if (! display && source->format.layout == IMAGE_PLANAR)
+        {
+            for (int c = 0; c != histogram->channels; ++ c)
+                histogram_tally_plane(histogram, &tally, c, image_channel_row(source, z, c, y), size.x);
+            continue;
+        }
+
+        void const * pixels = display ? image_row(display, z, y) : image_row(source, z, y);
+
+        histogram_tally_row(histogram, &tally, pixels, stride, size.x);
+    }
+
+    parallel_lock();
+    histogram_tally_merge(histogram, &tally);
+    parallel_unlock();
+}
+
+Image_Analysis * image_analyze(Image const * source, Image * display)
+{
+    Image_Format format = source->format;
+    Size size = format.size;
+    int channels = format_to_size(format.format);
+    int display_channels = display ? format_to_size(display->format.format) : channels;
+    int row_count = size.y * size.z;
+
+    error_check(channels > ANALYSIS_CHANNELS, "too many channels for analysis");
+    if (display)
+    {
+        error_check(display->format.type != GL_FLOAT, "display type must be float");
+        error_check(! size_equal(display->format.size, size), "display size must match");
+        error_check(display_channels != channels && ! (channels == 3 && display_channels == 4), "display channels must match");
+    }
+
+    Image_Analysis * analysis = calloc_size(Image_Analysis);
+    analysis->channels = channels;
+
+    if (histogram_supported(format.type))
+        analysis->histogram = histogram_empty(format.type, channels, 0, HISTOGRAM_LINEAR);
+
+    double offset[ANALYSIS_CHANNELS] = {0};
+    if (size.x && size.y)
+    {
+        int pixel_stride = image_format_stride(format).x;
+
+        for (int c = 0; c != channels; ++ c)
+        {
+            float centre;
+            unsigned char const * row = (unsigned char const *) image_channel_row(source, 0, c, size.y / 2);
+
+            pixel_convert(row + pixel_stride * (size.x / 2), format.type, &centre, GL_FLOAT, 1);
+            offset[c] = isfinite(centre) ? centre : 0;
+        }
+    }
+
+    Accumulator total;
+    accumulator_clear(&total);
+    pixel_convert_isa();
+
+    Analysis_Task task = {source, display, analysis, &total, offset};
+    parallel_for(row_count, parallel_reduction_grain(row_count), analyze_rows, &task);
+
+    if (analysis->histogram && format.type != GL_FLOAT)
+        accumulate_codes(&total, analysis->histogram->pending, format.type, channels, offset);
+
+    for (int c = 0; c != channels; ++ c)
+    {
+        uint64_t count = total.count[c];
+        double mean = count ? total.sum[c] / count : 0;
+
+        analysis->count[c] = count;
+        analysis->sum[c] = total.sum[c] + count * offset[c];
+        analysis->mean[c] = count ? mean + offset[c] : 0;
+        analysis->variance[c] = count ? fmax(total.squares[c] / count - mean * mean, 0) : 0;
+        analysis->min[c] = count ? total.min[c] : 0;
+        analysis->max[c] = count ? total.max[c] : 0;
+        analysis->zeros[c] = total.zeros[c];
+        analysis->negatives[c] = total.negatives[c];
+        analysis->nans[c] = total.nans[c];
+        analysis->infs[c] = total.infs[c];
+    }
+
+    if (analysis->histogram && format.type == GL_FLOAT)
+    {
+        float min = +FLT_MAX, max = -FLT_MAX;
+
+        for (int c = 0; c != channels; ++ c)
+        {
+            min = fminf(min, total.min[c]);
+            max = fmaxf(max, total.max[c]);
+        }
+
+        /* float bins depend on the min and max, so float data is tallied in a second sweep */
+        histogram_set_range(analysis->histogram, min, max, total.min_positive);
+        parallel_for(row_count, parallel_reduction_grain(row_count), tally_float_rows, &task);
+    }
+
+    if (analysis->histogram)
+        histogram_finish(analysis->histogram);
+
+    return analysis;
+}
+
+void image_analysis_destroy(Image_Analysis * analysis)
+{
+    if (! analysis)
+        return;
+
+    histogram_destroy(analysis->histogram);
+    free(analysis);
+}
+
+void image_analysis_print(Image_Analysis const * analysis)
+{
+    for (int c = 0; c != analysis->channels; ++ c)
+    {
+        printf("channel %d: mean = %g, var = %g, min = %g, max = %g, zeros = %" PRIu64 "\n", c,
+            analysis->mean[c], analysis->variance[c], analysis->min[c], analysis->max[c], analysis->zeros[c]);
+
+        uint64_t negatives = analysis->negatives[c], infs = analysis->infs[c], nans = analysis->nans[c];
+        if (negatives || infs || nans)
+            printf("  # negative = %s%" PRIu64 "%s, # inf = %s%" PRIu64 "%s, # nan = %s%" PRIu64 "%s\n",
+                negatives ? ANSI_BG_RED : "", negatives, ANSI_RESET,
+                infs      ? ANSI_BG_RED : "", infs,      ANSI_RESET,
+                nans      ? ANSI_BG_RED : "", nans,      ANSI_RESET);
+    }
+}
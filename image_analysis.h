@@ -0,0 +1,33 @@
+#ifndef IMAGE_ANALYSIS_H
+#define IMAGE_ANALYSIS_H
+
+#include <stdint.h>
+
+#include "histogram.h"
+#include "image.h"
+
+#define ANALYSIS_CHANNELS 4
+
+/*
+ * Everything the viewer wants to know about a freshly loaded image,
+ * gathered in one pass over its pixels. Values are normalized like
+ * pixel_convert; moments, min and max only cover finite samples.
+ */
+typedef struct
+{
+    int channels;
+    uint64_t count[ANALYSIS_CHANNELS];      /* finite samples */
+    double sum[ANALYSIS_CHANNELS], mean[ANALYSIS_CHANNELS], variance[ANALYSIS_CHANNELS];
+    float min[ANALYSIS_CHANNELS], max[ANALYSIS_CHANNELS];
+    uint64_t zeros[ANALYSIS_CHANNELS], negatives[ANALYSIS_CHANNELS];
+    uint64_t nans[ANALYSIS_CHANNELS], infs[ANALYSIS_CHANNELS];
+    Histogram * histogram;                  /* NULL for unsupported types */
+}
+Image_Analysis;
+
+Image_Format     image_analysis_display_format(Image_Format);
+Image_Analysis * image_analyze(Image const *, Image * display);
+void             image_analysis_destroy(Image_Analysis *);
+void             image_analysis_print(Image_Analysis const *);
+
+#endif
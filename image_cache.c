@@ -0,0 +1,373 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "image_cache.h"
+#include "image_pool.h"
+#include "memory.h"
+
+/* the pixels start on a page of their own */
+#define HEADER_BYTES 4096
+
+/* smaller images decode faster than their entry is found */
+#define MIN_BYTES (1 << 20)
+
+/* temporary files of crashed writers */
+#define STALE_SECONDS (24 * 60 * 60)
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version, byte_order;
+    uint32_t type, format, width, height, depth, row_stride, layout;
+    uint64_t pixel_bytes, source_bytes;
+    int64_t source_time;
+    uint32_t path_length;
+}
+Cache_Header;
+
+typedef struct
+{
+    char path[PATH_MAX];
+    uint64_t bytes;
+    int64_t time;
+}
+Cache_Key;
+
+typedef struct
+{
+    char name[256];
+    off_t bytes;
+    time_t time;
+}
+Cache_Entry;
+
+typedef struct
+{
+    void * map;
+    size_t bytes;
+}
+Mapping;
+
+static char const MAGIC[4] = {'I', 'V', 'D', 'C'};
+static uint32_t const VERSION = 1;
+static uint32_t const ENDIAN_CHECK = 0x01020304;
+
+static char directory[PATH_MAX];
+static size_t limit;
+
+void image_cache_set_directory(char const path[])
+{
+    snprintf(directory, sizeof directory, "%s", path ? path : "");
+}
+
+void image_cache_set_limit(size_t bytes)
+{
+    limit = bytes;
+}
+
+static char const * cache_directory(void)
+{
+    if (directory[0])
+        return directory;
+
+    char const * path = getenv("IV_CACHE");
+    if (path)
+    {
+        image_cache_set_directory(path);
+        mkdir(directory, 0755);
+        return directory;
+    }
+
+    char const * home = getenv("HOME");
+    if (! home)
+        return NULL;
+
+    snprintf(directory, sizeof directory, "%s/.cache", home);
+    mkdir(directory, 0755);
+    snprintf(directory, sizeof directory, "%s/.cache/iv", home);
+    mkdir(directory, 0755);
+
+    return directory;
+}
+
+static int source_key(char const name[], Cache_Key * key)
+{
+    struct stat status;
+
+    if (! realpath(name, key->path) || stat(key->path, &status) != 0)
+        return 0;
+
+    key->bytes = status.st_size;
+    key->time = status.st_mtime;
+
+    return 1;
+}
+
+static uint64_t hash_bytes(uint64_t hash, void const * data, size_t bytes)
+{
+    unsigned char const * p = (unsigned char const *) data;
+
+    for (size_t i = 0; i != bytes; ++ i)
+        hash = (hash ^ p[i]) * 0x100000001b3ull;
+
+    return hash;
+}
+
+static int entry_name(Cache_Key const * key, char name[])
+{
+    char const * path = cache_directory();
+    if (! path)
+        return 0;
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = hash_bytes(hash, key->path, strlen(key->path));
+    hash = hash_bytes(hash, &key->bytes, sizeof key->bytes);
+    hash = hash_bytes(hash, &key->time, sizeof key->time);
+
+    return snprintf(name, PATH_MAX, "%s/%016llx.ivc", path, (unsigned long long) hash) < PATH_MAX;
+}
+
+static void unmap(void * context)
+{
+    Mapping * mapping = (Mapping *) context;
+
+    munmap(mapping->map, mapping->bytes);
+    free(mapping);
+}
+
+/* the header has to match the source exactly, a hash collision is just a miss */
+static int valid_entry(Cache_Header const * header, Cache_Key const * key, size_t bytes)
+{
+    size_t path_length = strlen(key->path);
+
+    if (memcmp(header->magic, MAGIC, sizeof MAGIC) || header->version != VERSION || header->byte_order != ENDIAN_CHECK)
+        return 0;
+
+    if (header->source_bytes != key->bytes || header->source_time != key->time || header->path_length != path_length)
+        return 0;
+
+    if (memcmp((char const *) (header + 1), key->path, path_length))
+        return 0;
+
+    Image_Format format = {header->type, header->format, {header->width, header->height, header->depth}, header->row_stride, (Image_Layout) header->layout};
+
+    return header->pixel_bytes == (uint64_t) image_format_bytes(format) && HEADER_BYTES + header->pixel_bytes == bytes;
+}
+
+Image * image_cache_load(char const name[])
+{
+    Cache_Key key;
+    char file_name[PATH_MAX];
+
+    if (! limit || ! source_key(name, &key) || ! entry_name(&key, file_name))
+        return NULL;
+
+    int file = open(file_name, O_RDONLY);
+    struct stat status;
+
+    if (file < 0)
+        return NULL;
+
+    if (fstat(file, &status) != 0 || status.st_size <= HEADER_BYTES)
+    {
+        close(file);
+        return NULL;
+    }
+
+    // private, the viewer may change the pixels but never the entry
+    void * map = mmap(NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    close(file);
+
+    if (map == MAP_FAILED)
+        return NULL;
+
+    Cache_Header const * header = (Cache_Header const *) map;
+    if (! valid_entry(header, &key, status.st_size))
+    {
+        munmap(map, status.st_size);
+        return NULL;
+    }
+
+    // the modification time orders the entries for eviction
+    utimes(file_name, NULL);
+
+    Image_Format format = {header->type, header->format, {header->width, header->height, header->depth}, header->row_stride, (Image_Layout) header->layout};
+    Image * image = image_create(format, (unsigned char *) map + HEADER_BYTES);
+
+    Mapping * mapping = malloc_size(Mapping);
+    mapping->map = map;
+    mapping->bytes = status.st_size;
+    image_pool_adopt(image->pixels, unmap, mapping);
+
+    return image;
+}
+
+/* written under a temporary name, readers only ever see complete entries */
+int image_cache_store(char const name[], Image const * image)
+{
+    Cache_Key key;
+    char file_name[PATH_MAX], temporary_name[PATH_MAX + 8];
+    size_t pixel_bytes = image_format_bytes(image->format);
+    size_t path_length;
+
+    if (! limit || image->palette || pixel_bytes < MIN_BYTES || HEADER_BYTES + pixel_bytes > limit)
+        return 0;
+
+    if (! source_key(name, &key) || ! entry_name(&key, file_name))
+        return 0;
+
+    path_length = strlen(key.path);
+    if (sizeof(Cache_Header) + path_length > HEADER_BYTES)
+        return 0;
+
+    unsigned char block[HEADER_BYTES];
+    Image_Format format = image->format;
+    Cache_Header header =
+    {
+        {MAGIC[0], MAGIC[1], MAGIC[2], MAGIC[3]},
+        VERSION, ENDIAN_CHECK,
+        format.type, format.format, format.size.x, format.size.y, format.size.z, format.row_stride, format.layout,
+        pixel_bytes, key.bytes, key.time, path_length
+    };
+
+    memset(block, 0, sizeof block);
+    memcpy(block, &header, sizeof header);
+    memcpy(block + sizeof header, key.path, path_length);
+
+    sprintf(temporary_name, "%s.XXXXXX", file_name);
+    int file = mkstemp(temporary_name);
+    if (file < 0)
+        return 0;
+
+    FILE * stream = fdopen(file, "wb");
+    int success =
+        fwrite(block, 1, sizeof block, stream) == sizeof block &&
+        fwrite(image->pixels, 1, pixel_bytes, stream) == pixel_bytes;
+
+    success = fclose(stream) == 0 && success;
+    success = success && rename(temporary_name, file_name) == 0;
+
+    if (! success)
+        unlink(temporary_name);
+    else
+        image_cache_trim();
+
+    return success;
+}
+
+static int compare_entries(void const * a, void const * b)
+{
+    time_t time_a = ((Cache_Entry const *) a)->time;
+    time_t time_b = ((Cache_Entry const *) b)->time;
+
+    return (time_a > time_b) - (time_a < time_b);
+}
+
+/* least recently used first until the entries fit the limit */
+void image_cache_trim(void)
+{
+    char const * path = cache_directory();
+    char name[PATH_MAX];
+
+    if (! path || ! limit)
+        return;
+
+    snprintf(name, sizeof name, "%s/lock", path);
+    int lock = open(name, O_CREAT | O_RDWR, 0644);
+    if (lock < 0)
+        return;
+
+    flock(lock, LOCK_EX);
+
+    DIR * listing = opendir(path);
+    Cache_Entry * entries = NULL;
+    int count = 0, capacity = 0;
+    uint64_t total = 0;
+    time_t now = time(NULL);
+    struct dirent * file;
+
+    while (listing && (file = readdir(listing)))
+    {
+        char const * extension = strstr(file->d_name, ".ivc");
+        struct stat status;
+
+        if (! extension)
+            continue;
+
+        snprintf(name, sizeof name, "%s/%s", path, file->d_name);
+        if (stat(name, &status) != 0)
+            continue;
+
+        if (extension[4])
+        {
+            if (now - status.st_mtime > STALE_SECONDS)
+                unlink(name);
+            continue;
+        }
+
+        if (count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 64;
+            entries = realloc_array(Cache_Entry, entries, capacity);
+        }
+
+        snprintf(entries[count].name, sizeof entries[count].name, "%s", file->d_name);
+        entries[count].bytes = status.st_size;
+        entries[count].time = status.st_mtime;
+        total += status.st_size;
+        ++ count;
+    }
+
+    if (listing)
+        closedir(listing);
+
+    qsort(entries, count, sizeof(Cache_Entry), compare_entries);
+
+    // a mapped entry stays readable after unlinking
+    for (int i = 0; i != count && total > limit; ++ i)
+    {
+        snprintf(name, sizeof name, "%s/%s", path, entries[i].name);
+        if (unlink(name) == 0)
+            total -= entries[i].bytes;
+    }
+
+    free(entries);
+    flock(lock, LOCK_UN);
+    close(lock);
+}
+
+static int already_raw(char const name[])
+{
+    char const * mime_type = file_guess_mime_type(name);
+
+    return mime_type && (! strcmp(mime_type, PNM_MIME) || ! strcmp(mime_type, PGM_MIME) ||
+        ! strcmp(mime_type, PPM_MIME) || ! strcmp(mime_type, RAW_MIME));
+}
+
+/* formats that are stored uncompressed anyway are read directly */
+Image * image_cache_open(char const name[])
+{
+    if (! limit || already_raw(name))
+        return image_open(name);
+
+    Image * image = image_cache_load(name);
+    if (image)
+        return image;
+
+    image = image_open(name);
+    if (image)
+        image_cache_store(name, image);
+
+    return image;
+}
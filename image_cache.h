@@ -0,0 +1,24 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <stddef.h>
+
+#include "image.h"
+
+/*
+ * Decoded images kept on disk across runs, keyed by the real path, size
+ * and modification time of their source. Entries are uncompressed and
+ * mapped copy on write, so loading one costs no decoding and no copy.
+ * Entries appear atomically by rename and the least recently used are
+ * evicted under a lock file, so several instances may share a directory.
+ * The directory defaults to $IV_CACHE, else ~/.cache/iv; a limit of 0,
+ * the default, turns the cache off.
+ */
+void    image_cache_set_directory(char const path[]);
+void    image_cache_set_limit(size_t bytes);
+Image * image_cache_load(char const name[]);
+int     image_cache_store(char const name[], Image const *);
+Image * image_cache_open(char const name[]);
+void    image_cache_trim(void);
+
+#endif
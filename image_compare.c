@@ -0,0 +1,265 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "color.h"
+#include "error.h"
+#include "image_compare.h"
+#include "image_process.h"
+#include "memory.h"
+#include "parallel.h"
+#include "pixel_convert.h"
+#include "print.h"
+#include "ssim.h"
+
+/* the same floor image_squared_error puts under relative errors */
+#define RELATIVE_CLAMP 0.01f
+
+typedef struct
+{
+    uint64_t count[COMPARE_CHANNELS], nonfinite[COMPARE_CHANNELS];
+    double squares[COMPARE_CHANNELS], relative_squares[COMPARE_CHANNELS];
+    float max_error[COMPARE_CHANNELS];
+}
+Accumulator;
+
+typedef struct
+{
+    Image const * image, * reference;
+    Image_Comparison * comparison;
+    Accumulator total;
+}
+Compare_Task;
+
+/* errors are non-negative, so the upper half of their bits orders them on a log scale with 7 bits of mantissa */
+static int error_bin(float error)
+{
+    uint32_t bits;
+    memcpy(&bits, &error, sizeof bits);
+
+    return bits >> 16;
+}
+
+static float bin_value(double bin)
+{
+    uint32_t low = (uint32_t) bin << 16, high = ((uint32_t) bin + 1) << 16;
+    float low_value, high_value;
+
+    memcpy(&low_value, &low, sizeof low);
+    memcpy(&high_value, &high, sizeof high);
+
+    return low_value + (bin - floor(bin)) * (high_value - low_value);
+}
+
+static void difference_row(float const * image, float const * reference, Color4 * target, int channels, int count)
+{
+    for (int i = 0; i != count; ++ i)
+    {
+        float const * a = &image[i * channels], * b = &reference[i * channels];
+        Color d = channels >= 3
+            ? color_sub(* (Color const *) a, * (Color const *) b)
+            : (Color) {a[0] - b[0], a[0] - b[0], a[0] - b[0]};
+
+        target[i].c = map_color(d);
+        target[i].a = 1;
+    }
+}
+
+static void compare_rows(void * context, int first, int last)
+{
+    Compare_Task * task = (Compare_Task *) context;
+    Image_Comparison * comparison = task->comparison;
+    Image const * image = task->image, * reference = task->reference;
+    Size size = image->format.size;
+    int channels = comparison->channels;
+    int n = size.x * channels;
+
+    float * row = malloc_array(float, n);
+    float * reference_row = malloc_array(float, n);
+    uint64_t * bins = calloc_array(uint64_t, COMPARE_BINS);
+    Accumulator local;
+
+    clear(Accumulator, &local);
+
+    for (int r = first; r != last; ++ r)
+    {
+        int z = r / size.y, y = r % size.y;
+
+        pixel_convert(image_row(image, z, y), image->format.type, row, GL_FLOAT, n);
+        pixel_convert(image_row(reference, z, y), reference->format.type, reference_row, GL_FLOAT, n);
+
+        for (int i = 0; i != n; i += channels)
+        for (int c = 0; c != channels; ++ c)
+        {
+            float a = row[i + c], b = reference_row[i + c];
+            float d = a - b;
+
+            if (! isfinite(d))
+            {
+                ++ local.nonfinite[c];
+                continue;
+            }
+
+            float e = fabsf(d);
+            float relative = d / (b < RELATIVE_CLAMP ? RELATIVE_CLAMP : b);
+
+            ++ local.count[c];
+            local.squares[c] += (double) d * d;
+            local.relative_squares[c] += (double) relative * relative;
+            if (e > local.max_error[c])
+                local.max_error[c] = e;
+
+            ++ bins[error_bin(e)];
+        }
+
+        if (comparison->difference)
+            difference_row(row, reference_row, (Color4 *) image_row(comparison->difference, z, y), channels, size.x);
+    }
+
+    parallel_lock();
+    for (int c = 0; c != channels; ++ c)
+    {
+        task->total.count[c] += local.count[c];
+        task->total.nonfinite[c] += local.nonfinite[c];
+        task->total.squares[c] += local.squares[c];
+        task->total.relative_squares[c] += local.relative_squares[c];
+        if (local.max_error[c] > task->total.max_error[c])
+            task->total.max_error[c] = local.max_error[c];
+    }
+    for (int i = 0; i != COMPARE_BINS; ++ i)
+        comparison->bins[i] += bins[i];
+    parallel_unlock();
+
+    free(bins);
+    free(reference_row);
+    free(row);
+}
+
+Image_Comparison * image_compare(Image const * image, Image const * reference, int flags)
+{
+    Image_Format format = image->format;
+    int channels = format_to_size(format.format);
+
+    error_check(! size_equal(format.size, reference->format.size), "compared images must have same size");
+    error_check(format.format != reference->format.format, "compared images must have same format");
+    error_check(channels > COMPARE_CHANNELS, "too many channels to compare");
+    error_check(format.layout == IMAGE_PLANAR || reference->format.layout == IMAGE_PLANAR, "compared images must be interleaved");
+
+    Image_Comparison * comparison = calloc_size(Image_Comparison);
+    comparison->channels = channels;
+    comparison->bins = calloc_array(uint64_t, COMPARE_BINS);
+
+    if (flags & COMPARE_DIFFERENCE)
+    {
+        Image_Format difference_format = {GL_FLOAT, GL_RGBA, format.size};
+        comparison->difference = image_new_uninitialized(difference_format);
+    }
+
+    pixel_convert_isa();
+
+    Compare_Task task = {image, reference, comparison};
+    int row_count = format.size.y * format.size.z;
+
+    parallel_for(row_count, parallel_reduction_grain(row_count), compare_rows, &task);
+
+    Accumulator const * total = &task.total;
+    uint64_t count = 0;
+    double squares = 0, relative_squares = 0;
+
+    for (int c = 0; c != channels; ++ c)
+    {
+        comparison->count[c] = total->count[c];
+        comparison->nonfinite[c] = total->nonfinite[c];
+        comparison->mse[c] = total->count[c] ? total->squares[c] / total->count[c] : 0;
+        comparison->relative_mse[c] = total->count[c] ? total->relative_squares[c] / total->count[c] : 0;
+        comparison->max_error[c] = total->max_error[c];
+        comparison->ssim[c] = NAN;
+
+        count += total->count[c];
+        squares += total->squares[c];
+        relative_squares += total->relative_squares[c];
+        if (total->max_error[c] > comparison->max)
+            comparison->max = total->max_error[c];
+    }
+
+    comparison->bin_total = count;
+    comparison->mean_mse = count ? squares / count : 0;
+    comparison->mean_relative_mse = count ? relative_squares / count : 0;
+    comparison->psnr = image_psnr(comparison->mean_mse);
+    comparison->rmse = image_rmse(comparison->mean_mse);
+    comparison->mean_ssim = NAN;
+
+    /* SSIM filters moment images, which takes passes of its own */
+    if (flags & COMPARE_SSIM)
+    {
+        Ssim_Parameters parameters = ssim_parameters();
+        image_ssim_mean(image, reference, &parameters, comparison->ssim);
+
+        comparison->mean_ssim = 0;
+        for (int c = 0; c != channels; ++ c)
+            comparison->mean_ssim += comparison->ssim[c] / channels;
+    }
+
+    return comparison;
+}
+
+/* interpolated within a bin, which spans less than 1% of its value */
+float image_comparison_percentile(Image_Comparison const * comparison, double fraction)
+{
+    uint64_t total = comparison->bin_total;
+
+    if (! total)
+        return NAN;
+
+    double rank = fraction * total;
+    if (rank < 0)
+        rank = 0;
+    if (rank > total - 0.5)
+        rank = total - 0.5;
+
+    uint64_t before = 0;
+    int bin = 0;
+    while (bin != COMPARE_BINS - 1 && before + comparison->bins[bin] <= rank)
+        before += comparison->bins[bin ++];
+
+    float value = bin_value(bin + (rank - before) / comparison->bins[bin]);
+    return value < comparison->max ? value : comparison->max;
+}
+
+void image_comparison_print(Image_Comparison const * comparison)
+{
+    printf("mse = %g, relative mse = %g, psnr = %g dB, rmse = %g, max error = %g\n",
+        comparison->mean_mse, comparison->mean_relative_mse, comparison->psnr, comparison->rmse, comparison->max);
+
+    printf("error percentiles: 50%% = %g, 90%% = %g, 99%% = %g, 99.9%% = %g\n",
+        image_comparison_percentile(comparison, 0.5), image_comparison_percentile(comparison, 0.9),
+        image_comparison_percentile(comparison, 0.99), image_comparison_percentile(comparison, 0.999));
+
+    if (! isnan(comparison->mean_ssim))
+        printf("ssim = %g\n", comparison->mean_ssim);
+
+    for (int c = 0; c != comparison->channels; ++ c)
+    {
+        uint64_t nonfinite = comparison->nonfinite[c];
+
+        printf("channel %d: mse = %g, relative mse = %g, max error = %g", c,
+            comparison->mse[c], comparison->relative_mse[c], comparison->max_error[c]);
+        if (! isnan(comparison->ssim[c]))
+            printf(", ssim = %g", comparison->ssim[c]);
+        if (nonfinite)
+            printf(", # non-finite = %s%" PRIu64 "%s", ANSI_BG_RED, nonfinite, ANSI_RESET);
+        printf("\n");
+    }
+}
+
+void image_comparison_destroy(Image_Comparison * comparison)
+{
+    if (! comparison)
+        return;
+
+    image_destroy(comparison->difference);
+    free(comparison->bins);
+    free(comparison);
+}
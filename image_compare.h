@@ -0,0 +1,40 @@
+#ifndef IMAGE_COMPARE_H
+#define IMAGE_COMPARE_H
+
+#include <stdint.h>
+
+#include "image.h"
+
+#define COMPARE_CHANNELS 4
+#define COMPARE_BINS (1 << 15)
+
+enum {COMPARE_DIFFERENCE = 1, COMPARE_SSIM = 2};
+
+/*
+ * Error metrics of an image against a reference, gathered in one pass.
+ * The images need the same size and format but may differ in type;
+ * samples are normalized like pixel_convert and every channel, alpha
+ * included, is compared. Pairs with a NaN or Inf on either side are
+ * counted apart and left out of the metrics.
+ */
+typedef struct
+{
+    int channels;
+    uint64_t count[COMPARE_CHANNELS], nonfinite[COMPARE_CHANNELS];
+    double mse[COMPARE_CHANNELS], relative_mse[COMPARE_CHANNELS];
+    float max_error[COMPARE_CHANNELS];
+    double ssim[COMPARE_CHANNELS];          /* NaN without COMPARE_SSIM */
+    double mean_mse, mean_relative_mse, psnr, rmse, mean_ssim;
+    float max;
+    uint64_t * bins;        /* absolute errors of all channels, by the upper half of their bits */
+    uint64_t bin_total;
+    Image * difference;     /* RGBA float, only with COMPARE_DIFFERENCE */
+}
+Image_Comparison;
+
+Image_Comparison * image_compare(Image const * image, Image const * reference, int flags);
+float              image_comparison_percentile(Image_Comparison const *, double fraction);
+void               image_comparison_print(Image_Comparison const *);
+void               image_comparison_destroy(Image_Comparison *);
+
+#endif
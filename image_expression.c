@@ -0,0 +1,363 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "image_expression.h"
+#include "memory.h"
+#include "parallel.h"
+#include "pixel_convert.h"
+
+#define TILE_PIXELS 256
+
+typedef struct
+{
+    Expression_Operator operator;
+    int slot;
+    Image const * image;
+    float value, weight_1, weight_2;
+}
+Instruction;
+
+/* postfix code over a stack of tile buffers, the result ends up in slot 0 */
+typedef struct
+{
+    Instruction * code;
+    int count, depth;
+    Image_Format format;
+    int channels, alpha;
+}
+Program;
+
+static Image_Expression * node(Expression_Operator operator, Image_Expression * operand_1, Image_Expression * operand_2)
+{
+    Image_Expression * expression = calloc_size(Image_Expression);
+    expression->operator = operator;
+    expression->operands[0] = operand_1;
+    expression->operands[1] = operand_2;
+
+    return expression;
+}
+
+Image_Expression * image_expression_image(Image const * image)
+{
+    Image_Expression * expression = node(EXPRESSION_IMAGE, NULL, NULL);
+    expression->image = image;
+
+    return expression;
+}
+
+Image_Expression * image_expression_constant(float value)
+{
+    Image_Expression * expression = node(EXPRESSION_CONSTANT, NULL, NULL);
+    expression->value = value;
+
+    return expression;
+}
+
+Image_Expression * image_expression_blend(Image_Expression * expression_1, float t1, Image_Expression * expression_2, float t2)
+{
+    Image_Expression * expression = node(EXPRESSION_BLEND, expression_1, expression_2);
+    expression->weight_1 = t1;
+    expression->weight_2 = t2;
+
+    return expression;
+}
+
+Image_Expression * image_expression_divide(Image_Expression * numerator, Image_Expression * denominator, float clamp_value)
+{
+    Image_Expression * expression = node(EXPRESSION_DIVIDE, numerator, denominator);
+    expression->value = clamp_value;
+
+    return expression;
+}
+
+Image_Expression * image_expression_scale(Image_Expression * operand, float scale)
+{
+    Image_Expression * expression = node(EXPRESSION_SCALE, operand, NULL);
+    expression->value = scale;
+
+    return expression;
+}
+
+Image_Expression * image_expression_square(Image_Expression * operand)    {return node(EXPRESSION_SQUARE, operand, NULL);}
+Image_Expression * image_expression_log(Image_Expression * operand)       {return node(EXPRESSION_LOG, operand, NULL);}
+Image_Expression * image_expression_clean_nan(Image_Expression * operand) {return node(EXPRESSION_CLEAN_NAN, operand, NULL);}
+
+void image_expression_destroy(Image_Expression * expression)
+{
+    if (! expression)
+        return;
+
+    image_expression_destroy(expression->operands[0]);
+    image_expression_destroy(expression->operands[1]);
+    free(expression);
+}
+
+static void leaf_format(Image_Expression const * expression, Image_Format * format, int * found)
+{
+    if (expression->operator == EXPRESSION_IMAGE)
+    {
+        Image_Format leaf = expression->image->format;
+
+        if (! * found)
+        {
+            * format = leaf;
+            * found = 1;
+        }
+
+        error_check(! size_equal(leaf.size, format->size), "expression images must have same size");
+        error_check(leaf.format != format->format, "expression images must have same format");
+        error_check(leaf.layout != IMAGE_INTERLEAVED, "expression images must be interleaved");
+    }
+
+    for (int i = 0; i != 2; ++ i)
+        if (expression->operands[i])
+            leaf_format(expression->operands[i], format, found);
+}
+
+Image_Format image_expression_format(Image_Expression const * expression)
+{
+    Image_Format format = {GL_FLOAT};
+    int found = 0;
+
+    leaf_format(expression, &format, &found);
+    error_check(! found, "expression needs at least one image");
+
+    Image_Format result = {GL_FLOAT, format.format, format.size};
+    return result;
+}
+
+static int count_nodes(Image_Expression const * expression)
+{
+    return expression ? 1 + count_nodes(expression->operands[0]) + count_nodes(expression->operands[1]) : 0;
+}
+
+static void emit(Program * program, Image_Expression const * expression, int slot)
+{
+    for (int i = 0; i != 2; ++ i)
+        if (expression->operands[i])
+            emit(program, expression->operands[i], slot + i);
+
+    Instruction instruction = {expression->operator, slot, expression->image, expression->value, expression->weight_1, expression->weight_2};
+    program->code[program->count ++] = instruction;
+
+    if (slot + 1 > program->depth)
+        program->depth = slot + 1;
+}
+
+static Program compile(Image_Expression const * expression)
+{
+    Program program = {NULL};
+
+    program.format = image_expression_format(expression);
+    program.channels = format_to_size(program.format.format);
+    program.alpha = program.format.format == GL_RGBA ? 3 : program.format.format == GL_LUMINANCE_ALPHA ? 1 : -1;
+    program.code = malloc_array(Instruction, count_nodes(expression));
+    emit(&program, expression, 0);
+
+    return program;
+}
+
+/* runs the program on count pixels from column x of one row; the result is opaque */
+static float const * run_tile(Program const * program, float * buffers, float const ** values, int layer, int row, int x, int count)
+{
+    int channels = program->channels;
+    int n = count * channels;
+
+    for (int k = 0; k != program->count; ++ k)
+    {
+        Instruction const * instruction = &program->code[k];
+        int s = instruction->slot;
+        float * target = buffers + (size_t) s * TILE_PIXELS * channels;
+        float const * a = values[s];
+        float const * b = values[s + 1];
+
+        switch (instruction->operator)
+        {
+            case EXPRESSION_IMAGE:
+            {
+                Image const * image = instruction->image;
+                GLenum type = image->format.type;
+                unsigned char const * pixels = (unsigned char const *) image_row(image, layer, row) + (size_t) x * channels * image_type_to_size(type);
+
+                if (type == GL_FLOAT)
+                {
+                    values[s] = (float const *) pixels;
+                    continue;
+                }
+
+                pixel_convert(pixels, type, target, GL_FLOAT, n);
+                break;
+            }
+
+            case EXPRESSION_CONSTANT:
+                for (int i = 0; i != n; ++ i) target[i] = instruction->value;
+                break;
+
+            case EXPRESSION_BLEND:
+            {
+                float t1 = instruction->weight_1, t2 = instruction->weight_2;
+                for (int i = 0; i != n; ++ i) target[i] = a[i] * t1 + b[i] * t2;
+                break;
+            }
+
+            case EXPRESSION_DIVIDE:
+            {
+                float clamp_value = instruction->value;
+                for (int i = 0; i != n; ++ i) target[i] = a[i] / (b[i] < clamp_value ? clamp_value : b[i]);
+                break;
+            }
+
+            case EXPRESSION_SCALE:
+            {
+                float scale = instruction->value;
+                for (int i = 0; i != n; ++ i) target[i] = a[i] * scale;
+                break;
+            }
+
+            case EXPRESSION_SQUARE:
+                for (int i = 0; i != n; ++ i) target[i] = a[i] * a[i];
+                break;
+
+            case EXPRESSION_LOG:
+                for (int i = 0; i != n; ++ i) target[i] = logf(a[i] + 0.0000001f);
+                break;
+
+            case EXPRESSION_CLEAN_NAN:
+                for (int i = 0; i != n; ++ i) target[i] = isnan(a[i]) ? 0 : a[i];
+                break;
+        }
+
+        values[s] = target;
+    }
+
+    if (program->alpha >= 0)
+    {
+        if (values[0] != buffers)
+            memcpy(buffers, values[0], n * sizeof(float));
+
+        for (int i = program->alpha; i < n; i += channels)
+            buffers[i] = 1;
+
+        values[0] = buffers;
+    }
+
+    return values[0];
+}
+
+typedef struct
+{
+    Program const * program;
+    Image * target;
+    double * sums;
+    int tiles_per_row;
+}
+Evaluate_Task;
+
+static void evaluate_tiles(void * context, int first, int last)
+{
+    Evaluate_Task * task = (Evaluate_Task *) context;
+    Program const * program = task->program;
+    Size size = program->format.size;
+    int channels = program->channels;
+
+    float * buffers = malloc_array(float, (size_t) program->depth * TILE_PIXELS * channels);
+    float const ** values = calloc_array(float const *, program->depth + 1);
+    double sums[4] = {0};
+
+    for (int t = first; t != last; ++ t)
+    {
+        int r = t / task->tiles_per_row;
+        int x = t % task->tiles_per_row * TILE_PIXELS;
+        int count = x + TILE_PIXELS < size.x ? TILE_PIXELS : size.x - x;
+        int layer = r / size.y, row = r % size.y;
+
+        float const * result = run_tile(program, buffers, values, layer, row, x, count);
+
+        if (task->target)
+            memmove((float *) image_row(task->target, layer, row) + (size_t) x * channels, result, (size_t) count * channels * sizeof(float));
+
+        if (task->sums)
+        {
+            double row_sums[4] = {0};
+
+            for (int i = 0; i != count; ++ i)
+            for (int c = 0; c != channels; ++ c)
+                row_sums[c] += result[i * channels + c];
+
+            for (int c = 0; c != channels; ++ c)
+                sums[c] += row_sums[c];
+        }
+    }
+
+    if (task->sums)
+    {
+        parallel_lock();
+        for (int c = 0; c != channels; ++ c)
+            task->sums[c] += sums[c];
+        parallel_unlock();
+    }
+
+    free(values);
+    free(buffers);
+}
+
+static void evaluate(Image_Expression const * expression, Image * target, double sums[])
+{
+    Program program = compile(expression);
+    Size size = program.format.size;
+
+    error_check(program.channels > 4, "expressions support up to four channels");
+    if (target)
+    {
+        error_check(target->format.type != GL_FLOAT, "expression target must have type float");
+        error_check(target->format.format != program.format.format, "expression target must have the format of its images");
+        error_check(! size_equal(target->format.size, size), "expression target must have the size of its images");
+        error_check(target->format.layout != IMAGE_INTERLEAVED, "expression target must be interleaved");
+    }
+
+    pixel_convert_isa();
+
+    Evaluate_Task task = {&program, target, sums, (size.x + TILE_PIXELS - 1) / TILE_PIXELS};
+    int tile_count = task.tiles_per_row * size.y * size.z;
+
+    if (sums)
+        for (int c = 0; c != program.channels; ++ c)
+            sums[c] = 0;
+
+    parallel_for(tile_count, sums ? parallel_reduction_grain(tile_count) : 1, evaluate_tiles, &task);
+
+    free(program.code);
+}
+
+/* the target may be one of the leaves, every tile is read before it is written */
+void image_expression_evaluate_into(Image_Expression const * expression, Image * target)
+{
+    evaluate(expression, target, NULL);
+}
+
+Image * image_expression_evaluate(Image_Expression const * expression)
+{
+    Image * target = image_new_uninitialized(image_expression_format(expression));
+    evaluate(expression, target, NULL);
+
+    return target;
+}
+
+/* one sum per channel, alpha included */
+void image_expression_sum(Image_Expression const * expression, double sums[])
+{
+    evaluate(expression, NULL, sums);
+}
+
+void image_expression_mean(Image_Expression const * expression, double means[])
+{
+    Image_Format format = image_expression_format(expression);
+    double count = (double) size_volume(format.size);
+
+    evaluate(expression, NULL, means);
+
+    for (int c = 0; c != format_to_size(format.format); ++ c)
+        means[c] = count ? means[c] / count : 0;
+}
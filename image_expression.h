@@ -0,0 +1,50 @@
+#ifndef IMAGE_EXPRESSION_H
+#define IMAGE_EXPRESSION_H
+
+#include "image.h"
+
+typedef enum
+{
+    EXPRESSION_IMAGE, EXPRESSION_CONSTANT,
+    EXPRESSION_BLEND, EXPRESSION_DIVIDE,
+    EXPRESSION_SCALE, EXPRESSION_SQUARE, EXPRESSION_LOG, EXPRESSION_CLEAN_NAN,
+}
+Expression_Operator;
+
+/*
+ * Element-wise image arithmetic, recorded instead of run. Evaluation
+ * walks the images once in small tiles, so a chain of operations needs
+ * neither temporaries nor more than one pass. Leaves may have any type
+ * pixel_convert reads but must share size and format. Alpha is not an
+ * operand: results are opaque, like those of image_blend. Every node owns
+ * its operands, so an image used twice needs two leaves.
+ */
+typedef struct Image_Expression
+{
+    Expression_Operator operator;
+    Image const * image;
+    float value, weight_1, weight_2;
+    struct Image_Expression * operands[2];
+}
+Image_Expression;
+
+Image_Expression * image_expression_image(Image const *);
+Image_Expression * image_expression_constant(float);
+Image_Expression * image_expression_blend(Image_Expression *, float t1, Image_Expression *, float t2);
+Image_Expression * image_expression_divide(Image_Expression *, Image_Expression *, float clamp_value);
+Image_Expression * image_expression_scale(Image_Expression *, float);
+Image_Expression * image_expression_square(Image_Expression *);
+Image_Expression * image_expression_log(Image_Expression *);
+Image_Expression * image_expression_clean_nan(Image_Expression *);
+void               image_expression_destroy(Image_Expression *);
+
+#define image_expression_subtract(e_1, e_2) image_expression_blend((e_1), 1, (e_2), -1)
+#define image_expression_add(e_1, e_2)      image_expression_blend((e_1), 1, (e_2), 1)
+
+Image_Format image_expression_format(Image_Expression const *);
+void    image_expression_evaluate_into(Image_Expression const *, Image * target);
+Image * image_expression_evaluate(Image_Expression const *);
+void    image_expression_sum(Image_Expression const *, double sums[]);
+void    image_expression_mean(Image_Expression const *, double means[]);
+
+#endif
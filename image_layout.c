@@ -0,0 +1,126 @@
+#include <string.h>
+
+#include "error.h"
+#include "image_layout.h"
+#include "parallel.h"
+
+/* each sample moves between its pixel and its plane */
+static inline void shuffle(unsigned char * const planes[], unsigned char * pixels, int channels, int size, int count, int to_planar)
+{
+    for (int i = 0; i != count; ++ i)
+    for (int c = 0; c != channels; ++ c)
+    {
+        unsigned char * sample = &pixels[((size_t) i * channels + c) * size];
+        unsigned char * plane = &planes[c][(size_t) i * size];
+
+        if (to_planar)
+            memcpy(plane, sample, size);
+        else
+            memcpy(sample, plane, size);
+    }
+}
+
+static inline void shuffle_sizes(unsigned char * const planes[], unsigned char * pixels, int channels, int size, int count, int to_planar)
+{
+    switch (size)
+    {
+        case 1:  shuffle(planes, pixels, channels, 1, count, to_planar); break;
+        case 2:  shuffle(planes, pixels, channels, 2, count, to_planar); break;
+        case 4:  shuffle(planes, pixels, channels, 4, count, to_planar); break;
+        default: shuffle(planes, pixels, channels, size, count, to_planar); break;
+    }
+}
+
+/* constant channel counts and sample sizes let the compiler turn the loops into vector shuffles */
+static inline void shuffle_row(unsigned char * const planes[], unsigned char * pixels, int channels, int size, int count, int to_planar)
+{
+    switch (channels)
+    {
+        case 2:  shuffle_sizes(planes, pixels, 2, size, count, to_planar); break;
+        case 3:  shuffle_sizes(planes, pixels, 3, size, count, to_planar); break;
+        case 4:  shuffle_sizes(planes, pixels, 4, size, count, to_planar); break;
+        default: shuffle(planes, pixels, channels, size, count, to_planar); break;
+    }
+}
+
+typedef struct
+{
+    Image const * source;
+    Image * target;
+}
+Layout_Task;
+
+/* runs of pixels contiguous in both images: whole rows, or the part of a row inside one tile */
+static void convert_rows(void * context, int first, int last)
+{
+    Layout_Task const * task = (Layout_Task const *) context;
+    Image const * source = task->source;
+    Image * target = task->target;
+    Image_Format format = source->format;
+    int channels = format_to_size(format.format);
+    int size = image_type_to_size(format.type);
+    int source_planar = format.layout == IMAGE_PLANAR;
+    int target_planar = target->format.layout == IMAGE_PLANAR;
+    int tiled = format.layout == IMAGE_TILED || target->format.layout == IMAGE_TILED;
+    int run = tiled ? IMAGE_TILE : format.size.x;
+    size_t source_channel_stride = image_format_channel_stride(format);
+    size_t target_channel_stride = image_format_channel_stride(target->format);
+    unsigned char * planes[16];
+
+    for (int r = first; r != last; ++ r)
+    for (int x = 0; x < format.size.x; x += run)
+    {
+        int z = r / format.size.y, y = r % format.size.y;
+        int count = x + run < format.size.x ? run : format.size.x - x;
+        unsigned char const * from = (unsigned char const *) image_pixel(source, z, y, x);
+        unsigned char * to = (unsigned char *) image_pixel(target, z, y, x);
+
+        if (source_planar && target_planar)
+        {
+            for (int c = 0; c != channels; ++ c)
+                memcpy(to + c * target_channel_stride, from + c * source_channel_stride, (size_t) count * size);
+        }
+        else if (! source_planar && ! target_planar)
+            memcpy(to, from, (size_t) count * channels * size);
+        else if (target_planar)
+        {
+            for (int c = 0; c != channels; ++ c)
+                planes[c] = to + c * target_channel_stride;
+
+            shuffle_row(planes, (unsigned char *) from, channels, size, count, 1);
+        }
+        else
+        {
+            for (int c = 0; c != channels; ++ c)
+                planes[c] = (unsigned char *) from + c * source_channel_stride;
+
+            shuffle_row(planes, to, channels, size, count, 0);
+        }
+    }
+}
+
+void image_layout_convert_into(Image const * source, Image * target)
+{
+    Image_Format format = source->format;
+
+    error_check(format.type != target->format.type, "layout conversion needs same type");
+    error_check(format.format != target->format.format, "layout conversion needs same format");
+    error_check(! size_equal(format.size, target->format.size), "layout conversion needs same size");
+    error_check(format_to_size(format.format) > 16, "too many channels for layout conversion");
+
+    Layout_Task task = {source, target};
+    int row_count = format.size.y * format.size.z;
+
+    parallel_for(row_count, 16, convert_rows, &task);
+}
+
+Image * image_to_layout(Image const * image, Image_Layout layout)
+{
+    Image_Format format = image->format;
+    format.layout = layout;
+
+    Image * target = image_new_uninitialized(format);
+    image_layout_convert_into(image, target);
+
+    return target;
+}
@@ -0,0 +1,16 @@
+#ifndef IMAGE_LAYOUT_H
+#define IMAGE_LAYOUT_H
+
+#include "image.h"
+
+/*
+ * Moves pixels between the interleaved, planar and tiled layouts. Source
+ * and target need the same type, format and size; their row strides may
+ * differ. Most kernels expect interleaved images, planar ones suit per
+ * channel passes and loaders that store channel by channel, tiled ones
+ * keep neighbourhoods of very large images together.
+ */
+void    image_layout_convert_into(Image const * source, Image * target);
+Image * image_to_layout(Image const *, Image_Layout);
+
+#endif
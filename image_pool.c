@@ -0,0 +1,235 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image_pool.h"
+
+#define LOCK(mutex)   pthread_mutex_lock(&mutex)
+#define UNLOCK(mutex) pthread_mutex_unlock(&mutex)
+
+/* smaller blocks are left to malloc */
+#define MIN_BYTES   (64 * 1024)
+#define MAX_ENTRIES (32)
+
+typedef struct {void * block; size_t bytes; unsigned long stamp;} Entry;
+typedef struct {void * block; Image_Pool_Release release; void * context;} Foreign;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static Entry entries[MAX_ENTRIES];
+static int count;
+static unsigned long stamp;
+static Image_Pool_Statistics statistics = {0, 0, 0, 0, 0, 0, 256 * 1024 * 1024, 0};
+static Foreign * foreign;
+static int foreign_count, foreign_capacity;
+
+/* most recently released block of exactly that size, still warm in the cache */
+static void * take(size_t bytes, size_t alignment)
+{
+    int best = -1;
+
+    for (int i = 0; i != count; ++ i)
+    {
+        if (entries[i].bytes != bytes || (uintptr_t) entries[i].block % alignment != 0)
+            continue;
+
+        if (best < 0 || entries[i].stamp > entries[best].stamp)
+            best = i;
+    }
+
+    if (best < 0)
+        return NULL;
+
+    void * block = entries[best].block;
+
+    statistics.cached_bytes -= bytes;
+    entries[best] = entries[-- count];
+
+    return block;
+}
+
+static void evict_oldest(void)
+{
+    int oldest = 0;
+
+    for (int i = 1; i != count; ++ i)
+    {
+        if (entries[i].stamp < entries[oldest].stamp)
+            oldest = i;
+    }
+
+    free(entries[oldest].block);
+
+    statistics.cached_bytes -= entries[oldest].bytes;
+    ++ statistics.evictions;
+    entries[oldest] = entries[-- count];
+}
+
+void * image_pool_malloc(size_t bytes)
+{
+    if (bytes < MIN_BYTES)
+        return malloc(bytes);
+
+    LOCK(mutex);
+    void * block = take(bytes, 1);
+    block ? ++ statistics.hits : ++ statistics.misses;
+    UNLOCK(mutex);
+
+    return block ? block : malloc(bytes);
+}
+
+/* alignment must be a power of two multiple of sizeof(void *) */
+void * image_pool_malloc_aligned(size_t bytes, size_t alignment)
+{
+    void * block = NULL;
+
+    if (bytes >= MIN_BYTES)
+    {
+        LOCK(mutex);
+        block = take(bytes, alignment);
+        block ? ++ statistics.hits : ++ statistics.misses;
+        UNLOCK(mutex);
+    }
+
+    if (! block && posix_memalign(&block, alignment, bytes) != 0)
+        return NULL;
+
+    return block;
+}
+
+void * image_pool_calloc(size_t bytes)
+{
+    if (bytes < MIN_BYTES)
+        return calloc(1, bytes);
+
+    LOCK(mutex);
+    void * block = take(bytes, 1);
+    block ? ++ statistics.hits : ++ statistics.misses;
+    UNLOCK(mutex);
+
+    /* fresh calloc memory is zeroed lazily by the system */
+    if (! block)
+        return calloc(1, bytes);
+
+    memset(block, 0, bytes);
+    return block;
+}
+
+void image_pool_adopt(void * block, Image_Pool_Release release, void * context)
+{
+    LOCK(mutex);
+
+    if (foreign_count == foreign_capacity)
+    {
+        foreign_capacity = foreign_capacity ? 2 * foreign_capacity : 16;
+        foreign = (Foreign *) realloc(foreign, foreign_capacity * sizeof(Foreign));
+    }
+
+    foreign[foreign_count].block = block;
+    foreign[foreign_count].release = release;
+    foreign[foreign_count].context = context;
+    ++ foreign_count;
+
+    UNLOCK(mutex);
+}
+
+/* adopted blocks go back to their owner, the mutex is held */
+static int release_foreign(void * block)
+{
+    for (int i = 0; i != foreign_count; ++ i)
+    {
+        if (foreign[i].block != block)
+            continue;
+
+        Foreign entry = foreign[i];
+        foreign[i] = foreign[-- foreign_count];
+
+        UNLOCK(mutex);
+        entry.release(entry.context);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* bytes must not exceed the size of the block */
+void image_pool_free(void * block, size_t bytes)
+{
+    if (! block)
+        return;
+
+    LOCK(mutex);
+
+    if (release_foreign(block))
+        return;
+
+    if (bytes < MIN_BYTES)
+    {
+        UNLOCK(mutex);
+        free(block);
+        return;
+    }
+
+    if (bytes > statistics.limit)
+    {
+        UNLOCK(mutex);
+        free(block);
+        return;
+    }
+
+    while (count == MAX_ENTRIES || statistics.cached_bytes + bytes > statistics.limit)
+        evict_oldest();
+
+    entries[count].block = block;
+    entries[count].bytes = bytes;
+    entries[count].stamp = ++ stamp;
+    ++ count;
+
+    ++ statistics.releases;
+    statistics.cached_bytes += bytes;
+    if (statistics.cached_bytes > statistics.peak_bytes)
+        statistics.peak_bytes = statistics.cached_bytes;
+
+    UNLOCK(mutex);
+}
+
+void image_pool_set_limit(size_t bytes)
+{
+    LOCK(mutex);
+
+    statistics.limit = bytes;
+    while (count != 0 && statistics.cached_bytes > statistics.limit)
+        evict_oldest();
+
+    UNLOCK(mutex);
+}
+
+void image_pool_trim(void)
+{
+    LOCK(mutex);
+
+    while (count != 0)
+        evict_oldest();
+
+    UNLOCK(mutex);
+}
+
+Image_Pool_Statistics image_pool_statistics(void)
+{
+    LOCK(mutex);
+    Image_Pool_Statistics result = statistics;
+    result.cached_count = count;
+    UNLOCK(mutex);
+
+    return result;
+}
+
+void image_pool_print(void)
+{
+    Image_Pool_Statistics s = image_pool_statistics();
+
+    printf("image pool: %lu hits, %lu misses, %lu releases, %lu evictions, %d blocks, %.1f MB cached (peak %.1f MB, limit %.1f MB)\n",
+        s.hits, s.misses, s.releases, s.evictions, s.cached_count,
+        s.cached_bytes / 1048576.0, s.peak_bytes / 1048576.0, s.limit / 1048576.0);
+}
@@ -0,0 +1,28 @@
+#ifndef IMAGE_POOL_H
+#define IMAGE_POOL_H
+
+#include <stddef.h>
+
+typedef struct
+{
+    unsigned long hits, misses, releases, evictions;
+    size_t cached_bytes, peak_bytes, limit;
+    int cached_count;
+}
+Image_Pool_Statistics;
+
+/* blocks owned elsewhere, such as file mappings, go back through release instead of into the pool */
+typedef void (* Image_Pool_Release)(void * context);
+
+void * image_pool_malloc(size_t bytes);
+void * image_pool_calloc(size_t bytes);
+void * image_pool_malloc_aligned(size_t bytes, size_t alignment);
+void   image_pool_free(void *, size_t bytes);
+void   image_pool_adopt(void *, Image_Pool_Release, void * context);
+void   image_pool_set_limit(size_t bytes);
+void   image_pool_trim(void);
+
+Image_Pool_Statistics image_pool_statistics(void);
+void image_pool_print(void);
+
+#endif
@@ -2,15 +2,24 @@
 #include <float.h>
 #include <stdio.h>
 
+#include "area_table.h"
+#include "convolve.h"
 #include "error.h"
 #include "half.h"
+#include "histogram.h"
+#include "image_expression.h"
+#include "image_pool.h"
 #include "image_process.h"
 #include "kernel.h"
 #include "math_.h"
+#include "median.h"
 #include "memory.h"
+#include "parallel.h"
+#include "pixel_convert.h"
 //#include "perlin.h"
 #include "print.h"
 #include "size.h"
+#include "ssim.h"
 #include "utils.h"
 
 #if 1
@@ -39,6 +48,12 @@
 }
 #endif
 
+/* for the kernels that walk the pixels of each row in turn */
+static void check_interleaved(Image const * image)
+{
+    error_check(image->format.layout != IMAGE_INTERLEAVED, "image must be interleaved");
+}
+
 static int extraction_index(GLenum format, GLenum component)
 {
     switch (component)
@@ -79,6 +94,48 @@ static int extraction_index(GLenum format, GLenum component)
     return -1;
 }
 
+typedef struct {Image const * image; Image * new_image;} Retype_Task;
+
+static void retype_rows(void * context, int first, int last)
+{
+    Retype_Task const * task = (Retype_Task const *) context;
+    Image_Format format = task->image->format;
+    int count = format_to_size(format.format) * format.size.x;
+
+    for (int r = first; r != last; ++ r)
+    {
+        int i = r / format.size.y;
+        int j = r % format.size.y;
+
+        pixel_convert(image_row(task->image, i, j), format.type, image_row(task->new_image, i, j), task->new_image->format.type, count);
+    }
+}
+
+/* packed images convert as one stream, padded ones row by row */
+void image_retype_into(Image const * image, Image * new_image)
+{
+    Image_Format format = image->format;
+    Image_Format new_format = new_image->format;
+
+    error_check(format.format != new_format.format, "images must have same format");
+    error_check(! size_equal(format.size, new_format.size), "images must have same size");
+
+    int count = format_to_size(format.format) * format.size.x;
+    int row_count = format.size.y * format.size.z;
+
+    if (image_format_row_bytes(format)     == count * image_type_to_size(format.type) &&
+        image_format_row_bytes(new_format) == count * image_type_to_size(new_format.type))
+    {
+        pixel_convert_chunked(image->pixels, format.type, new_image->pixels, new_format.type, count * row_count);
+        return;
+    }
+
+    Retype_Task task = {image, new_image};
+
+    pixel_convert_isa();
+    parallel_for(row_count, 1, retype_rows, &task);
+}
+
 Image * image_retype(Image const * image, GLenum target_type)
 {
     Image_Format format = image->format;
@@ -87,181 +144,8 @@ Image * image_retype(Image const * image, GLenum target_type)
     
     Image_Format new_format = format;
     new_format.type = target_type;
-    Image * new_image = image_new(new_format);
-    
-    int count = format_to_size(format.format) * size_total(format.size);
-    int i;
-
-    // TODO: convert to double as intermediate
-    
-    switch (format.type)
-    {
-        case GL_UNSIGNED_BYTE:
-        {
-            unsigned char const * source = (unsigned char const *) image->pixels;
-            switch (target_type)
-            {
-                case GL_UNSIGNED_SHORT:
-                {
-                    unsigned short * target = (unsigned short *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = source[i] << 8;
-                }
-                break;
-                    
-                case GL_FLOAT:
-                {
-                    float * target = (float *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = source[i] / 255.0;
-                }
-                break;
-                    
-                case GL_DOUBLE:
-                {
-                    double * target = (double *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = source[i] / 255.0;
-                }
-                break;
-            }
-        }
-        break;
-            
-        case GL_UNSIGNED_SHORT:
-        {
-            unsigned short const * source = (unsigned short const *) image->pixels;
-            switch (target_type)
-            {
-                case GL_UNSIGNED_BYTE:
-                {
-                    unsigned char * target = (unsigned char *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = source[i] >> 8;
-                }
-                break;
-                    
-                case GL_FLOAT:
-                {
-                    float * target = (float *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = source[i] / 65535.0;
-                }
-                break;
-                    
-                case GL_DOUBLE:
-                {
-                    double * target = (double *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = source[i] / 65535.0;
-                }
-                break;
-            }
-        }
-        break;
-
-        case GL_HALF_FLOAT_ARB:
-        {
-            unsigned short const * source = (unsigned short const *) image->pixels;
-            switch (target_type)
-            {
-                case GL_UNSIGNED_BYTE:
-                {
-                    unsigned char * target = (unsigned char *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = clamp(half_to_float(source[i])) * 255.0;
-                }
-                break;
-                    
-                case GL_UNSIGNED_SHORT:
-                {
-                    unsigned short * target = (unsigned short *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = clamp(half_to_float(source[i])) * 65535.0;
-                }
-                break;
-                    
-                case GL_FLOAT:
-                {
-                    float * target = (float *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = half_to_float(source[i]);
-                }
-                break;
-                    
-                case GL_DOUBLE:
-                {
-                    double * target = (double *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = half_to_float(source[i]);
-                }
-                break;
-            }
-        }
-        break;
-            
-        case GL_FLOAT:
-        {
-            float const * source = (float const *) image->pixels;
-            switch (target_type)
-            {
-                case GL_UNSIGNED_BYTE:
-                {
-                    unsigned char * target = (unsigned char *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = clamp(source[i]) * 255.0;
-                }
-                    break;
-                    
-                case GL_UNSIGNED_SHORT:
-                {
-                    unsigned short * target = (unsigned short *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = clamp(source[i]) * 65535.0;
-                }
-                    break;
-                    
-                case GL_HALF_FLOAT_ARB:
-                {
-                    unsigned short * target = (unsigned short *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = half_from_float(source[i]);
-                }
-                    break;
-                    
-                case GL_DOUBLE:
-                {
-                    double * target = (double *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = source[i];
-                }
-                    break;
-            }
-        }
-        break;
-            
-        case GL_DOUBLE:
-        {
-            double const * source = (double const *) image->pixels;
-            switch (target_type)
-            {
-                case GL_UNSIGNED_BYTE:
-                {
-                    unsigned char * target = (unsigned char *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = source[i] * 255.0; // TODO dclamp
-                }
-                    break;
-                    
-                case GL_UNSIGNED_SHORT:
-                {
-                    unsigned short * target = (unsigned short *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = source[i] * 65535.0;
-                }
-                    break;
-                    
-                case GL_HALF_FLOAT_ARB:
-                {
-                    unsigned short * target = (unsigned short *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = half_from_float(source[i]);
-                }
-                    break;
-                    
-                case GL_FLOAT:
-                {
-                    float * target = (float *) new_image->pixels;
-                    for (i = 0; i < count; ++ i) target[i] = source[i];
-                }
-                    break;
-            }
-        }
-            break;
-    }
+    Image * new_image = image_new_uninitialized(new_format);
+    image_retype_into(image, new_image);
     
     return new_image;
 }
@@ -277,8 +161,9 @@ Image * image_reformat(Image const * image)
     format.type = GL_FLOAT;
     format.format = GL_RGBA;
 
-    Image * image3 = image_new(format);
+    Image * image3 = image_new_uninitialized(format);
     image_add_alpha(image2, image3);
+    image_destroy(image2);
 
     return image3;
 }
@@ -288,46 +173,54 @@ Image * image_reformat(Image const * image)
 
 Image * image_rgb_to_gray(Image const * source)
 {
+    check_interleaved(source);
+
     Image_Format source_format = source->format;
 
     error_check(source_format.format != GL_RGB && source_format.format != GL_RGBA, "format must be RGB or RGBA");
     error_check(source_format.type != GL_FLOAT, "type must be float");
 
-    int pixel_count = image_format_pixels(source_format);
+    Size size = source_format.size;
 
     Image_Format target_format = source_format;
     target_format.format = source_format.format == GL_RGB ? GL_LUMINANCE : GL_LUMINANCE_ALPHA;
+    target_format.row_stride = 0;
 
-    Image * target        = image_new(target_format);
-    float * target_pixels = target->pixels;
+    Image * target = image_new(target_format);
 
-    switch (source_format.format)
+    for (int i = 0; i != size.z; ++ i)
+    for (int j = 0; j != size.y; ++ j)
     {
-        case GL_RGB:
-            {
-                Color const * source_pixels = source->pixels;
+        float * target_pixels = (float *) image_row(target, i, j);
 
-                for (int i = 0; i != pixel_count; ++ i)
+        switch (source_format.format)
+        {
+            case GL_RGB:
                 {
-                    Color c = source_pixels[i];
-                    target_pixels[i] = color_to_luminance(c);
-                }
+                    Color const * source_pixels = (Color const *) image_row(source, i, j);
 
-            }
-            break;
+                    for (int k = 0; k != size.x; ++ k)
+                    {
+                        Color c = source_pixels[k];
+                        target_pixels[k] = color_to_luminance(c);
+                    }
 
-        case GL_RGBA:
-            {
-                Color4 const * source_pixels = source->pixels;
+                }
+                break;
 
-                for (int i = 0; i != pixel_count; ++ i)
+            case GL_RGBA:
                 {
-                    Color4 c = source_pixels[i];
-                    target_pixels[2 * i + 0] = color_to_luminance(c.c);
-                    target_pixels[2 * i + 1] = c.a;
+                    Color4 const * source_pixels = (Color4 const *) image_row(source, i, j);
+
+                    for (int k = 0; k != size.x; ++ k)
+                    {
+                        Color4 c = source_pixels[k];
+                        target_pixels[2 * k + 0] = color_to_luminance(c.c);
+                        target_pixels[2 * k + 1] = c.a;
+                    }
                 }
-            }
-            break;
+                break;
+        }
     }
 
     return target;
@@ -335,54 +228,60 @@ Image * image_rgb_to_gray(Image const * source)
 
 Image * image_extract(Image const * image, GLenum target_format, GLenum source_component, GLenum target_component)
 {
+    check_interleaved(image);
+
     Image_Format format = image->format;
+    Size size = format.size;
     
     int source_components = format_to_size(format.format);
     int target_components = format_to_size(target_format);
     int source_index = extraction_index(format.format, source_component);
     int target_index = extraction_index(target_format, target_component);
-    int count = size_total(format.size);
+    int count = size.x;
     
     error_check(source_index == -1, "illegal source component");
     error_check(target_index == -1, "illegal target component");
     
     Image_Format new_format = format;
     new_format.format = target_format;
+    new_format.row_stride = 0;
     Image * new_image = image_new(new_format);
     image_clear(new_image);
     
     //process(format.type, image->pixels, new_image->pixels, source_components, target_components, swizzle, count);
     
+    for (int i = 0; i != size.z; ++ i)
+    for (int j = 0; j != size.y; ++ j)
     switch (image_type_to_size(format.type))
     {
         case 1:
         {
-            unsigned char const * source = (unsigned char const *) image->pixels;
-            unsigned char * target = (unsigned char *) new_image->pixels;
+            unsigned char const * source = (unsigned char const *) image_row(image, i, j);
+            unsigned char * target = (unsigned char *) image_row(new_image, i, j);
             extract(source, target, source_components, target_components, source_index, target_index, count);
         }
             break;
             
         case 2:
         {
-            short const * source = (short const *) image->pixels;
-            short * target = (short *) new_image->pixels;
+            short const * source = (short const *) image_row(image, i, j);
+            short * target = (short *) image_row(new_image, i, j);
             extract(source, target, source_components, target_components, source_index, target_index, count);
         }
             break;
             
         case 4:
         {
-            float const * source = (float const *) image->pixels;
-            float * target = (float *) new_image->pixels;
+            float const * source = (float const *) image_row(image, i, j);
+            float * target = (float *) image_row(new_image, i, j);
             extract(source, target, source_components, target_components, source_index, target_index, count);
         }
             break;
             
         case 8:
         {
-            double const * source = (double const *) image->pixels;
-            double * target = (double *) new_image->pixels;
+            double const * source = (double const *) image_row(image, i, j);
+            double * target = (double *) image_row(new_image, i, j);
             extract(source, target, source_components, target_components, source_index, target_index, count);
         }
             break;
@@ -472,22 +371,36 @@ mponents, swizzle2, count);
 
 void image_convert(Image * image, Image_Format target_format)
 {
+    check_interleaved(image);
+
     // TODO all other formats
     // assume ubyte to float
 
-    int const pixel_count = size_total(image->format.size);
-    unsigned char * source = (unsigned char *) image->pixels;
-    float * target = malloc_array(float, pixel_count);
+    Image_Format source_format = image->format;
+    Image_Format format = source_format;
+    format.type = target_format.type; // XXX replace all
+    format.row_stride = 0;
+
+    Size size = format.size;
+    int const count = size.x * format_to_size(format.format);
+    unsigned char * pixels = (unsigned char *) image->pixels;
+    float * target = (float *) image_pool_malloc(image_format_bytes(format));
+    float * target_pixels = target;
 
-    for (int i = 0; i != pixel_count; ++ i)
+    for (int i = 0; i != size.z; ++ i)
+    for (int j = 0; j != size.y; ++ j)
     {
-        target[i] = source[i] / 255.0;
+        unsigned char const * source = (unsigned char const *) image_row(image, i, j);
+
+        for (int k = 0; k != count; ++ k)
+        {
+            * target_pixels ++ = source[k] / 255.0;
+        }
     }
 
     image->pixels = target;
-    free(source);
-
-    image->format.type = target_format.type; // XXX replace all
+    image->format = format;
+    image_pool_free(pixels, image_format_bytes(source_format));
 }
 
 void image_add_alpha(Image const * source, Image * target)
@@ -498,18 +411,21 @@ void image_add_alpha(Image const * source, Image * target)
     error_check(target->format.format != GL_RGBA, "target format must be rgba");
     error_check(!size_equal(source->format.size, target->format.size), "source and target size must be equal");
 
-    float const * source_pixels = (float const *) source->pixels;
-    float * target_pixels = (float *) target->pixels;
     Size size = source->format.size;
 
     for (int i = 0; i != size.z; ++ i)
     for (int j = 0; j != size.y; ++ j)
-    for (int k = 0; k != size.x; ++ k)
     {
-        * target_pixels ++ = * source_pixels ++;
-        * target_pixels ++ = * source_pixels ++;
-        * target_pixels ++ = * source_pixels ++;
-        * target_pixels ++ = 1;
+        float const * source_pixels = (float const *) image_row(source, i, j);
+        float * target_pixels = (float *) image_row(target, i, j);
+
+        for (int k = 0; k != size.x; ++ k)
+        {
+            * target_pixels ++ = * source_pixels ++;
+            * target_pixels ++ = * source_pixels ++;
+            * target_pixels ++ = * source_pixels ++;
+            * target_pixels ++ = 1;
+        }
     }
 }
 
@@ -521,30 +437,31 @@ void image_remove_alpha(Image const * source, Image * target)
 //    error_check(target->format.format != GL_RGB, "target format must be rgb");
     error_check(!size_equal(source->format.size, target->format.size), "source and target size must be equal");
 
-    float const * source_pixels = (float const *) source->pixels;
-    float * target_pixels = (float *) target->pixels;
     Size size = source->format.size;
 
-    if (source->format.format == GL_RGBA)
+    for (int i = 0; i != size.z; ++ i)
+    for (int j = 0; j != size.y; ++ j)
     {
-        for (int i = 0; i != size.z; ++ i)
-        for (int j = 0; j != size.y; ++ j)
-        for (int k = 0; k != size.x; ++ k)
+        float const * source_pixels = (float const *) image_row(source, i, j);
+        float * target_pixels = (float *) image_row(target, i, j);
+
+        if (source->format.format == GL_RGBA)
         {
-            * target_pixels ++ = * source_pixels ++;
-            * target_pixels ++ = * source_pixels ++;
-            * target_pixels ++ = * source_pixels ++;
-            source_pixels ++;
+            for (int k = 0; k != size.x; ++ k)
+            {
+                * target_pixels ++ = * source_pixels ++;
+                * target_pixels ++ = * source_pixels ++;
+                * target_pixels ++ = * source_pixels ++;
+                source_pixels ++;
+            }
         }
-    }
-    else if (source->format.format == GL_LUMINANCE_ALPHA)
-    {
-        for (int i = 0; i != size.z; ++ i)
-        for (int j = 0; j != size.y; ++ j)
-        for (int k = 0; k != size.x; ++ k)
+        else if (source->format.format == GL_LUMINANCE_ALPHA)
         {
-            * target_pixels ++ = * source_pixels ++;
-            source_pixels ++;
+            for (int k = 0; k != size.x; ++ k)
+            {
+                * target_pixels ++ = * source_pixels ++;
+                source_pixels ++;
+            }
         }
     }
 }
@@ -768,7 +685,8 @@ float image_sample_2D(Image const * image, Vector position)
     error_check(image->format.format != GL_LUMINANCE, "bad format");
 
     Size size = image->format.size;
-    Size d = size_stride(size);
+    Size storage = image_format_storage(image->format);
+    Size d = size_stride(storage);
 
     float x = position.x * size.x;
     float y = position.y * size.y;
@@ -782,7 +700,7 @@ float image_sample_2D(Image const * image, Vector position)
     float u = x - j;
     float v = y - i;
 
-    int index = size_index(size, 0, i, j);
+    int index = size_index(storage, 0, i, j);
 
     float const * pixels = (float *) image->pixels;
     float const values[2][2] =
@@ -794,9 +712,21 @@ float image_sample_2D(Image const * image, Vector position)
     return interpolate_bilinear(values, u, v);
 }
 
-int image_sample_position(Image const * image, int j, int i, Size size, Size d, Border border, int samples[4])
+/* in pixels from the first one; tiled images count whole tiles before the one holding the pixel */
+static size_t pixel_index(Image const * image, Size d, int i, int j)
 {
-    int dj, di;
+    if (image->format.layout != IMAGE_TILED)
+        return (size_t) i * d.y + (size_t) j * d.x;
+
+    size_t tiles_x = image_format_tiles(image->format).x;
+    size_t tile = i / IMAGE_TILE * tiles_x + j / IMAGE_TILE;
+
+    return (tile * IMAGE_TILE + i % IMAGE_TILE) * IMAGE_TILE + j % IMAGE_TILE;
+}
+
+int image_sample_position(Image const * image, int j, int i, Size size, Size d, Border border, size_t samples[4])
+{
+    int j1, i1;
 
     switch (border)
     {
@@ -807,11 +737,11 @@ int image_sample_position(Image const * image, int j, int i, Size size, Size d,
             if (j < 0) j = 0;
             if (i < 0) i = 0;
 
-            if (j >= size.x - 1) {j = size.x - 1; dj = 0;}
-            else dj = d.x;
+            if (j >= size.x - 1) j = j1 = size.x - 1;
+            else j1 = j + 1;
 
-            if (i >= size.y - 1) {i = size.y - 1; di = 0;}
-            else di = d.y;
+            if (i >= size.y - 1) i = i1 = size.y - 1;
+            else i1 = i + 1;
 
             break;
 
@@ -826,18 +756,16 @@ int image_sample_position(Image const * image, int j, int i, Size size, Size d,
             assert(j >= 0 && j < size.x);
             assert(i >= 0 && i < size.y);
 
-            dj = (j == size.x - 1) ? -j : d.x;
-            di = (i == size.y - 1) ? (-i * d.y) : d.y;
+            j1 = (j == size.x - 1) ? 0 : j + 1;
+            i1 = (i == size.y - 1) ? 0 : i + 1;
 
             break;
     }
 
-    int index = size_index(size, 0, i, j);
-
-    samples[0] = index;
-    samples[1] = index      + dj;
-    samples[2] = index + di;
-    samples[3] = index + di + dj;
+    samples[0] = pixel_index(image, d, i,  j);
+    samples[1] = pixel_index(image, d, i,  j1);
+    samples[2] = pixel_index(image, d, i1, j);
+    samples[3] = pixel_index(image, d, i1, j1);
 
     return 1;
 }
@@ -848,7 +776,8 @@ Color4 image_sample_color4_2D(Image const * image, Vector position, Border borde
     error_check(image->format.format != GL_RGBA,  "bad format");
 
     Size size = image->format.size;
-    Size d = size_stride(size);
+    Size storage = image_format_storage(image->format);
+    Size d = size_stride(storage);
 
     float x = position.x * size.x;
     float y = position.y * size.y;
@@ -859,7 +788,7 @@ Color4 image_sample_color4_2D(Image const * image, Vector position, Border borde
     float u = x - j;
     float v = y - i;
 
-    int samples[4];
+    size_t samples[4];
     if (! image_sample_position(image, j, i, size, d, border, samples))
     {
         Color4 black = {BLACK, 1};
@@ -877,42 +806,26 @@ Color4 image_sample_color4_2D(Image const * image, Vector position, Border borde
 }
 
 #if 1
-static int index_of_sample(Image const * image, Vector position, Border border)
+/* the pixel under a position, or 0 outside of a black border */
+static int sample_coordinates(Size size, Vector position, Border border, int * k_, int * i_, int * j_)
 {
-    Size size = image->format.size;
-    Size d = size_stride(size);
-
-    float x = position.x;
-    float y = position.y;
-    float z = position.z;
-//    float x = position.x * size.x;
-//    float y = position.y * size.y;
-
-    int j = floor(x);
-    int i = floor(y);
-    int k = floor(z);
-
-//    float u = x - j;
-//    float v = y - i;
-
-    int dj, di;
+    int j = floor(position.x);
+    int i = floor(position.y);
+    int k = floor(position.z);
 
     switch (border)
     {
-        case BORDER_BLACK: //return -1;
-            if (i < 0 || i >= size.y  || j < 0 || j >= size.x)
-                return -1;
+        case BORDER_BLACK:
+            if (i < 0 || i >= size.y  || j < 0 || j >= size.x || k < 0 || k >= size.z)
+                return 0;
             break;
 
         case BORDER_CLAMP:
             if (j < 0) j = 0;
             if (i < 0) i = 0;
 
-            if (j >= size.x - 1) {j = size.x - 1; dj = 0;}
-            else dj = d.x;
-
-            if (i >= size.y - 1) {i = size.y - 1; di = 0;}
-            else di = d.y;
+            if (j >= size.x - 1) j = size.x - 1;
+            if (i >= size.y - 1) i = size.y - 1;
 
             break;
 
@@ -927,13 +840,35 @@ static int index_of_sample(Image const * image, Vector position, Border border)
             assert(j >= 0 && j < size.x);
             assert(i >= 0 && i < size.y);
 
-            dj = (j == size.x - 1) ? -j : d.x;
-            di = (i == size.y - 1) ? (-i * d.y) : d.y;
-
             break;
     }
 
-    return size_index(size, k, i, j);
+    * k_ = k;
+    * i_ = i;
+    * j_ = j;
+
+    return 1;
+}
+
+static void const * view_sample(Image_View const * view, Vector position, Border border)
+{
+    int k, i, j;
+
+    if (! sample_coordinates(view->format.size, position, border, &k, &i, &j))
+        return NULL;
+
+    return image_view_pixel(view, k, i, j);
+}
+
+/* tiled images have no view, their pixels are found through their tiles */
+static void const * tiled_sample(Image const * image, Vector position, Border border)
+{
+    int k, i, j;
+
+    if (! sample_coordinates(image->format.size, position, border, &k, &i, &j))
+        return NULL;
+
+    return image_pixel(image, k, i, j);
 }
 
 Color color_from_luminance(float luminance)
@@ -942,35 +877,58 @@ Color color_from_luminance(float luminance)
     return c;
 }
 
-Color image_sample(Image const * image, Vector position, Border border)
+static Color sample_color(Image_Format format, float const * pixel)
 {
-    error_check(image->format.type   != GL_FLOAT, "bad type");
-    error_check(image->format.format != GL_RGB && image->format.format != GL_RGBA && image->format.format != GL_LUMINANCE,  "bad format");
+    error_check(format.type   != GL_FLOAT, "bad type");
+    error_check(format.format != GL_RGB && format.format != GL_RGBA && format.format != GL_LUMINANCE,  "bad format");
 
-    int index = index_of_sample(image, position, border);
-    if (index == -1)
+    if (! pixel)
         return MAGENTA;
 
-    if (image->format.format == GL_RGB)
-        return ((Color const *) image->pixels)[index];
+    if (format.format == GL_LUMINANCE)
+        return color_from_luminance(pixel[0]);
+
+    Color color = {pixel[0], pixel[1], pixel[2]};
+    return color;
+}
+
+Color image_view_sample(Image_View const * view, Vector position, Border border)
+{
+    return sample_color(view->format, (float const *) view_sample(view, position, border));
+}
 
-    if (image->format.format == GL_LUMINANCE)
-        return color_from_luminance(((float const *) image->pixels)[index]);
+Color image_sample(Image const * image, Vector position, Border border)
+{
+    if (image->format.layout == IMAGE_TILED)
+        return sample_color(image->format, (float const *) tiled_sample(image, position, border));
 
-    Color4 color4 = ((Color4 const *) image->pixels)[index];
-    return color4.c;
+    Image_View view = image_view(image);
+    return image_view_sample(&view, position, border);
 }
 
-unsigned short image_sample_index(Image const * image, Vector position, Border border)
+static unsigned short sample_index(Image_Format format, unsigned short const * pixel)
 {
-    error_check(image->format.type   != GL_UNSIGNED_SHORT, "bad type");
-    error_check(image->format.format != GL_LUMINANCE,  "bad format");
+    error_check(format.type   != GL_UNSIGNED_SHORT, "bad type");
+    error_check(format.format != GL_LUMINANCE,  "bad format");
 
-    int index = index_of_sample(image, position, border);
-    if (index == -1)
+    if (! pixel)
         return -1;
 
-    return (((unsigned short const *) image->pixels)[index]);
+    return * pixel;
+}
+
+unsigned short image_view_sample_index(Image_View const * view, Vector position, Border border)
+{
+    return sample_index(view->format, (unsigned short const *) view_sample(view, position, border));
+}
+
+unsigned short image_sample_index(Image const * image, Vector position, Border border)
+{
+    if (image->format.layout == IMAGE_TILED)
+        return sample_index(image->format, (unsigned short const *) tiled_sample(image, position, border));
+
+    Image_View view = image_view(image);
+    return image_view_sample_index(&view, position, border);
 }
 #endif
 
@@ -981,7 +939,8 @@ Color image_sample_color_2D(Image const * image, Vector position, Border border)
     error_check(image->format.format != GL_RGB,  "bad format");
 
     Size size = image->format.size;
-    Size d = size_stride(size);
+    Size storage = image_format_storage(image->format);
+    Size d = size_stride(storage);
 
     float x = position.x * size.x;
     float y = position.y * size.y;
@@ -1030,7 +989,7 @@ Color image_sample_color_2D(Image const * image, Vector position, Border border)
             break;
     }
 
-    int index = size_index(size, 0, i, j);
+    int index = size_index(storage, 0, i, j);
 
     Color const * pixels = (Color *) image->pixels;
     Color const values[2][2] =
@@ -1042,96 +1001,51 @@ Color image_sample_color_2D(Image const * image, Vector position, Border border)
     return color_interpolate_bilinear(values, u, v);
 }
 
-static int choose_bin_count(Image_Format format)
+Image * image_histogram(Image const * image, int bin_count)
 {
-    switch (format.type)
-    {
-        default:
-        case GL_UNSIGNED_BYTE:  return 256;
-        case GL_UNSIGNED_SHORT: return 65536;
-    }
+    Image_View view = image_view(image);
+    Histogram * histogram = histogram_new(&view, bin_count, HISTOGRAM_LINEAR);
+    Image * result = histogram_image(histogram, image->format.format);
+
+    histogram_destroy(histogram);
+    return result;
 }
 
-Image * image_histogram(Image const * image, int bin_count)
+/* over the colour channels, alpha does not take part in the range */
+void image_view_min_max(Image_View const * view, float * min, float * max)
 {
-    Image_Format format = image->format;
-    int pixel_count = size_volume(format.size);
-    int channel_count = format_to_size(format.format);
+    error_check(view->format.type != GL_FLOAT, "type must be float");
 
-    if (! bin_count)
-        bin_count = choose_bin_count(format);
+    Size size = view->format.size;
+    GLenum format = view->format.format;
+    int channel_count = format_to_size(format);
 
-    Image_Format histogram_format = {GL_FLOAT, image->format.format, {bin_count, 1, 1}};
-    Image * histogram = image_new(histogram_format);
-    float * target = (float *) histogram->pixels;
+    if (format == GL_LUMINANCE_ALPHA || format == GL_RGBA || format == GL_BGRA)
+        -- channel_count;
+
+    * min = +FLT_MAX;
+    * max = -FLT_MAX;
 
-    switch (format.type)
+    for (int i = 0; i != size.z; ++ i)
+    for (int j = 0; j != size.y; ++ j)
+    for (int k = 0; k != size.x; ++ k)
     {
-        default:
-            error_check(1, "unsupported type for histogram");
-            break;
+        unsigned char const * pixel = (unsigned char const *) image_view_pixel(view, i, j, k);
 
-        case GL_UNSIGNED_BYTE:
+        for (int c = 0; c != channel_count; ++ c)
         {
-            unsigned char const * source = (unsigned char const *) image->pixels;
-            for (int i = 0; i !=   pixel_count; ++ i)
-            for (int j = 0; j != channel_count; ++ j)
-            {
-                int index = source[i * channel_count + j];
-                target[index] += 1.0;
-            }
-        }
-        break;
+            float value = * (float const *) (pixel + c * view->channel_stride);
 
-        case GL_UNSIGNED_SHORT:
-        {
-            unsigned short const * source = (unsigned short const *) image->pixels;
-            for (int i = 0; i !=   pixel_count; ++ i)
-            for (int j = 0; j != channel_count; ++ j)
-            {
-                int index = source[i * channel_count + j];
-                target[index * channel_count + j] += 1.0;
-            }
+            * min = fmin(* min, value);
+            * max = fmax(* max, value);
         }
-        break;
-
-        case GL_FLOAT:
-        {
-            float const * source = (float const *) image->pixels;
-            for (int i = 0; i !=   pixel_count; ++ i)
-            for (int j = 0; j != channel_count; ++ j)
-            {
-                float value = source[i * channel_count + j];
-                if (isnan(value) || isinf(value) || value < 0)
-                    continue;
-
-                int index = floor(value * (bin_count - 1));
-                target[index * channel_count + j] += 1.0;
-            }
-        }
-    }
-
-    return histogram;
-}
+    }
+}
 
 void image_min_max(Image const * image, float * min, float * max)
 {
-    float const * source = (float const *) image->pixels; 
-    Size size = image->format.size;
-
-    * min = +FLT_MAX;
-    * max = -FLT_MAX;
-
-    for (int i = 0; i != size.z; ++ i)
-    for (int j = 0; j != size.y; ++ j)
-    for (int k = 0; k != size.x; ++ k)
-    {
-         int index = size_index(size, i, j, k);
-         float value = source[index];
-
-         * min = fmin(* min, value);
-         * max = fmax(* max, value);
-    }
+    Image_View view = image_view(image);
+    image_view_min_max(&view, min, max);
 }
 
 #if 0
@@ -1186,158 +1100,41 @@ void complex_plot(Image * image, Complex_Function f, void * data, Box box)
 
 Image * image_convolve(Image const * source, float const weights[], int size, Border border)
 {
-    error_check(source->format.format != GL_RGB, "image format must be RGB");
-
-    Image * target = image_new(source->format);
-
-    Color const * source_pixels = (Color const *) source->pixels;
-    Color       * target_pixels = (Color       *) target->pixels;
-
-    int width  = source->format.size.x;
-    int height = source->format.size.x;
-    int size_2 = size / 2;
-
-    int k;
-    Color accumulator;
-
-    for (int i = 0; i != height; ++ i)
-    {
-        int j = 0;
-
-        // wrap, mirror, replicate
-        for (; j != size_2; ++ j)
-        {
-            accumulator = BLACK;
-
-            switch (border)
-            {
-                default:
-                case BORDER_MIRROR:
-                    for (k = - size_2; k != 0; ++ k)
-                    {
-                        color_accumulate(&accumulator, source_pixels[i * width + j - k], weights[k]);
-                    }
-                    break;
-
-                case BORDER_CLAMP:
-                    for (k = - size_2; k != 0; ++ k)
-                    {
-                        color_accumulate(&accumulator, source_pixels[i * width], weights[k]);
-                    }
-                    break;
-
-                case BORDER_WRAP:
-                    for (k = - size_2; k != 0; ++ k)
-                    {
-                        color_accumulate(&accumulator, source_pixels[(i + 1) * width + j - k], weights[k]);
-                    }
-                    break;
-            }
-
-            for (; k <= size_2; ++ k)
-            {
-                color_accumulate(&accumulator, source_pixels[i * width + j + k], weights[k]);
-            }
-
-            target_pixels[i * width + j] = accumulator;
-        }
-
-        for (; j != width - size_2; ++ j)
-        {
-            accumulator = BLACK;
-
-            for (k = - size_2; k <= size_2; ++ k)
-            {
-                color_accumulate(&accumulator, source_pixels[i * width + j - k], weights[k]);
-            }
-
-            target_pixels[i * width + j] = accumulator;
-        }
-
-        for (; j != width; ++ j)
-        {
-            accumulator = BLACK;
-
-            for (k = - size_2; k <= 0; ++ k)
-            {
-                color_accumulate(&accumulator, source_pixels[i * width + j + k], weights[k]);
-            }
-
-            switch (border)
-            {
-                case BORDER_BLACK:
-                    break;
-
-                case BORDER_MIRROR:
-                    for (; k <= size_2; ++ k)
-                    {
-                        color_accumulate(&accumulator, source_pixels[i * width + j - k], weights[k]);
-                    }
-                    break;
-
-                case BORDER_CLAMP:
-                    for (; k <= size_2; ++ k)
-                    {
-                        color_accumulate(&accumulator, source_pixels[i * width], weights[k]);
-                    }
-                    break;
-
-                case BORDER_WRAP:
-                    for (; k <= size_2; ++ k)
-                    {
-                        color_accumulate(&accumulator, source_pixels[(i - 1) * width + j - k], weights[k]);
-                    }
-                    break;
-            }
-
-            target_pixels[i * width + j] = accumulator;
-        }
-    }
-
-    return target;
+    return image_convolve_separable(source, weights, size, weights, size, border);
 }
 
 Image * image_fast_area_sum(Image const * source)
 {
-    Image_Format format = source->format;
-
-    error_check(format_to_size(format.format) != 1, "image is not single component");
-    error_check(format.type != GL_FLOAT, "image is float type");
-
+    Image_Format format = {GL_FLOAT, source->format.format, source->format.size};
     Image * target = image_new(format);
-
-    float const * source_pixels = (float const *) source->pixels;
-    float * target_pixels = (float *) target->pixels;
-
     Size size = format.size;
-    int width = size.x;
-    int height = size.y;
-    
-    int m = (int) log2((float) height);
-    int n = (int) log2((float) width);
-    
-    for (int k = 0; k != n; ++ k)
-    {
-        int offset = 1 << k;
-        for (int i = 0; i != height; ++ i)
-        {
-            for (int j = 0; j != width; ++ i)
-            {
-                target_pixels[i * width + j] = source_pixels[i * width + j] + source_pixels[i * width + j + offset];
-            }
-        }
-    }
 
-    for (int k = 0; k != m; ++ k)
+    for (int i = 0; i != size.z; ++ i)
     {
-        int offset = 1 << k;
-        for (int i = 0; i != height; ++ i)
+        Image_View view = image_view_layer(image_view(source), i);
+        Area_Table * table = area_table_new(&view, 0);
+        int channels = table->channels;
+
+        for (int j = 0; j != size.y; ++ j)
         {
-            for (int j = 0; j != width; ++ i)
+            float * row = (float *) image_row(target, i, j);
+            size_t first = (size_t) (j + 1) * (size.x + 1);
+            double const * sums = &table->sums[first * channels];
+
+            for (int k = 0; k != size.x; ++ k)
             {
-                target_pixels[i * width + j] = source_pixels[i * width + j] + source_pixels[i * width + j + offset];
+                /* the offset only went out of the pixels that are in the sums */
+                double count = (double) (j + 1) * (k + 1);
+
+                if (table->nans)
+                    count -= table->nans[first + k + 1] + table->infs[first + k + 1];
+
+                for (int l = 0; l != channels; ++ l)
+                    row[k * channels + l] = sums[(k + 1) * channels + l] + count * table->offset[l];
             }
         }
+
+        area_table_destroy(table);
     }
 
     return target;
@@ -1358,116 +1155,131 @@ float image_statistics_threshold(Image const * image, float threshold)
 
     error_check(format.type != GL_FLOAT, "image_statistics_threshold type must be float");
     error_check(format.format != GL_RGB, "image_statistics_threshold format must be rgb");
+    check_interleaved(image);
 
-    Color const * pixels = (Color const *) image->pixels;
-    int const pixel_count = size_total(format.size);
+    Size size = format.size;
+    int const pixel_count = size_total(size);
 
     float error = 0.0;
 
-    for (int i = 0; i != pixel_count; ++ i)
+    for (int i = 0; i != size.z; ++ i)
+    for (int j = 0; j != size.y; ++ j)
     {
-        Color color = pixels[i];
-        float mean = (color.r + color.g + color.b) / 3.0;
+        Color const * pixels = (Color const *) image_row(image, i, j);
 
-        if (mean <= threshold)
-            continue;
+        for (int k = 0; k != size.x; ++ k)
+        {
+            Color color = pixels[k];
+            float mean = (color.r + color.g + color.b) / 3.0;
 
-        error += mean;
+            if (mean <= threshold)
+                continue;
+
+            error += mean;
+        }
     }
 
     return (float) error / pixel_count;
 }
 
-Image_Statistics image_statistics(Image const * image)
-{
-    Image_Format format = image->format;
+typedef struct {Image_View const * view; Color sum, sum2, min, max;} Statistics_Task;
 
-    error_check(format.type != GL_FLOAT, "only float type supported");
-
-    int const pixel_count = size_total(format.size);
+/* one contiguous run per channel and row, luminance fills all three colour channels */
+static void statistics_planes(Image_View const * view, int first, int last, Color * sum, Color * sum2, Color * min_color, Color * max_color)
+{
+    Size size = view->format.size;
+    int channels = view->format.format == GL_LUMINANCE ? 1 : 3;
+    float * s = (float *) sum, * s2 = (float *) sum2, * low = (float *) min_color, * high = (float *) max_color;
 
-    switch (format.format)
+    for (int r = first; r != last; ++ r)
+    for (int c = 0; c != channels; ++ c)
     {
-        case GL_LUMINANCE:
-        {
-            float accumulator = 0, accumulator2 = 0, min_value = FLT_MAX, max_value = -FLT_MAX;
-            float const * pixels = (float const *) image->pixels;
-
-            for (int i = 0; i != pixel_count; ++ i)
-            {
-                float value = pixels[i];
+        float const * samples = (float const *) ((unsigned char const *) image_view_pixel(view, r / size.y, r % size.y, 0) + c * view->channel_stride);
 
-                accumulator += value;
-                accumulator2 += value * value;
+        for (int x = 0; x != size.x; ++ x)
+        {
+            float value = samples[x];
 
-                min_value = fmin(min_value, value);
-                max_value = fmax(max_value, value);
-            }
+            s[c] += value;
+            s2[c] += value * value;
+            low[c] = value < low[c] ? value : low[c];
+            high[c] = value > high[c] ? value : high[c];
+        }
+    }
 
-            float factor = 1.0 / pixel_count;
-            Color mean  = color_scale(WHITE, accumulator * factor);
-            Color mean2 = color_scale(WHITE, accumulator2 * factor);
-            Color variance = color_sub(mean2, color_square(mean));
+    for (int c = channels; c != 3; ++ c)
+    {
+        s[c] = s[0];
+        s2[c] = s2[0];
+        low[c] = low[0];
+        high[c] = high[0];
+    }
+}
 
-            Image_Statistics stats = {mean, variance, color_scale(WHITE, min_value), color_scale(WHITE, max_value)};
-            return stats;
-        }
+static void statistics_pixels(Image_View const * view, int first, int last, Color * sum, Color * sum2, Color * min_color, Color * max_color)
+{
+    Image_Format format = view->format;
 
-        case GL_RGB:
-        {
-            Color accumulator = BLACK, accumulator2 = BLACK, min_color = MAX_COLOR, max_color = MIN_COLOR;
-            Color const * pixels = (Color const *) image->pixels;
+    for (int r = first; r != last; ++ r)
+    for (int x = 0; x != format.size.x; ++ x)
+    {
+        float const * pixel = (float const *) image_view_pixel(view, r / format.size.y, r % format.size.y, x);
+        Color color = format.format == GL_LUMINANCE
+            ? color_from_luminance(pixel[0])
+            : * (Color const *) pixel;
 
-            for (int i = 0; i != pixel_count; ++ i)
-            {
-                Color color = pixels[i];
+        color_accumulate(sum, color, 1);
+        color_accumulate(sum2, color_square(color), 1);
 
-                color_accumulate(&accumulator, color, 1);
-                color_accumulate(&accumulator2, color_square(color), 1);
+        * min_color = color_min(* min_color, color);
+        * max_color = color_max(* max_color, color);
+    }
+}
 
-                min_color = color_min(min_color, color);
-                max_color = color_max(max_color, color);
-            }
+static void statistics_rows(void * context, int first, int last)
+{
+    Statistics_Task * task = (Statistics_Task *) context;
+    Image_View const * view = task->view;
+    Color accumulator = BLACK, accumulator2 = BLACK, min_color = MAX_COLOR, max_color = MIN_COLOR;
 
-            float factor = 1.0 / pixel_count;
-            Color mean = color_scale(accumulator, factor);
-            Color mean2 = color_scale(accumulator2, factor);
-            Color variance = color_sub(mean2, color_square(mean));
+    if (view->format.layout == IMAGE_PLANAR)
+        statistics_planes(view, first, last, &accumulator, &accumulator2, &min_color, &max_color);
+    else
+        statistics_pixels(view, first, last, &accumulator, &accumulator2, &min_color, &max_color);
 
-            Image_Statistics stats = {mean, variance, min_color, max_color};
-            return stats;
-        }
+    parallel_lock();
+    color_accumulate(&task->sum, accumulator, 1);
+    color_accumulate(&task->sum2, accumulator2, 1);
+    task->min = color_min(task->min, min_color);
+    task->max = color_max(task->max, max_color);
+    parallel_unlock();
+}
 
-        case GL_RGBA:
-        {
-            Color accumulator = BLACK, accumulator2 = BLACK, min_color = MAX_COLOR, max_color = MIN_COLOR;
-            Color4 const * pixels = (Color4 const *) image->pixels;
+Image_Statistics image_view_statistics(Image_View const * view)
+{
+    Image_Format format = view->format;
 
-            for (int i = 0; i != pixel_count; ++ i)
-            {
-                Color color = pixels[i].c;
+    error_check(format.type != GL_FLOAT, "only float type supported");
+    error_check(format.format != GL_LUMINANCE && format.format != GL_RGB && format.format != GL_RGBA, "only luminance or RGB[A] float supported");
 
-                color_accumulate(&accumulator, color, 1);
-                color_accumulate(&accumulator2, color_square(color), 1);
+    int row_count = format.size.y * format.size.z;
+    Statistics_Task task = {view, BLACK, BLACK, MAX_COLOR, MIN_COLOR};
 
-                min_color = color_min(min_color, color);
-                max_color = color_max(max_color, color);
-            }
+    parallel_for(row_count, parallel_reduction_grain(row_count), statistics_rows, &task);
 
-            float factor = 1.0 / pixel_count;
-            Color mean = color_scale(accumulator, factor);
-            Color mean2 = color_scale(accumulator2, factor);
-            Color variance = color_sub(mean2, color_square(mean));
+    float factor = 1.0 / size_total(format.size);
+    Color mean = color_scale(task.sum, factor);
+    Color mean2 = color_scale(task.sum2, factor);
+    Color variance = color_sub(mean2, color_square(mean));
 
-            Image_Statistics stats = {mean, variance, min_color, max_color};
-            return stats;
-        }
+    Image_Statistics stats = {mean, variance, task.min, task.max};
+    return stats;
+}
 
-        default:
-            error_check(1, "only RGB[A] float supported");
-            Image_Statistics stats = {BLACK, BLACK, BLACK, BLACK};
-            return stats;
-    }
+Image_Statistics image_statistics(Image const * image)
+{
+    Image_View view = image_view(image);
+    return image_view_statistics(&view);
 }
 
 void image_problems_print(Image_Problems problems)
@@ -1483,22 +1295,25 @@ Image_Problems image_problems(Image const * image)
 
     error_check(format.type != GL_FLOAT, "only float type supported");
 
-    int const pixel_count = size_total(format.size);
     int neg = 0, inf = 0, nan = 0;
 
     switch (format.format)
     {
         case GL_LUMINANCE:
         {
-            float const * pixels = (float const *) image->pixels;
-
-            for (int i = 0; i != pixel_count; ++ i)
+            for (int z = 0; z != format.size.z; ++ z)
+            for (int y = 0; y != format.size.y; ++ y)
             {
-                float value = pixels[i];
+                float const * pixels = (float const *) image_row(image, z, y);
 
-                if (value < 0)    ++ neg;
-                if (isinf(value)) ++ inf;
-                if (isnan(value)) ++ nan;
+                for (int i = 0; i != format.size.x; ++ i)
+                {
+                    float value = pixels[i];
+
+                    if (value < 0)    ++ neg;
+                    if (isinf(value)) ++ inf;
+                    if (isnan(value)) ++ nan;
+                }
             }
 
             break;
@@ -1506,15 +1321,19 @@ Image_Problems image_problems(Image const * image)
 
         case GL_RGB:
         {
-            Color const * pixels = (Color const *) image->pixels;
-
-            for (int i = 0; i != pixel_count; ++ i)
+            for (int z = 0; z != format.size.z; ++ z)
+            for (int y = 0; y != format.size.y; ++ y)
             {
-                Color color = pixels[i];
+                Color const * pixels = (Color const *) image_row(image, z, y);
+
+                for (int i = 0; i != format.size.x; ++ i)
+                {
+                    Color color = pixels[i];
 
-                if (color_is_negative(color)) ++ neg;
-                if (color_is_inf(color)) ++ inf;
-                if (color_is_nan(color)) ++ nan;
+                    if (color_is_negative(color)) ++ neg;
+                    if (color_is_inf(color)) ++ inf;
+                    if (color_is_nan(color)) ++ nan;
+                }
             }
 
             break;
@@ -1522,15 +1341,19 @@ Image_Problems image_problems(Image const * image)
 
         case GL_RGBA:
         {
-            Color4 const * pixels = (Color4 const *) image->pixels;
-
-            for (int i = 0; i != pixel_count; ++ i)
+            for (int z = 0; z != format.size.z; ++ z)
+            for (int y = 0; y != format.size.y; ++ y)
             {
-                Color color = pixels[i].c;
+                Color4 const * pixels = (Color4 const *) image_row(image, z, y);
 
-                if (color_is_negative(color)) ++ neg;
-                if (color_is_inf(color)) ++ inf;
-                if (color_is_nan(color)) ++ nan;
+                for (int i = 0; i != format.size.x; ++ i)
+                {
+                    Color color = pixels[i].c;
+
+                    if (color_is_negative(color)) ++ neg;
+                    if (color_is_inf(color)) ++ inf;
+                    if (color_is_nan(color)) ++ nan;
+                }
             }
 
             break;
@@ -1547,28 +1370,34 @@ Image_Problems image_problems(Image const * image)
 
 void image_correct_gamma(Image * image, float gamma)
 {
+    check_interleaved(image);
+
     Image_Format format = image->format;
     error_check(format.type != GL_FLOAT, "only float type supported");
     error_check(format.format != GL_RGB && format.format != GL_RGBA, "only rgb[a] format supported");
 
-    int pixel_count = image_format_pixels(format);
+    Size size = format.size;
 
-    if (format.format == GL_RGB)
+    for (int i = 0; i != size.z; ++ i)
+    for (int j = 0; j != size.y; ++ j)
     {
-        Color * pixels = (Color *) image->pixels;
-
-        for (int i = 0; i != pixel_count; ++ i)
+        if (format.format == GL_RGB)
         {
-            pixels[i] = color_correct_gamma(pixels[i], gamma);
-        }
-    }
-    else if (format.format == GL_RGBA)
-    {
-        Color4 * pixels = (Color4 *) image->pixels;
+            Color * pixels = (Color *) image_row(image, i, j);
 
-        for (int i = 0; i != pixel_count; ++ i)
+            for (int k = 0; k != size.x; ++ k)
+            {
+                pixels[k] = color_correct_gamma(pixels[k], gamma);
+            }
+        }
+        else if (format.format == GL_RGBA)
         {
-            pixels[i].c = color_correct_gamma(pixels[i].c, gamma);
+            Color4 * pixels = (Color4 *) image_row(image, i, j);
+
+            for (int k = 0; k != size.x; ++ k)
+            {
+                pixels[k].c = color_correct_gamma(pixels[k].c, gamma);
+            }
         }
     }
 }
@@ -1615,16 +1444,24 @@ Image * image_normals(Image const * image, float scale)
 
 void image_remap(Image * image, float scale, float bias)
 {
+    check_interleaved(image);
+
     Image_Format format = image->format;
     error_check(format.type != GL_FLOAT, "only float type supported");
 
-    int n = size_total(format.size) * format_to_size(format.format);
-    float * pixels = image->pixels;
+    Size size = format.size;
+    int n = size.x * format_to_size(format.format);
 
-    for (int i = 0; i != n; ++ i)
+    for (int i = 0; i != size.z; ++ i)
+    for (int j = 0; j != size.y; ++ j)
     {
-        * pixels = (* pixels) * scale + bias;
-        ++ pixels;
+        float * pixels = (float *) image_row(image, i, j);
+
+        for (int k = 0; k != n; ++ k)
+        {
+            * pixels = (* pixels) * scale + bias;
+            ++ pixels;
+        }
     }
 }
 
@@ -1709,6 +1546,58 @@ Color map_color(Color c)
     return BLACK;
 }
 
+typedef struct {Image const * image1, * image2; Image * diff_image;} Diff_Task;
+
+static void diff_rows(void * context, int first, int last)
+{
+    Diff_Task const * task = (Diff_Task const *) context;
+    Image_Format format = task->image1->format;
+    Size size = format.size;
+
+    if (format.type == GL_FLOAT)
+    {
+        for (int r = first; r != last; ++ r)
+        {
+            int i = r / size.y;
+            int j = r % size.y;
+
+            Color4 const * source1 = (Color4 const *) image_row(task->image1, i, j);
+            Color4 const * source2 = (Color4 const *) image_row(task->image2, i, j);
+            Color4 * target = (Color4 *) image_row(task->diff_image, i, j);
+
+            for (int index = 0; index != size.x; ++ index)
+            {
+                Color4 d = {map_color(color_sub(source1[index].c, source2[index].c)), 1};
+                target[index] = d;
+            }
+        }
+    }
+
+    if (format.type == GL_HALF_FLOAT_ARB)
+    {
+        Color4 * row1 = malloc_array(Color4, size.x);
+        Color4 * row2 = malloc_array(Color4, size.x);
+
+        for (int r = first; r != last; ++ r)
+        {
+            int i = r / size.y;
+            int j = r % size.y;
+
+            half_to_float_n((unsigned short const *) image_row(task->image1, i, j), (float *) row1, 4 * size.x);
+            half_to_float_n((unsigned short const *) image_row(task->image2, i, j), (float *) row2, 4 * size.x);
+
+            // alpha of the first image is kept, should be 1
+            for (int k = 0; k != size.x; ++ k)
+                row1[k].c = map_color(color_sub(row1[k].c, row2[k].c));
+
+            half_from_float_n((float const *) row1, (unsigned short *) image_row(task->diff_image, i, j), 4 * size.x);
+        }
+
+        free(row1);
+        free(row2);
+    }
+}
+
 Image * image_diff(Image const * image1, Image const * image2)
 {
     Image_Format format1 = image1->format;
@@ -1725,55 +1614,9 @@ Image * image_diff(Image const * image1, Image const * image2)
     Size size = format1.size;
 
     Image * diff_image = image_new(format1);
+    Diff_Task task = {image1, image2, diff_image};
 
-    if (format1.type == GL_FLOAT)
-    {
-        Color4 const * source1 = (Color4 const *) image1->pixels;
-        Color4 const * source2 = (Color4 const *) image2->pixels;
-        Color4 * target = (Color4 *) diff_image->pixels;
-
-        for (int i = 0; i != size.z; ++ i)
-        for (int j = 0; j != size.y; ++ j)
-        for (int k = 0; k != size.x; ++ k)
-        {
-            int index = size_index(size, i, j, k);
-            Color4 d = {map_color(color_sub(source1[index].c, source2[index].c)), 1};
-            target[index] = d;
-        }
-    }
-
-    if (format1.type == GL_HALF_FLOAT_ARB)
-    {
-        unsigned short const * source1 = (unsigned short const *) image1->pixels;
-        unsigned short const * source2 = (unsigned short const *) image2->pixels;
-        unsigned short * target = (unsigned short *) diff_image->pixels;
-
-        for (int i = 0; i != size.z; ++ i)
-        for (int j = 0; j != size.y; ++ j)
-        for (int k = 0; k != size.x; ++ k)
-        {
-            int index = size_index(size, i, j, k);
-            Color c1 =
-            {
-                half_to_float(source1[index * 4 + 0]),
-                half_to_float(source1[index * 4 + 1]),
-                half_to_float(source1[index * 4 + 2])
-            };
-            Color c2 =
-            {
-                half_to_float(source2[index * 4 + 0]),
-                half_to_float(source2[index * 4 + 1]),
-                half_to_float(source2[index * 4 + 2])
-            };
-            Color d = color_sub(c1, c2);
-            d = map_color(d);
-
-            target[index * 4 + 0] = half_from_float(d.r);
-            target[index * 4 + 1] = half_from_float(d.g);
-            target[index * 4 + 2] = half_from_float(d.b);
-            target[index * 4 + 3] = source1[index * 4 + 3]; // should be 1
-        }
-    }
+    parallel_for(size.y * size.z, 1, diff_rows, &task);
 
     return diff_image;
 }
@@ -1793,16 +1636,19 @@ void image_accumulate(Image * target, Image const * source, float scale)
     error_check(source_format.size.y != target_format.size.y, "images must have same size");
     error_check(source_format.size.z != target_format.size.z, "images must have same size");
     
+    check_interleaved(target);
+    check_interleaved(source);
+
     Size size = source_format.size;
-    Color4 const * source_pixels = (Color4 const *) source->pixels;
-    Color4 * target_pixels = (Color4 *) target->pixels;
 
     for (int i = 0; i != size.z; ++ i)
     for (int j = 0; j != size.y; ++ j)
-    for (int k = 0; k != size.x; ++ k)
     {
-        int index = size_index(size, i, j, k);
-        target_pixels[index] = color4_add_scaled(source_pixels[index], target_pixels[index], scale);
+        Color4 const * source_pixels = (Color4 const *) image_row(source, i, j);
+        Color4 * target_pixels = (Color4 *) image_row(target, i, j);
+
+        for (int k = 0; k != size.x; ++ k)
+            target_pixels[k] = color4_add_scaled(source_pixels[k], target_pixels[k], scale);
     }
 }
 
@@ -1821,21 +1667,26 @@ void image_accumulate_masked(Image * target, Image const * mask, Image const * s
     error_check(source_format.size.y != target_format.size.y, "images must have same size");
     error_check(source_format.size.z != target_format.size.z, "images must have same size");
     
-    Size size = source_format.size;
-    Color4 const * source_pixels = (Color4 const *) source->pixels;
-    Color4 * target_pixels = (Color4 *) target->pixels;
+    check_interleaved(target);
+    check_interleaved(mask);
+    check_interleaved(source);
 
-    unsigned short const * mask_pixels = (unsigned short const *) mask->pixels;
+    Size size = source_format.size;
 
     for (int i = 0; i != size.z; ++ i)
     for (int j = 0; j != size.y; ++ j)
-    for (int k = 0; k != size.x; ++ k)
     {
-        int index = size_index(size, i, j, k);
-        if (mask_pixels[index])
-            continue;
+        Color4 const * source_pixels = (Color4 const *) image_row(source, i, j);
+        Color4 * target_pixels = (Color4 *) image_row(target, i, j);
+        unsigned short const * mask_pixels = (unsigned short const *) image_row(mask, i, j);
 
-        target_pixels[index] = color4_add_scaled(source_pixels[index], target_pixels[index], scale);
+        for (int k = 0; k != size.x; ++ k)
+        {
+            if (mask_pixels[k])
+                continue;
+
+            target_pixels[k] = color4_add_scaled(source_pixels[k], target_pixels[k], scale);
+        }
     }
 }
 
@@ -1859,23 +1710,29 @@ void image_accumulate_convergence(Image * target, Image const * reference, Image
     error_check(source_format.size.y != target_format.size.y, "images must have same size");
     error_check(source_format.size.z != target_format.size.z, "images must have same size");
 
+    check_interleaved(target);
+    check_interleaved(reference);
+    check_interleaved(source);
+
     Size size = source_format.size;
-    Color4 const * reference_pixels = (Color4 const *) reference->pixels;
-    Color4 const * source_pixels    = (Color4 const *) source->pixels;
-    //unsigned char * target_pixels = (unsigned char *) target->pixels;
-    //float * target_pixels = (float *) target->pixels;
-    unsigned short * target_pixels = (unsigned short *) target->pixels;
 
     for (int i = 0; i != size.z; ++ i)
     for (int j = 0; j != size.y; ++ j)
-    for (int k = 0; k != size.x; ++ k)
     {
-        int index = size_index(size, i, j, k);
-        if (target_pixels[index])
-            continue;
+        Color4 const * reference_pixels = (Color4 const *) image_row(reference, i, j);
+        Color4 const * source_pixels    = (Color4 const *) image_row(source, i, j);
+        //unsigned char * target_pixels = (unsigned char *) image_row(target, i, j);
+        //float * target_pixels = (float *) image_row(target, i, j);
+        unsigned short * target_pixels = (unsigned short *) image_row(target, i, j);
 
-        if (color_similar(color_scale(source_pixels[index].c, 1.0 / iteration), reference_pixels[index].c, tolerance * color_max_channel(reference_pixels[index].c)))
-            target_pixels[index] = iteration;
+        for (int k = 0; k != size.x; ++ k)
+        {
+            if (target_pixels[k])
+                continue;
+
+            if (color_similar(color_scale(source_pixels[k].c, 1.0 / iteration), reference_pixels[k].c, tolerance * color_max_channel(reference_pixels[k].c)))
+                target_pixels[k] = iteration;
+        }
     }
 }
 
@@ -1886,176 +1743,115 @@ void image_log(Image * image)
     error_check(format.format != GL_RGB, "image_log image must be of format RGB, RGBA, or luminance");
     error_check(format.type != GL_FLOAT, "image_log image must be of type float");
 
+    check_interleaved(image);
+
     Size size = format.size;
-    Color * pixels = (Color *) image->pixels;
 
     for (int i = 0; i != size.z; ++ i)
     for (int j = 0; j != size.y; ++ j)
-    for (int k = 0; k != size.x; ++ k)
     {
-        int index = size_index(size, i, j, k);
-        pixels[index] = color_log(pixels[index]);
-    }
-}
+        Color * pixels = (Color *) image_row(image, i, j);
 
-void image_scale(Image * image, float scale)
-{
-    Image_Format format = image->format;
-
-    error_check(format.format != GL_RGB && format.format != GL_RGBA && format.format != GL_LUMINANCE, "images must be of format RGB, RGBA, or luminance");
-    error_check(format.type != GL_FLOAT, "images must be of type float");
-
-    Size size = format.size;
-
-    if (format.format == GL_RGBA)
-    {
-        Color4 * pixels = (Color4 *) image->pixels;
-
-        for (int i = 0; i != size.z; ++ i)
-        for (int j = 0; j != size.y; ++ j)
         for (int k = 0; k != size.x; ++ k)
-        {
-            int index = size_index(size, i, j, k);
-            pixels[index].c = color_scale(pixels[index].c, scale);
-        }
-    }
-    else if (format.format == GL_RGB)
-    {
-        Color * pixels = (Color *) image->pixels;
-
-        for (int i = 0; i != size.z; ++ i)
-        for (int j = 0; j != size.y; ++ j)
-        for (int k = 0; k != size.x; ++ k)
-        {
-            int index = size_index(size, i, j, k);
-            pixels[index] = color_scale(pixels[index], scale);
-        }
-    }
-    else if (format.format == GL_LUMINANCE)
-    {
-        float * pixels = (float *) image->pixels;
-
-        for (int i = 0; i != size.z; ++ i)
-        for (int j = 0; j != size.y; ++ j)
-        for (int k = 0; k != size.x; ++ k)
-        {
-            int index = size_index(size, i, j, k);
-            pixels[index] *= scale;
-        }
+            pixels[k] = color_log(pixels[k]);
     }
 }
 
-void image_assign_divide(Image * image, Image const * denominator_image, unsigned short zero_denominator)
-{
-    Image_Format format = image->format;
-
-    error_check(format.format != GL_RGBA && format.format != GL_LUMINANCE, "images must be of format RGBA or luminance");
-    error_check(format.type != GL_FLOAT, "images must be of type float");
+typedef struct {Image * image; float scale;} Scale_Task;
 
+static void scale_rows(void * context, int first, int last)
+{
+    Scale_Task const * task = (Scale_Task const *) context;
+    Image_Format format = task->image->format;
     Size size = format.size;
+    float scale = task->scale;
 
-    unsigned short const * denominators = (unsigned short const *) denominator_image->pixels;
-
-    if (format.format == GL_RGBA)
+    for (int r = first; r != last; ++ r)
     {
-        Color4 * pixels = (Color4 *) image->pixels;
+        int i = r / size.y;
+        int j = r % size.y;
 
-        for (int i = 0; i != size.z; ++ i)
-        for (int j = 0; j != size.y; ++ j)
-        for (int k = 0; k != size.x; ++ k)
+        if (format.format == GL_RGBA)
         {
-            int index = size_index(size, i, j, k);
-            unsigned short denominator = denominators[index] ? denominators[index] : zero_denominator;
+            Color4 * pixels = (Color4 *) image_row(task->image, i, j);
 
-            pixels[index].c = color_scale(pixels[index].c, 1.0 / denominator);
+            for (int index = 0; index != size.x; ++ index)
+                pixels[index].c = color_scale(pixels[index].c, scale);
         }
-    }
-    else if (format.format == GL_LUMINANCE)
-    {
-        float * pixels = (float *) image->pixels;
+        else if (format.format == GL_RGB)
+        {
+            Color * pixels = (Color *) image_row(task->image, i, j);
 
-        for (int i = 0; i != size.z; ++ i)
-        for (int j = 0; j != size.y; ++ j)
-        for (int k = 0; k != size.x; ++ k)
+            for (int index = 0; index != size.x; ++ index)
+                pixels[index] = color_scale(pixels[index], scale);
+        }
+        else if (format.format == GL_LUMINANCE)
         {
-            int index = size_index(size, i, j, k);
-            unsigned short denominator = denominators[index] ? denominators[index] : zero_denominator;
+            float * pixels = (float *) image_row(task->image, i, j);
 
-            pixels[index] /= (float) denominator;
+            for (int index = 0; index != size.x; ++ index)
+                pixels[index] *= scale;
         }
     }
 }
 
-Image * image_crop(Image const * source, Size position, Size size)
+void image_scale(Image * image, float scale)
 {
-    Image_Format source_format = source->format;
-    Size source_size = source_format.size;
+    Image_Format format = image->format;
 
-    error_check(source_format.format != GL_RGBA && source_format.format != GL_RGB && source_format.format != GL_LUMINANCE, "images must be of format RGBA, RGB, or luminance");
-    error_check(source_format.type   != GL_FLOAT, "images must be of type float");
+    error_check(format.format != GL_RGB && format.format != GL_RGBA && format.format != GL_LUMINANCE, "images must be of format RGB, RGBA, or luminance");
+    error_check(format.type != GL_FLOAT, "images must be of type float");
 
-    Image_Format target_format = source_format;
-    target_format.size = size;
-    Size target_size   = size;
+    Scale_Task task = {image, scale};
+    parallel_for(format.size.y * format.size.z, 1, scale_rows, &task);
+}
 
-    Image * target = image_new(target_format);
+void image_assign_divide(Image * image, Image const * denominator_image, unsigned short zero_denominator)
+{
+    Image_Format format = image->format;
 
-    switch (source_format.format)
-    {
-        case GL_LUMINANCE:
-        {
+    error_check(format.format != GL_RGBA && format.format != GL_LUMINANCE, "images must be of format RGBA or luminance");
+    error_check(format.type != GL_FLOAT, "images must be of type float");
 
-            float const * source_pixels = (float const *) source->pixels;
-            float       * target_pixels = (float       *) target->pixels;
+    check_interleaved(image);
+    check_interleaved(denominator_image);
 
-            for (int i = 0; i != size.z; ++ i)
-            for (int j = 0; j != size.y; ++ j)
-            for (int k = 0; k != size.x; ++ k)
-            {
-                int source_index = size_index(source_size, position.z + i, position.y + j, position.x + k);
-                int target_index = size_index(target_size, i, j, k);
+    Size size = format.size;
 
-                target_pixels[target_index] = source_pixels[source_index];
-            }
-            break;
-        }
+    for (int i = 0; i != size.z; ++ i)
+    for (int j = 0; j != size.y; ++ j)
+    {
+        unsigned short const * denominators = (unsigned short const *) image_row(denominator_image, i, j);
 
-        case GL_RGB:
+        if (format.format == GL_RGBA)
         {
-            Color const * source_pixels = (Color const *) source->pixels;
-            Color       * target_pixels = (Color       *) target->pixels;
+            Color4 * pixels = (Color4 *) image_row(image, i, j);
 
-            for (int i = 0; i != size.z; ++ i)
-            for (int j = 0; j != size.y; ++ j)
             for (int k = 0; k != size.x; ++ k)
             {
-                int source_index = size_index(source_size, position.z + i, position.y + j, position.x + k);
-                int target_index = size_index(target_size, i, j, k);
+                unsigned short denominator = denominators[k] ? denominators[k] : zero_denominator;
 
-                target_pixels[target_index] = source_pixels[source_index];
+                pixels[k].c = color_scale(pixels[k].c, 1.0 / denominator);
             }
-            break;
         }
-
-        case GL_RGBA:
+        else if (format.format == GL_LUMINANCE)
         {
-            Color4 const * source_pixels = (Color4 const *) source->pixels;
-            Color4       * target_pixels = (Color4       *) target->pixels;
+            float * pixels = (float *) image_row(image, i, j);
 
-            for (int i = 0; i != size.z; ++ i)
-            for (int j = 0; j != size.y; ++ j)
             for (int k = 0; k != size.x; ++ k)
             {
-                int source_index = size_index(source_size, position.z + i, position.y + j, position.x + k);
-                int target_index = size_index(target_size, i, j, k);
+                unsigned short denominator = denominators[k] ? denominators[k] : zero_denominator;
 
-                target_pixels[target_index] = source_pixels[source_index];
+                pixels[k] /= (float) denominator;
             }
-            break;
         }
-   }
+    }
+}
 
-    return target;
+Image * image_crop(Image const * source, Size position, Size size)
+{
+    Image_View view = image_view_region(image_view(source), position, size);
+    return image_view_copy(&view);
 }
 
 Image * image_pad_border(Image const * source, Size padding, Border border)
@@ -2359,17 +2155,15 @@ void image_flip_horizontal(Image * image)
 
     error_check(format.format != GL_RGBA, "images must be of format RGBA");
     error_check(format.type != GL_FLOAT, "images must be of type float");
-
-    Color4 * pixels = (Color4 *) image->pixels;
+    check_interleaved(image);
 
     for (int i = 0; i != size.z; ++ i)
     for (int j = 0; j != size.y; ++ j)
-    for (int k = 0; k != size.x / 2; ++ k)
     {
-        int index_1 = size_index(size, i, j, k);
-        int index_2 = size_index(size, i, j, size.x - 1 - k);
+        Color4 * pixels = (Color4 *) image_row(image, i, j);
 
-        swap(Color4, pixels[index_1], pixels[index_2]);
+        for (int k = 0; k != size.x / 2; ++ k)
+            swap(Color4, pixels[k], pixels[size.x - 1 - k]);
     }
 }
 
@@ -2380,16 +2174,56 @@ void image_negate(Image * image)
 
     error_check(format.format != GL_RGBA, "images must be of format RGBA");
     error_check(format.type != GL_FLOAT, "images must be of type float");
-
-    Color4 * pixels = (Color4 *) image->pixels;
+    check_interleaved(image);
 
     for (int i = 0; i != size.z; ++ i)
     for (int j = 0; j != size.y; ++ j)
-    for (int k = 0; k != size.x; ++ k)
     {
-        int index = size_index(size, i, j, k);
+        Color4 * pixels = (Color4 *) image_row(image, i, j);
+
+        for (int k = 0; k != size.x; ++ k)
+            pixels[k].c = color_negate(pixels[k].c);
+    }
+}
+
+typedef struct {Image const * source, * palette; Image * target;} Palette_Task;
+
+static void palette_rows(void * context, int first, int last)
+{
+    Palette_Task const * task = (Palette_Task const *) context;
+    Image const * palette = task->palette;
+    Size size = task->source->format.size;
+    int last_index = palette->format.size.x - 1;
+
+    for (int r = first; r != last; ++ r)
+    {
+        int i = r / size.y;
+        int j = r % size.y;
+
+        float const * source_pixels = (float const *) image_row(task->source, i, j);
+        Color4 * target_pixels = (Color4 *) image_row(task->target, i, j);
+
+        if (palette->format.format == GL_RGBA)
+        {
+            Color4 const * palette_pixels = (Color4 const *) palette->pixels;
+
+            for (int k = 0; k != size.x; ++ k)
+            {
+                int color_index = clamp(source_pixels[k]) * last_index;
+                target_pixels[k] = palette_pixels[color_index];
+            }
+        }
+        else if (palette->format.format == GL_RGB)
+        {
+            Color const * palette_pixels = (Color const *) palette->pixels;
 
-        pixels[index].c = color_negate(pixels[index].c);
+            for (int k = 0; k != size.x; ++ k)
+            {
+                int color_index = clamp(source_pixels[k]) * last_index;
+                target_pixels[k].c = palette_pixels[color_index];
+                target_pixels[k].a = 1.0;
+            }
+        }
     }
 }
 
@@ -2398,49 +2232,15 @@ Image * image_apply_palette(Image const * source, Image const * palette)
     Image_Format source_format = source->format;
     Size size = source_format.size;
 
-    Image_Format palette_format = palette->format;
-
     error_check(source_format.format != GL_LUMINANCE, "images must be of format luminance");
     error_check(source_format.type   != GL_FLOAT,     "images must be of type float");
 
     Image_Format target_format = source_format;
     target_format.format = GL_RGBA;
     Image * target = image_new(target_format);
+    Palette_Task task = {source, palette, target};
 
-    float const * source_pixels = (float const *) source->pixels;
-    Color4 * target_pixels = (Color4 *) target->pixels;
-
-    if (palette_format.format == GL_RGBA)
-    {
-        Color4 const * palette_pixels = (Color4 const *) palette->pixels;
-
-        for (int i = 0; i != size.z; ++ i)
-        for (int j = 0; j != size.y; ++ j)
-        for (int k = 0; k != size.x; ++ k)
-        {
-            int index = size_index(size, i, j, k);
-            float luminance = clamp(source_pixels[index]);
-            int color_index = luminance * (palette->format.size.x - 1);
-
-            target_pixels[index] = palette_pixels[color_index];
-        }
-    }
-    else if (palette_format.format == GL_RGB)
-    {
-        Color const * palette_pixels = (Color const *) palette->pixels;
-
-        for (int i = 0; i != size.z; ++ i)
-        for (int j = 0; j != size.y; ++ j)
-        for (int k = 0; k != size.x; ++ k)
-        {
-            int index = size_index(size, i, j, k);
-            float luminance = clamp(source_pixels[index]);
-            int color_index = luminance * (palette->format.size.x - 1);
-
-            target_pixels[index].c = palette_pixels[color_index];
-            target_pixels[index].a = 1.0;
-        }
-    }
+    parallel_for(size.y * size.z, 1, palette_rows, &task);
 
     return target;
 }
@@ -2456,12 +2256,13 @@ int image_count_zeros(Image const * image)
     error_check(format.type   != GL_UNSIGNED_SHORT, "images must be of type unsigned short");
 
     unsigned short const * pixels = (unsigned short const *) image->pixels;
+    Size storage = image_format_storage(format);
 
     for (int i = 0; i != size.z; ++ i)
     for (int j = 0; j != size.y; ++ j)
     for (int k = 0; k != size.x; ++ k)
     {
-        int index = size_index(size, i, j, k);
+        int index = size_index(storage, i, j, k);
         if (! pixels[index])
             ++ zeros;
     }
@@ -2480,71 +2281,88 @@ int image_sum_values(Image const * image)
     error_check(format.type   != GL_UNSIGNED_SHORT, "images must be of type unsigned short");
 
     unsigned short const * pixels = (unsigned short const *) image->pixels;
+    Size storage = image_format_storage(format);
 
     for (int i = 0; i != size.z; ++ i)
     for (int j = 0; j != size.y; ++ j)
     for (int k = 0; k != size.x; ++ k)
     {
-        int index = size_index(size, i, j, k);
+        int index = size_index(storage, i, j, k);
         value += pixels[index];
     }
 
     return value;
 }
 
-Image * image_blend(Image const * image_1, float t1, Image const * image_2, float t2)
-{
-    error_check(! image_format_equal(image_1->format, image_2->format), "image to blend must have same image format");
-    error_check(image_1->format.type   != GL_FLOAT,     "image to blend must have type float");
-    //error_check(image_1->format.size.z != 1 && image_2->format.size.z != 1 || image_1->format.size.z != image_2->format.size.z, "one of the image depths must be 1 or they must have the same depth");
-    // TODO support single depth
-
-    Image_Format format = image_1->format;
-    Size size  = format.size;
+typedef struct {Image const * image_1, * image_2; Image * image; float t1, t2;} Blend_Task;
 
-    Image * image = image_new(format);
+static void blend_rows(void * context, int first, int last)
+{
+    Blend_Task const * task = (Blend_Task const *) context;
+    Image_Format format = task->image->format;
+    Size size = format.size;
+    float t1 = task->t1, t2 = task->t2;
 
-    if (format.format == GL_LUMINANCE_ALPHA)
+    for (int r = first; r != last; ++ r)
     {
-        float const * pixels_1 = (float const *) image_1->pixels;
-        float const * pixels_2 = (float const *) image_2->pixels;
-        float * pixels = (float *) image->pixels;
+        int z = r / size.y;
+        int y = r % size.y;
 
-        int count = size_total(size);
+        if (format.format == GL_LUMINANCE_ALPHA)
+        {
+            float const * pixels_1 = (float const *) image_row(task->image_1, z, y);
+            float const * pixels_2 = (float const *) image_row(task->image_2, z, y);
+            float * pixels = (float *) image_row(task->image, z, y);
 
-        for (int i = 0; i != count; ++ i)
+            for (int i = 0; i != size.x; ++ i)
+            {
+                pixels[i * 2 + 0] = pixels_1[i * 2] * t1 + pixels_2[i * 2] * t2;
+                pixels[i * 2 + 1] = 1.0;
+            }
+        }
+        else if (format.format == GL_RGBA)
         {
-            pixels[i * 2 + 0] = pixels_1[i * 2] * t1 + pixels_2[i * 2] * t2;
-            pixels[i * 2 + 1] = 1.0;
+            Color4 const * pixels_1 = (Color4 const *) image_row(task->image_1, z, y);
+            Color4 const * pixels_2 = (Color4 const *) image_row(task->image_2, z, y);
+            Color4 * pixels = (Color4 *) image_row(task->image, z, y);
+
+            for (int i = 0; i != size.x; ++ i)
+            {
+                pixels[i].c = color_blend(pixels_1[i].c, t1, pixels_2[i].c, t2);
+                pixels[i].a = 1.0;
+            }
         }
-    }
-    else if (format.format == GL_RGBA)
-    {
-        Color4 const * pixels_1 = (Color4 const *) image_1->pixels;
-        Color4 const * pixels_2 = (Color4 const *) image_2->pixels;
-        Color4 * pixels = (Color4 *) image->pixels;
+        else
+        {
+            float const * pixels_1 = (float const *) image_row(task->image_1, z, y);
+            float const * pixels_2 = (float const *) image_row(task->image_2, z, y);
+            float * pixels = (float *) image_row(task->image, z, y);
 
-        int count = size_total(size);
+            int count = size.x * format_to_size(format.format);
 
-        for (int i = 0; i != count; ++ i)
-        {
-            pixels[i].c = color_blend(pixels_1[i].c, t1, pixels_2[i].c, t2);
-            pixels[i].a = 1.0;
+            for (int i = 0; i != count; ++ i)
+            {
+                pixels[i] = pixels_1[i] * t1 + pixels_2[i] * t2;
+            }
         }
     }
-    else
-    {
-        float const * pixels_1 = (float const *) image_1->pixels;
-        float const * pixels_2 = (float const *) image_2->pixels;
-        float * pixels = (float *) image->pixels;
+}
+
+Image * image_blend(Image const * image_1, float t1, Image const * image_2, float t2)
+{
+    error_check(! image_format_equal(image_1->format, image_2->format), "image to blend must have same image format");
+    error_check(image_1->format.type   != GL_FLOAT,     "image to blend must have type float");
+    error_check(image_1->format.layout != IMAGE_INTERLEAVED, "image to blend must be interleaved");
+    //error_check(image_1->format.size.z != 1 && image_2->format.size.z != 1 || image_1->format.size.z != image_2->format.size.z, "one of the image depths must be 1 or they must have the same depth");
+    // TODO support single depth
 
-        int count = size_total(size) * format_to_size(format.format);
+    Image_Format format = image_1->format;
+    Size size  = format.size;
 
-        for (int i = 0; i != count; ++ i)
-        {
-            pixels[i] = pixels_1[i] * t1 + pixels_2[i] * t2;
-        }
-    }
+    Image * image = image_new(format);
+    Blend_Task task = {image_1, image_2, image, t1, t2};
+
+    parallel_for(size.y * size.z, 1, blend_rows, &task);
 
     return image;
 }
@@ -2553,37 +2371,43 @@ void image_assign_square(Image * image)
 {
     error_check(image->format.type != GL_FLOAT, "image to square must have type float");
 
+    check_interleaved(image);
+
     Image_Format format = image->format;
     Size size = format.size;
 
-    if (format.format == GL_RGBA)
+    for (int j = 0; j != size.z; ++ j)
+    for (int k = 0; k != size.y; ++ k)
     {
-        int count = size_total(size);
-        Color4 * pixels = (Color4 *) image->pixels;
-        
-        for (int i = 0; i != count; ++ i)
+        if (format.format == GL_RGBA)
         {
-            pixels[i].c = color_square(pixels[i].c);
+            int count = size.x;
+            Color4 * pixels = (Color4 *) image_row(image, j, k);
+            
+            for (int i = 0; i != count; ++ i)
+            {
+                pixels[i].c = color_square(pixels[i].c);
+            }
         }
-    }
-    else if (format.format == GL_LUMINANCE_ALPHA)
-    {
-        int count = size_total(size);
-        float * pixels = (float *) image->pixels;
-
-        for (int i = 0; i != count; ++ i)
+        else if (format.format == GL_LUMINANCE_ALPHA)
         {
-            pixels[i * 2] = SQ(pixels[i * 2]);
-        }
-    }
-    else
-    {
-        int count = size_total(size) * format_to_size(format.format);
-        float * pixels = (float *) image->pixels;
+            int count = size.x;
+            float * pixels = (float *) image_row(image, j, k);
 
-        for (int i = 0; i != count; ++ i)
+            for (int i = 0; i != count; ++ i)
+            {
+                pixels[i * 2] = SQ(pixels[i * 2]);
+            }
+        }
+        else
         {
-            pixels[i] = SQ(pixels[i]);
+            int count = size.x * format_to_size(format.format);
+            float * pixels = (float *) image_row(image, j, k);
+
+            for (int i = 0; i != count; ++ i)
+            {
+                pixels[i] = SQ(pixels[i]);
+            }
         }
     }
 }
@@ -2592,48 +2416,53 @@ Image * image_divide(Image const * source_1, Image const * source_2, float clamp
 {
     error_check(! image_format_equal(source_1->format, source_2->format), "image to divide must have same image format");
     error_check(source_1->format.type   != GL_FLOAT,     "image to divide must have type float");
+    check_interleaved(source_1);
 
     Image_Format format = source_1->format;
     Size size = format.size;
 
     Image * target = image_new(format);
 
-    if (format.format == GL_RGBA)
+    for (int j = 0; j != size.z; ++ j)
+    for (int k = 0; k != size.y; ++ k)
     {
-        Color min_color = {clamp_value, clamp_value, clamp_value};
-        int count = size_total(size);
-        Color4 const * source_pixels_1 = (Color4 const *) source_1->pixels;
-        Color4 const * source_pixels_2 = (Color4 const *) source_2->pixels;
-        Color4       * target_pixels   = (Color4       *) target->pixels;
-
-        for (int i = 0; i != count; ++ i)
+        if (format.format == GL_RGBA)
         {
-            target_pixels[i].c = color_div(source_pixels_1[i].c, color_clamp_min(source_pixels_2[i].c, min_color));
-            target_pixels[i].a = 1;
-        }
-    }
-    else if (format.format == GL_LUMINANCE_ALPHA)
-    {
-        int count = size_total(size);
-        float const * source_pixels_1 = (float const *) source_1->pixels;
-        float const * source_pixels_2 = (float const *) source_2->pixels;
-        float       * target_pixels   = (float       *) target->pixels;
+            Color min_color = {clamp_value, clamp_value, clamp_value};
+            int count = size.x;
+            Color4 const * source_pixels_1 = (Color4 const *) image_row(source_1, j, k);
+            Color4 const * source_pixels_2 = (Color4 const *) image_row(source_2, j, k);
+            Color4       * target_pixels   = (Color4       *) image_row(target, j, k);
 
-        for (int i = 0; i != count; ++ i)
-        {
-            target_pixels[i * 2] = source_pixels_1[i * 2] / clamp_to(source_pixels_2[i * 2], clamp_value, FLT_MAX);
+            for (int i = 0; i != count; ++ i)
+            {
+                target_pixels[i].c = color_div(source_pixels_1[i].c, color_clamp_min(source_pixels_2[i].c, min_color));
+                target_pixels[i].a = 1;
+            }
         }
-    }
-    else
-    {
-        int count = size_total(size) * format_to_size(format.format);
-        float const * source_pixels_1 = (float const *) source_1->pixels;
-        float const * source_pixels_2 = (float const *) source_2->pixels;
-        float       * target_pixels   = (float       *) target->pixels;
+        else if (format.format == GL_LUMINANCE_ALPHA)
+        {
+            int count = size.x;
+            float const * source_pixels_1 = (float const *) image_row(source_1, j, k);
+            float const * source_pixels_2 = (float const *) image_row(source_2, j, k);
+            float       * target_pixels   = (float       *) image_row(target, j, k);
 
-        for (int i = 0; i != count; ++ i)
+            for (int i = 0; i != count; ++ i)
+            {
+                target_pixels[i * 2] = source_pixels_1[i * 2] / clamp_to(source_pixels_2[i * 2], clamp_value, FLT_MAX);
+            }
+        }
+        else
         {
-            target_pixels[i] = source_pixels_1[i] / clamp_to(source_pixels_2[i], clamp_value, FLT_MAX);
+            int count = size.x * format_to_size(format.format);
+            float const * source_pixels_1 = (float const *) image_row(source_1, j, k);
+            float const * source_pixels_2 = (float const *) image_row(source_2, j, k);
+            float       * target_pixels   = (float       *) image_row(target, j, k);
+
+            for (int i = 0; i != count; ++ i)
+            {
+                target_pixels[i] = source_pixels_1[i] / clamp_to(source_pixels_2[i], clamp_value, FLT_MAX);
+            }
         }
     }
 
@@ -2642,19 +2471,26 @@ Image * image_divide(Image const * source_1, Image const * source_2, float clamp
 
 void image_clean_nan(Image * image)
 {
+    check_interleaved(image);
+
     Image_Format format = image->format;
 
     error_check(format.type != GL_FLOAT, "image to clean must have type float");
 
     Size size = format.size;
 
-    int count = size_total(size) * format_to_size(format.format);
-    float * pixels = (float *) image->pixels;
+    int count = size.x * format_to_size(format.format);
 
-    for (int i = 0; i != count; ++ i)
+    for (int j = 0; j != size.z; ++ j)
+    for (int k = 0; k != size.y; ++ k)
     {
-        if (isnan(pixels[i]))
-            pixels[i] = 0;
+        float * pixels = (float *) image_row(image, j, k);
+
+        for (int i = 0; i != count; ++ i)
+        {
+            if (isnan(pixels[i]))
+                pixels[i] = 0;
+        }
     }
 }
 
@@ -2664,148 +2500,88 @@ Image * image_merge(Image const * const * images, int count)
 
     for (int i = 1; i != count; ++ i)
     {
-        Image_Format format = images[i]->format;
-        Size size = format.size;
-
-        error_check(merged_format.type   != format.type ||
-                    merged_format.format != format.format, "format and type of images must be equal");
-        error_check(merged_format.size.x != size.x ||
-                    merged_format.size.y != size.y, "X and Y dimensions of images must be equal");
-
-        merged_format.size.z += size.z;
-    }
-
-    Image * image = image_new(merged_format);
-    char * pixels = (char *) image->pixels;
-
-    for (int i = 0; i != count; ++ i)
-    {
-        Image_Format format = images[i]->format;
-        int byte_count = image_format_bytes(format);
-
-        memcpy(pixels, images[i]->pixels, byte_count);
-        pixels += byte_count;
-    }
-
-    return image;
-}
-
-float image_mse(Image const * source, Image const * reference, int relative)
-{
-    Image * squared_error = image_squared_error(source, reference, relative);
-
-    Image_Format format = squared_error->format;
-    //int pixel_count = image_format_pixels(format);
-    int count = format_to_size(format.format) * size_total(format.size);
-
-    float acc = 0;
-
-    if (format.type == GL_FLOAT)
-    {
-        float const * pixels = (float const *) squared_error->pixels;
-        for (int i = 0; i != count; ++ i) {acc += pixels[i];}
-    }
-    else if (format.type == GL_UNSIGNED_BYTE)
-    {
-        unsigned char const * pixels = (unsigned char const *) squared_error->pixels;
-        for (int i = 0; i != count; ++ i) {acc += pixels[i];}
-    }
-    else
-    {
-        error_fail("image_mse: unsupported type");
-    }
-
-    return acc / count;
-}
-
-float image_rmse(float mse) { return sqrt(mse) * 255; }
-float image_psnr(float mse) { return - 10 * log(mse) / log(10.0); }
-
-#if 0
-Image * image_ssim(Image const * sources, Image const * reference)
-{
-    float L  = 1.0;
-    float k1 = 0.01;
-    float k2 = 0.02;
-    float gaussian = 1;
+        Image_Format format = images[i]->format;
+        Size size = format.size;
 
-    float c1 = SQ(k1 * L);
-    float c2 = SQ(k2 * L);
+        error_check(merged_format.type   != format.type ||
+                    merged_format.format != format.format, "format and type of images must be equal");
+        error_check(merged_format.size.x != size.x ||
+                    merged_format.size.y != size.y, "X and Y dimensions of images must be equal");
 
-    float n;
-    float * k;
-    if (gaussian)
-    {
-        n = 11;
-        k = // kernel
+        merged_format.size.z += size.z;
     }
-    else
+
+    Image * image = image_new(merged_format);
+    char * pixels = (char *) image->pixels;
+
+    for (int i = 0; i != count; ++ i)
     {
-        n = 8;
-        k = // kernel
+        Image_Format format = images[i]->format;
+        size_t byte_count = image_format_bytes(format);
+
+        memcpy(pixels, images[i]->pixels, byte_count);
+        pixels += byte_count;
     }
 
-    mx2 = image_square(mx);
-    my2 = image_square(my);
-    mx_my = image_multiply(mx, my);
+    return image;
+}
 
-    sx2 = // conv
-    sy2 = // conv
-    sxz = // conv
+static Image_Expression * squared_error(Image const * sources, Image const * reference, int relative)
+{
+    static float const clamp_value = 0.01;
+    Image_Expression * difference = image_expression_subtract(image_expression_image(sources), image_expression_image(reference));
 
-    Image * ssim = .... // sum and divide images
+    if (relative)
+        difference = image_expression_divide(difference, image_expression_image(reference), clamp_value);
 
-    return ssim;
+    return image_expression_square(difference);
 }
 
-float image_mssim(Image const * sources, Image const * reference)
+float image_mse(Image const * source, Image const * reference, int relative)
 {
-    Image * ssim = image_ssim(sources, reference);
+    Image_Expression * error = squared_error(source, reference, relative);
+    Image_Format format = image_expression_format(error);
+    int channels = format_to_size(format.format);
+    double sums[4], acc = 0;
+
+    image_expression_sum(error, sums);
+    image_expression_destroy(error);
 
-    // ...
-    return 42;
+    for (int c = 0; c != channels; ++ c)
+        acc += sums[c];
+
+    return acc / ((double) channels * size_total(format.size));
 }
 
-float image_dmssim(float mssim) { return 1.0 / mssim - 1.0; }
-#endif
+float image_rmse(float mse) { return sqrt(mse) * 255; }
+float image_psnr(float mse) { return - 10 * log(mse) / log(10.0); }
+
 
 
 Image * image_squared_error(Image const * sources, Image const * reference, int relative)
 {
-    Image * difference = image_subtract(sources, reference);
-    Image * error;
-
-    if (relative)
-    {
-        static float const clamp_value = 0.01;
-        error = image_divide(difference, reference, clamp_value);
-        image_destroy(difference);
-    }
-    else
-        error = difference;
+    Image_Expression * error = squared_error(sources, reference, relative);
+    Image * image = image_expression_evaluate(error);
 
-    image_assign_square(error);
+    image_expression_destroy(error);
 
-    return error;
+    return image;
 }
 
 Image * image_squared_error_visual(Image const * sources, Image const * reference)
 {
-    //Image * error = image_squared_error(sources, reference, 1);
-    Image * error = image_subtract(sources, reference);
-    image_assign_square(error);
-
     Image * laplacian = kernel_laplacian_2();
     Image * edge = image_new(reference->format);
     image_splat(edge, reference, laplacian, 0);
-    image_assign_square(edge);
 
     static float const clamp_value = 0.0001;
-    Image * error2 = image_divide(error, edge, clamp_value);
+    Image_Expression * error = image_expression_square(image_expression_subtract(image_expression_image(sources), image_expression_image(reference)));
+    Image_Expression * visual = image_expression_divide(error, image_expression_square(image_expression_image(edge)), clamp_value);
+    Image * error2 = image_expression_evaluate(visual);
 
+    image_expression_destroy(visual);
     image_destroy(edge);
     image_destroy(laplacian);
-    image_destroy(error);
 
     return error2;
 }
@@ -2943,7 +2719,7 @@ Image * image_duplicate_layers(Image const * source, int layer_count)
     error_check(layer_count < 1, "target image must have at least 1 layer");
 
     Image_Format source_format = source->format;
-    int byte_count = image_format_bytes(source_format);
+    size_t byte_count = image_format_bytes(source_format);
 
     Image_Format target_format = source_format;
     target_format.size.z = layer_count;
@@ -2959,160 +2735,17 @@ Image * image_duplicate_layers(Image const * source, int layer_count)
     return target;
 }
 
-static Color filter_mean(Image const * image, Image const * kernel, int x, int y)
-{
-    Size  image_size =  image->format.size;
-    Size kernel_size = kernel->format.size;
-
-    Color accumulator = BLACK;
-
-    for (int i = 0; i != kernel_size.y; ++ i)
-    for (int j = 0; j != kernel_size.x; ++ j)
-    {
-        int  pixel_index = size_index( image_size, 0, y + i, x + j);
-        int weight_index = size_index(kernel_size, 0, i, j);
-
-        color_accumulate(&accumulator,
-            ((Color const *)  image->pixels)[pixel_index],
-            ((float const *) kernel->pixels)[weight_index]);
-    }
-
-    return accumulator;
-}
-
-static Color filter_std_dev(Image const * image, Image const * kernel, int x, int y, Color mean)
-{
-    Size  image_size =  image->format.size;
-    Size kernel_size = kernel->format.size;
-
-    Color accumulator = BLACK;
-
-    for (int i = 0; i != kernel_size.y; ++ i)
-    for (int j = 0; j != kernel_size.x; ++ j)
-    {
-        int  pixel_index = size_index( image_size, 0, y + i, x + j);
-        int weight_index = size_index(kernel_size, 0, i, j);
-
-        Color value = color_sub(((Color const *) image->pixels)[pixel_index], mean);
-        color_accumulate(&accumulator, color_square(value), ((float const *) kernel->pixels)[weight_index]);
-    }
-
-    return color_sqrt(accumulator);
-}
-
-static Color filter_std_dev_12(Image const * image_1, Image const * image_2, Image const * kernel, int x, int y, Color mean_1, Color mean_2)
-{
-    Size  image_size = image_1->format.size;
-    Size kernel_size =  kernel->format.size;
-
-    Color accumulator = BLACK;
-
-    for (int i = 0; i != kernel_size.y; ++ i)
-    for (int j = 0; j != kernel_size.x; ++ j)
-    {
-        int  pixel_index = size_index( image_size, 0, y + i, x + j);
-        int weight_index = size_index(kernel_size, 0, i, j);
-
-        Color value_1 = color_sub(((Color const *) image_1->pixels)[pixel_index], mean_1);
-        Color value_2 = color_sub(((Color const *) image_2->pixels)[pixel_index], mean_2);
-
-        color_accumulate(&accumulator, color_multiply(value_1, value_2, 1), ((float const *) kernel->pixels)[weight_index]);
-    }
-
-    return accumulator;
-}
-
 Color image_mssim(Image const * image_1, Image const * image_2, float L, float k_1, float k_2, float alpha, float beta, float gamma)
 {
-    error_check(! image_format_equal(image_1->format, image_2->format), "MSSIM requires both images to have same format");
-    error_check(image_1->format.type != GL_FLOAT, "MSSIM image type must be float");
-    error_check(image_1->format.format != GL_RGB, "MSSIM image format must be rgb");
-    error_check(image_1->format.size.z != 1, "MSSIM image depth must be 1");
-
-#if 0
-    static int const kernel_width = 11;
-#else
-    static int const kernel_width = 5;
-#endif
-
-    float c_1 = SQ(k_1 * L);
-    float c_2 = SQ(k_2 * L);
-    float c_3 = c_2 / 2;
-
-    Color C_1 = {c_1, c_1, c_1};
-    Color C_2 = {c_2, c_2, c_2};
-    Color C_3 = {c_3, c_3, c_3};
-
-#if 1
-    static float const sigma = 1.5;
-    Image * kernel = kernel_gaussian_2d(kernel_width, sigma, ORIGIN);
-#else
-    Image * kernel = kernel_box_2d(kernel_width, ORIGIN);
-#endif
-
-    Size size = image_1->format.size;
-    Size map_size = {size.x - kernel_width, size.y - kernel_width, 1};
-
-    Image_Format format = {GL_FLOAT, GL_RGB, map_size};
-    Image * ssim_map = image_new(format);
-    Color * pixels = (Color *) ssim_map->pixels;
-
-    Color m_1, m_2, s_1, s_2, s_12, n1, n2, n3, d1, d2, d3;
-    int i, j, index;
-#ifdef OMP
-    #pragma omp parallel for private(i, j, index, m_1, m_2, s_1, s_2, s_12, n1, n2, n3, d1, d2, d3)
-#endif
-    for (i = 0; i < map_size.y; ++ i)
-    {
-        for (j = 0; j < map_size.x; ++ j)
-        {
-            m_1  = filter_mean(image_1, kernel, j, i);
-            m_2  = filter_mean(image_2, kernel, j, i);
-            s_1  = filter_std_dev(image_1, kernel, j, i, m_1);
-            s_2  = filter_std_dev(image_2, kernel, j, i, m_2);
-            s_12 = filter_std_dev_12(image_1, image_2, kernel, j, i, m_1, m_2);
-
-            n1 = color_add(color_multiply(m_1, m_2, 2), C_1);
-            d1 = color_add_3(color_square(m_1), color_square(m_2), C_1);
-
-#if 0
-            n2 = color_add(color_scale(s_12, 2), C_2);
-            d2 = color_add_3(color_square(s_1), color_square(s_2), C_2);
-#else
-            n2 = color_add(color_scale(color_mul(s_1, s_2), 2), C_2);
-            d2 = color_add_3(color_square(s_1), color_square(s_2), C_2);
-
-            n3 = color_add(s_12, C_3);
-            d3 = color_add(color_mul(s_1, s_2), C_3);
-#endif
-
-            index = size_index(map_size, 0, i, j);
-#if 0
-            pixels[index] = color_div(color_mul(n1, n2), color_mul(d1, d2));
-#else
-            Color a = color_pow(color_div(n1, d1), alpha);
-            Color b = color_pow(color_div(n2, d2), beta);
-            Color c = color_pow(color_div(n3, d3), gamma);
-
-            pixels[index] = color_mul(color_mul(a, b), c);
-#endif
-        }
-    }
+    error_check(format_to_size(image_1->format.format) < 3, "MSSIM image format must have color channels");
 
-    Color accumulator = BLACK;
-
-    for (i = 0; i != map_size.y; ++ i)
-    for (j = 0; j != map_size.x; ++ j)
-    {
-        index = size_index(map_size, 0, i, j);
-        color_accumulate(&accumulator, pixels[index], 1.0);
-    }
+    Ssim_Parameters parameters = {L, k_1, k_2, alpha, beta, gamma, 1.5, 5};
+    double means[SSIM_CHANNELS];
 
-    image_destroy(ssim_map);
-    image_destroy(kernel);
+    image_ssim_mean(image_1, image_2, &parameters, means);
 
-    int pixel_count = map_size.x * map_size.y;
-    return color_scale(accumulator, 1.0 / pixel_count);
+    Color mean = {means[0], means[1], means[2]};
+    return mean;
 }
 
 float color_squared_relative_error(Color ref, Color c)
@@ -3128,6 +2761,8 @@ float color_squared_relative_error(Color ref, Color c)
 
 float image_similar(Image const * reference, Image const * image, float tolerance)
 {
+    check_interleaved(reference);
+
     error_check(! image_format_equal(reference->format, image->format), "image_similar requires both images to have same format");
     error_check(reference->format.type != GL_FLOAT, "image_similar image type must be float");
     error_check(reference->format.format != GL_RGB, "image_similar image format must be rgb");
@@ -3135,21 +2770,21 @@ float image_similar(Image const * reference, Image const * image, float toleranc
     Image_Format format = reference->format;
     Size size = format.size;
 
-    Color const * reference_pixels = (Color const *) reference->pixels;
-    Color const * image_pixels = (Color const *) image->pixels;
-
     int not_converged = 0;
 
     for (int i = 0; i != size.z; ++ i)
     for (int j = 0; j != size.y; ++ j)
-    for (int k = 0; k != size.x; ++ k)
     {
-        int index = size_index(size, i, j, k);
+        Color const * reference_pixels = (Color const *) image_row(reference, i, j);
+        Color const * image_pixels = (Color const *) image_row(image, i, j);
 
-        float error = color_squared_relative_error(reference_pixels[index], image_pixels[index]);
+        for (int k = 0; k != size.x; ++ k)
+        {
+            float error = color_squared_relative_error(reference_pixels[k], image_pixels[k]);
 
-        if (error > tolerance)
-            ++ not_converged;
+            if (error > tolerance)
+                ++ not_converged;
+        }
     }
 
     int pixel_count = size_total(size);
@@ -3158,35 +2793,38 @@ float image_similar(Image const * reference, Image const * image, float toleranc
 
 float * image_error_distribution(Image const * image, int n, int logarithmic)
 {
+    check_interleaved(image);
+
     error_check(image->format.type != GL_FLOAT, "image_error_distribution image type must be float");
     error_check(image->format.format != GL_RGB, "image_error_distribution image format must be rgb");
 
     Size size = image->format.size;
-    Color const * pixels = (Color const *) image->pixels;
 
     float * distribution = calloc_array(float, n);
 
     for (int i = 0; i != size.z; ++ i)
     for (int j = 0; j != size.y; ++ j)
-    for (int k = 0; k != size.x; ++ k)
     {
-        int index = size_index(size, i, j, k);
+        Color const * pixels = (Color const *) image_row(image, i, j);
 
-        Color color = pixels[index];
-        float error = (color.r + color.g + color.b) / 3.0;
+        for (int k = 0; k != size.x; ++ k)
+        {
+            Color color = pixels[k];
+            float error = (color.r + color.g + color.b) / 3.0;
 
-        //float value = - log(error) / log(10.0);
-        float value = logarithmic ? - log(error) / log(2.0) : error / 0.0003;
+            //float value = - log(error) / log(10.0);
+            float value = logarithmic ? - log(error) / log(2.0) : error / 0.0003;
 
-        int error_index;
-        if (value < 0)
-            error_index = 0;
-        else if (value >= n)
-            error_index = n - 1;
-        else
-            error_index = (int) value;
+            int error_index;
+            if (value < 0)
+                error_index = 0;
+            else if (value >= n)
+                error_index = n - 1;
+            else
+                error_index = (int) value;
 
-        distribution[error_index] += 1.0;
+            distribution[error_index] += 1.0;
+        }
     }
 
     int pixel_count = size_total(size);
@@ -3233,59 +2871,40 @@ Image * image_to_lab(Image const * source)
 void image_splat(Image * target, Image const * source, Image const * kernel, int rescale)
 {
     error_check(! image_format_equal(target->format, source->format), "image_splat requires target and source to have same format");
-    error_check(target->format.type != GL_FLOAT, "image_splat type must be luminance");
-    error_check(target->format.format != GL_RGB, "image_splat format must be rgb");
+    error_check(rescale && target->format.type != GL_FLOAT, "image_splat rescale type must be float");
     error_check(kernel->format.type != GL_FLOAT, "image_splat kernel type must be float");
     error_check(kernel->format.format != GL_LUMINANCE, "image_splat kernel format must be luminance");
 
-    Size target_size = target->format.size;
-    Size source_size = source->format.size;
-    Size kernel_size = kernel->format.size;
-    Size kernel_half_size = {kernel_size.x / 2, kernel_size.y / 2, 1};
-
-    Color       * target_pixels = (Color       *) target->pixels;
-    Color const * source_pixels = (Color const *) source->pixels;
-    float const * kernel_pixels = (float const *) kernel->pixels;
-
-    // add omp
-    for (int i = 0; i != target_size.z; ++ i)
-    for (int j = 0; j != target_size.y; ++ j)
-    {
-        int k;
-#ifdef OMP
-    #pragma omp parallel for
-#endif
-    for (k = 0; k < target_size.x; ++ k)
-    {
-        int target_index = size_index(target_size, i, j, k);
-
-        Color accumulator = BLACK;
-        float accumulated_weight = 0.0;
+    image_convolve_kernel_into(source, target, kernel, BORDER_BLACK);
 
-        for (int l = 0; l != kernel_size.y; ++ l)
-        for (int m = 0; m != kernel_size.x; ++ m)
-        {
-            int n = j + l - kernel_half_size.y;
-            int o = k + m - kernel_half_size.x;
+    if (! rescale)
+        return;
 
-            if (n < 0 || n >= source_size.y) continue;
-            if (o < 0 || o >= source_size.x) continue;
+    // divide by the weight that fell inside the source
+    Size size = target->format.size;
+    Image_Format format = {GL_FLOAT, GL_LUMINANCE, {size.x, size.y, 1}};
+    Image * ones = image_new(format);
+    float * one_pixels = (float *) ones->pixels;
 
-            int kernel_index = size_index(kernel_size, 0, l, m);
-            int source_index = size_index(source_size, i, n, o);
+    for (int i = 0; i != size.x * size.y; ++ i)
+        one_pixels[i] = 1;
 
-            float weight = kernel_pixels[kernel_index];
+    Image * weights = image_convolve_kernel(ones, kernel, BORDER_BLACK);
+    float const * weight_pixels = (float const *) weights->pixels;
+    int channels = format_to_size(target->format.format);
 
-            color_accumulate(&accumulator, source_pixels[source_index], weight);
-            accumulated_weight += weight;
-        }
+    for (int i = 0; i != size.z; ++ i)
+    for (int j = 0; j != size.y; ++ j)
+    {
+        float * row = (float *) image_row(target, i, j);
 
-        if (rescale)
-            target_pixels[target_index] = color_scale(accumulator, 1.0 / accumulated_weight);
-        else
-            target_pixels[target_index] = accumulator;
-    }
+        for (int k = 0; k != size.x; ++ k)
+        for (int l = 0; l != channels; ++ l)
+            row[k * channels + l] /= weight_pixels[j * size.x + k];
     }
+
+    image_destroy(weights);
+    image_destroy(ones);
 }
 
 void image_update_mean(Image * mean_n, Image const * x_n1, int n)
@@ -3293,21 +2912,20 @@ void image_update_mean(Image * mean_n, Image const * x_n1, int n)
     error_check(! image_format_equal(mean_n->format, x_n1->format), "image_update_mean must have same format");
     error_check(mean_n->format.type != GL_FLOAT, "image_update_mean type must be float");
     error_check(mean_n->format.format != GL_RGB, "image_update_mean format must be rgb");
+    check_interleaved(mean_n);
 
     Size size = mean_n->format.size;
 
-    Color       * target_pixels = (Color       *) mean_n->pixels;
-    Color const * source_pixels = (Color const *) x_n1->pixels;
-
     float scale = 1.0 / (n + 1);
 
     for (int i = 0; i != size.z; ++ i)
     for (int j = 0; j != size.y; ++ j)
-    for (int k = 0; k != size.x; ++ k)
     {
-        int index = size_index(size, i, j, k);
+        Color       * target_pixels = (Color       *) image_row(mean_n, i, j);
+        Color const * source_pixels = (Color const *) image_row(x_n1, i, j);
 
-        target_pixels[index] = color_scale(color_add(color_scale(target_pixels[index], n), source_pixels[index]), scale);
+        for (int k = 0; k != size.x; ++ k)
+            target_pixels[k] = color_scale(color_add(color_scale(target_pixels[k], n), source_pixels[k]), scale);
     }
 }
 
@@ -3316,13 +2934,11 @@ void image_update_variance(Image * var_n, Image const * mean_n1, Image const * x
     error_check(! image_format_equal(var_n->format, x_n1->format), "image_update_mean must have same format");
     error_check(var_n->format.type != GL_FLOAT, "image_update_mean type must be float");
     error_check(var_n->format.format != GL_RGB, "image_update_mean format must be rgb");
+    error_check(! image_format_equal(var_n->format, mean_n1->format), "image_update_variance must have same format");
+    check_interleaved(var_n);
 
     Size size = var_n->format.size;
 
-    Color       *     var_pixels = (Color       *) var_n->pixels;
-    Color const * mean_n1_pixels = (Color const *) mean_n1->pixels;
-    Color const *    x_n1_pixels = (Color const *) x_n1->pixels;
-
     // biased variance
     if (n == 0)
     {
@@ -3332,214 +2948,95 @@ void image_update_variance(Image * var_n, Image const * mean_n1, Image const * x
 
     for (int i = 0; i != size.z; ++ i)
     for (int j = 0; j != size.y; ++ j)
-    for (int k = 0; k != size.x; ++ k)
-    {
-        int index = size_index(size, i, j, k);
-
-        Color a = color_scale(var_pixels[index], (float) n / (n + 1));
-        Color b = color_scale(color_square(color_sub(x_n1_pixels[index], mean_n1_pixels[index])), 1.0 / n);
-        var_pixels[index] = color_add(a, b);
-    }
-}
-
-static int compare(void const * data_1, void const * data_2)
-{
-    float value_1 = * ((float const *) data_1);
-    float value_2 = * ((float const *) data_2);
-
-    float delta = value_1 - value_2;
-    return signum(delta);
-}
-
-static void initialize_offsets(int offsets[], int width, Size stride)
-{
-    for (int i = 0; i != width; ++ i)
-    for (int j = 0; j != width; ++ j)
     {
-        int k = i - width/2;
-        int l = j - width/2;
+        Color       *     var_pixels = (Color       *) image_row(var_n, i, j);
+        Color const * mean_n1_pixels = (Color const *) image_row(mean_n1, i, j);
+        Color const *    x_n1_pixels = (Color const *) image_row(x_n1, i, j);
 
-        offsets[i*width + j] = stride.x * l + stride.y * k;
+        for (int k = 0; k != size.x; ++ k)
+        {
+            Color a = color_scale(var_pixels[k], (float) n / (n + 1));
+            Color b = color_scale(color_square(color_sub(x_n1_pixels[k], mean_n1_pixels[k])), 1.0 / n);
+            var_pixels[k] = color_add(a, b);
+        }
     }
 }
 
 Image * image_filter_median(Image const * source, int width, int median_index)
 {
-    error_check(source->format.type != GL_FLOAT, "imean_filter_median type must be float");
-    error_check(source->format.format != GL_RGB, "image_filter_median format must be rgb");
-    error_check((width % 2) == 0, "median filter size must be odd");
-    error_check(median_index >= 0 && median_index < SQ(width) - 1, "median index must be in [0, w^2)");
-
-    int width_2 = width / 2;
-
-    Image_Format format = source->format;
-    Image * target = image_new(format);
-
-    float const * source_pixels = (float const *) source->pixels;
-    float       * target_pixels = (float       *) target->pixels;
-
-    Size size   = format.size;
-    Size stride = size_stride(size);
-
-    int * offsets = malloc_array(int, width * width);
-    initialize_offsets(offsets, width, stride);
-    float * buffer = malloc_array(float, width * width);
-
-    for (int i = 0; i != size.z; ++ i)
-    for (int j = 0; j != size.y; ++ j)
-    for (int k = 0; k != size.x; ++ k)
-    {
-        int target_index = size_index(size, i, j, k);
-
-        for (int l = 0; l != 3; ++ l)
-        {
-            int count = 0;
-
-            for (int m = -width_2; m <= width_2; ++ m)
-            {
-                if (j + m < 0 || j + m >= size.y) continue;
-
-                for (int n = -width_2; n <= width_2; ++ n)
-                {
-                    if (k + n < 0 || k + n > size.x) continue;
-                    
-                    buffer[count ++] = source_pixels[(target_index + offsets[(width_2 + m) * width + width_2 + n]) * 3 + l];
-                }
-            }
-
-            qsort(buffer, count, sizeof(float), compare);
-
-            target_pixels[target_index * 3 + l] = buffer[median_index];
-        }
-    }
-
-    free(offsets);
-    free(buffer);
-
-    return target;
+    return image_filter_rank(source, width, median_index);
 }
 
 Image * image_filter_median_weighted(Image const * source)
 {
-    int const width = 3;
-    int median_index = 7;
-
-    error_check(source->format.type != GL_FLOAT, "imean_filter_median type must be float");
-    error_check(source->format.format != GL_RGB, "image_filter_median format must be rgb");
-    error_check((width % 2) == 0, "median filter size must be odd");
-
-    int width_2 = width / 2;
-
-    Image_Format format = source->format;
-    Image * target = image_new(format);
-
-    float const * source_pixels = (float const *) source->pixels;
-    float       * target_pixels = (float       *) target->pixels;
-
-    Size size   = format.size;
-    Size stride = size_stride(size);
-
-    int * offsets = malloc_array(int, width * width);
-    initialize_offsets(offsets, width, stride);
-
-    float * buffer = malloc_array(float, 15); //width * width);
-
-    static float const weights[3][3] =
+    static int const weights[3 * 3] =
     {
-        {1, 2, 1},
-        {2, 3, 2},
-        {1, 2, 1}
+        1, 2, 1,
+        2, 3, 2,
+        1, 2, 1
     };
 
-    for (int i = 0; i != size.z; ++ i)
-    for (int j = 0; j != size.y; ++ j)
-    for (int k = 0; k != size.x; ++ k)
-    {
-        int target_index = size_index(size, i, j, k);
-
-        for (int l = 0; l != 3; ++ l)
-        {
-            int count = 0;
-
-            for (int m = -width_2; m <= width_2; ++ m)
-            {
-                if (j + m < 0 || j + m >= size.y) continue;
-
-                for (int n = -width_2; n <= width_2; ++ n)
-                {
-                    if (k + n < 0 || k + n > size.x) continue;
-                    
-                    float value = source_pixels[(target_index + offsets[(width_2 + m) * width + width_2 + n]) * 3 + l];
-                    for (int p = 0; p != weights[m + width_2][n + width_2]; ++ p)
-                    {
-                        buffer[count ++] = value;
-                    }
-
-                }
-            }
-
-            qsort(buffer, count, sizeof(float), compare);
-
-            target_pixels[target_index * 3 + l] = buffer[median_index];
-        }
-    }
-
-    free(offsets);
-    free(buffer);
-
-    return target;
+    return image_filter_rank_weighted(source, 3, weights, 7);
 }
 
 void image_add_procedural(Image * image, float (* proc)(void *), void * data)
 {
-    Image_Format format = image->format;
+    check_interleaved(image);
 
-    int count = format_to_size(format.format) * size_total(format.size);
+    Image_Format format = image->format;
+    Size size = format.size;
+    int count = format_to_size(format.format) * size.x;
 
-    switch (format.type)
+    for (int j = 0; j != size.z; ++ j)
+    for (int k = 0; k != size.y; ++ k)
     {
-        case GL_UNSIGNED_BYTE:
+        void * row = image_row(image, j, k);
+
+        switch (format.type)
         {
-            unsigned char * pixels = (unsigned char *) image->pixels;
-            for (int i = 0; i != count; ++ i)
+            case GL_UNSIGNED_BYTE:
             {
-                pixels[i] += (unsigned char) floor(256 * proc(data));
+                unsigned char * pixels = (unsigned char *) row;
+                for (int i = 0; i != count; ++ i)
+                {
+                    pixels[i] += (unsigned char) floor(256 * proc(data));
+                }
+                break;
             }
-            break;
-        }
             
-        case GL_UNSIGNED_SHORT:
-        {
-            unsigned short * pixels = (unsigned short *) image->pixels;
-            for (int i = 0; i != count; ++ i)
+            case GL_UNSIGNED_SHORT:
             {
-                pixels[i] += (unsigned short) floor(65536 * proc(data));
+                unsigned short * pixels = (unsigned short *) row;
+                for (int i = 0; i != count; ++ i)
+                {
+                    pixels[i] += (unsigned short) floor(65536 * proc(data));
+                }
+                break;
             }
-            break;
-        }
 
-        case GL_FLOAT:
-        {
-            float * pixels = (float *) image->pixels;
-            for (int i = 0; i != count; ++ i)
+            case GL_FLOAT:
             {
-                pixels[i] += proc(data);
+                float * pixels = (float *) row;
+                for (int i = 0; i != count; ++ i)
+                {
+                    pixels[i] += proc(data);
+                }
+                break;
             }
-            break;
-        }
 
-        case GL_DOUBLE:
-        {
-            float * pixels = (float *) image->pixels;
-            for (int i = 0; i != count; ++ i)
+            case GL_DOUBLE:
             {
-                pixels[i] += proc(data);
+                float * pixels = (float *) row;
+                for (int i = 0; i != count; ++ i)
+                {
+                    pixels[i] += proc(data);
+                }
+                break;
             }
-            break;
+            default:
+               error_fail("image_add_procedural: unsupported type");
+               break;
         }
-        default:
-           error_fail("image_add_procedural: unsupported type");
-           break;
     }
 }
 
@@ -3577,18 +3074,23 @@ void image_add_noise_uniform(Image * image, float a, float b)
 
 void image_add_noise(Image * image, float sigma)
 {
+    check_interleaved(image);
+
     Image_Format format = image->format;
 
     error_check(format.type != GL_FLOAT, "image_add_noise image type must be float");
     error_check(format.format != GL_LUMINANCE && format.format != GL_RGB, "image_add_noise image format must be luminance or rgb");
 
-    int pixel_count = image_format_pixels(format);
+    Size size = format.size;
+    int pixel_count = size.x;
 
+    for (int j = 0; j != size.z; ++ j)
+    for (int k = 0; k != size.y; ++ k)
     switch (format.format)
     {
         case GL_LUMINANCE:
         {
-            float * pixels  = (float *) image->pixels;
+            float * pixels  = (float *) image_row(image, j, k);
             for (int i = 0; i < pixel_count; ++ i)
             {
                 pixels[i] += randn() * sigma;
@@ -3597,7 +3099,7 @@ void image_add_noise(Image * image, float sigma)
         }
         case GL_RGB:
         {
-            Color * pixels  = (Color *) image->pixels;
+            Color * pixels  = (Color *) image_row(image, j, k);
             for (int i = 0; i < pixel_count; ++ i)
             {
                 pixels[i].r += randn() * sigma;
@@ -3611,6 +3113,8 @@ void image_add_noise(Image * image, float sigma)
 
 void image_add_2(Image const * a, Image const * b, Image * c)
 {
+    check_interleaved(a);
+
     Image_Format a_format = a->format;
     Image_Format b_format = b->format;
     Image_Format c_format = c->format;
@@ -3619,15 +3123,18 @@ void image_add_2(Image const * a, Image const * b, Image * c)
     error_check(a_format.format != GL_LUMINANCE && a_format.format != GL_RGB, "image_add_2: format must be luminance or rgb");
     error_check(! image_format_equal(a_format, b_format) || ! image_format_equal(a_format, c_format), "image_add_2: image_format must match");
 
-    int pixel_count = image_format_pixels(a_format);
+    Size size = a_format.size;
+    int pixel_count = size.x;
 
+    for (int j = 0; j != size.z; ++ j)
+    for (int k = 0; k != size.y; ++ k)
     switch (a_format.format)
     {
         case GL_LUMINANCE:
         {
-            float const * a_pixels = (float const *) a->pixels;
-            float const * b_pixels = (float const *) b->pixels;
-            float       * c_pixels = (float       *) c->pixels;
+            float const * a_pixels = (float const *) image_row(a, j, k);
+            float const * b_pixels = (float const *) image_row(b, j, k);
+            float       * c_pixels = (float       *) image_row(c, j, k);
 
             for (int i = 0; i != pixel_count; ++ i)
             {
@@ -3637,9 +3144,9 @@ void image_add_2(Image const * a, Image const * b, Image * c)
         }
         case GL_RGB:
         {
-            Color const * a_pixels = (Color const *) a->pixels;
-            Color const * b_pixels = (Color const *) b->pixels;
-            Color       * c_pixels = (Color       *) c->pixels;
+            Color const * a_pixels = (Color const *) image_row(a, j, k);
+            Color const * b_pixels = (Color const *) image_row(b, j, k);
+            Color       * c_pixels = (Color       *) image_row(c, j, k);
 
             for (int i = 0; i != pixel_count; ++ i)
             {
@@ -3652,45 +3159,58 @@ void image_add_2(Image const * a, Image const * b, Image * c)
 
 void image_yuv_to_rgb(Image * image)
 {
+    check_interleaved(image);
+
     error_check(image->format.type != GL_FLOAT, "type must be float");
     error_check(image->format.format != GL_RGB, "format must be rgb");
 
-    int pixel_count = image_format_pixels(image->format);
-    Color * pixels = image->pixels;
+    Size size = image->format.size;
 
-    for (int i = 0; i != pixel_count; ++ i)
+    for (int j = 0; j != size.z; ++ j)
+    for (int k = 0; k != size.y; ++ k)
     {
-        Color c = pixels[i];
-        Color d =
+        Color * pixels = (Color *) image_row(image, j, k);
+
+        for (int i = 0; i != size.x; ++ i)
         {
-            c.r / sqrt(3) + c.g / sqrt(2) + c.b / sqrt(6),
-            c.r / sqrt(3)             - 2 * c.b / sqrt(6),
-            c.r / sqrt(3) - c.g / sqrt(2) + c.b / sqrt(6)
-        };
-        pixels[i] = d;
+            Color c = pixels[i];
+            Color d =
+            {
+                c.r / sqrt(3) + c.g / sqrt(2) + c.b / sqrt(6),
+                c.r / sqrt(3)             - 2 * c.b / sqrt(6),
+                c.r / sqrt(3) - c.g / sqrt(2) + c.b / sqrt(6)
+            };
+            pixels[i] = d;
+        }
     }
 }
 
 void image_rgb_to_yuv(Image * image)
 {   
+    check_interleaved(image);
     printf("%d\n", image->format.format);
 
     error_check(image->format.type != GL_FLOAT, "type must be float");
     error_check(image->format.format != GL_RGB, "format must be rgb");
 
-    int pixel_count = image_format_pixels(image->format);
-    Color * pixels = (Color *) image->pixels;
+    Size size = image->format.size;
+
+    for (int j = 0; j != size.z; ++ j)
+    for (int k = 0; k != size.y; ++ k)
+    {
+        Color * pixels = (Color *) image_row(image, j, k);
 
-    for (int i = 0; i != pixel_count; ++ i)
-    {   
-        Color c = pixels[i];
-        Color d = 
+        for (int i = 0; i != size.x; ++ i)
         {   
-            (c.r +   c.g + c.b) / sqrt(3),
-            (c.r         - c.b) / sqrt(2),
-            (c.r - 2*c.g + c.b) / sqrt(6)
-        };  
-        pixels[i] = d;
-    }   
+            Color c = pixels[i];
+            Color d = 
+            {   
+                (c.r +   c.g + c.b) / sqrt(3),
+                (c.r         - c.b) / sqrt(2),
+                (c.r - 2*c.g + c.b) / sqrt(6)
+            };  
+            pixels[i] = d;
+        }
+    }
 } 
 
@@ -4,10 +4,12 @@
 #include "box.h"
 #include "color.h"
 #include "image.h"
+#include "image_view.h"
 #include "math_.h"
 #include "texture.h"
 
 Image * image_retype(Image const *, GLenum target_type);
+void image_retype_into(Image const *, Image *);
 Image * image_reformat(Image const *);
 Image * image_rgb_to_gray(Image const *);
 Image * image_extract(Image const *, GLenum target_format, GLenum source_component, GLenum target_component);
@@ -25,12 +27,15 @@ void  image_fill_color(Image *, Texture, void *, Box);
 void  image_gradient(Image *, Color const values[2][2]);
 unsigned short image_sample_index(Image const *, Vector, Border);
 Color image_sample(Image const *, Vector, Border);
+Color image_view_sample(Image_View const *, Vector, Border);
+unsigned short image_view_sample_index(Image_View const *, Vector, Border);
 float image_sample_1D(Image const *, float);
 float image_sample_2D(Image const *, Vector);
 Color image_sample_color_2D(Image const *, Vector, Border);
 Color4 image_sample_color4_2D(Image const *, Vector, Border);
 Image * image_histogram(Image const *, int bin_count);
 void  image_min_max(Image const *, float * min, float * max);
+void  image_view_min_max(Image_View const *, float * min, float * max);
 
 Image * image_convolve(Image const *, float const weights[], int size, Border);
 Image * image_fast_area_sum(Image const *);
@@ -44,6 +49,7 @@ typedef struct {int neg, inf, nan;} Image_Problems;
 void             image_statistics_print(Image_Statistics);
 float            image_statistics_threshold(Image const * image, float threshold);
 Image_Statistics image_statistics(Image const *);
+Image_Statistics image_view_statistics(Image_View const *);
 
 void           image_problems_print(Image_Problems);
 Image_Problems image_problems(Image const *);
@@ -59,6 +65,7 @@ void    image_accumulate_convergence(Image * target, Image const * reference, Im
 void    image_scale(Image *, float);
 void    image_log(Image *);
 
+Color   map_color(Color);
 Image * image_diff(Image const * image1, Image const * image2);
 Image * image_crop(Image const *, Size position, Size size);
 Image * image_pad(Image const *, Size padding);
@@ -90,9 +97,6 @@ Image * image_merge(Image const * const *, int count);
 Image * image_duplicate_layers(Image const *, int layer_count);
 
 Image * image_squared_error(Image const * sources, Image const * reference, int relative);
-//Image * image_ssim(Image const * sources, Image const * reference);
-//float image_mssim(Image const * sources, Image const * reference);
-//float image_dmssim(float mssim);
 float image_mse(Image const * sources, Image const * reference, int relative);
 float image_rmse(float mse);
 float image_psnr(float mse);
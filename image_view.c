@@ -0,0 +1,151 @@
+#include <string.h>
+
+#include "error.h"
+#include "image_view.h"
+
+Image_View image_view(Image const * image)
+{
+    Image_View view;
+
+    error_check(image->format.layout == IMAGE_TILED, "tiled images have no view");
+
+    view.parent  = image;
+    view.base    = (unsigned char *) image->pixels;
+    view.format  = image->format;
+    view.stride  = image_format_stride(image->format);
+    view.channel_stride = image_format_channel_stride(image->format);
+    view.channel = 0;
+
+    view.format.row_stride = 0;
+
+    return view;
+}
+
+Image_View image_view_region(Image_View view, Size position, Size size)
+{
+    Size limit = view.format.size;
+
+    error_check(position.x < 0 || position.y < 0 || position.z < 0, "region must start inside the view");
+    error_check(position.x + size.x > limit.x || position.y + size.y > limit.y || position.z + size.z > limit.z, "region must end inside the view");
+
+    view.base += position.z * view.stride.z + position.y * view.stride.y + position.x * view.stride.x;
+    view.format.size = size;
+
+    return view;
+}
+
+Image_View image_view_layer(Image_View view, int layer)
+{
+    Size position = {0, 0, layer};
+    Size size = view.format.size;
+    size.z = 1;
+
+    return image_view_region(view, position, size);
+}
+
+Image_View image_view_channel(Image_View view, int channel)
+{
+    error_check(channel < 0 || channel >= format_to_size(view.format.format), "channel out of range");
+
+    view.channel += channel;
+    view.format.format = GL_LUMINANCE;
+    view.format.layout = IMAGE_INTERLEAVED;
+
+    return view;
+}
+
+void * image_view_pixel(Image_View const * view, int layer, int row, int column)
+{
+    return
+        view->base +
+        layer  * view->stride.z +
+        row    * view->stride.y +
+        column * view->stride.x +
+        view->channel * view->channel_stride;
+}
+
+/* whole pixels side by side, so GL can read the view in place */
+int image_view_packed(Image_View const * view)
+{
+    size_t pixel_size = image_format_pixel_size(view->format);
+
+    return
+        view->stride.x == pixel_size &&
+        view->stride.y % pixel_size == 0 &&
+        view->stride.z % view->stride.y == 0;
+}
+
+void image_view_store_unpack(Image_View const * view)
+{
+    GLint alignment = image_unpack_alignment((long) image_view_pixel(view, 0, 0, 0));
+    GLint row_alignment = image_unpack_alignment(view->stride.y);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment < row_alignment ? alignment : row_alignment);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, view->stride.y / view->stride.x);
+    glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, view->stride.z / view->stride.y);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_IMAGES, 0);
+}
+
+void image_view_draw(Image_View const * view)
+{
+    Image_Format format = view->format;
+
+    if (! image_view_packed(view))
+    {
+        Image * image = image_view_copy(view);
+        image_draw(image);
+        image_destroy(image);
+        return;
+    }
+
+    image_view_store_unpack(view);
+    glDrawPixels(format.size.x, format.size.y, format.format, format.type, image_view_pixel(view, 0, 0, 0));
+    image_store_unpack_reset();
+}
+
+/* the copy is packed and interleaved, whatever the layout of the parent */
+Image * image_view_copy(Image_View const * view)
+{
+    Image_Format format = view->format;
+    Size size = format.size;
+
+    format.layout = IMAGE_INTERLEAVED;
+    Image * image = image_new_uninitialized(format);
+
+    int pixel_size = image_format_pixel_size(format);
+    int sample_size = image_type_to_size(format.type);
+    int channels = format_to_size(format.format);
+    int row_size = pixel_size * size.x;
+    int interleaved = channels == 1 || view->channel_stride == (size_t) sample_size;
+
+    for (int i = 0; i != size.z; ++ i)
+    for (int j = 0; j != size.y; ++ j)
+    {
+        unsigned char * target = (unsigned char *) image_row(image, i, j);
+
+        if (view->stride.x == (size_t) pixel_size && interleaved)
+        {
+            memcpy(target, image_view_pixel(view, i, j, 0), row_size);
+            continue;
+        }
+
+        if (interleaved)
+        {
+            for (int k = 0; k != size.x; ++ k)
+                memcpy(&target[k * pixel_size], image_view_pixel(view, i, j, k), pixel_size);
+            continue;
+        }
+
+        for (int c = 0; c != channels; ++ c)
+        {
+            unsigned char const * source = (unsigned char const *) image_view_pixel(view, i, j, 0) + c * view->channel_stride;
+
+            for (int k = 0; k != size.x; ++ k)
+                memcpy(&target[k * pixel_size + c * sample_size], &source[k * view->stride.x], sample_size);
+        }
+    }
+
+    return image;
+}
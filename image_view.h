@@ -0,0 +1,29 @@
+#ifndef IMAGE_VIEW_H
+#define IMAGE_VIEW_H
+
+#include "image.h"
+
+/* non-owning window onto an image: a region, a layer or a single channel */
+typedef struct
+{
+    Image const * parent;
+    unsigned char * base;   /* first pixel of the view */
+    Image_Format format;    /* type, visible channels and size of the view */
+    Image_Stride stride;    /* bytes between neighbouring pixels, rows and layers */
+    size_t channel_stride;  /* bytes between the channels of a pixel */
+    int channel;            /* first parent channel seen through the view */
+}
+Image_View;
+
+Image_View image_view(Image const *);
+Image_View image_view_region(Image_View, Size position, Size size);
+Image_View image_view_layer(Image_View, int layer);
+Image_View image_view_channel(Image_View, int channel);
+
+void *  image_view_pixel(Image_View const *, int layer, int row, int column);
+int     image_view_packed(Image_View const *);
+void    image_view_store_unpack(Image_View const *);
+void    image_view_draw(Image_View const *);
+Image * image_view_copy(Image_View const *);
+
+#endif
@@ -3,6 +3,7 @@
 #include <stdio.h>
 
 #include "action.h"
+#include "area_table.h"
 #include "color.h"
 #include "error.h"
 #include "font.h"
@@ -11,15 +12,23 @@
 #include "glut.h"
 #include "half.h"
 #include "image.h"
+#include "image_analysis.h"
+#include "image_cache.h"
+#include "image_pool.h"
 #include "image_process.h"
+#include "image_view.h"
 #include "list.h"
 #include "math_.h"
 #include "memory.h"
 #include "palette.h"
+#include "parallel.h"
 #include "pixel_map.h"
 #include "pixel_transfer.h"
+#include "playback.h"
 #include "print.h"
+#include "pyramid_view.h"
 #include "string.h"
+#include "texture.h"
 #include "time_.h"
 #include "utils.h"
 #include "variable.h"
@@ -35,8 +44,9 @@ static Font_ * font;
 static char title[256], image_size[256], string_buffer[256];
 static Vector mouse_position, picked_position, grabbed_position;
 static int mouse_entered;
-static enum {NORMAL, GRABBED, ZOOMING} mode;
-static Box zoom_box;
+static enum {NORMAL, GRABBED, ZOOMING, SELECTING, SCRUBBING} mode;
+static Box zoom_box, selection_box;
+static int selection;
 static float const zoom_factor = 1.1;
 static int precision = 2;
 
@@ -45,6 +55,9 @@ static int name_index, layer;
 static char const ** layer_names;
 
 static Image * source_image, * download_image, * histogram;
+static Image_Analysis * analysis;
+static Area_Table * region_table;
+static int region_layer;
 static Property * properties;
 static unsigned property_count;
 
@@ -52,7 +65,29 @@ static enum {CHANNEL_ALL, CHANNEL_RED, CHANNEL_GREEN, CHANNEL_BLUE} channels;
 static float scale = 1.0, contrast = 1.0, gamma_value = 1.0;
 static int filter, play, false_colors;
 static int delay = 2000;
+static int pool_size = 256;
+static int disk_cache_size;
+static int thread_count;
 static int dirty_texture;
+static int flip_x, flip_y, rotation; // rotation in quarter turns
+
+// A/B comparison against a resident reference image
+static Image * reference_image;
+static char const * reference_name;
+static enum {AB_OFF, AB_WIPE, AB_FLICKER, AB_DIFFERENCE} ab_mode;
+static float wipe_position, exposure;
+static int flicker_delay = 500, flicker_phase, flicker_generation;
+static int dirty_reference, dirty_float_textures;
+
+// out of core pyramids are drawn tile by tile, their coarsest level stands in for the analysis
+static Pyramid * pyramid;
+static Pyramid_View * pyramid_view;
+static char pyramid_output[256];
+
+// sequences play from a ring of display images decoded ahead, the full state is restored on pause
+static Playback * playback;
+static float fps;
+static int ring_size = 8, decoder_count, play_mode, playback_generation;
 
 static Variable_Extension const names_extension = {&names, name_parser,  NULL};
 static Variable_Extension const boxes_extension = {NULL, box_parse,    NULL};
@@ -70,8 +105,17 @@ static Variable const variables[] =
     {&filter,      'b', NIL, "filter",       "-f",  "filter",            NULL},
     {&play,        'b', NIL, "play",         "-p",  "play slideshow",    NULL},
     {&delay,       'd', NIL, "delay",        "-d",  "delay",             NULL},
+    {&fps,         'f', NIL, "fps",          "-fps","frame rate (0 = 1000 / delay)", NULL},
+    {&ring_size,   'd', NIL, "ring",         "-rb", "frames decoded ahead", NULL},
+    {&decoder_count,'d',NIL, "decoders",     "-dt", "decoder threads (0 = one per core)", NULL},
+    {&play_mode,   'd', NIL, "play_mode",    "-pm", "0 = loop, 1 = ping pong, 2 = once", NULL},
     {&boxes,       'M', NIL, "highlight",    "-hl", "highlight region",  &boxes_extension},
     {&precision,   'd', NIL, "precision",    "-pr", "precision",         NULL},
+    {&pool_size,   'd', NIL, "pool_size",    "-ps", "image pool size in MB", NULL},
+    {&disk_cache_size,'d',NIL, "disk_cache",   "-dc", "decoded image disk cache in MB (0 = off)", NULL},
+    {&thread_count,'d', NIL, "threads",      "-j",  "worker threads (0 = one per core)", NULL},
+    {&flicker_delay,'d',NIL, "flicker",      "-fl", "flicker interval in ms", NULL},
+    {pyramid_output,'s',NIL, "pyramid",      "-py", "convert the first image to a pyramid file and exit", NULL},
     {&names,       's', NIL, NULL,           NULL,  "images",            &names_extension},
 };
 static int const variable_count = array_count(variables);
@@ -108,10 +152,51 @@ static void draw_spherical_projection(int nx, int ny)
 }
 #endif
 
+static Image * open_source(char const name[])
+{
+    pyramid_view_destroy(pyramid_view);
+    pyramid_close(pyramid);
+    pyramid_view = NULL;
+    pyramid = NULL;
+
+    if (! pyramid_is_file(name))
+        return image_cache_open(name);
+
+    pyramid = pyramid_open(name, (size_t) pool_size << 20);
+    if (! pyramid)
+        return NULL;
+
+    pyramid_view = pyramid_view_new(pyramid);
+    if (verbose)
+        pyramid_print(pyramid);
+
+    return pyramid_read_level(pyramid, pyramid->level_count - 1);
+}
+
+/* the full resolution extent, which for pyramids is not the one of the loaded image */
+static Size image_extent(void)
+{
+    return pyramid ? pyramid->sizes[0] : download_image->format.size;
+}
+
+/* unsigned short luminance is shown as raw indices */
+static int indexed_source(void)
+{
+    return ! pyramid && ! play && source_image->format.format == GL_LUMINANCE && source_image->format.type == GL_UNSIGNED_SHORT;
+}
+
+static Color sample_pixel(Vector position)
+{
+    if (pyramid)
+        return pyramid_sample(pyramid, 0, (int) position.x, (int) position.y);
+
+    return image_sample(download_image, position, BORDER_BLACK);
+}
+
 static Image * load_image(char const name[])
 {
     image_destroy(source_image);
-    source_image = image_open(name);
+    source_image = open_source(name);
     error_check_arg(! source_image, "failed to open file \"%s\"", name);
 
     if (verbose)
@@ -143,18 +228,21 @@ static Image * load_image(char const name[])
         }
     }
 
+    Image * float_image = image_new_uninitialized(image_analysis_display_format(source_image->format));
+
+    image_analysis_destroy(analysis);
+    analysis = image_analyze(source_image, float_image);
+
     image_destroy(histogram);
-    if (source_image->format.type == GL_UNSIGNED_BYTE ||
-        source_image->format.type == GL_UNSIGNED_SHORT ||
-        source_image->format.type == GL_FLOAT)
-        histogram = image_histogram(source_image, 0);
-    else
-        histogram = NULL;
+    histogram = analysis->histogram ? histogram_image(analysis->histogram, source_image->format.format) : NULL;
+
+    if (verbose)
+        image_analysis_print(analysis);
 
-    if (source_image->format.format == GL_LUMINANCE && source_image->format.type == GL_UNSIGNED_SHORT)
+    if (indexed_source())
     {
-        int zeros = image_count_zeros(source_image);
-        int value = image_sum_values(source_image);
+        int zeros = analysis->zeros[0];
+        int value = llround(analysis->sum[0] * 65535);
 
         int pixel_count = size_volume(source_image->format.size);
 
@@ -162,64 +250,97 @@ static Image * load_image(char const name[])
         printf("total samples = %d\n", zeros * 1024 + value);
     }
 
-    Image * float_image = image_retype(source_image, GL_FLOAT);
-
-    // hack to add alpha channel for comparison
-    if (float_image->format.format == GL_RGB)
-    {
-        Image_Format format = float_image->format;
-        format.format = GL_RGBA;
-
-        Image * tmp_image = image_new(format);
-        image_add_alpha(float_image, tmp_image);
-
-        image_destroy(float_image);
-        float_image = tmp_image;
-    }
-
     // XXX hack
 //    image_scale(float_image, 65535.0 / 1024.0);
 
-    Color4 const * pixels = (Color4 const *) float_image->pixels;
     if (verbose)
     for (int i = 0; i != boxes.count; ++ i)
     {
         Box box = * (Box *) boxes.entries[i];
-        int ii = box.min.z;
-        int jj = box.min.y;
-        int kk = box.min.x;
+        Size image_size = float_image->format.size;
+        Size min = {fmax(box.min.x, 0), fmax(box.min.y, 0), fmax(box.min.z, 0)};
+        Size max = {fmin(box.max.x, image_size.x), fmin(box.max.y, image_size.y), min.z + 1};
+        Size size = {max.x - min.x, max.y - min.y, 1};
+
+        if (size.x <= 0 || size.y <= 0 || min.z >= image_size.z)
+            continue;
 
-        int index = size_index(float_image->format.size, ii, jj, kk);
-        Color4 c = pixels[index];
+        Image_View view = image_view_region(image_view(float_image), min, size);
+        Image_Statistics stats = image_view_statistics(&view);
 
-        // TODO mean, var
-        printf("%d: ", i); color_print(c.c); puts("");
+        printf("%d: mean = ", i); color_print(stats.mean);
+        printf(", var = "); color_print(stats.var); puts("");
     }
 
     return float_image;
 }
 
+/* decodes straight to the display format, the state of the current image stays as it is */
+static Image * load_display_image(char const name[])
+{
+    Image * source = image_cache_open(name);
+    if (! source)
+        return NULL;
+
+    Image * display = image_new_uninitialized(image_analysis_display_format(source->format));
+    image_analysis_destroy(image_analyze(source, display));
+    image_destroy(source);
+
+    return display;
+}
+
+static void set_reference(Image * image, char const name[])
+{
+    image_destroy(reference_image);
+    reference_image = image;
+    reference_name = name;
+
+    dirty_reference = 1;
+    dirty_float_textures = 1;
+}
+
 static void update_labels(void)
 {
     char const * name = (char const *) names.entries[name_index];
+    static char const * const ab_labels[] = {"", "wipe", "flicker", "difference"};
 
-    if (layer_names)
+    if (ab_mode != AB_OFF)
+        sprintf(title, "%s -- %s %s", basename_(name), ab_labels[ab_mode], basename_(reference_name));
+    else if (layer_names)
         sprintf(title, "%s -- %s", name, layer_names[layer]);
     else
         sprintf(title, "%s", name);
 
-    sprintf(image_size, "%dx%d", download_image->format.size.x, download_image->format.size.y);
+    Size extent = image_extent();
+    sprintf(image_size, "%dx%d", extent.x, extent.y);
+
+    if (play && playback)
+    {
+        Playback_Statistics statistics = playback_statistics(playback);
+        sprintf(image_size + strlen(image_size), " -- %.1f fps, %lu dropped", statistics.rate, statistics.dropped);
+    }
 
     if (glutGetWindow())
         glutSetWindowTitle(title);
 }
 
+static void region_table_invalidate(void)
+{
+    area_table_destroy(region_table);
+    region_table = NULL;
+}
+
 static void update_image(void)
 {
+    region_table_invalidate();
     image_destroy(download_image);
 
     char const * name = (char const *) names.entries[name_index];
     download_image = load_image(name);
+    dirty_float_textures = 1;
+
+    if (verbose)
+        image_pool_print();
 
     update_labels();
 }
@@ -229,9 +350,57 @@ static Vector pick(Vector position)
     return matrix_mul(backward_matrix, position);
 }
 
+static Size view_size(void)
+{
+    Size size = image_extent();
+    if (rotation % 2)
+        swap(int, size.x, size.y);
+
+    return size;
+}
+
+/* maps image coordinates to the rotated and mirrored view, exact for quarter turns */
+static Matrix view_matrix(void)
+{
+    Size size = image_extent();
+    float a[2][2] = {{1, 0}, {0, 1}};
+    float b[2] = {0, 0};
+
+    for (int i = 0; i != rotation; ++ i)
+    {
+        // (x, y) -> (height - y, x)
+        float height = (i % 2) ? size.x : size.y;
+        float row[2] = {a[0][0], a[0][1]};
+
+        a[0][0] = -a[1][0]; a[0][1] = -a[1][1];
+        a[1][0] = row[0];   a[1][1] = row[1];
+
+        float t = b[0];
+        b[0] = height - b[1];
+        b[1] = t;
+    }
+
+    Size view = view_size();
+    if (flip_x)
+    {
+        a[0][0] = -a[0][0]; a[0][1] = -a[0][1];
+        b[0] = view.x - b[0];
+    }
+    if (flip_y)
+    {
+        a[1][0] = -a[1][0]; a[1][1] = -a[1][1];
+        b[1] = view.y - b[1];
+    }
+
+    Matrix matrix = IDENTITY_MATRIX;
+    matrix.m[0][0] = a[0][0]; matrix.m[1][0] = a[0][1]; matrix.m[3][0] = b[0];
+    matrix.m[0][1] = a[1][0]; matrix.m[1][1] = a[1][1]; matrix.m[3][1] = b[1];
+    return matrix;
+}
+
 static void zoom(float factor)
 {
-    Vector handle = picked_position;
+    Vector handle = matrix_mul(view_matrix(), picked_position);
     Vector t2 = vector_scale(handle, 1 - factor);
     translation = vector_add(translation, vector_scale(t2, scale));
     scale *= factor;
@@ -290,8 +459,126 @@ static void font_render_local(char const buffer[], Vector position, Vector ancho
     font_render_exact(font, buffer, matrix_mul(forward_matrix, position), anchor);
 } 
 
-static void draw_pixel_content(void)
+/* whole pixels covered by the selection, both corners included */
+static Box selection_region(void)
+{
+    Box box = box_fix(selection_box);
+    box.max = vector_add(box.max, vector(1, 1, 0));
+
+    return box;
+}
+
+/* table over the displayed layer, built on first use after a change */
+static Area_Statistics region_statistics(Box box)
+{
+    if (region_table && region_layer != layer)
+        region_table_invalidate();
+
+    if (! region_table)
+    {
+        Image_View view = image_view_layer(image_view(download_image), layer);
+        region_table = area_table_new(&view, AREA_TABLE_SQUARES | AREA_TABLE_RANGE);
+        region_layer = layer;
+    }
+
+    Vector min = vector_floor(box.min);
+    Vector max = vector_ceil(box.max);
+    Size position = {(int) min.x, (int) min.y, 0};
+    Size size = {(int) (max.x - min.x), (int) (max.y - min.y), 1};
+
+    return area_table_statistics(region_table, position, size);
+}
+
+static void sprintf_values(char buffer[], char const label[], double const values[], int count)
+{
+    buffer += sprintf(buffer, "%s", label);
+
+    for (int i = 0; i != count; ++ i)
+        buffer += sprintf(buffer, " %.*g", precision + 2, values[i]);
+}
+
+static void draw_region_statistics(Box box)
 {
+    // the table would cover the stand in level only
+    if (pyramid)
+        return;
+
+    Area_Statistics stats = region_statistics(box);
+    int count = region_table->channels < 3 ? region_table->channels : 3;
+    double min[AREA_TABLE_CHANNELS], max[AREA_TABLE_CHANNELS];
+
+    for (int i = 0; i != count; ++ i)
+    {
+        min[i] = stats.min[i];
+        max[i] = stats.max[i];
+    }
+
+    Vector position = vector_add(matrix_mul(forward_matrix, vector(box.max.x, box.max.y, 0)), vector(6, 0, 0));
+    int line = 0;
+
+    color_apply(WHITE);
+    sprintf(string_buffer, "n = %d", stats.count);
+    font_render_exact(font, string_buffer, vector_add(position, vector(0, -18 * line ++, 0)), ANCHOR_TOP_LEFT);
+
+    if (stats.count)
+    {
+        sprintf_values(string_buffer, "mean", stats.mean, count);
+        font_render_exact(font, string_buffer, vector_add(position, vector(0, -18 * line ++, 0)), ANCHOR_TOP_LEFT);
+        sprintf_values(string_buffer, "var", stats.variance, count);
+        font_render_exact(font, string_buffer, vector_add(position, vector(0, -18 * line ++, 0)), ANCHOR_TOP_LEFT);
+        sprintf_values(string_buffer, "min", min, count);
+        font_render_exact(font, string_buffer, vector_add(position, vector(0, -18 * line ++, 0)), ANCHOR_TOP_LEFT);
+        sprintf_values(string_buffer, "max", max, count);
+        font_render_exact(font, string_buffer, vector_add(position, vector(0, -18 * line ++, 0)), ANCHOR_TOP_LEFT);
+    }
+
+    if (stats.nan_count || stats.inf_count)
+    {
+        color_apply(RED);
+        sprintf(string_buffer, "nan = %d, inf = %d", stats.nan_count, stats.inf_count);
+        font_render_exact(font, string_buffer, vector_add(position, vector(0, -18 * line ++, 0)), ANCHOR_TOP_LEFT);
+    }
+}
+
+static Font_Batch * label_batch;
+static int dirty_labels = 1;
+
+/* drops labels that would spill into the neighbouring pixel */
+static void batch_label(char const buffer[], Vector position, int line, Color color)
+{
+    if (10 + font_batch_width(font, buffer) > scale)
+        return;
+
+    font_batch_add(label_batch, font, buffer, vector_add(position, vector(10, -10 - 18 * line, 0)), ANCHOR_TOP_LEFT, color);
+}
+
+static void batch_pixel_values(Vector position, Size pixel_coordinates, Color sample)
+{
+    char buffer[256];
+
+    sprintf(buffer, "%d, %d", pixel_coordinates.x, pixel_coordinates.y);
+    batch_label(buffer, position, 0, CYAN);
+
+    sprintf_color_value(buffer, sample.r); batch_label(buffer, position, 1, RED);
+    sprintf_color_value(buffer, sample.g); batch_label(buffer, position, 2, GREEN);
+    sprintf_color_value(buffer, sample.b); batch_label(buffer, position, 3, BLUE);
+}
+
+static void batch_pixel_values_index(Vector position, Size pixel_coordinates, unsigned short value)
+{
+    char buffer[256];
+
+    sprintf(buffer, "%d, %d", pixel_coordinates.x, pixel_coordinates.y);
+    batch_label(buffer, position, 0, CYAN);
+
+    sprintf(buffer, "%d", value);
+    batch_label(buffer, position, 1, WHITE);
+}
+
+/* whole image pixels inside the window, whatever the view orientation */
+static Box visible_region(void)
+{
+    Size extent = image_extent();
     Box box = MIN_BOX;
     box = box_add(box, pick(ORIGIN));
 
@@ -303,38 +590,74 @@ static void draw_pixel_content(void)
     box.max = vector_ceil(box.max);
 
     box.min = vector_max(box.min, ORIGIN);
-    box.max = vector_min(box.max, vector(download_image->format.size.x, download_image->format.size.y, 0));
+    box.max = vector_min(box.max, vector(extent.x, extent.y, 0));
+
+    return box;
+}
+
+static void draw_pixel_content(void)
+{
+    static Size cached_min, cached_max;
+    static int cached_layer;
+    static float cached_scale;
+    static Vector cached_origin;
+
+    Box box = visible_region();
 
     Size min = {(int) box.min.x, (int) box.min.y, 0};
     Size max = {(int) box.max.x, (int) box.max.y, 0};
 
-    font_begin(viewport);
+    Vector origin = matrix_mul(forward_matrix, ORIGIN);
+
+    if (! label_batch)
+        label_batch = font_batch_new();
 
-    for (int i = min.y; i != max.y; ++ i)
-    for (int j = min.x; j != max.x; ++ j)
+    /* panning only shifts the labels, rebuild when the visible pixels change */
+    if (dirty_labels || ! size_equal(min, cached_min) || ! size_equal(max, cached_max) ||
+        layer != cached_layer || scale != cached_scale)
     {
-        Size pixel_coordinates = {j, i, 0};
+        font_batch_clear(label_batch);
 
-        Vector sample_position = {j, i, 0};
-        sample_position.z = 0;
+        for (int i = min.y; i < max.y; ++ i)
+        for (int j = min.x; j < max.x; ++ j)
+        {
+            Size pixel_coordinates = {j, i, 0};
 
-        Vector position = matrix_mul(forward_matrix, sample_position);
-        position.y += scale;
+            Vector sample_position = {j, i, 0};
 
-        sample_position.z = layer;
+            // top left corner of the pixel on screen, whatever the view orientation
+            Vector corner_1 = matrix_mul(forward_matrix, sample_position);
+            Vector corner_2 = matrix_mul(forward_matrix, vector(j + 1, i + 1, 0));
+            Vector position = {fmin(corner_1.x, corner_2.x), fmax(corner_1.y, corner_2.y), 0};
 
-        if (source_image->format.format == GL_LUMINANCE && source_image->format.type == GL_UNSIGNED_SHORT)
-        {
-            unsigned short color_index = image_sample_index(source_image, sample_position, BORDER_BLACK);
-            draw_pixel_values_index(position, pixel_coordinates, color_index);
-        }
-        else
-        {
-            Color pixel_color = image_sample(download_image, sample_position, BORDER_BLACK);
-            draw_pixel_values(position, pixel_coordinates, pixel_color);
+            sample_position.z = layer;
+
+            if (indexed_source())
+            {
+                unsigned short color_index = image_sample_index(source_image, sample_position, BORDER_BLACK);
+                batch_pixel_values_index(position, pixel_coordinates, color_index);
+            }
+            else
+            {
+                Color pixel_color = sample_pixel(sample_position);
+                batch_pixel_values(position, pixel_coordinates, pixel_color);
+            }
         }
+
+        cached_min    = min;
+        cached_max    = max;
+        cached_layer  = layer;
+        cached_scale  = scale;
+        cached_origin = origin;
+        dirty_labels  = 0;
     }
 
+    font_begin(viewport);
+
+    Vector offset = vector_sub(origin, cached_origin);
+    glTranslatef(offset.x, offset.y, 0);
+    font_batch_draw(font, label_batch);
+
     font_end();
 }
 
@@ -386,6 +709,217 @@ static Color channels_to_color(void)
     }
 }
 
+static void download_display_texture(Image const * image, int image_layer)
+{
+    Color contrast_color = color_scale(channels_to_color(), contrast);
+    pixel_transfer_scale(contrast_color);
+    pixel_map_correct_gamma(gamma_value);
+
+    if (image->format.format == GL_LUMINANCE && false_colors)
+    {
+        Image * palette = palette_false(1024); // XXX
+        ((Color *) palette->pixels)[0] = BLACK;
+
+        Image * paletted_image = image_apply_palette(image, palette);
+        texture_download(paletted_image);
+        image_destroy(paletted_image);
+        image_destroy(palette);
+    }
+    else
+        texture_download_layer(image, image_layer);
+
+    pixel_map_reset();
+    pixel_transfer_reset();
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter ? GL_LINEAR : GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter ? GL_LINEAR : GL_NEAREST);
+}
+
+static int reference_layer(void)
+{
+    return layer < reference_image->format.size.z ? layer : 0;
+}
+
+static void bind_reference_texture(void)
+{
+    static GLuint texture;
+
+    if (! texture)
+        glGenTextures(1, &texture);
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    if (dirty_reference)
+    {
+        download_display_texture(reference_image, reference_layer());
+        dirty_reference = 0;
+    }
+}
+
+/* the difference is mapped like map_color, red where the image is below the reference */
+static char const * const difference_source =
+    "uniform sampler2D image, reference;\n"
+    "uniform vec3 mask;\n"
+    "uniform float exposure;\n"
+    "void main()\n"
+    "{\n"
+    "    vec2 p = gl_TexCoord[0].st;\n"
+    "    vec3 d = (texture2D(image, p).rgb - texture2D(reference, p).rgb) * mask * exposure;\n"
+    "    float m = d.r;\n"
+    "    if (abs(d.g) > abs(m)) m = d.g;\n"
+    "    if (abs(d.b) > abs(m)) m = d.b;\n"
+    "    gl_FragColor = m < 0.0 ? vec4(-m, 0.0, 0.0, 1.0) : vec4(0.0, m, m, 1.0);\n"
+    "}\n";
+
+static GLuint difference_program(void)
+{
+    static GLuint program;
+
+    if (program)
+        return program;
+
+    GLuint shader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(shader, 1, &difference_source, NULL);
+    glCompileShader(shader);
+
+    GLint status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (! status)
+    {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof log, NULL, log);
+        printf(ANSI_RED "shader error" ANSI_RESET ": %s\n", log);
+    }
+
+    program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+
+    return program;
+}
+
+/* raw float copies of both images, kept until either changes */
+static void bind_float_textures(void)
+{
+    static GLuint textures[2];
+
+    if (! textures[0])
+        glGenTextures(2, textures);
+
+    for (int i = 1; i >= 0; -- i)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+
+        if (dirty_float_textures)
+        {
+            if (i)
+                texture_download_layer_float(reference_image, reference_layer());
+            else
+                texture_download_layer_float(download_image, layer);
+        }
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter ? GL_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter ? GL_LINEAR : GL_NEAREST);
+    }
+
+    dirty_float_textures = 0;
+}
+
+/* columns [first, last) of the image whose texture is bound, in its pixel coordinates */
+static void draw_image_columns(Size size, float first, float last)
+{
+    glMatrixMode(GL_TEXTURE);
+    glLoadIdentity();
+    glScalef(1.0 / size.x, 1.0 / size.y, 1);
+    glMatrixMode(GL_MODELVIEW);
+
+    glBegin(GL_TRIANGLE_STRIP);
+    glTexCoord2f(first, 0);      glVertex2f(first, 0);
+    glTexCoord2f(last, 0);       glVertex2f(last, 0);
+    glTexCoord2f(first, size.y); glVertex2f(first, size.y);
+    glTexCoord2f(last, size.y);  glVertex2f(last, size.y);
+    glEnd();
+}
+
+static int same_extent(Image const * image_1, Image const * image_2)
+{
+    return image_1->format.size.x == image_2->format.size.x && image_1->format.size.y == image_2->format.size.y;
+}
+
+static void draw_comparison(GLuint texture)
+{
+    Size size = download_image->format.size;
+    Size reference_size = reference_image->format.size;
+
+    switch (ab_mode)
+    {
+        default:
+            break;
+
+        case AB_WIPE:
+        {
+            float wipe = clamp_to(wipe_position, 0, size.x);
+
+            draw_image_columns(size, 0, wipe);
+            bind_reference_texture();
+            draw_image_columns(reference_size, fmin(wipe, reference_size.x), reference_size.x);
+
+            glDisable(GL_TEXTURE_2D);
+            glBegin(GL_LINES);
+            glVertex2f(wipe, 0);
+            glVertex2f(wipe, imax(size.y, reference_size.y));
+            glEnd();
+            return;
+        }
+
+        case AB_FLICKER:
+            if (! flicker_phase)
+                break;
+
+            bind_reference_texture();
+            draw_image_columns(reference_size, 0, reference_size.x);
+            return;
+
+        case AB_DIFFERENCE:
+        {
+            if (! same_extent(download_image, reference_image))
+                break;
+
+            GLuint program = difference_program();
+            Color mask = channels_to_color();
+
+            bind_float_textures();
+            glUseProgram(program);
+            glUniform1i(glGetUniformLocation(program, "image"), 0);
+            glUniform1i(glGetUniformLocation(program, "reference"), 1);
+            glUniform3f(glGetUniformLocation(program, "mask"), mask.r, mask.g, mask.b);
+            glUniform1f(glGetUniformLocation(program, "exposure"), pow(2, exposure));
+
+            draw_image_columns(size, 0, size.x);
+
+            glUseProgram(0);
+            return;
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    draw_image_columns(size, 0, size.x);
+}
+
+/* tiles go up with the same contrast and gamma as whole images */
+static void draw_pyramid(void)
+{
+    Color contrast_color = color_scale(channels_to_color(), contrast);
+    pixel_transfer_scale(contrast_color);
+    pixel_map_correct_gamma(gamma_value);
+
+    pyramid_view_draw(pyramid_view, visible_region(), scale, filter);
+
+    pixel_map_reset();
+    pixel_transfer_reset();
+}
+
 static void display(void)
 {
     glext_init();
@@ -401,60 +935,49 @@ static void display(void)
     glTranslatef(delta_translation.x, delta_translation.y, 0);
     glScalef(scale, scale, scale);
 
+    Matrix display_matrix = matrix_transformer();
+    Matrix view = view_matrix();
+    matrix_apply(&view);
+
     static GLuint texture;
-    if (texture == 0 || dirty_texture)
-    {
+    if (texture == 0)
         glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-
-        Color contrast_color = color_scale(channels_to_color(), contrast);
-        pixel_transfer_scale(contrast_color);
-        pixel_map_correct_gamma(gamma_value);
 
-        if (download_image->format.format == GL_LUMINANCE && false_colors)
-        {
-            Image * palette = palette_false(1024); // XXX
-            ((Color *) palette->pixels)[0] = BLACK;
+    glBindTexture(GL_TEXTURE_2D, texture);
 
-            Image * paletted_image = image_apply_palette(download_image, palette);
-            texture_download(paletted_image);
-            image_destroy(paletted_image);
-            image_destroy(palette);
-        }
+    if (dirty_texture)
+    {
+        dirty_labels = 1;
+        if (pyramid)
+            pyramid_view_invalidate(pyramid_view);
         else
-            texture_download_layer(download_image, layer);
-
-        pixel_map_reset();
-        pixel_transfer_reset();
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter ? GL_LINEAR : GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter ? GL_LINEAR : GL_NEAREST);
+            download_display_texture(download_image, layer);
 
+        // the reference follows contrast, gamma and channel changes
+        dirty_reference = 1;
         dirty_texture = 0;
     }
-    else
-        glBindTexture(GL_TEXTURE_2D, texture);
 
     glEnable(GL_TEXTURE_2D);
 
-    Size size = download_image->format.size;
-
-    glMatrixMode(GL_TEXTURE);
-    glPushMatrix();
-    glLoadIdentity();
-    glScalef(1.0 / size.x, 1.0 / size.y, 1);
+    Size size = image_extent();
 
     forward_matrix  = matrix_transformer();
     backward_matrix = matrix_invert(forward_matrix);
 
+    glMatrixMode(GL_TEXTURE);
+    glPushMatrix();
+    glMatrixMode(GL_MODELVIEW);
+
     color_apply(WHITE);
-    glBegin(GL_TRIANGLE_STRIP);
-    glTexCoord2f(0, 0);           glVertex2f(0, 0);
-    glTexCoord2f(size.x, 0);      glVertex2f(size.x, 0);
-    glTexCoord2f(0, size.y);      glVertex2f(0, size.y);
-    glTexCoord2f(size.x, size.y); glVertex2f(size.x, size.y);
-    glEnd();
+    if (pyramid)
+        draw_pyramid();
+    else if (reference_image && ab_mode != AB_OFF)
+        draw_comparison(texture);
+    else
+        draw_image_columns(size, 0, size.x);
 
+    glMatrixMode(GL_TEXTURE);
     glPopMatrix();
     glMatrixMode(GL_MODELVIEW);
 
@@ -515,6 +1038,12 @@ static void display(void)
         }
     }
 
+    if (selection)
+    {
+        color_apply(CYAN);
+        draw_box(selection_region());
+    }
+
     float MIN = 1E-2;
     float MAX = 1E+6;
     Box box =
@@ -569,24 +1098,30 @@ static void display(void)
         Box box = * (Box *) boxes.entries[i];
         Vector position = {box.min.x, box.max.y, 0};
         font_render_local(buffer, position, ANCHOR_BOTTOM_RIGHT);
+
+        draw_region_statistics(box);
     }
 
+    if (selection)
+        draw_region_statistics(selection_region());
+
     if (mouse_entered)
     {
-        if (source_image->format.format == GL_LUMINANCE && source_image->format.type == GL_UNSIGNED_SHORT)
+        if (indexed_source())
         {
             unsigned short color_index = image_sample_index(source_image, sample_position, BORDER_BLACK);
             draw_pixel_values_index(mouse_position, pixel_coordinates, color_index);
         }
         else
         {
-            Color pixel_color = image_sample(download_image, sample_position, BORDER_BLACK);
+            Color pixel_color = sample_pixel(sample_position);
             draw_pixel_values(mouse_position, pixel_coordinates, pixel_color);
         }
     }
     color_apply(WHITE);
-    font_render_local(title, ORIGIN, ANCHOR_TOP_LEFT);
-    font_render_local(image_size, vector(size.x, size.y, 0), ANCHOR_BOTTOM_LEFT);
+    Size displayed_size = view_size();
+    font_render_exact(font, title, matrix_mul(display_matrix, ORIGIN), ANCHOR_TOP_LEFT);
+    font_render_exact(font, image_size, matrix_mul(display_matrix, vector(displayed_size.x, displayed_size.y, 0)), ANCHOR_BOTTOM_LEFT);
 
     font_end();
 
@@ -600,38 +1135,154 @@ static void display(void)
     glutSwapBuffers();
 }
 
-static void timer(int value)
+static void flicker(int generation)
 {
-    if (! play)
+    if (ab_mode != AB_FLICKER || generation != flicker_generation)
         return;
 
-    name_index = (name_index + 1) % names.count;
-    update_image();
+    toggle(flicker_phase);
+
+    glutTimerFunc(flicker_delay, flicker, generation);
+    glutPostRedisplay();
+}
+
+static Image * decode_frame(void * context, int frame)
+{
+    List const * list = (List const *) context;
+
+    return load_display_image((char const *) list->entries[frame]);
+}
+
+static void ensure_playback(void)
+{
+    if (playback || pyramid || names.count < 2)
+        return;
+
+    playback = playback_new(names.count, name_index, decode_frame, &names, ring_size, decoder_count);
+    playback_set_mode(playback, (Playback_Mode) iclamp_to(play_mode, PLAYBACK_LOOP, PLAYBACK_ONCE));
+    playback_set_fps(playback, fps > 0 ? fps : 1000.0 / delay);
+}
+
+/* only the display image changes, statistics and properties stay with the image shown on pause */
+static void show_frame(int frame, Image * image)
+{
+    name_index = frame;
+
+    if (image)
+    {
+        image_destroy(download_image);
+        download_image = image;
+
+        if (layer >= image->format.size.z)
+            layer = 0;
+    }
+
+    region_table_invalidate();
     dirty_texture = 1;
+    dirty_float_textures = 1;
 
-    glutTimerFunc(delay, timer, 42);
+    update_labels();
     glutPostRedisplay();
 }
 
-static void center(void)
+static void timer(int generation);
+
+/* a new generation drops the timers scheduled before */
+static void schedule_frame(int generation)
 {
-    translation.x = (viewport.width  - scale * download_image->format.size.x) / 2,
-    translation.y = (viewport.height - scale * download_image->format.size.y) / 2,
-    translation.z = 0;
+    float wait = playback_wait(playback);
+
+    if (wait >= 0)
+        glutTimerFunc(ceil(1000 * wait), timer, generation);
+}
+
+static void timer(int generation)
+{
+    if (! playback || generation != playback_generation)
+        return;
+
+    Image * image;
+    int frame = playback_update(playback, &image);
+
+    if (frame >= 0)
+        show_frame(frame, image);
+
+    // the end of a sequence played once
+    if (play && ! playback_pending(playback))
+    {
+        play = 0;
+        update_image();
+        glutPostRedisplay();
+        return;
+    }
+
+    schedule_frame(generation);
+}
+
+static void set_play(int state)
+{
+    ensure_playback();
+    if (! playback)
+        return;
+
+    play = state;
+
+    // a sequence played once starts over from its end
+    if (play && play_mode == PLAYBACK_ONCE && name_index == names.count - 1)
+        name_index = 0;
+
+    playback_play(playback, play);
+
+    if (play)
+        playback_seek(playback, name_index);
+    else
+        update_image();
 
     dirty_texture = 1;
+    update_labels();
+    schedule_frame(++ playback_generation);
+}
+
+/* while playing the playhead moves instead, the frame comes from the ring */
+static void show_name(void)
+{
+    if (! play)
+    {
+        update_image();
+        return;
+    }
+
+    playback_seek(playback, name_index);
+    schedule_frame(++ playback_generation);
+}
+
+/* the width of the window spans the sequence */
+static void scrub(int x)
+{
+    name_index = iclamp_to((int) ((float) x * names.count / viewport.width), 0, names.count - 1);
+
+    playback_seek(playback, name_index);
+    schedule_frame(++ playback_generation);
+}
+
+static void center(void)
+{
+    Size size = view_size();
+
+    translation.x = (viewport.width  - scale * size.x) / 2,
+    translation.y = (viewport.height - scale * size.y) / 2,
+    translation.z = 0;
 }
 
 static void fit(int fill)
 {
-    float scale_x = (float) viewport.width  / download_image->format.size.x;
-    float scale_y = (float) viewport.height / download_image->format.size.y;
+    Size size = view_size();
+    float scale_x = (float) viewport.width  / size.x;
+    float scale_y = (float) viewport.height / size.y;
 
     scale = fill ? fmax(scale_x, scale_y) : fmin(scale_x, scale_y);
 
     center();
-
-    dirty_texture = 1;
 }
 
 #if 0
@@ -678,7 +1329,7 @@ static void keyboard(unsigned char key, int x, int y)
         if (index < names.count)
         {
             name_index = index;
-            update_image();
+            show_name();
             dirty_texture = 1;
             glutPostRedisplay();
         }
@@ -694,69 +1345,114 @@ static void keyboard(unsigned char key, int x, int y)
             property_print(properties, property_count);
             break;
 
+        // cycles wipe, flicker and difference against the reference, which is decoded once
         case 'D':
-            if (names.count >= 2)
+            if (pyramid)
             {
-                char const * name1 = (char const *) names.entries[(name_index + 0) % names.count];
-                char const * name2 = (char const *) names.entries[(name_index + 1) % names.count];
+                warn("no comparison for pyramids");
+                return;
+            }
 
-                Image * image2 = load_image(name2);
-                if (! image2)
+            if (! reference_image)
+            {
+                if (names.count < 2)
                 {
-                    warn("failed to load second image");
-                    break;
+                    warn("comparison needs a second image");
+                    return;
                 }
 
-#if 1
-                Image * diff_image = image_diff(download_image, image2);
-#else
-                printf("a\n");
-                Image * diff_image = image_squared_error(download_image, image2, 0);
-                printf("b\n");
-                save_image(diff_image);
-#endif
-                if (diff_image)
+                char const * name = (char const *) names.entries[(name_index + 1) % names.count];
+                Image * image = load_display_image(name);
+                if (! image)
                 {
-                    image_destroy(download_image);
-                    download_image = diff_image;
-
-                    sprintf(title, "Difference %s - %s", basename_(name1), basename_(name2));
+                    warn("failed to load second image");
+                    return;
                 }
-                else
-                    warn("failed to diff images");
 
-                image_destroy(image2);
+                set_reference(image, name);
             }
-            break;
 
-        case ' ': toggle(play); if (play) glutTimerFunc(delay, timer, 42); break;
+            cycle(ab_mode, AB_OFF, AB_DIFFERENCE);
+            if (ab_mode == AB_DIFFERENCE && ! same_extent(download_image, reference_image))
+            {
+                warn("difference needs images of the same size");
+                ab_mode = AB_OFF;
+            }
+
+            if (ab_mode == AB_WIPE)
+                wipe_position = download_image->format.size.x / 2.0;
+
+            if (ab_mode == AB_FLICKER)
+            {
+                flicker_phase = 0;
+                glutTimerFunc(flicker_delay, flicker, ++ flicker_generation);
+            }
+
+            update_labels();
+            glutPostRedisplay();
+            return;
+
+        // the current image becomes the reference
+        case 'B':
+            if (pyramid)
+            {
+                warn("no comparison for pyramids");
+                return;
+            }
+
+            set_reference(image_copy(download_image), (char const *) names.entries[name_index]);
+            update_labels();
+            glutPostRedisplay();
+            return;
+
+        case ' ': set_play(! play); break;
+        case 'p':
+            cycle(play_mode, PLAYBACK_LOOP, PLAYBACK_ONCE);
+            if (playback)
+                playback_set_mode(playback, (Playback_Mode) play_mode);
+            return;
+        // steps pause
+        case ',':
+        case '.':
+            if (play)
+                set_play(0);
+            if (key == ',')
+                cycle_down(name_index, 0, names.count - 1);
+            else
+                cycle(name_index, 0, names.count - 1);
+            update_image();
+            break;
         case 'C': center(); break;
         case 'w': fit(0); break;
         case 'W': fit(1); break;
         case 'g': toggle(false_colors); break;
         case 'G': gamma_value = gamma_value == 1.0 ? 2.2 : 1.0; break;
         case 'F': window_toggle_fullscreen(); break;
-        case 'R': contrast = 1.0; scale = 1.0; translation = ORIGIN; channels = CHANNEL_ALL; break;
+        case 'R': contrast = 1.0; exposure = 0; scale = 1.0; translation = ORIGIN; channels = CHANNEL_ALL; flip_x = flip_y = rotation = 0; break;
         case '=':
-        case '+': contrast *= 2; break;
-        case '-': contrast /= 2; break;
-        case 'l': cycle     (layer, 0, download_image->format.size.z - 1); update_labels(); break;
-        case 'L': cycle_down(layer, 0, download_image->format.size.z - 1); update_labels(); break;
+        case '+': if (ab_mode == AB_DIFFERENCE) {exposure += 1; glutPostRedisplay(); return;} contrast *= 2; break;
+        case '-': if (ab_mode == AB_DIFFERENCE) {exposure -= 1; glutPostRedisplay(); return;} contrast /= 2; break;
+        case 'l': cycle     (layer, 0, download_image->format.size.z - 1); dirty_float_textures = 1; update_labels(); break;
+        case 'L': cycle_down(layer, 0, download_image->format.size.z - 1); dirty_float_textures = 1; update_labels(); break;
         case 'c': cycle(channels, CHANNEL_ALL, CHANNEL_BLUE); break;
-        case 'h': image_flip_horizontal(download_image); break;
-        case 'v': image_flip(download_image); break;
+        // view transforms, the texture stays as it is
+        case 'h': toggle(flip_x);                  dirty_labels = 1; glutPostRedisplay(); return;
+        case 'v': toggle(flip_y);                  dirty_labels = 1; glutPostRedisplay(); return;
+        case 'r': cycle(rotation, 0, 3); center(); dirty_labels = 1; glutPostRedisplay(); return;
         case 's': zoom(0.5); break;
         case 'S':
             {
                 float old_scale = scale;
                 zoom(2.0);
                 // experiment
-                if (viewport.width  == (int) floor(old_scale * download_image->format.size.x) &&
-                    viewport.height == (int) floor(old_scale * download_image->format.size.y))
+                Size size = view_size();
+                if (viewport.width  == (int) floor(old_scale * size.x) &&
+                    viewport.height == (int) floor(old_scale * size.y))
                     glutReshapeWindow(viewport.width * scale, viewport.height * scale);
             }
             break;
         case 'f': toggle(filter); break;
+        case 'x': selection = 0; break;
     }
 
     dirty_texture = 1;
@@ -768,12 +1464,12 @@ static void special(int key, int x, int y)
     switch (key)
     {
         default: return;
-        case GLUT_KEY_HOME:      name_index = 0; update_image(); break;
-        case GLUT_KEY_END:       name_index = names.count - 1; update_image(); break;
-        case GLUT_KEY_PAGE_DOWN: name_index += 10; if (name_index >= names.count) name_index = names.count - 1; update_image(); break;
-        case GLUT_KEY_PAGE_UP:   name_index -= 10; if (name_index < 0) name_index = 0; update_image(); break;
-        case GLUT_KEY_LEFT:      cycle_down(name_index, 0, names.count - 1); update_image(); break;
-        case GLUT_KEY_RIGHT:     cycle     (name_index, 0, names.count - 1); update_image(); break; //schedule_value_action(0, 1, &alpha, 2.0); break;
+        case GLUT_KEY_HOME:      name_index = 0; show_name(); break;
+        case GLUT_KEY_END:       name_index = names.count - 1; show_name(); break;
+        case GLUT_KEY_PAGE_DOWN: name_index += 10; if (name_index >= names.count) name_index = names.count - 1; show_name(); break;
+        case GLUT_KEY_PAGE_UP:   name_index -= 10; if (name_index < 0) name_index = 0; show_name(); break;
+        case GLUT_KEY_LEFT:      cycle_down(name_index, 0, names.count - 1); show_name(); break;
+        case GLUT_KEY_RIGHT:     cycle     (name_index, 0, names.count - 1); show_name(); break; //schedule_value_action(0, 1, &alpha, 2.0); break;
         case GLUT_KEY_F11:       window_toggle_fullscreen(); break;
     }
 
@@ -795,13 +1491,36 @@ static void initialize(int argc, char * argv[])
         exit(EXIT_FAILURE);
     }
 
-    half_initialize();
+    image_pool_set_limit((size_t) pool_size << 20);
+    image_cache_set_limit((size_t) disk_cache_size << 20);
+    parallel_set_thread_count(thread_count);
+
+    if (pyramid_output[0])
+    {
+        char const * name = (char const *) names.entries[0];
+        Time_ time = time_current();
+
+        error_check_arg(! pyramid_convert(name, pyramid_output), "failed to convert \"%s\"", name);
+
+        if (verbose)
+            printf("converted \"%s\" in %.1f s\n", name, time_duration(time));
+
+        exit(EXIT_SUCCESS);
+    }
+
     font = font_open("Arial", 14);
 
     update_image();
 
+    // the full resolution of a pyramid does not fit any screen
+    if (pyramid)
+    {
+        Size size = image_extent();
+        scale = fmin(scale, fmin(1024.0 / size.x, 1024.0 / size.y));
+    }
+
     if (play)
-        glutTimerFunc(delay, timer, 42);
+        set_play(1);
 }
 
 static void reshape(int width, int height)
@@ -809,8 +1528,9 @@ static void reshape(int width, int height)
     viewport.width  = width;
     viewport.height = height;
 
-    if (width  >= scale * download_image->format.size.x ||
-        height >= scale * download_image->format.size.y)
+    Size size = view_size();
+    if (width  >= scale * size.x ||
+        height >= scale * size.y)
         center();
 }
 
@@ -825,6 +1545,22 @@ static void mouse(int button, int state, int x, int y)
 
         case GLUT_LEFT_BUTTON:
 
+            if (state == GLUT_DOWN && mode == NORMAL && (glutGetModifiers() & GLUT_ACTIVE_SHIFT))
+            {
+                mode = SELECTING;
+                selection = 1;
+                selection_box.min = selection_box.max = vector_floor(pick(position));
+                glutSetCursor(GLUT_CURSOR_CROSSHAIR);
+                break;
+            }
+
+            if (mode == SELECTING)
+            {
+                mode = NORMAL;
+                glutSetCursor(GLUT_CURSOR_INHERIT);
+                break;
+            }
+
             if (mode == NORMAL)
                 grabbed_position = position;
 
@@ -839,6 +1575,25 @@ static void mouse(int button, int state, int x, int y)
 
             break;
 
+        case GLUT_MIDDLE_BUTTON:
+
+            ensure_playback();
+            if (! playback || (mode != NORMAL && mode != SCRUBBING))
+                return;
+
+            mode = (state == GLUT_DOWN) ? SCRUBBING : NORMAL;
+
+            if (mode == SCRUBBING)
+                scrub(x);
+            else if (! play)
+            {
+                ++ playback_generation;
+                update_image();
+                dirty_texture = 1;
+            }
+
+            break;
+
         case GLUT_RIGHT_BUTTON:
 
             if (mode == NORMAL)
@@ -859,7 +1614,7 @@ static void mouse(int button, int state, int x, int y)
                 Vector t2 = vector_sub(picked_position, center2);
                 t2 = t2; // XXX
 
-                Vector size = box_size(zoom_box);
+                Vector size = box_size(box_transform(zoom_box, view_matrix()));
                 float factor = fmin(viewport.width / size.x, viewport.height / size.y);
 
                 scale = factor;
@@ -885,6 +1640,8 @@ static void motion(int x, int y)
         case NORMAL:  break;
         case GRABBED: delta_translation = vector_sub(position, grabbed_position); break;
         case ZOOMING: zoom_box.max = vector_floor(pick(mouse_position)); break;
+        case SELECTING: selection_box.max = vector_floor(pick(mouse_position)); break;
+        case SCRUBBING: scrub(x); break;
     }
 
     glutPostRedisplay();
@@ -896,6 +1653,9 @@ static void passive_motion(int x, int y)
     mouse_position  = position;
     picked_position = pick(position);
 
+    if (ab_mode == AB_WIPE)
+        wipe_position = picked_position.x;
+
     glutPostRedisplay();
 }
 
@@ -928,7 +1688,11 @@ int main(int argc, char * argv[])
     initialize(argc, argv);
 
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA);
-    glutInitWindowSize(download_image->format.size.x, download_image->format.size.y);
+    Size size = image_extent();
+    if (pyramid)
+        glutInitWindowSize(ceil(scale * size.x), ceil(scale * size.y));
+    else
+        glutInitWindowSize(size.x, size.y);
 
     glutCreateWindow(title);
     glutDisplayFunc(display);
@@ -36,6 +36,25 @@ Image * kernel_gaussian_2d(int width, float sigma, Vector sample)
     return image;
 }
 
+void kernel_gaussian_1d(float weights[], int width, float sigma)
+{
+    error_check((width % 2) != 1, "kernel width must be odd");
+
+    float sigma2 = SQ(sigma);
+    int radius = width / 2;
+
+    float accumulator = 0.0;
+
+    for (int i = 0; i != width; ++ i)
+    {
+        weights[i] = expf(- SQ(i - radius) / (2 * sigma2));
+        accumulator += weights[i];
+    }
+
+    for (int i = 0; i != width; ++ i)
+        weights[i] /= accumulator;
+}
+
 Image * kernel_box_2d(int width, Vector sample)
 {
     Image_Format format = {GL_FLOAT, GL_LUMINANCE, {width, width, 1}};
@@ -105,3 +124,43 @@ float kernel_pixel_filter_energy(Image const * kernel)
 
     return accumulator;
 }
+
+/* splits a rank one kernel into its row and column factors */
+int kernel_separate(Image const * kernel, float row_weights[], float column_weights[])
+{
+    Size size = kernel->format.size;
+    float const * weights = (float const *) kernel->pixels;
+
+    error_check(kernel->format.type != GL_FLOAT || kernel->format.format != GL_LUMINANCE, "kernel must be float luminance");
+
+    int pivot = 0;
+    for (int i = 1; i != size.x * size.y; ++ i)
+    {
+        if (fabsf(weights[i]) > fabsf(weights[pivot]))
+            pivot = i;
+    }
+
+    float peak = weights[pivot];
+    if (peak == 0)
+        return 0;
+
+    int pivot_row = pivot / size.x;
+    int pivot_column = pivot % size.x;
+
+    for (int j = 0; j != size.x; ++ j)
+        row_weights[j] = weights[pivot_row * size.x + j];
+
+    for (int i = 0; i != size.y; ++ i)
+        column_weights[i] = weights[i * size.x + pivot_column] / peak;
+
+    for (int i = 0; i != size.y; ++ i)
+    for (int j = 0; j != size.x; ++ j)
+    {
+        float product = column_weights[i] * row_weights[j];
+
+        if (fabsf(product - weights[i * size.x + j]) > 1e-6 * fabsf(peak))
+            return 0;
+    }
+
+    return 1;
+}
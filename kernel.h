@@ -4,9 +4,11 @@
 #include "image.h"
 
 Image * kernel_gaussian_2d(int width, float sigma, Vector sample);
+void    kernel_gaussian_1d(float weights[], int width, float sigma);
 Image * kernel_box_2d(int width, Vector sample);
 float   kernel_pixel_filter_energy(Image const * kernel);
 Image * kernel_laplacian(void);
 Image * kernel_laplacian_2(void);
+int     kernel_separate(Image const * kernel, float row_weights[], float column_weights[]);
 
 #endif
@@ -0,0 +1,588 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "median.h"
+#include "memory.h"
+#include "parallel.h"
+#include "pixel_convert.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#define BAND_ROWS 64
+#define TILE_SAMPLES 1024
+#define CHANNELS_MAX 4
+#define CHUNK 256
+#define WIDTH_MAX 255   /* keeps window counts within 16 bits */
+
+static int use_avx2 = -1;
+
+static int clamp_index(int i, int count)
+{
+    return i < 0 ? 0 : i >= count ? count - 1 : i;
+}
+
+/* integer samples keep their raw values so the filters stay exact */
+static void row_to_float(void const * source, GLenum type, float * target, int count)
+{
+    if (type == GL_UNSIGNED_BYTE)
+        for (int i = 0; i != count; ++ i) target[i] = ((unsigned char const *) source)[i];
+    else if (type == GL_UNSIGNED_SHORT)
+        for (int i = 0; i != count; ++ i) target[i] = ((unsigned short const *) source)[i];
+    else
+        pixel_convert(source, type, target, GL_FLOAT, count);
+}
+
+static void row_from_float(float const * source, void * target, GLenum type, int count)
+{
+    if (type == GL_UNSIGNED_BYTE)
+        for (int i = 0; i != count; ++ i) ((unsigned char *) target)[i] = source[i];
+    else if (type == GL_UNSIGNED_SHORT)
+        for (int i = 0; i != count; ++ i) ((unsigned short *) target)[i] = source[i];
+    else
+        pixel_convert(source, GL_FLOAT, target, type, count);
+}
+
+/* one layer as float with radius replicated pixels on every side */
+static float * padded_layer(Image const * source, int layer, int radius)
+{
+    Size size = source->format.size;
+    int channels = format_to_size(source->format.format);
+    int row_floats = (size.x + 2 * radius) * channels;
+    float * buffer = malloc_array(float, (size_t) (size.y + 2 * radius) * row_floats);
+
+    for (int i = 0; i != size.y + 2 * radius; ++ i)
+    {
+        float * row = &buffer[(size_t) i * row_floats];
+        float * pixels = &row[radius * channels];
+
+        row_to_float(image_row(source, layer, clamp_index(i - radius, size.y)), source->format.type, pixels, size.x * channels);
+
+        for (int j = 0; j != radius; ++ j)
+        {
+            memcpy(&row[j * channels], pixels, channels * sizeof(float));
+            memcpy(&pixels[(size.x + j) * channels], &pixels[(size.x - 1) * channels], channels * sizeof(float));
+        }
+    }
+
+    return buffer;
+}
+
+/*
+ * Median networks, applied to CHUNK samples at once so every
+ * compare-exchange is a vector min and max (Paeth, Devillard).
+ */
+
+#define SORT(a, b) sort_pair(v[a], v[b], count)
+
+typedef void Sort_Pair(float * restrict, float * restrict, int);
+
+static void sort_pair_portable(float * restrict a, float * restrict b, int count)
+{
+    for (int i = 0; i != count; ++ i)
+    {
+        float x = a[i], y = b[i];
+        a[i] = x < y ? x : y;
+        b[i] = x > y ? x : y;
+    }
+}
+
+#ifdef X86
+TARGET("avx2") static void sort_pair_avx2(float * restrict a, float * restrict b, int count)
+{
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&a[i]), y = _mm256_loadu_ps(&b[i]);
+        _mm256_storeu_ps(&a[i], _mm256_min_ps(x, y));
+        _mm256_storeu_ps(&b[i], _mm256_max_ps(x, y));
+    }
+
+    sort_pair_portable(&a[i], &b[i], count - i);
+}
+#endif
+
+static inline __attribute__((always_inline)) void median_9(float v[][CHUNK], int count, Sort_Pair * sort_pair)
+{
+    SORT(1, 2); SORT(4, 5); SORT(7, 8); SORT(0, 1); SORT(3, 4); SORT(6, 7);
+    SORT(1, 2); SORT(4, 5); SORT(7, 8); SORT(0, 3); SORT(5, 8); SORT(4, 7);
+    SORT(3, 6); SORT(1, 4); SORT(2, 5); SORT(4, 7); SORT(4, 2); SORT(6, 4);
+    SORT(4, 2);
+}
+
+static inline __attribute__((always_inline)) void median_25(float v[][CHUNK], int count, Sort_Pair * sort_pair)
+{
+    SORT(0, 1);   SORT(3, 4);   SORT(2, 4);   SORT(2, 3);   SORT(6, 7);
+    SORT(5, 7);   SORT(5, 6);   SORT(9, 10);  SORT(8, 10);  SORT(8, 9);
+    SORT(12, 13); SORT(11, 13); SORT(11, 12); SORT(15, 16); SORT(14, 16);
+    SORT(14, 15); SORT(18, 19); SORT(17, 19); SORT(17, 18); SORT(21, 22);
+    SORT(20, 22); SORT(20, 21); SORT(23, 24); SORT(2, 5);   SORT(3, 6);
+    SORT(0, 6);   SORT(0, 3);   SORT(4, 7);   SORT(1, 7);   SORT(1, 4);
+    SORT(11, 14); SORT(8, 14);  SORT(8, 11);  SORT(12, 15); SORT(9, 15);
+    SORT(9, 12);  SORT(13, 16); SORT(10, 16); SORT(10, 13); SORT(20, 23);
+    SORT(17, 23); SORT(17, 20); SORT(21, 24); SORT(18, 24); SORT(18, 21);
+    SORT(19, 22); SORT(8, 17);  SORT(9, 18);  SORT(0, 18);  SORT(0, 9);
+    SORT(10, 19); SORT(1, 19);  SORT(1, 10);  SORT(11, 20); SORT(2, 20);
+    SORT(2, 11);  SORT(12, 21); SORT(3, 21);  SORT(3, 12);  SORT(13, 22);
+    SORT(4, 22);  SORT(4, 13);  SORT(14, 23); SORT(5, 23);  SORT(5, 14);
+    SORT(15, 24); SORT(6, 24);  SORT(6, 15);  SORT(7, 16);  SORT(7, 19);
+    SORT(13, 21); SORT(15, 23); SORT(7, 13);  SORT(7, 15);  SORT(1, 9);
+    SORT(3, 11);  SORT(5, 17);  SORT(11, 17); SORT(9, 17);  SORT(4, 10);
+    SORT(6, 12);  SORT(7, 14);  SORT(4, 6);   SORT(4, 7);   SORT(12, 14);
+    SORT(10, 14); SORT(6, 7);   SORT(10, 12); SORT(6, 10);  SORT(6, 17);
+    SORT(12, 17); SORT(7, 17);  SORT(7, 10);  SORT(12, 18); SORT(7, 12);
+    SORT(10, 18); SORT(12, 20); SORT(10, 20); SORT(10, 12);
+}
+
+#undef SORT
+
+/* one output row: gathers the window samples of each chunk, then runs the network */
+static inline __attribute__((always_inline)) void network_row(float const * padded, int row_floats, int channels, int width, float * target, int count, Sort_Pair * sort_pair)
+{
+    float v[25][CHUNK];
+
+    for (int first = 0; first < count; first += CHUNK)
+    {
+        int n = count - first < CHUNK ? count - first : CHUNK;
+
+        for (int i = 0; i != width; ++ i)
+        for (int j = 0; j != width; ++ j)
+            memcpy(v[i * width + j], &padded[(size_t) i * row_floats + j * channels + first], n * sizeof(float));
+
+        if (width == 3)
+            median_9(v, n, sort_pair);
+        else
+            median_25(v, n, sort_pair);
+
+        memcpy(&target[first], v[width * width / 2], n * sizeof(float));
+    }
+}
+
+static void network_row_portable(float const * padded, int row_floats, int channels, int width, float * target, int count)
+{
+    network_row(padded, row_floats, channels, width, target, count, sort_pair_portable);
+}
+
+#ifdef X86
+TARGET("avx2") static void network_row_avx2(float const * padded, int row_floats, int channels, int width, float * target, int count)
+{
+    network_row(padded, row_floats, channels, width, target, count, sort_pair_avx2);
+}
+#endif
+
+typedef struct
+{
+    Image const * source;
+    Image * target;
+    float const * padded;
+    int layer, width, rank, count;
+    int const * weights;
+}
+Rank_Task;
+
+static void network_rows(void * context, int first, int last)
+{
+    Rank_Task const * task = (Rank_Task const *) context;
+    Size size = task->source->format.size;
+    int channels = format_to_size(task->source->format.format);
+    int row_floats = (size.x + 2 * (task->width / 2)) * channels;
+    float * row = malloc_array(float, size.x * channels);
+
+    for (int i = first; i != last; ++ i)
+    {
+        float const * window = &task->padded[(size_t) i * row_floats];
+
+#ifdef X86
+        if (use_avx2)
+            network_row_avx2(window, row_floats, channels, task->width, row, size.x * channels);
+        else
+#endif
+            network_row_portable(window, row_floats, channels, task->width, row, size.x * channels);
+
+        row_from_float(row, image_row(task->target, task->layer, i), task->source->format.type, size.x * channels);
+    }
+
+    free(row);
+}
+
+static void filter_network(Image const * source, Image * target, int width)
+{
+    Size size = source->format.size;
+
+    for (int z = 0; z != size.z; ++ z)
+    {
+        float * padded = padded_layer(source, z, width / 2);
+        Rank_Task task = {source, target, padded, z, width};
+
+        parallel_for(size.y, 1, network_rows, &task);
+        free(padded);
+    }
+}
+
+/* Wirth's selection, reorders values */
+static float select_rank(float values[], int count, int rank)
+{
+    int low = 0, high = count - 1;
+
+    while (low < high)
+    {
+        float pivot = values[rank];
+        int i = low, j = high;
+
+        do
+        {
+            while (values[i] < pivot) ++ i;
+            while (pivot < values[j]) -- j;
+
+            if (i <= j)
+            {
+                float swap = values[i];
+                values[i ++] = values[j];
+                values[j --] = swap;
+            }
+        }
+        while (i <= j);
+
+        if (j < rank) low = i;
+        if (rank < i) high = j;
+    }
+
+    return values[rank];
+}
+
+static void select_rows(void * context, int first, int last)
+{
+    Rank_Task const * task = (Rank_Task const *) context;
+    Size size = task->source->format.size;
+    int channels = format_to_size(task->source->format.format);
+    int width = task->width;
+    int row_floats = (size.x + 2 * (width / 2)) * channels;
+    float * row = malloc_array(float, size.x * channels);
+    float * values = malloc_array(float, task->count);
+
+    for (int i = first; i != last; ++ i)
+    {
+        for (int j = 0; j != size.x; ++ j)
+        for (int c = 0; c != channels; ++ c)
+        {
+            float const * window = &task->padded[(size_t) i * row_floats + j * channels + c];
+            int n = 0;
+
+            for (int k = 0; k != width; ++ k)
+            for (int l = 0; l != width; ++ l)
+            {
+                float value = window[(size_t) k * row_floats + l * channels];
+
+                for (int w = task->weights ? task->weights[k * width + l] : 1; w > 0; -- w)
+                    values[n ++] = value;
+            }
+
+            row[j * channels + c] = select_rank(values, n, task->rank);
+        }
+
+        row_from_float(row, image_row(task->target, task->layer, i), task->source->format.type, size.x * channels);
+    }
+
+    free(values);
+    free(row);
+}
+
+static void filter_select(Image const * source, Image * target, int width, int const weights[], int rank, int count)
+{
+    Size size = source->format.size;
+
+    for (int z = 0; z != size.z; ++ z)
+    {
+        float * padded = padded_layer(source, z, width / 2);
+        Rank_Task task = {source, target, padded, z, width, rank, count, weights};
+
+        parallel_for(size.y, 1, select_rows, &task);
+        free(padded);
+    }
+}
+
+/*
+ * 8 bit: Perreault and Hebert, Median filtering in constant time, 2007.
+ * Column histograms slide down, the kernel histogram slides right; its
+ * fine bins are only brought up to date for the coarse bin that holds
+ * the rank.
+ */
+
+static inline void bins_add(uint16_t * restrict target, uint16_t const * restrict source, int count)
+{
+    for (int i = 0; i != count; ++ i)
+        target[i] += source[i];
+}
+
+static inline void bins_sub(uint16_t * restrict target, uint16_t const * restrict source, int count)
+{
+    for (int i = 0; i != count; ++ i)
+        target[i] -= source[i];
+}
+
+static void histogram_8_row(unsigned char const * row, int count, int delta, uint16_t * fine, uint16_t * coarse)
+{
+    for (int i = 0; i != count; ++ i)
+    {
+        fine[i * 256 + row[i]] += delta;
+        coarse[i * 16 + (row[i] >> 4)] += delta;
+    }
+}
+
+/* rows [first, last) and columns [left, right); column histograms cover the tile plus radius */
+static void filter_histogram_8_tile(Image const * source, Image * target, int layer, int first, int last, int left, int right, int radius, int rank)
+{
+    Size size = source->format.size;
+    int channels = format_to_size(source->format.format);
+    int low = clamp_index(left - radius, size.x);
+    int high = clamp_index(right - 1 + radius, size.x);
+    int count = (high - low + 1) * channels;
+
+    uint16_t * fine = calloc((size_t) count * 256, sizeof(uint16_t));
+    uint16_t * coarse = calloc((size_t) count * 16, sizeof(uint16_t));
+    uint16_t kernel_fine[CHANNELS_MAX][256], kernel_coarse[CHANNELS_MAX][16];
+    int updated[CHANNELS_MAX][16];
+
+#define COLUMN(column, channel) ((clamp_index((column), size.x) - low) * channels + (channel))
+
+    for (int k = first - radius; k <= first + radius; ++ k)
+        histogram_8_row((unsigned char const *) image_row(source, layer, clamp_index(k, size.y)) + low * channels, count, 1, fine, coarse);
+
+    for (int y = first; y != last; ++ y)
+    {
+        if (y != first)
+        {
+            histogram_8_row((unsigned char const *) image_row(source, layer, clamp_index(y - radius - 1, size.y)) + low * channels, count, -1, fine, coarse);
+            histogram_8_row((unsigned char const *) image_row(source, layer, clamp_index(y + radius, size.y)) + low * channels, count, +1, fine, coarse);
+        }
+
+        unsigned char * target_row = (unsigned char *) image_row(target, layer, y);
+
+        memset(kernel_coarse, 0, sizeof(kernel_coarse));
+
+        for (int c = 0; c != channels; ++ c)
+        {
+            for (int b = 0; b != 16; ++ b)
+                updated[c][b] = INT32_MIN / 2;
+
+            for (int k = left - radius; k <= left + radius; ++ k)
+                bins_add(kernel_coarse[c], &coarse[COLUMN(k, c) * 16], 16);
+        }
+
+        for (int x = left; x != right; ++ x)
+        for (int c = 0; c != channels; ++ c)
+        {
+            int remaining = rank, b = 0;
+
+            while (remaining >= kernel_coarse[c][b])
+                remaining -= kernel_coarse[c][b ++];
+
+            uint16_t * bins = &kernel_fine[c][b * 16];
+
+            if (x - updated[c][b] > 2 * radius + 1)
+            {
+                memset(bins, 0, 16 * sizeof(uint16_t));
+
+                for (int k = x - radius; k <= x + radius; ++ k)
+                    bins_add(bins, &fine[COLUMN(k, c) * 256 + b * 16], 16);
+            }
+            else
+            {
+                for (int p = updated[c][b] + 1; p <= x; ++ p)
+                {
+                    bins_add(bins, &fine[COLUMN(p + radius, c) * 256 + b * 16], 16);
+                    bins_sub(bins, &fine[COLUMN(p - radius - 1, c) * 256 + b * 16], 16);
+                }
+            }
+
+            updated[c][b] = x;
+
+            int v = 0;
+            while (remaining >= bins[v])
+                remaining -= bins[v ++];
+
+            target_row[x * channels + c] = b * 16 + v;
+
+            // the column past the window of the last one is not in the tile's histograms
+            if (x + 1 == right)
+                continue;
+
+            bins_add(kernel_coarse[c], &coarse[COLUMN(x + radius + 1, c) * 16], 16);
+            bins_sub(kernel_coarse[c], &coarse[COLUMN(x - radius, c) * 16], 16);
+        }
+    }
+
+#undef COLUMN
+
+    free(fine);
+    free(coarse);
+}
+
+/*
+ * 16 bit: a sliding window histogram in four levels of 16 bins, so adding
+ * a sample costs four increments and finding a rank at most 64 steps.
+ */
+
+typedef struct {uint16_t level_0[16], level_1[256], level_2[4096], level_3[65536];} Histogram_16;
+
+static inline void histogram_16_add(Histogram_16 * h, unsigned v, int delta)
+{
+    h->level_0[v >> 12] += delta;
+    h->level_1[v >> 8]  += delta;
+    h->level_2[v >> 4]  += delta;
+    h->level_3[v]       += delta;
+}
+
+static unsigned histogram_16_rank(Histogram_16 const * h, int rank)
+{
+    unsigned b = 0;
+
+    while (rank >= h->level_0[b]) rank -= h->level_0[b ++];
+    b *= 16;
+    while (rank >= h->level_1[b]) rank -= h->level_1[b ++];
+    b *= 16;
+    while (rank >= h->level_2[b]) rank -= h->level_2[b ++];
+    b *= 16;
+    while (rank >= h->level_3[b]) rank -= h->level_3[b ++];
+
+    return b;
+}
+
+static void filter_histogram_16_band(Image const * source, Image * target, int layer, int first, int last, int radius, int rank)
+{
+    Size size = source->format.size;
+    int channels = format_to_size(source->format.format);
+    Histogram_16 * histogram = calloc(1, sizeof(Histogram_16));
+    unsigned short const ** rows = malloc_array(unsigned short const *, 2 * radius + 1);
+
+    for (int y = first; y != last; ++ y)
+    {
+        unsigned short * target_row = (unsigned short *) image_row(target, layer, y);
+
+        for (int k = 0; k != 2 * radius + 1; ++ k)
+            rows[k] = (unsigned short const *) image_row(source, layer, clamp_index(y + k - radius, size.y));
+
+        for (int c = 0; c != channels; ++ c)
+        {
+            for (int k = 0; k != 2 * radius + 1; ++ k)
+            for (int l = - radius; l <= radius; ++ l)
+                histogram_16_add(histogram, rows[k][clamp_index(l, size.x) * channels + c], 1);
+
+            for (int x = 0; x != size.x; ++ x)
+            {
+                target_row[x * channels + c] = histogram_16_rank(histogram, rank);
+
+                int enter = clamp_index(x + radius + 1, size.x) * channels + c;
+                int leave = clamp_index(x - radius, size.x) * channels + c;
+
+                for (int k = 0; k != 2 * radius + 1; ++ k)
+                {
+                    histogram_16_add(histogram, rows[k][enter], 1);
+                    histogram_16_add(histogram, rows[k][leave], -1);
+                }
+            }
+
+            /* the window past the last column is removed again, leaving the histogram empty */
+            for (int k = 0; k != 2 * radius + 1; ++ k)
+            for (int l = size.x - radius; l <= size.x + radius; ++ l)
+                histogram_16_add(histogram, rows[k][clamp_index(l, size.x) * channels + c], -1);
+        }
+    }
+
+    free(rows);
+    free(histogram);
+}
+
+/* 8 bit column histograms of a tile stay within the second level cache */
+static int tile_width(Image const * source)
+{
+    int channels = format_to_size(source->format.format);
+    return source->format.type == GL_UNSIGNED_BYTE ? TILE_SAMPLES / channels : source->format.size.x;
+}
+
+static void histogram_tiles(void * context, int first_task, int last_task)
+{
+    Rank_Task const * task = (Rank_Task const *) context;
+    Image const * source = task->source;
+    Size size = source->format.size;
+    int width = tile_width(source);
+    int tile_count = (size.x + width - 1) / width;
+    int band_count = (size.y + BAND_ROWS - 1) / BAND_ROWS;
+
+    for (int i = first_task; i != last_task; ++ i)
+    {
+        int layer = i / (band_count * tile_count);
+        int band = i / tile_count % band_count;
+        int tile = i % tile_count;
+
+        int first = band * BAND_ROWS;
+        int last = first + BAND_ROWS < size.y ? first + BAND_ROWS : size.y;
+        int left = tile * width;
+        int right = left + width < size.x ? left + width : size.x;
+
+        if (source->format.type == GL_UNSIGNED_BYTE)
+            filter_histogram_8_tile(source, task->target, layer, first, last, left, right, task->width / 2, task->rank);
+        else
+            filter_histogram_16_band(source, task->target, layer, first, last, task->width / 2, task->rank);
+    }
+}
+
+static void filter_histogram(Image const * source, Image * target, int width, int rank)
+{
+    Size size = source->format.size;
+    int tile_count = (size.x + tile_width(source) - 1) / tile_width(source);
+    int band_count = (size.y + BAND_ROWS - 1) / BAND_ROWS;
+    Rank_Task task = {source, target, NULL, 0, width, rank};
+
+    parallel_for(tile_count * band_count * size.z, 1, histogram_tiles, &task);
+}
+
+Image * image_filter_rank_weighted(Image const * source, int width, int const weights[], int rank)
+{
+    error_check((width % 2) == 0, "rank filter width must be odd");
+    error_check(width > WIDTH_MAX, "rank filter width too large");
+    error_check(format_to_size(source->format.format) > CHANNELS_MAX, "rank filter supports up to four channels");
+    error_check(source->format.layout != IMAGE_INTERLEAVED, "rank filter needs interleaved images");
+
+    int count = 0;
+    for (int i = 0; i != width * width; ++ i)
+        count += weights ? weights[i] : 1;
+
+    error_check(rank < 0 || rank >= count, "rank must be in [0, window count)");
+
+    if (use_avx2 < 0)
+    {
+        use_avx2 = 0;
+#ifdef X86
+        __builtin_cpu_init();
+        use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+    }
+
+    pixel_convert_isa();
+
+    Image_Format format = source->format;
+    format.row_stride = 0;
+    Image * target = image_new_uninitialized(format);
+    GLenum type = format.type;
+
+    if (! weights && rank == count / 2 && (width == 3 || width == 5))
+        filter_network(source, target, width);
+    else if (! weights && (type == GL_UNSIGNED_BYTE || type == GL_UNSIGNED_SHORT))
+        filter_histogram(source, target, width, rank);
+    else
+        filter_select(source, target, width, weights, rank, count);
+
+    return target;
+}
+
+Image * image_filter_rank(Image const * source, int width, int rank)
+{
+    return image_filter_rank_weighted(source, width, NULL, rank);
+}
@@ -0,0 +1,14 @@
+#ifndef MEDIAN_H
+#define MEDIAN_H
+
+#include "image.h"
+
+/*
+ * Rank filters over width x width windows, every channel on its own,
+ * borders replicated. Rank 0 is the minimum, (count - 1) / 2 the median,
+ * where count is width^2 or the sum of the integer weights.
+ */
+Image * image_filter_rank(Image const *, int width, int rank);
+Image * image_filter_rank_weighted(Image const *, int width, int const weights[], int rank);
+
+#endif
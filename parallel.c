@@ -0,0 +1,260 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "parallel.h"
+#include "system.h"
+
+#define LOCK(mutex)   pthread_mutex_lock(&mutex)
+#define UNLOCK(mutex) pthread_mutex_unlock(&mutex)
+
+#define THREADS_MAX 256
+#define TASKS_PER_THREAD 4
+
+typedef struct
+{
+    Parallel_Body body;
+    void * context;
+    int first, last;
+    int * remaining;
+}
+Task;
+
+/* the owner pushes and pops at the bottom, thieves take from the top */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    Task * tasks;
+    int size, top, bottom;
+}
+Deque;
+
+static pthread_mutex_t start_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t sleep_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t reduction_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+
+static pthread_t threads[THREADS_MAX];
+static Deque deques[THREADS_MAX];  /* deque 0 is shared by threads outside the pool */
+static int requested_count, started_count;
+static int pending, stopping;
+
+static __thread int worker_index;
+
+static void deque_push(Deque * deque, Task task)
+{
+    if (deque->bottom == deque->size)
+    {
+        if (deque->top > 0)
+        {
+            memmove(deque->tasks, &deque->tasks[deque->top], (deque->bottom - deque->top) * sizeof(Task));
+            deque->bottom -= deque->top;
+            deque->top = 0;
+        }
+        else
+        {
+            deque->size = deque->size ? 2 * deque->size : 64;
+            deque->tasks = realloc_array(Task, deque->tasks, deque->size);
+        }
+    }
+
+    deque->tasks[deque->bottom ++] = task;
+}
+
+static int deque_take(Deque * deque, Task * task, int steal)
+{
+    int found = 0;
+
+    LOCK(deque->mutex);
+    if (deque->bottom > deque->top)
+    {
+        * task = steal ? deque->tasks[deque->top ++] : deque->tasks[-- deque->bottom];
+        found = 1;
+
+        if (deque->top == deque->bottom)
+            deque->top = deque->bottom = 0;
+    }
+    UNLOCK(deque->mutex);
+
+    return found;
+}
+
+static int find_task(Task * task)
+{
+    int self = worker_index;
+
+    if (deque_take(&deques[self], task, 0))
+        goto found;
+
+    for (int i = 1; i != started_count; ++ i)
+        if (deque_take(&deques[(self + i) % started_count], task, 1))
+            goto found;
+
+    return 0;
+
+found:
+    __atomic_sub_fetch(&pending, 1, __ATOMIC_SEQ_CST);
+    return 1;
+}
+
+static void run(Task const * task)
+{
+    task->body(task->context, task->first, task->last);
+    __atomic_sub_fetch(task->remaining, 1, __ATOMIC_RELEASE);
+}
+
+static void * worker_main(void * argument)
+{
+    worker_index = (int) (intptr_t) argument;
+
+    for (;;)
+    {
+        Task task;
+
+        if (find_task(&task))
+        {
+            run(&task);
+            continue;
+        }
+
+        LOCK(sleep_mutex);
+        while (__atomic_load_n(&pending, __ATOMIC_SEQ_CST) <= 0 && ! stopping)
+            pthread_cond_wait(&wake, &sleep_mutex);
+        int stop = stopping;
+        UNLOCK(sleep_mutex);
+
+        if (stop)
+            return NULL;
+    }
+}
+
+int parallel_thread_count(void)
+{
+    int count = requested_count > 0 ? requested_count : system_core_count();
+    return count < 1 ? 1 : count > THREADS_MAX ? THREADS_MAX : count;
+}
+
+static void pool_start(void)
+{
+    if (__atomic_load_n(&started_count, __ATOMIC_ACQUIRE))
+        return;
+
+    LOCK(start_mutex);
+    if (! started_count)
+    {
+        int count = parallel_thread_count();
+
+        for (int i = 0; i != count; ++ i)
+            pthread_mutex_init(&deques[i].mutex, NULL);
+
+        /* published first, the workers steal modulo the count */
+        __atomic_store_n(&started_count, count, __ATOMIC_RELEASE);
+
+        for (int i = 1; i != count; ++ i)
+            pthread_create(&threads[i], NULL, worker_main, (void *) (intptr_t) i);
+    }
+    UNLOCK(start_mutex);
+}
+
+/* joins the workers; the next loop starts them again */
+void parallel_shutdown(void)
+{
+    LOCK(start_mutex);
+    if (started_count)
+    {
+        LOCK(sleep_mutex);
+        stopping = 1;
+        pthread_cond_broadcast(&wake);
+        UNLOCK(sleep_mutex);
+
+        for (int i = 1; i != started_count; ++ i)
+            pthread_join(threads[i], NULL);
+
+        for (int i = 0; i != started_count; ++ i)
+        {
+            free(deques[i].tasks);
+            pthread_mutex_destroy(&deques[i].mutex);
+            memset(&deques[i], 0, sizeof(Deque));
+        }
+
+        stopping = 0;
+        started_count = 0;
+    }
+    UNLOCK(start_mutex);
+}
+
+void parallel_set_thread_count(int count)
+{
+    parallel_shutdown();
+    requested_count = count;
+}
+
+/* a grain that gives every thread a single range, for loops that reduce into per range state */
+int parallel_reduction_grain(int count)
+{
+    int threads = parallel_thread_count();
+    return (count + threads - 1) / threads;
+}
+
+void parallel_lock(void)
+{
+    LOCK(reduction_mutex);
+}
+
+void parallel_unlock(void)
+{
+    UNLOCK(reduction_mutex);
+}
+
+void parallel_for(int count, int grain, Parallel_Body body, void * context)
+{
+    if (count <= 0)
+        return;
+
+    pool_start();
+
+    int threads = started_count;
+    int chunk = (count + threads * TASKS_PER_THREAD - 1) / (threads * TASKS_PER_THREAD);
+    if (chunk < grain)
+        chunk = grain;
+
+    int task_count = (count + chunk - 1) / chunk;
+    if (threads == 1 || task_count <= 1)
+    {
+        body(context, 0, count);
+        return;
+    }
+
+    int remaining = task_count - 1;
+    Deque * deque = &deques[worker_index];
+
+    /* pushed back to front, so the owner continues with the neighbouring range */
+    LOCK(deque->mutex);
+    for (int i = task_count - 1; i != 0; -- i)
+    {
+        Task task = {body, context, i * chunk, i == task_count - 1 ? count : (i + 1) * chunk, &remaining};
+        deque_push(deque, task);
+    }
+    UNLOCK(deque->mutex);
+
+    __atomic_add_fetch(&pending, task_count - 1, __ATOMIC_SEQ_CST);
+
+    LOCK(sleep_mutex);
+    pthread_cond_broadcast(&wake);
+    UNLOCK(sleep_mutex);
+
+    body(context, 0, chunk);
+
+    while (__atomic_load_n(&remaining, __ATOMIC_ACQUIRE) > 0)
+    {
+        Task task;
+
+        if (find_task(&task))
+            run(&task);
+        else
+            sched_yield();
+    }
+}
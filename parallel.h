@@ -0,0 +1,21 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/* body of a parallel loop, called with disjoint ranges [first, last) */
+typedef void (* Parallel_Body)(void * context, int first, int last);
+
+/*
+ * Persistent pool of worker threads with one task deque each. The
+ * calling thread runs part of the loop itself and, while it waits, steals
+ * work from the others, so loops may nest. The thread count only changes
+ * between loops.
+ */
+void parallel_set_thread_count(int);    /* 0 takes one thread per core */
+int  parallel_thread_count(void);
+void parallel_for(int count, int grain, Parallel_Body, void * context);
+int  parallel_reduction_grain(int count);
+void parallel_lock(void);
+void parallel_unlock(void);
+void parallel_shutdown(void);
+
+#endif
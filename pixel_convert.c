@@ -0,0 +1,540 @@
+#include <string.h>
+
+#include "half.h"
+#include "image.h"
+#include "math_.h"
+#include "parallel.h"
+#include "pixel_convert.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* source and target bytes converted per task, small enough to stay in L2 */
+#define CHUNK_BYTES (256 * 1024)
+
+static float const U8_SCALE  = 1.0f / 255;
+static float const U16_SCALE = 1.0f / 65535;
+
+static int detected = -1, f16c;
+static Pixel_Convert_ISA isa;
+
+static void convert_scalar(void const * source_pixels, GLenum source_type, void * target_pixels, GLenum target_type, int count)
+{
+    int i;
+
+    // TODO: convert to double as intermediate
+    
+    switch (source_type)
+    {
+        default:
+            memset(target_pixels, 0, count * image_type_to_size(target_type));
+            break;
+
+        case GL_UNSIGNED_BYTE:
+        {
+            unsigned char const * source = (unsigned char const *) source_pixels;
+            switch (target_type)
+            {
+                default:
+                    memset(target_pixels, 0, count * image_type_to_size(target_type));
+                    break;
+
+                case GL_UNSIGNED_SHORT:
+                {
+                    unsigned short * target = (unsigned short *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = source[i] << 8;
+                }
+                break;
+                    
+                case GL_FLOAT:
+                {
+                    float * target = (float *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = source[i] / 255.0;
+                }
+                break;
+                    
+                case GL_DOUBLE:
+                {
+                    double * target = (double *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = source[i] / 255.0;
+                }
+                break;
+            }
+        }
+        break;
+            
+        case GL_UNSIGNED_SHORT:
+        {
+            unsigned short const * source = (unsigned short const *) source_pixels;
+            switch (target_type)
+            {
+                default:
+                    memset(target_pixels, 0, count * image_type_to_size(target_type));
+                    break;
+
+                case GL_UNSIGNED_BYTE:
+                {
+                    unsigned char * target = (unsigned char *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = source[i] >> 8;
+                }
+                break;
+                    
+                case GL_FLOAT:
+                {
+                    float * target = (float *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = source[i] / 65535.0;
+                }
+                break;
+                    
+                case GL_DOUBLE:
+                {
+                    double * target = (double *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = source[i] / 65535.0;
+                }
+                break;
+            }
+        }
+        break;
+
+        case GL_HALF_FLOAT_ARB:
+        {
+            unsigned short const * source = (unsigned short const *) source_pixels;
+            switch (target_type)
+            {
+                default:
+                    memset(target_pixels, 0, count * image_type_to_size(target_type));
+                    break;
+
+                case GL_UNSIGNED_BYTE:
+                {
+                    unsigned char * target = (unsigned char *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = clamp(half_to_float(source[i])) * 255.0 + 0.5;
+                }
+                break;
+                    
+                case GL_UNSIGNED_SHORT:
+                {
+                    unsigned short * target = (unsigned short *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = clamp(half_to_float(source[i])) * 65535.0 + 0.5;
+                }
+                break;
+                    
+                case GL_FLOAT:
+                {
+                    half_to_float_n(source, (float *) target_pixels, count);
+                }
+                break;
+                    
+                case GL_DOUBLE:
+                {
+                    double * target = (double *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = half_to_float(source[i]);
+                }
+                break;
+            }
+        }
+        break;
+            
+        case GL_FLOAT:
+        {
+            float const * source = (float const *) source_pixels;
+            switch (target_type)
+            {
+                default:
+                    memset(target_pixels, 0, count * image_type_to_size(target_type));
+                    break;
+
+                case GL_UNSIGNED_BYTE:
+                {
+                    unsigned char * target = (unsigned char *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = clamp(source[i]) * 255.0 + 0.5;
+                }
+                    break;
+                    
+                case GL_UNSIGNED_SHORT:
+                {
+                    unsigned short * target = (unsigned short *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = clamp(source[i]) * 65535.0 + 0.5;
+                }
+                    break;
+                    
+                case GL_HALF_FLOAT_ARB:
+                {
+                    half_from_float_n(source, (unsigned short *) target_pixels, count);
+                }
+                    break;
+                    
+                case GL_DOUBLE:
+                {
+                    double * target = (double *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = source[i];
+                }
+                    break;
+            }
+        }
+        break;
+            
+        case GL_DOUBLE:
+        {
+            double const * source = (double const *) source_pixels;
+            switch (target_type)
+            {
+                default:
+                    memset(target_pixels, 0, count * image_type_to_size(target_type));
+                    break;
+
+                case GL_UNSIGNED_BYTE:
+                {
+                    unsigned char * target = (unsigned char *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = source[i] * 255.0 + 0.5; // TODO dclamp
+                }
+                    break;
+                    
+                case GL_UNSIGNED_SHORT:
+                {
+                    unsigned short * target = (unsigned short *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = source[i] * 65535.0 + 0.5;
+                }
+                    break;
+                    
+                case GL_HALF_FLOAT_ARB:
+                {
+                    unsigned short * target = (unsigned short *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = half_from_float(source[i]);
+                }
+                    break;
+                    
+                case GL_FLOAT:
+                {
+                    float * target = (float *) target_pixels;
+                    for (i = 0; i < count; ++ i) target[i] = source[i];
+                }
+                    break;
+            }
+        }
+            break;
+    }
+}
+
+
+static void half_to_float_batch(void const * source, void * target, int count)
+{
+    half_to_float_n((unsigned short const *) source, (float *) target, count);
+}
+
+static void float_to_half_batch(void const * source, void * target, int count)
+{
+    half_from_float_n((float const *) source, (unsigned short *) target, count);
+}
+
+#ifdef X86
+TARGET("sse2") static void u8_to_float_sse2(void const * source_, void * target_, int count)
+{
+    unsigned char const * source = (unsigned char const *) source_;
+    float * target = (float *) target_;
+    __m128 const scale = _mm_set1_ps(U8_SCALE);
+    __m128i const zero = _mm_setzero_si128();
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v  = _mm_loadu_si128((__m128i const *) &source[i]);
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+        _mm_storeu_ps(&target[i +  0], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+        _mm_storeu_ps(&target[i +  4], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+        _mm_storeu_ps(&target[i +  8], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+        _mm_storeu_ps(&target[i + 12], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+    }
+
+    for (; i != count; ++ i) target[i] = source[i] * U8_SCALE;
+}
+
+TARGET("sse2") static void u16_to_float_sse2(void const * source_, void * target_, int count)
+{
+    unsigned short const * source = (unsigned short const *) source_;
+    float * target = (float *) target_;
+    __m128 const scale = _mm_set1_ps(U16_SCALE);
+    __m128i const zero = _mm_setzero_si128();
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((__m128i const *) &source[i]);
+
+        _mm_storeu_ps(&target[i + 0], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), scale));
+        _mm_storeu_ps(&target[i + 4], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), scale));
+    }
+
+    for (; i != count; ++ i) target[i] = source[i] * U16_SCALE;
+}
+
+TARGET("sse2") static void float_to_u8_sse2(void const * source_, void * target_, int count)
+{
+    float const * source = (float const *) source_;
+    unsigned char * target = (unsigned char *) target_;
+    __m128 const zero = _mm_setzero_ps(), one = _mm_set1_ps(1), scale = _mm_set1_ps(255), half = _mm_set1_ps(0.5);
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v[4];
+
+        for (int j = 0; j != 4; ++ j)
+        {
+            __m128 x = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(&source[i + 4 * j]), zero), one);
+            v[j] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(x, scale), half));
+        }
+
+        __m128i lo = _mm_packs_epi32(v[0], v[1]);
+        __m128i hi = _mm_packs_epi32(v[2], v[3]);
+        _mm_storeu_si128((__m128i *) &target[i], _mm_packus_epi16(lo, hi));
+    }
+
+    for (; i != count; ++ i) target[i] = clamp(source[i]) * 255.0 + 0.5;
+}
+
+TARGET("sse2") static void u8_to_u16_sse2(void const * source_, void * target_, int count)
+{
+    unsigned char const * source = (unsigned char const *) source_;
+    unsigned short * target = (unsigned short *) target_;
+    __m128i const zero = _mm_setzero_si128();
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((__m128i const *) &source[i]);
+
+        _mm_storeu_si128((__m128i *) &target[i + 0], _mm_unpacklo_epi8(zero, v));
+        _mm_storeu_si128((__m128i *) &target[i + 8], _mm_unpackhi_epi8(zero, v));
+    }
+
+    for (; i != count; ++ i) target[i] = source[i] << 8;
+}
+
+TARGET("sse2") static void u16_to_u8_sse2(void const * source_, void * target_, int count)
+{
+    unsigned short const * source = (unsigned short const *) source_;
+    unsigned char * target = (unsigned char *) target_;
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i lo = _mm_srli_epi16(_mm_loadu_si128((__m128i const *) &source[i + 0]), 8);
+        __m128i hi = _mm_srli_epi16(_mm_loadu_si128((__m128i const *) &source[i + 8]), 8);
+
+        _mm_storeu_si128((__m128i *) &target[i], _mm_packus_epi16(lo, hi));
+    }
+
+    for (; i != count; ++ i) target[i] = source[i] >> 8;
+}
+
+TARGET("avx2") static void u8_to_float_avx2(void const * source_, void * target_, int count)
+{
+    unsigned char const * source = (unsigned char const *) source_;
+    float * target = (float *) target_;
+    __m256 const scale = _mm256_set1_ps(U8_SCALE);
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((__m128i const *) &source[i]);
+
+        _mm256_storeu_ps(&target[i + 0], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v)), scale));
+        _mm256_storeu_ps(&target[i + 8], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8))), scale));
+    }
+
+    for (; i != count; ++ i) target[i] = source[i] * U8_SCALE;
+}
+
+TARGET("avx2") static void u16_to_float_avx2(void const * source_, void * target_, int count)
+{
+    unsigned short const * source = (unsigned short const *) source_;
+    float * target = (float *) target_;
+    __m256 const scale = _mm256_set1_ps(U16_SCALE);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((__m128i const *) &source[i]);
+        _mm256_storeu_ps(&target[i], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v)), scale));
+    }
+
+    for (; i != count; ++ i) target[i] = source[i] * U16_SCALE;
+}
+
+TARGET("avx2") static void float_to_u8_avx2(void const * source_, void * target_, int count)
+{
+    float const * source = (float const *) source_;
+    unsigned char * target = (unsigned char *) target_;
+    __m256 const zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1), scale = _mm256_set1_ps(255), half = _mm256_set1_ps(0.5);
+    __m256i const order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int i = 0;
+
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i v[4];
+
+        for (int j = 0; j != 4; ++ j)
+        {
+            __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(&source[i + 8 * j]), zero), one);
+            v[j] = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(x, scale), half));
+        }
+
+        /* packs work per 128 bit lane, the permutation restores the order */
+        __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+        _mm256_storeu_si256((__m256i *) &target[i], _mm256_permutevar8x32_epi32(packed, order));
+    }
+
+    for (; i != count; ++ i) target[i] = clamp(source[i]) * 255.0 + 0.5;
+}
+
+TARGET("avx2") static void float_to_u16_avx2(void const * source_, void * target_, int count)
+{
+    float const * source = (float const *) source_;
+    unsigned short * target = (unsigned short *) target_;
+    __m256 const zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1), scale = _mm256_set1_ps(65535), half = _mm256_set1_ps(0.5);
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256 x0 = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(&source[i + 0]), zero), one);
+        __m256 x1 = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(&source[i + 8]), zero), one);
+        __m256i v0 = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(x0, scale), half));
+        __m256i v1 = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(x1, scale), half));
+
+        __m256i packed = _mm256_packus_epi32(v0, v1);
+        _mm256_storeu_si256((__m256i *) &target[i], _mm256_permute4x64_epi64(packed, 0xd8));
+    }
+
+    for (; i != count; ++ i) target[i] = clamp(source[i]) * 65535.0 + 0.5;
+}
+
+#endif
+
+static void detect(void)
+{
+    detected = PIXEL_CONVERT_SCALAR;
+#ifdef X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2"))
+        detected = PIXEL_CONVERT_SSE2;
+
+    if (__builtin_cpu_supports("avx2"))
+        detected = PIXEL_CONVERT_AVX2;
+
+    f16c = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+#endif
+    isa = detected;
+}
+
+Pixel_Convert_ISA pixel_convert_isa(void)
+{
+    if (detected < 0)
+        detect();
+
+    return isa;
+}
+
+/* can only lower the level, for comparisons against the portable code */
+void pixel_convert_set_isa(Pixel_Convert_ISA level)
+{
+    if (detected < 0)
+        detect();
+
+    isa = level < detected ? level : detected;
+}
+
+char const * pixel_convert_isa_name(void)
+{
+    switch (pixel_convert_isa())
+    {
+        case PIXEL_CONVERT_SSE2: return f16c ? "sse2+f16c" : "sse2";
+        case PIXEL_CONVERT_AVX2: return f16c ? "avx2+f16c" : "avx2";
+        default:                 return "scalar";
+    }
+}
+
+#define PAIR(source, target) ((source) << 16 ^ (target))
+
+/* NULL where only the portable code exists, half has its own dispatch */
+Pixel_Converter pixel_converter(GLenum source_type, GLenum target_type)
+{
+    Pixel_Convert_ISA level = pixel_convert_isa();
+
+    if (source_type == GL_HALF_FLOAT_ARB && target_type == GL_FLOAT)
+        return half_to_float_batch;
+
+    if (source_type == GL_FLOAT && target_type == GL_HALF_FLOAT_ARB)
+        return float_to_half_batch;
+
+    if (level == PIXEL_CONVERT_SCALAR)
+        return NULL;
+#ifdef X86
+    int avx2 = level >= PIXEL_CONVERT_AVX2;
+
+    switch (PAIR(source_type, target_type))
+    {
+        case PAIR(GL_UNSIGNED_BYTE,  GL_FLOAT):          return avx2 ? u8_to_float_avx2  : u8_to_float_sse2;
+        case PAIR(GL_UNSIGNED_SHORT, GL_FLOAT):          return avx2 ? u16_to_float_avx2 : u16_to_float_sse2;
+        case PAIR(GL_FLOAT,          GL_UNSIGNED_BYTE):  return avx2 ? float_to_u8_avx2  : float_to_u8_sse2;
+        case PAIR(GL_FLOAT,          GL_UNSIGNED_SHORT): return avx2 ? float_to_u16_avx2 : NULL;
+        case PAIR(GL_UNSIGNED_BYTE,  GL_UNSIGNED_SHORT): return u8_to_u16_sse2;
+        case PAIR(GL_UNSIGNED_SHORT, GL_UNSIGNED_BYTE):  return u16_to_u8_sse2;
+    }
+#endif
+    return NULL;
+}
+
+/* source and target may coincide if the target type is not wider; integer targets round to the nearest code */
+void pixel_convert(void const * source, GLenum source_type, void * target, GLenum target_type, int count)
+{
+    if (source_type == target_type)
+    {
+        memmove(target, source, (size_t) count * image_type_to_size(source_type));
+        return;
+    }
+
+    Pixel_Converter convert = pixel_converter(source_type, target_type);
+
+    if (convert)
+        convert(source, target, count);
+    else
+        convert_scalar(source, source_type, target, target_type, count);
+}
+
+typedef struct {void const * source; void * target; GLenum source_type, target_type; int count, chunk;} Chunk_Task;
+
+static void convert_chunks(void * context, int first_chunk, int last_chunk)
+{
+    Chunk_Task const * task = (Chunk_Task const *) context;
+    int source_size = image_type_to_size(task->source_type);
+    int target_size = image_type_to_size(task->target_type);
+
+    for (int i = first_chunk; i != last_chunk; ++ i)
+    {
+        size_t first = (size_t) i * task->chunk;
+        int n = task->count - first < (size_t) task->chunk ? (int) (task->count - first) : task->chunk;
+
+        pixel_convert(
+            (unsigned char const *) task->source + first * source_size, task->source_type,
+            (unsigned char       *) task->target + first * target_size, task->target_type, n);
+    }
+}
+
+/* cache sized pieces, spread over the thread pool */
+void pixel_convert_chunked(void const * source, GLenum source_type, void * target, GLenum target_type, int count)
+{
+    int source_size = image_type_to_size(source_type);
+    int target_size = image_type_to_size(target_type);
+    int chunk = CHUNK_BYTES / (source_size + target_size) / 64 * 64;
+    Chunk_Task task = {source, target, source_type, target_type, count, chunk};
+
+    pixel_convert_isa();
+    parallel_for((count + chunk - 1) / chunk, 1, convert_chunks, &task);
+}
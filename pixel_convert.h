@@ -0,0 +1,18 @@
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+
+#include "opengl.h"
+
+typedef enum {PIXEL_CONVERT_SCALAR, PIXEL_CONVERT_SSE2, PIXEL_CONVERT_AVX2} Pixel_Convert_ISA;
+
+typedef void (* Pixel_Converter)(void const * source, void * target, int count);
+
+Pixel_Converter   pixel_converter(GLenum source_type, GLenum target_type);
+Pixel_Convert_ISA pixel_convert_isa(void);
+void              pixel_convert_set_isa(Pixel_Convert_ISA);
+char const *      pixel_convert_isa_name(void);
+
+void pixel_convert(void const * source, GLenum source_type, void * target, GLenum target_type, int count);
+void pixel_convert_chunked(void const * source, GLenum source_type, void * target, GLenum target_type, int count);
+
+#endif
@@ -0,0 +1,434 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "memory.h"
+#include "playback.h"
+#include "system.h"
+
+#define LOCK(playback)   pthread_mutex_lock(&(playback)->mutex)
+#define UNLOCK(playback) pthread_mutex_unlock(&(playback)->mutex)
+
+/* a late frame is looked for again this soon */
+#define POLL_SECONDS 0.002
+
+static long period(Playback const * playback)
+{
+    int count = playback->frame_count;
+
+    if (playback->mode == PLAYBACK_PING_PONG)
+        return count > 1 ? 2 * (count - 1) : 1;
+
+    return count;
+}
+
+static int phase_frame(Playback const * playback, long phase)
+{
+    int count = playback->frame_count;
+    long q = phase % period(playback);
+
+    switch (playback->mode)
+    {
+        default:
+        case PLAYBACK_LOOP:      return q;
+        case PLAYBACK_PING_PONG: return q < count ? q : period(playback) - q;
+        case PLAYBACK_ONCE:      return phase < count ? phase : count - 1;
+    }
+}
+
+/* within the lap of the frame shown, on the same way for ping pong */
+static long frame_phase(Playback const * playback, int frame)
+{
+    long shown = playback->shown_phase > 0 ? playback->shown_phase : 0;
+    long q = shown % period(playback);
+
+    switch (playback->mode)
+    {
+        default:
+        case PLAYBACK_LOOP:      return shown - q + frame;
+        case PLAYBACK_PING_PONG: return shown - q + (q < playback->frame_count ? frame : period(playback) - frame);
+        case PLAYBACK_ONCE:      return frame;
+    }
+}
+
+static long target_phase(Playback const * playback, Time_ time)
+{
+    if (! playback->playing)
+        return playback->start_phase;
+
+    long phase = playback->start_phase + (long) floor(time_difference(playback->start_time, time) * playback->fps);
+
+    if (playback->mode == PLAYBACK_ONCE && phase >= playback->frame_count)
+        phase = playback->frame_count - 1;
+
+    return phase;
+}
+
+static Time_ due_time(Playback const * playback, long phase)
+{
+    Time_ time = playback->start_time;
+    double seconds = time.tv_sec + time.tv_usec * 1E-6 + (phase - playback->start_phase) / playback->fps;
+
+    time.tv_sec = (long) floor(seconds);
+    time.tv_usec = (long) ((seconds - time.tv_sec) * 1E6);
+    return time;
+}
+
+static int find_slot(Playback const * playback, long phase)
+{
+    for (int i = 0; i != playback->slot_count; ++ i)
+        if (playback->slots[i].state != SLOT_EMPTY && playback->slots[i].phase == phase)
+            return i;
+
+    return -1;
+}
+
+static void empty_slot(Playback_Slot * slot)
+{
+    image_destroy(slot->image);
+    slot->image = NULL;
+    slot->state = SLOT_EMPTY;
+}
+
+/* the phases to decode next: from the one due once a decode would be done, as many as there are slots */
+static long window_start(Playback const * playback, Time_ now)
+{
+    long target = target_phase(playback, now);
+    long start = target == playback->shown_phase ? target + 1 : target;
+
+    if (playback->playing)
+    {
+        Time_ done = now;
+        double seconds = now.tv_usec * 1E-6 + playback->statistics.decode_time;
+
+        done.tv_sec += (long) floor(seconds);
+        done.tv_usec = (long) ((seconds - floor(seconds)) * 1E6);
+
+        long ready = target_phase(playback, done);
+        if (ready > start)
+            start = ready;
+    }
+
+    return start;
+}
+
+static long window_end(Playback const * playback, long start)
+{
+    long end = start + playback->slot_count;
+
+    if (playback->mode == PLAYBACK_ONCE && end > playback->frame_count)
+        end = playback->frame_count;
+
+    return end;
+}
+
+static int free_slot(Playback const * playback, long start, long end)
+{
+    int stale = -1;
+
+    for (int i = 0; i != playback->slot_count; ++ i)
+    {
+        Playback_Slot const * slot = &playback->slots[i];
+
+        if (slot->state == SLOT_EMPTY)
+            return i;
+
+        if (slot->state == SLOT_READY && (slot->phase < start || slot->phase >= end))
+            stale = i;
+    }
+
+    return stale;
+}
+
+static void wait_until(Playback * playback, Time_ time)
+{
+    struct timespec deadline = {time.tv_sec, time.tv_usec * 1000};
+    pthread_cond_timedwait(&playback->wake, &playback->mutex, &deadline);
+}
+
+static void * decoder_main(void * argument)
+{
+    Playback * playback = (Playback *) argument;
+
+    LOCK(playback);
+
+    while (! playback->stopping)
+    {
+        Time_ now = time_current();
+        long start = window_start(playback, now);
+        long end = window_end(playback, start);
+        long phase = start;
+        int index = -1;
+
+        while (phase < end && find_slot(playback, phase) >= 0)
+            ++ phase;
+
+        // decoded frames that are still to be shown are kept, even when due before the window
+        long keep = playback->playing && playback->shown_phase + 1 < start ? playback->shown_phase + 1 : start;
+
+        if (phase < end)
+            index = free_slot(playback, keep, end);
+
+        if (index < 0)
+        {
+            if (playback->playing)
+                wait_until(playback, due_time(playback, target_phase(playback, now) + 1));
+            else
+                pthread_cond_wait(&playback->wake, &playback->mutex);
+
+            continue;
+        }
+
+        Playback_Slot * slot = &playback->slots[index];
+        int generation = playback->generation;
+
+        empty_slot(slot);
+        slot->phase = phase;
+        slot->state = SLOT_DECODING;
+
+        UNLOCK(playback);
+        Image * image = playback->decode(playback->context, phase_frame(playback, phase));
+        float seconds = time_duration(now);
+        LOCK(playback);
+
+        float * decode_time = &playback->statistics.decode_time;
+        * decode_time = * decode_time ? 0.8 * * decode_time + 0.2 * seconds : seconds;
+
+        slot->image = image;
+        slot->state = SLOT_READY;
+
+        // the phases were renumbered meanwhile
+        if (generation != playback->generation)
+            empty_slot(slot);
+    }
+
+    UNLOCK(playback);
+    return NULL;
+}
+
+Playback * playback_new(int frame_count, int first_frame, Playback_Decoder decode, void * context, int slot_count, int thread_count)
+{
+    Playback * playback = calloc_size(Playback);
+
+    playback->decode = decode;
+    playback->context = context;
+    playback->frame_count = frame_count;
+    playback->slot_count = slot_count > 0 ? slot_count : 1;
+    playback->thread_count = thread_count > 0 ? thread_count : system_core_count();
+    playback->mode = PLAYBACK_LOOP;
+    playback->fps = 24;
+    playback->start_phase = playback->shown_phase = first_frame;
+    playback->late_phase = -1;
+    playback->start_time = playback->shown_time = time_current();
+
+    playback->slots = calloc_array(Playback_Slot, playback->slot_count);
+    playback->threads = malloc_array(pthread_t, playback->thread_count);
+
+    pthread_mutex_init(&playback->mutex, NULL);
+    pthread_cond_init(&playback->wake, NULL);
+
+    for (int i = 0; i != playback->thread_count; ++ i)
+        pthread_create(&playback->threads[i], NULL, decoder_main, playback);
+
+    return playback;
+}
+
+void playback_destroy(Playback * playback)
+{
+    if (! playback)
+        return;
+
+    LOCK(playback);
+    playback->stopping = 1;
+    pthread_cond_broadcast(&playback->wake);
+    UNLOCK(playback);
+
+    for (int i = 0; i != playback->thread_count; ++ i)
+        pthread_join(playback->threads[i], NULL);
+
+    for (int i = 0; i != playback->slot_count; ++ i)
+        image_destroy(playback->slots[i].image);
+
+    pthread_cond_destroy(&playback->wake);
+    pthread_mutex_destroy(&playback->mutex);
+    free(playback->threads);
+    free(playback->slots);
+    free(playback);
+}
+
+/* the clock restarts at the frame shown */
+static void restart(Playback * playback)
+{
+    playback->start_phase = playback->shown_phase >= 0 ? playback->shown_phase : 0;
+    playback->start_time = time_current();
+    pthread_cond_broadcast(&playback->wake);
+}
+
+void playback_set_fps(Playback * playback, float fps)
+{
+    LOCK(playback);
+    playback->fps = fps > 0 ? fps : 1;
+    restart(playback);
+    UNLOCK(playback);
+}
+
+void playback_set_mode(Playback * playback, Playback_Mode mode)
+{
+    LOCK(playback);
+
+    int frame = phase_frame(playback, playback->shown_phase);
+
+    ++ playback->generation;
+    for (int i = 0; i != playback->slot_count; ++ i)
+        if (playback->slots[i].state == SLOT_READY)
+            empty_slot(&playback->slots[i]);
+
+    playback->mode = mode;
+    playback->shown_phase = frame;
+    playback->late_phase = -1;
+    restart(playback);
+
+    UNLOCK(playback);
+}
+
+void playback_play(Playback * playback, int playing)
+{
+    LOCK(playback);
+
+    if (playing && playback->mode == PLAYBACK_ONCE && playback->shown_phase == playback->frame_count - 1)
+        playback->shown_phase = -1;
+
+    playback->playing = playing;
+    restart(playback);
+
+    UNLOCK(playback);
+}
+
+void playback_seek(Playback * playback, int frame)
+{
+    LOCK(playback);
+
+    playback->start_phase = frame_phase(playback, frame);
+    playback->start_time = time_current();
+    pthread_cond_broadcast(&playback->wake);
+
+    UNLOCK(playback);
+}
+
+/*
+ * The frame to show now, or -1 while the one shown stays up. The image
+ * goes to the caller. When playing, the newest decoded frame that is due
+ * is taken and the ones it skips count as dropped.
+ */
+int playback_update(Playback * playback, Image ** image)
+{
+    LOCK(playback);
+
+    Time_ now = time_current();
+    long target = target_phase(playback, now);
+    long shown = playback->shown_phase;
+    int best = -1, frame = -1;
+
+    * image = NULL;
+
+    for (int i = 0; i != playback->slot_count && target != shown; ++ i)
+    {
+        Playback_Slot const * slot = &playback->slots[i];
+
+        if (slot->state != SLOT_READY)
+            continue;
+
+        if (slot->phase != target && ! (playback->playing && slot->phase > shown && slot->phase < target))
+            continue;
+
+        if (best < 0 || slot->phase > playback->slots[best].phase)
+            best = i;
+    }
+
+    if (best >= 0)
+    {
+        Playback_Slot * slot = &playback->slots[best];
+        Playback_Statistics * statistics = &playback->statistics;
+
+        if (playback->playing)
+        {
+            float interval = time_difference(playback->shown_time, now);
+
+            if (shown >= 0 && slot->phase > shown + 1)
+                statistics->dropped += slot->phase - shown - 1;
+
+            if (interval > 0)
+                statistics->rate = statistics->rate ? 0.9 * statistics->rate + 0.1 / interval : 1 / interval;
+        }
+
+        playback->shown_phase = slot->phase;
+        playback->shown_time = now;
+        ++ statistics->shown;
+
+        frame = phase_frame(playback, slot->phase);
+        * image = slot->image;
+        slot->image = NULL;
+        slot->state = SLOT_EMPTY;
+
+        if (playback->playing && playback->mode == PLAYBACK_ONCE && slot->phase == playback->frame_count - 1)
+        {
+            playback->playing = 0;
+            playback->start_phase = slot->phase;
+        }
+
+        pthread_cond_broadcast(&playback->wake);
+    }
+
+    if (target != playback->shown_phase && target != playback->late_phase)
+    {
+        ++ playback->statistics.late;
+        playback->late_phase = target;
+    }
+
+    UNLOCK(playback);
+    return frame;
+}
+
+int playback_pending(Playback * playback)
+{
+    LOCK(playback);
+    int pending = playback->playing || target_phase(playback, time_current()) != playback->shown_phase;
+    UNLOCK(playback);
+
+    return pending;
+}
+
+/* seconds until the next update has something to do, negative when there is nothing to wait for */
+float playback_wait(Playback * playback)
+{
+    LOCK(playback);
+
+    Time_ now = time_current();
+    long target = target_phase(playback, now);
+    float seconds = -1;
+
+    if (target != playback->shown_phase)
+        seconds = POLL_SECONDS;
+    else if (playback->playing)
+        seconds = time_difference(now, due_time(playback, target + 1));
+
+    UNLOCK(playback);
+    return seconds;
+}
+
+Playback_Statistics playback_statistics(Playback * playback)
+{
+    LOCK(playback);
+    Playback_Statistics statistics = playback->statistics;
+    UNLOCK(playback);
+
+    return statistics;
+}
+
+void playback_print(Playback * playback)
+{
+    Playback_Statistics s = playback_statistics(playback);
+
+    printf("playback: %lu shown, %lu dropped, %lu late, %.1f fps of %.1f, %.1f ms per decode on %d threads\n",
+        s.shown, s.dropped, s.late, s.rate, playback->fps, 1000 * s.decode_time, playback->thread_count);
+}
@@ -0,0 +1,71 @@
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+#include <pthread.h>
+
+#include "image.h"
+#include "time_.h"
+
+typedef enum {PLAYBACK_LOOP, PLAYBACK_PING_PONG, PLAYBACK_ONCE} Playback_Mode;
+
+/* decodes a frame of the sequence, called on the decoder threads */
+typedef Image * (* Playback_Decoder)(void * context, int frame);
+
+typedef enum {SLOT_EMPTY, SLOT_DECODING, SLOT_READY} Playback_Slot_State;
+
+/* phases count frames along the way played, ping pong visits most frames twice per period */
+typedef struct
+{
+    long phase;
+    Playback_Slot_State state;
+    Image * image;
+}
+Playback_Slot;
+
+typedef struct
+{
+    unsigned long shown, dropped, late;
+    float rate, decode_time;
+}
+Playback_Statistics;
+
+/*
+ * Plays a sequence at a fixed frame rate against the wall clock. Decoder
+ * threads fill a ring of slots with the frames just ahead of the one due,
+ * so the rate does not depend on decode times: frames that are not ready
+ * in time are dropped, and the last one shown stays up meanwhile. Seeking
+ * moves the playhead, paused or not, for scrubbing.
+ */
+typedef struct
+{
+    Playback_Decoder decode;
+    void * context;
+    int frame_count, slot_count, thread_count;
+    Playback_Mode mode;
+    float fps;
+
+    Playback_Slot * slots;
+    pthread_t * threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    int playing, stopping, generation;
+
+    long start_phase, shown_phase, late_phase;
+    Time_ start_time, shown_time;
+    Playback_Statistics statistics;
+}
+Playback;
+
+Playback * playback_new(int frame_count, int first_frame, Playback_Decoder, void * context, int slot_count, int thread_count);
+void       playback_destroy(Playback *);
+void       playback_set_fps(Playback *, float);
+void       playback_set_mode(Playback *, Playback_Mode);
+void       playback_play(Playback *, int playing);
+void       playback_seek(Playback *, int frame);
+int        playback_update(Playback *, Image ** image);
+int        playback_pending(Playback *);
+float      playback_wait(Playback *);
+Playback_Statistics playback_statistics(Playback *);
+void       playback_print(Playback *);
+
+#endif
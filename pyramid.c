@@ -0,0 +1,894 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef PNG
+#include <png.h>
+#endif
+
+#ifdef ZLIB
+#include <zlib.h>
+#endif
+
+#include "error.h"
+#include "file_image.h"
+#include "half.h"
+#include "memory.h"
+#include "parallel.h"
+#include "pixel_convert.h"
+#include "pyramid.h"
+#include "system.h"
+
+#define TILE_GROUP 64
+
+/* scanlines read from an exr at once, a whole compressed block for every codec */
+#define EXR_BAND 32
+
+/* inputs that cannot be streamed are only decoded whole below this file size */
+#define DECODE_LIMIT ((off_t) 512 << 20)
+
+static char const MAGIC[4] = {'I', 'V', 'P', 'Y'};
+static uint32_t const VERSION = 1;
+static uint32_t const ENDIAN_CHECK = 0x01020304;
+
+static int pixel_bytes(Image_Format format)
+{
+    return format_to_size(format.format) * image_type_to_size(format.type);
+}
+
+static int supported(Image_Format format)
+{
+    int type =
+        format.type == GL_UNSIGNED_BYTE || format.type == GL_UNSIGNED_SHORT ||
+        format.type == GL_HALF_FLOAT_ARB || format.type == GL_FLOAT;
+    int channels =
+        format.format == GL_LUMINANCE || format.format == GL_LUMINANCE_ALPHA ||
+        format.format == GL_RGB || format.format == GL_RGBA;
+
+    return type && channels && format.size.z == 1 && format.size.x > 0 && format.size.y > 0;
+}
+
+static int level_sizes(Size size, int tile_size, Size sizes[], Size tiles[])
+{
+    int count = 0;
+
+    for (;;)
+    {
+        Size level_tiles = {(size.x + tile_size - 1) / tile_size, (size.y + tile_size - 1) / tile_size, 1};
+
+        sizes[count] = size;
+        tiles[count] = level_tiles;
+        ++ count;
+
+        if ((size.x <= tile_size && size.y <= tile_size) || count == PYRAMID_LEVELS)
+            return count;
+
+        size.x = (size.x + 1) / 2;
+        size.y = (size.y + 1) / 2;
+    }
+}
+
+/* every byte minus the same byte of the pixel before, like the sub filter of png */
+static void filter_rows(unsigned char * pixels, int width, int height, int pixel_size, int encode)
+{
+    int row_bytes = width * pixel_size;
+
+    for (int i = 0; i != height; ++ i)
+    {
+        unsigned char * row = pixels + (size_t) i * row_bytes;
+
+        if (encode)
+            for (int b = row_bytes - 1; b >= pixel_size; -- b)
+                row[b] -= row[b - pixel_size];
+        else
+            for (int b = pixel_size; b < row_bytes; ++ b)
+                row[b] += row[b - pixel_size];
+    }
+}
+
+#define AVERAGE_ROWS(Type, average) \
+    { \
+        Type const * p = (Type const *) row_1, * q = (Type const *) row_2; \
+        Type * t = (Type *) target; \
+        for (int j = 0; j != width; ++ j) \
+        { \
+            int a = 2 * j * channels; \
+            int b = (2 * j + 1 < source_width ? 2 * j + 1 : 2 * j) * channels; \
+            for (int c = 0; c != channels; ++ c, ++ a, ++ b) \
+                * t ++ = average; \
+        } \
+    }
+
+/* one row of the next level from two rows, the last column repeats at odd widths */
+static void average_rows(GLenum type, int channels, void const * row_1, void const * row_2, void * target, int source_width, int width)
+{
+    switch (type)
+    {
+        case GL_UNSIGNED_BYTE:  AVERAGE_ROWS(unsigned char,  (p[a] + p[b] + q[a] + q[b] + 2) >> 2); break;
+        case GL_UNSIGNED_SHORT: AVERAGE_ROWS(unsigned short, (p[a] + p[b] + q[a] + q[b] + 2) >> 2); break;
+        case GL_FLOAT:          AVERAGE_ROWS(float,          (p[a] + p[b] + q[a] + q[b]) / 4); break;
+        case GL_HALF_FLOAT_ARB: AVERAGE_ROWS(unsigned short,
+            half_from_float((half_to_float(p[a]) + half_to_float(p[b]) + half_to_float(q[a]) + half_to_float(q[b])) / 4)); break;
+    }
+}
+
+/* tile rows of one level, a single band of them is in memory at a time */
+typedef struct
+{
+    Size size, tiles;
+    size_t stride;
+    unsigned char * pixels;
+    int row, filled, pending;
+}
+Band;
+
+typedef struct
+{
+    FILE * file;
+    Image_Format format;
+    int tile_size, level_count, pixel_size, failed;
+    Band bands[PYRAMID_LEVELS];
+    int first_entry[PYRAMID_LEVELS];
+    Pyramid_Entry * index;
+    int entry_count;
+    uint64_t offset;
+
+    unsigned char * encoded;
+    size_t slot_bytes, encoded_bytes[TILE_GROUP];
+    uint32_t encodings[TILE_GROUP];
+}
+Writer;
+
+static int band_rows(Band const * band, int tile_size)
+{
+    int rows = band->size.y - band->row * tile_size;
+    return rows < tile_size ? rows : tile_size;
+}
+
+static void start_band(Writer * writer, int level, int row)
+{
+    Band * band = &writer->bands[level];
+
+    band->row = row;
+    band->filled = 0;
+    band->pending = level && 2 * row + 1 < writer->bands[level - 1].tiles.y ? 2 : 1;
+    memset(band->pixels, 0, band->stride * writer->tile_size);
+}
+
+typedef struct
+{
+    Writer * writer;
+    int level, first_tile;
+}
+Encode_Task;
+
+/* tiles are filtered and deflated when that pays off, stored as they are otherwise */
+static void encode_tiles(void * context, int first, int last)
+{
+    Encode_Task const * task = (Encode_Task const *) context;
+    Writer * writer = task->writer;
+    Band const * band = &writer->bands[task->level];
+    int tile_size = writer->tile_size;
+    int row_bytes = tile_size * writer->pixel_size;
+    size_t tile_bytes = (size_t) row_bytes * tile_size;
+    unsigned char * tile = (unsigned char *) malloc(2 * tile_bytes);
+
+    for (int i = first; i != last; ++ i)
+    {
+        int x = task->first_tile + i;
+        unsigned char * slot = writer->encoded + i * writer->slot_bytes;
+
+        for (int r = 0; r != tile_size; ++ r)
+            memcpy(tile + (size_t) r * row_bytes, band->pixels + r * band->stride + (size_t) x * row_bytes, row_bytes);
+
+#ifdef ZLIB
+        unsigned char * filtered = tile + tile_bytes;
+        uLongf bytes = writer->slot_bytes;
+
+        memcpy(filtered, tile, tile_bytes);
+        filter_rows(filtered, tile_size, tile_size, writer->pixel_size, 1);
+
+        if (compress2(slot, &bytes, filtered, tile_bytes, Z_BEST_SPEED) == Z_OK && bytes < tile_bytes)
+        {
+            writer->encodings[i] = PYRAMID_DEFLATE;
+            writer->encoded_bytes[i] = bytes;
+            continue;
+        }
+#endif
+        memcpy(slot, tile, tile_bytes);
+        writer->encodings[i] = PYRAMID_RAW;
+        writer->encoded_bytes[i] = tile_bytes;
+    }
+
+    free(tile);
+}
+
+static void write_band(Writer * writer, int level)
+{
+    Band const * band = &writer->bands[level];
+
+    for (int first = 0; first < band->tiles.x; first += TILE_GROUP)
+    {
+        int count = first + TILE_GROUP < band->tiles.x ? TILE_GROUP : band->tiles.x - first;
+        Encode_Task task = {writer, level, first};
+
+        parallel_for(count, 1, encode_tiles, &task);
+
+        for (int i = 0; i != count; ++ i)
+        {
+            Pyramid_Entry * entry = &writer->index[writer->first_entry[level] + band->row * band->tiles.x + first + i];
+
+            entry->offset = writer->offset;
+            entry->bytes = writer->encoded_bytes[i];
+            entry->encoding = writer->encodings[i];
+
+            if (fwrite(writer->encoded + i * writer->slot_bytes, 1, entry->bytes, writer->file) != entry->bytes)
+                writer->failed = 1;
+
+            writer->offset += entry->bytes;
+        }
+    }
+}
+
+typedef struct
+{
+    Writer * writer;
+    int level, first_row;
+}
+Reduce_Task;
+
+static void reduce_rows(void * context, int first, int last)
+{
+    Reduce_Task const * task = (Reduce_Task const *) context;
+    Writer const * writer = task->writer;
+    Band const * band = &writer->bands[task->level];
+    Band const * parent = &writer->bands[task->level + 1];
+    int rows = band_rows(band, writer->tile_size);
+    int channels = format_to_size(writer->format.format);
+
+    for (int k = first; k != last; ++ k)
+    {
+        int r1 = 2 * k, r2 = 2 * k + 1 < rows ? 2 * k + 1 : 2 * k;
+
+        average_rows(writer->format.type, channels,
+            band->pixels + r1 * band->stride, band->pixels + r2 * band->stride,
+            parent->pixels + (task->first_row + k) * parent->stride, band->size.x, parent->size.x);
+    }
+}
+
+/* a complete band goes to the file and into its half of the band above */
+static void flush_band(Writer * writer, int level)
+{
+    Band * band = &writer->bands[level];
+    int tile_size = writer->tile_size;
+
+    write_band(writer, level);
+
+    if (level + 1 != writer->level_count)
+    {
+        Band * parent = &writer->bands[level + 1];
+
+        if (parent->row != band->row / 2)
+            start_band(writer, level + 1, band->row / 2);
+
+        Reduce_Task task = {writer, level, band->row % 2 * tile_size / 2};
+        parallel_for((band_rows(band, tile_size) + 1) / 2, 8, reduce_rows, &task);
+
+        if (-- parent->pending == 0)
+            flush_band(writer, level + 1);
+    }
+
+    band->row = -1;
+}
+
+static Writer * writer_open(char const name[], Image_Format format)
+{
+    if (! supported(format))
+    {
+        warn("unsupported format for a pyramid");
+        return NULL;
+    }
+
+    FILE * file = fopen(name, "wb");
+    if (! file)
+        return NULL;
+
+    Writer * writer = calloc_size(Writer);
+    Size sizes[PYRAMID_LEVELS], tiles[PYRAMID_LEVELS];
+
+    writer->file = file;
+    writer->format = format;
+    writer->tile_size = PYRAMID_TILE;
+    writer->pixel_size = pixel_bytes(format);
+    writer->level_count = level_sizes(format.size, PYRAMID_TILE, sizes, tiles);
+
+    for (int l = 0; l != writer->level_count; ++ l)
+    {
+        Band * band = &writer->bands[l];
+
+        band->size = sizes[l];
+        band->tiles = tiles[l];
+        band->stride = (size_t) tiles[l].x * PYRAMID_TILE * writer->pixel_size;
+        band->pixels = (unsigned char *) malloc(band->stride * PYRAMID_TILE);
+        band->row = -1;
+        error_check(! band->pixels, "failed to allocate pyramid band");
+
+        writer->first_entry[l] = writer->entry_count;
+        writer->entry_count += tiles[l].x * tiles[l].y;
+    }
+
+    size_t tile_bytes = (size_t) PYRAMID_TILE * PYRAMID_TILE * writer->pixel_size;
+#ifdef ZLIB
+    writer->slot_bytes = compressBound(tile_bytes);
+#else
+    writer->slot_bytes = tile_bytes;
+#endif
+    writer->encoded = (unsigned char *) malloc(TILE_GROUP * writer->slot_bytes);
+    writer->index = calloc_array(Pyramid_Entry, writer->entry_count);
+    error_check(! writer->encoded || ! writer->index, "failed to allocate pyramid writer");
+
+    Pyramid_Header header;
+    clear(Pyramid_Header, &header);
+
+    if (fwrite(&header, sizeof header, 1, file) != 1)
+        writer->failed = 1;
+
+    writer->offset = sizeof header;
+
+    return writer;
+}
+
+static unsigned char * begin_row(Writer * writer, int y)
+{
+    Band * band = &writer->bands[0];
+
+    if (band->row != y / writer->tile_size)
+        start_band(writer, 0, y / writer->tile_size);
+
+    return band->pixels + (y % writer->tile_size) * band->stride;
+}
+
+static void end_row(Writer * writer)
+{
+    Band * band = &writer->bands[0];
+
+    if (++ band->filled == band_rows(band, writer->tile_size))
+        flush_band(writer, 0);
+}
+
+static int writer_close(Writer * writer, char const name[])
+{
+    for (int l = 0; l != writer->level_count; ++ l)
+        if (writer->bands[l].row >= 0)
+            writer->failed = 1;
+
+    Pyramid_Header header =
+    {
+        {MAGIC[0], MAGIC[1], MAGIC[2], MAGIC[3]},
+        VERSION, ENDIAN_CHECK,
+        writer->format.type, writer->format.format,
+        writer->format.size.x, writer->format.size.y,
+        writer->tile_size, writer->level_count,
+        0, writer->offset
+    };
+
+    if (fwrite(writer->index, sizeof(Pyramid_Entry), writer->entry_count, writer->file) != (size_t) writer->entry_count)
+        writer->failed = 1;
+
+    if (fseek(writer->file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof header, 1, writer->file) != 1)
+        writer->failed = 1;
+
+    if (fclose(writer->file) != 0)
+        writer->failed = 1;
+
+    int failed = writer->failed;
+    if (failed)
+        remove(name);
+
+    for (int l = 0; l != writer->level_count; ++ l)
+        free(writer->bands[l].pixels);
+
+    free(writer->encoded);
+    free(writer->index);
+    free(writer);
+
+    return ! failed;
+}
+
+/* rows of the input one at a time: png and exr are streamed, anything else is decoded whole */
+typedef struct
+{
+    Image_Format format;
+    int bottom_up;
+    Image const * image;
+#ifdef PNG
+    FILE * file;
+    png_structp reader;
+    png_infop info;
+#endif
+#ifdef EXR
+    Exr_Reader * exr;
+    unsigned char * band;
+    int band_first, band_count;
+#endif
+}
+Source;
+
+#ifdef PNG
+static int png_source_open(Source * source, char const name[])
+{
+    FILE * file = fopen(name, "rb");
+    png_byte signature[8];
+
+    if (! file)
+        return 0;
+
+    if (fread(signature, 1, sizeof signature, file) != sizeof signature || png_sig_cmp(signature, 0, sizeof signature) != 0)
+    {
+        fclose(file);
+        return 0;
+    }
+
+    png_structp reader = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(reader);
+
+    if (setjmp(png_jmpbuf(reader)))
+    {
+        png_destroy_read_struct(&reader, &info, NULL);
+        fclose(file);
+        return 0;
+    }
+
+    png_init_io(reader, file);
+    png_set_sig_bytes(reader, sizeof signature);
+    png_read_info(reader, info);
+
+    // interlaced rows only come complete after the last pass
+    if (png_get_interlace_type(reader, info) != PNG_INTERLACE_NONE)
+        png_error(reader, "interlaced");
+
+    int depth = png_get_bit_depth(reader, info);
+
+    png_set_expand(reader);
+    if (depth == 16 && ! system_is_big_endian())
+        png_set_swap(reader);
+
+    png_read_update_info(reader, info);
+
+    GLenum format;
+    switch (png_get_color_type(reader, info))
+    {
+        case PNG_COLOR_TYPE_GRAY:       format = GL_LUMINANCE;       break;
+        case PNG_COLOR_TYPE_GRAY_ALPHA: format = GL_LUMINANCE_ALPHA; break;
+        case PNG_COLOR_TYPE_RGB:        format = GL_RGB;             break;
+        case PNG_COLOR_TYPE_RGB_ALPHA:  format = GL_RGBA;            break;
+        default:                        png_error(reader, "color type");
+    }
+
+    Image_Format image_format =
+    {
+        depth == 16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, format,
+        {png_get_image_width(reader, info), png_get_image_height(reader, info), 1}
+    };
+
+    source->format = image_format;
+    source->bottom_up = 0;
+    source->file = file;
+    source->reader = reader;
+    source->info = info;
+
+    return 1;
+}
+
+static int png_source_read(Source * source, void * pixels)
+{
+    if (setjmp(png_jmpbuf(source->reader)))
+        return 0;
+
+    png_read_row(source->reader, (png_bytep) pixels, NULL);
+    return 1;
+}
+#endif
+
+#ifdef EXR
+static int exr_source_open(Source * source, char const name[])
+{
+    Image_Format format;
+    Exr_Reader * reader = exr_reader_open(name, &format);
+
+    if (! reader)
+        return 0;
+
+    source->format = format;
+    source->bottom_up = 0;
+    source->exr = reader;
+    source->band = malloc((size_t) EXR_BAND * format.size.x * pixel_bytes(format));
+    error_check(! source->band, "failed to allocate exr band");
+
+    return 1;
+}
+
+/* the band moves down the file, the writer asks for its rows from the top */
+static int exr_source_read(Source * source, int row, void * pixels)
+{
+    int height = source->format.size.y;
+    int line = height - 1 - row;
+    size_t row_bytes = (size_t) source->format.size.x * pixel_bytes(source->format);
+
+    if (line < source->band_first || line >= source->band_first + source->band_count)
+    {
+        source->band_first = line;
+        source->band_count = height - line < EXR_BAND ? height - line : EXR_BAND;
+
+        if (! exr_reader_read(source->exr, source->band_first, source->band_count, source->band))
+        {
+            source->band_count = 0;
+            return 0;
+        }
+    }
+
+    memcpy(pixels, source->band + (line - source->band_first) * row_bytes, row_bytes);
+    return 1;
+}
+#endif
+
+static int source_open(Source * source, char const name[])
+{
+    clear(Source, source);
+
+#ifdef PNG
+    if (png_source_open(source, name))
+        return 1;
+#endif
+
+#ifdef EXR
+    if (exr_source_open(source, name))
+        return 1;
+#endif
+
+    struct stat status;
+    if (stat(name, &status) == 0 && status.st_size > DECODE_LIMIT)
+    {
+        warn("input too large to decode whole, only non-interlaced png and single layer exr are streamed");
+        return 0;
+    }
+
+    Image * image = image_open(name);
+    if (! image)
+        return 0;
+
+    source->image = image;
+    source->format = image->format;
+    source->bottom_up = 1;
+
+    return 1;
+}
+
+static int source_read(Source * source, int row, void * pixels)
+{
+#ifdef PNG
+    if (source->reader)
+        return png_source_read(source, pixels);
+#endif
+
+#ifdef EXR
+    if (source->exr)
+        return exr_source_read(source, row, pixels);
+#endif
+
+    memcpy(pixels, image_pixel(source->image, 0, row, 0), (size_t) source->format.size.x * pixel_bytes(source->format));
+    return 1;
+}
+
+static void source_close(Source * source)
+{
+#ifdef PNG
+    if (source->reader)
+    {
+        png_destroy_read_struct(&source->reader, &source->info, NULL);
+        fclose(source->file);
+    }
+#endif
+
+#ifdef EXR
+    exr_reader_close(source->exr);
+    free(source->band);
+#endif
+}
+
+static int convert(Source * source, char const name[])
+{
+    Writer * writer = writer_open(name, source->format);
+    if (! writer)
+        return 0;
+
+    int height = source->format.size.y;
+
+    for (int i = 0; i != height && ! writer->failed; ++ i)
+    {
+        int y = source->bottom_up ? i : height - 1 - i;
+
+        if (source_read(source, y, begin_row(writer, y)))
+            end_row(writer);
+        else
+            writer->failed = 1;
+    }
+
+    return writer_close(writer, name);
+}
+
+int pyramid_convert(char const source_name[], char const target_name[])
+{
+    Source source;
+    if (! source_open(&source, source_name))
+        return 0;
+
+    int success = convert(&source, target_name);
+
+    source_close(&source);
+    image_destroy((Image *) source.image);
+
+    return success;
+}
+
+int pyramid_save(Image const * image, char const name[])
+{
+    error_check(image->format.layout != IMAGE_INTERLEAVED, "pyramids are written from interleaved images");
+
+    Source source;
+    clear(Source, &source);
+
+    source.image = image;
+    source.format = image->format;
+    source.bottom_up = 1;
+
+    return convert(&source, name);
+}
+
+int pyramid_is_file(char const name[])
+{
+    FILE * file = fopen(name, "rb");
+    char magic[sizeof MAGIC];
+
+    if (! file)
+        return 0;
+
+    int is_pyramid = fread(magic, 1, sizeof magic, file) == sizeof magic && ! memcmp(magic, MAGIC, sizeof magic);
+    fclose(file);
+
+    return is_pyramid;
+}
+
+int pyramid_tile_bytes(Pyramid const * pyramid)
+{
+    return pyramid->tile_size * pyramid->tile_size * pixel_bytes(pyramid->format);
+}
+
+static void load_tile(void * context, Tile_Key key, void * pixels)
+{
+    Pyramid const * pyramid = (Pyramid const *) context;
+    Pyramid_Entry entry = pyramid->index[pyramid->first_entry[key.level] + key.y * pyramid->tiles[key.level].x + key.x];
+    unsigned char const * data = pyramid->map + entry.offset;
+    size_t tile_bytes = pyramid_tile_bytes(pyramid);
+
+    if (entry.offset + entry.bytes <= pyramid->map_bytes)
+    {
+        if (entry.encoding == PYRAMID_RAW && entry.bytes == tile_bytes)
+        {
+            memcpy(pixels, data, tile_bytes);
+            return;
+        }
+#ifdef ZLIB
+        uLongf bytes = tile_bytes;
+
+        if (entry.encoding == PYRAMID_DEFLATE && uncompress((Bytef *) pixels, &bytes, data, entry.bytes) == Z_OK && bytes == tile_bytes)
+        {
+            filter_rows((unsigned char *) pixels, pyramid->tile_size, pyramid->tile_size, pixel_bytes(pyramid->format), 0);
+            return;
+        }
+#endif
+    }
+
+    warn("unreadable pyramid tile");
+    memset(pixels, 0, tile_bytes);
+}
+
+static int valid_header(Pyramid_Header const * header, size_t bytes, Size sizes[], Size tiles[], int first_entry[])
+{
+    if (memcmp(header->magic, MAGIC, sizeof MAGIC) || header->version != VERSION || header->byte_order != ENDIAN_CHECK)
+        return 0;
+
+    Image_Format format = {header->type, header->format, {header->width, header->height, 1}};
+    if (! supported(format) || header->tile_size == 0 || header->tile_size % 2)
+        return 0;
+
+    int level_count = level_sizes(format.size, header->tile_size, sizes, tiles);
+    if ((uint32_t) level_count != header->level_count)
+        return 0;
+
+    uint64_t entry_count = 0;
+    for (int l = 0; l != level_count; ++ l)
+    {
+        first_entry[l] = entry_count;
+        entry_count += (uint64_t) tiles[l].x * tiles[l].y;
+    }
+
+    return header->index_offset + entry_count * sizeof(Pyramid_Entry) <= bytes;
+}
+
+Pyramid * pyramid_open(char const name[], size_t cache_bytes)
+{
+    int file = open(name, O_RDONLY);
+    struct stat status;
+
+    if (file < 0)
+        return NULL;
+
+    if (fstat(file, &status) != 0 || (size_t) status.st_size < sizeof(Pyramid_Header))
+    {
+        close(file);
+        return NULL;
+    }
+
+    void * map = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+
+    if (map == MAP_FAILED)
+        return NULL;
+
+    Pyramid * pyramid = calloc_size(Pyramid);
+    Pyramid_Header const * header = (Pyramid_Header const *) map;
+
+    pyramid->map = (unsigned char const *) map;
+    pyramid->map_bytes = status.st_size;
+
+    if (! valid_header(header, pyramid->map_bytes, pyramid->sizes, pyramid->tiles, pyramid->first_entry))
+    {
+        warn("not a valid pyramid file");
+        pyramid_close(pyramid);
+        return NULL;
+    }
+
+    Image_Format format = {header->type, header->format, {header->width, header->height, 1}};
+
+    pyramid->format = format;
+    pyramid->tile_size = header->tile_size;
+    pyramid->level_count = header->level_count;
+    pyramid->index = (Pyramid_Entry const *) (pyramid->map + header->index_offset);
+    pyramid->cache = tile_cache_new(pyramid_tile_bytes(pyramid), cache_bytes, load_tile, pyramid);
+
+    // viewers jump around, read ahead would mostly fetch tiles of other rows
+    madvise(map, pyramid->map_bytes, MADV_RANDOM);
+
+    return pyramid;
+}
+
+void pyramid_close(Pyramid * pyramid)
+{
+    if (! pyramid)
+        return;
+
+    tile_cache_destroy(pyramid->cache);
+    munmap((void *) pyramid->map, pyramid->map_bytes);
+    free(pyramid);
+}
+
+void * pyramid_acquire(Pyramid * pyramid, int level, int tile_x, int tile_y)
+{
+    Tile_Key key = {level, 0, tile_x, tile_y};
+    return tile_cache_acquire(pyramid->cache, key);
+}
+
+void pyramid_release(Pyramid * pyramid, int level, int tile_x, int tile_y)
+{
+    Tile_Key key = {level, 0, tile_x, tile_y};
+    tile_cache_release(pyramid->cache, key);
+}
+
+typedef struct
+{
+    Pyramid * pyramid;
+    int level;
+    Size min, count;
+}
+Prefetch_Task;
+
+static void prefetch_tiles(void * context, int first, int last)
+{
+    Prefetch_Task const * task = (Prefetch_Task const *) context;
+
+    for (int i = first; i != last; ++ i)
+    {
+        int x = task->min.x + i % task->count.x;
+        int y = task->min.y + i / task->count.x;
+
+        pyramid_acquire(task->pyramid, task->level, x, y);
+        pyramid_release(task->pyramid, task->level, x, y);
+    }
+}
+
+/* tiles [min, max) of a level are decoded in parallel, resident ones only move to the front */
+void pyramid_prefetch(Pyramid * pyramid, int level, Size min, Size max)
+{
+    Size tiles = pyramid->tiles[level];
+    Prefetch_Task task = {pyramid, level};
+
+    task.min.x = min.x > 0 ? min.x : 0;
+    task.min.y = min.y > 0 ? min.y : 0;
+    task.count.x = (max.x < tiles.x ? max.x : tiles.x) - task.min.x;
+    task.count.y = (max.y < tiles.y ? max.y : tiles.y) - task.min.y;
+
+    if (task.count.x > 0 && task.count.y > 0)
+        parallel_for(task.count.x * task.count.y, 1, prefetch_tiles, &task);
+}
+
+Image * pyramid_read_level(Pyramid * pyramid, int level)
+{
+    Image_Format format = pyramid->format;
+    format.size = pyramid->sizes[level];
+
+    Image * image = image_new_uninitialized(format);
+    Size tiles = pyramid->tiles[level];
+    int tile_size = pyramid->tile_size;
+    int pixel_size = pixel_bytes(format);
+
+    for (int ty = 0; ty != tiles.y; ++ ty)
+    for (int tx = 0; tx != tiles.x; ++ tx)
+    {
+        unsigned char const * pixels = (unsigned char const *) pyramid_acquire(pyramid, level, tx, ty);
+        int x = tx * tile_size, y = ty * tile_size;
+        int width  = x + tile_size < format.size.x ? tile_size : format.size.x - x;
+        int height = y + tile_size < format.size.y ? tile_size : format.size.y - y;
+
+        for (int r = 0; r != height; ++ r)
+            memcpy(image_pixel(image, 0, y + r, x), pixels + (size_t) r * tile_size * pixel_size, (size_t) width * pixel_size);
+
+        pyramid_release(pyramid, level, tx, ty);
+    }
+
+    return image;
+}
+
+Color pyramid_sample(Pyramid * pyramid, int level, int x, int y)
+{
+    Image_Format format = pyramid->format;
+    Size size = pyramid->sizes[level];
+    int tile_size = pyramid->tile_size;
+    int channels = format_to_size(format.format);
+    float values[4] = {0, 0, 0, 0};
+
+    if (x < 0 || y < 0 || x >= size.x || y >= size.y)
+        return BLACK;
+
+    unsigned char const * tile = (unsigned char const *) pyramid_acquire(pyramid, level, x / tile_size, y / tile_size);
+    unsigned char const * pixel = tile + ((size_t) (y % tile_size) * tile_size + x % tile_size) * pixel_bytes(format);
+
+    if (format.type == GL_FLOAT)
+        memcpy(values, pixel, channels * sizeof(float));
+    else
+        pixel_convert(pixel, format.type, values, GL_FLOAT, channels);
+
+    pyramid_release(pyramid, level, x / tile_size, y / tile_size);
+
+    Color color = {values[0], values[1], values[2]};
+    if (channels < 3)
+        color.g = color.b = color.r;
+
+    return color;
+}
+
+void pyramid_print(Pyramid const * pyramid)
+{
+    image_format_print(pyramid->format);
+    printf("pyramid: %d levels of %dx%d tiles, %lu bytes mapped\n",
+        pyramid->level_count, pyramid->tile_size, pyramid->tile_size, (unsigned long) pyramid->map_bytes);
+
+    for (int l = 0; l != pyramid->level_count; ++ l)
+        printf("  %d: %dx%d in %dx%d tiles\n", l, pyramid->sizes[l].x, pyramid->sizes[l].y, pyramid->tiles[l].x, pyramid->tiles[l].y);
+
+    tile_cache_print(pyramid->cache);
+}
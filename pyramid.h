@@ -0,0 +1,72 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "color.h"
+#include "image.h"
+#include "tile_cache.h"
+
+#define PYRAMID_TILE   256
+#define PYRAMID_LEVELS 32
+
+typedef enum {PYRAMID_RAW, PYRAMID_DEFLATE} Pyramid_Encoding;
+
+/* fixed size, native byte order; the index sits behind the tiles */
+typedef struct
+{
+    char magic[4];
+    uint32_t version, byte_order;
+    uint32_t type, format;
+    uint32_t width, height;
+    uint32_t tile_size, level_count;
+    uint32_t reserved;
+    uint64_t index_offset;
+}
+Pyramid_Header;
+
+/* one per tile, level by level from the full resolution at 0, rows of tiles from the bottom */
+typedef struct
+{
+    uint64_t offset;
+    uint32_t bytes, encoding;
+}
+Pyramid_Entry;
+
+/*
+ * Mapped pyramid file. Tiles are square, interleaved and padded with
+ * zeros at the right and top edges, every level halves the previous one
+ * rounding up, the last one fits a single tile. Decoded tiles live in a
+ * tile cache keyed by level and tile position, so only what is looked at
+ * is ever read or inflated.
+ */
+typedef struct
+{
+    Image_Format format;
+    int tile_size, level_count;
+    Size sizes[PYRAMID_LEVELS], tiles[PYRAMID_LEVELS];
+    int first_entry[PYRAMID_LEVELS];
+
+    unsigned char const * map;
+    size_t map_bytes;
+    Pyramid_Entry const * index;
+    Tile_Cache * cache;
+}
+Pyramid;
+
+int       pyramid_is_file(char const name[]);
+int       pyramid_convert(char const source_name[], char const target_name[]);
+int       pyramid_save(Image const *, char const name[]);
+
+Pyramid * pyramid_open(char const name[], size_t cache_bytes);
+void      pyramid_close(Pyramid *);
+int       pyramid_tile_bytes(Pyramid const *);
+void *    pyramid_acquire(Pyramid *, int level, int tile_x, int tile_y);
+void      pyramid_release(Pyramid *, int level, int tile_x, int tile_y);
+void      pyramid_prefetch(Pyramid *, int level, Size min, Size max);
+Image *   pyramid_read_level(Pyramid *, int level);
+Color     pyramid_sample(Pyramid *, int level, int x, int y);
+void      pyramid_print(Pyramid const *);
+
+#endif
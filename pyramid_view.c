@@ -0,0 +1,148 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "memory.h"
+#include "pyramid_view.h"
+
+Pyramid_View * pyramid_view_new(Pyramid * pyramid)
+{
+    Pyramid_View * view = calloc_size(Pyramid_View);
+
+    view->pyramid = pyramid;
+    view->capacity = 256;
+    view->textures = malloc_array(Pyramid_Texture, view->capacity);
+
+    return view;
+}
+
+void pyramid_view_destroy(Pyramid_View * view)
+{
+    if (! view)
+        return;
+
+    for (int i = 0; i != view->count; ++ i)
+        glDeleteTextures(1, &view->textures[i].texture);
+
+    free(view->textures);
+    free(view);
+}
+
+void pyramid_view_invalidate(Pyramid_View * view)
+{
+    for (int i = 0; i != view->count; ++ i)
+        view->textures[i].key.level = -1;
+}
+
+/* the coarsest level that still has at least one pixel per screen pixel */
+int pyramid_view_level(Pyramid const * pyramid, float scale)
+{
+    int level = 0;
+
+    while (level + 1 < pyramid->level_count && scale * (1 << (level + 1)) <= 1)
+        ++ level;
+
+    return level;
+}
+
+static void upload(Pyramid_View * view, Tile_Key key, GLuint texture)
+{
+    Pyramid * pyramid = view->pyramid;
+    Image_Format format = pyramid->format;
+    int tile_size = pyramid->tile_size;
+    void const * pixels = pyramid_acquire(pyramid, key.level, key.x, key.y);
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, format.format, tile_size, tile_size, 0, format.format, format.type, pixels);
+    image_store_unpack_reset();
+
+    pyramid_release(pyramid, key.level, key.x, key.y);
+}
+
+/* a texture drawn in this frame is never recycled for another tile of the same frame */
+static GLuint tile_texture(Pyramid_View * view, Tile_Key key)
+{
+    int oldest = -1;
+
+    for (int i = 0; i != view->count; ++ i)
+    {
+        Pyramid_Texture * texture = &view->textures[i];
+
+        if (texture->key.level == key.level && texture->key.x == key.x && texture->key.y == key.y)
+        {
+            texture->stamp = view->stamp;
+            glBindTexture(GL_TEXTURE_2D, texture->texture);
+            return texture->texture;
+        }
+
+        if (texture->stamp != view->stamp && (oldest < 0 || texture->stamp < view->textures[oldest].stamp))
+            oldest = i;
+    }
+
+    if (view->count < view->capacity || oldest < 0)
+    {
+        if (view->count == view->capacity)
+        {
+            view->capacity *= 2;
+            view->textures = realloc_array(Pyramid_Texture, view->textures, view->capacity);
+            error_check(! view->textures, "failed to grow pyramid textures");
+        }
+
+        oldest = view->count ++;
+        glGenTextures(1, &view->textures[oldest].texture);
+    }
+
+    Pyramid_Texture * texture = &view->textures[oldest];
+    texture->key = key;
+    texture->stamp = view->stamp;
+    upload(view, key, texture->texture);
+
+    return texture->texture;
+}
+
+void pyramid_view_draw(Pyramid_View * view, Box visible, float scale, int filter)
+{
+    Pyramid * pyramid = view->pyramid;
+    int level = pyramid_view_level(pyramid, scale);
+    float span = (float) pyramid->tile_size * (1 << level);
+    Size extent = pyramid->sizes[0];
+    Size tiles = pyramid->tiles[level];
+
+    Size min = {(int) floor(visible.min.x / span), (int) floor(visible.min.y / span), 0};
+    Size max = {(int) ceil(visible.max.x / span), (int) ceil(visible.max.y / span), 0};
+
+    min.x = min.x > 0 ? min.x : 0;
+    min.y = min.y > 0 ? min.y : 0;
+    max.x = max.x < tiles.x ? max.x : tiles.x;
+    max.y = max.y < tiles.y ? max.y : tiles.y;
+
+    // the ring around the visible tiles is decoded ahead of panning
+    Size ring_min = {min.x - 1, min.y - 1, 0};
+    Size ring_max = {max.x + 1, max.y + 1, 0};
+    pyramid_prefetch(pyramid, level, ring_min, ring_max);
+
+    ++ view->stamp;
+
+    for (int y = min.y; y < max.y; ++ y)
+    for (int x = min.x; x < max.x; ++ x)
+    {
+        Tile_Key key = {level, 0, x, y};
+        tile_texture(view, key);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter ? GL_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter ? GL_LINEAR : GL_NEAREST);
+
+        // edge tiles are padded, only their part inside the image is drawn
+        float x0 = x * span, y0 = y * span;
+        float x1 = fmin(x0 + span, extent.x), y1 = fmin(y0 + span, extent.y);
+        float s = (x1 - x0) / span, t = (y1 - y0) / span;
+
+        glBegin(GL_TRIANGLE_STRIP);
+        glTexCoord2f(0, 0); glVertex2f(x0, y0);
+        glTexCoord2f(s, 0); glVertex2f(x1, y0);
+        glTexCoord2f(0, t); glVertex2f(x0, y1);
+        glTexCoord2f(s, t); glVertex2f(x1, y1);
+        glEnd();
+    }
+}
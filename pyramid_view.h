@@ -0,0 +1,38 @@
+#ifndef PYRAMID_VIEW_H
+#define PYRAMID_VIEW_H
+
+#include "box.h"
+#include "opengl.h"
+#include "pyramid.h"
+
+typedef struct
+{
+    Tile_Key key;
+    GLuint texture;
+    unsigned long stamp;
+}
+Pyramid_Texture;
+
+/*
+ * Draws the part of a pyramid inside a box of full resolution pixels,
+ * from the level that matches the scale. Visible tiles and a ring around
+ * them are decoded in parallel, each tile becomes a texture of its own;
+ * textures are recycled least recently drawn first. Uploads go through
+ * the current pixel transfer state, invalidate after changing it.
+ */
+typedef struct
+{
+    Pyramid * pyramid;
+    Pyramid_Texture * textures;
+    int count, capacity;
+    unsigned long stamp;
+}
+Pyramid_View;
+
+Pyramid_View * pyramid_view_new(Pyramid *);
+void           pyramid_view_destroy(Pyramid_View *);
+void           pyramid_view_invalidate(Pyramid_View *);
+int            pyramid_view_level(Pyramid const *, float scale);
+void           pyramid_view_draw(Pyramid_View *, Box visible, float scale, int filter);
+
+#endif
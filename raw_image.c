@@ -73,7 +73,7 @@ Image * raw_load(char const name[], Vector * ratio)
 
     Image * image = image_new(format);
 
-    unsigned const byte_count = image_format_bytes(format);
+    size_t const byte_count = image_format_bytes(format);
     fread(image->pixels, 1, byte_count, file);
     fclose(file);
 
@@ -82,7 +82,7 @@ Image * raw_load(char const name[], Vector * ratio)
 
 void raw_save(Image const * image, FILE * file)
 {
-    unsigned const byte_count = image_format_bytes(image->format);
+    size_t const byte_count = image_format_bytes(image->format);
     fwrite(image->pixels, 1, byte_count, file);
     fclose(file);
 }
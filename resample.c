@@ -0,0 +1,350 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "memory.h"
+#include "parallel.h"
+#include "pixel_convert.h"
+#include "resample.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* output rows per task, the horizontal results of a band stay in cache */
+#define BAND_ROWS 32
+
+static int use_fma = -1;
+
+/* every output sample reads taps consecutive source samples from first on */
+typedef struct
+{
+    int taps;
+    int * first;
+    float * weights;
+}
+Weight_Table;
+
+static double sinc(double x)
+{
+    if (x == 0)
+        return 1;
+
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+static double filter_support(Resample_Filter filter)
+{
+    switch (filter)
+    {
+        case RESAMPLE_BOX:      return 0.5;
+        case RESAMPLE_BILINEAR: return 1;
+        case RESAMPLE_BICUBIC:  return 2;
+        case RESAMPLE_LANCZOS:  return 3;
+    }
+
+    return 1;
+}
+
+static double filter_weight(Resample_Filter filter, double x)
+{
+    double a = fabs(x);
+
+    switch (filter)
+    {
+        case RESAMPLE_BOX:
+            return x >= -0.5 && x < 0.5;
+
+        case RESAMPLE_BILINEAR:
+            return a < 1 ? 1 - a : 0;
+
+        case RESAMPLE_BICUBIC:
+            if (a < 1) return (1.5 * a - 2.5) * a * a + 1;
+            if (a < 2) return ((-0.5 * a + 2.5) * a - 4) * a + 2;
+            return 0;
+
+        case RESAMPLE_LANCZOS:
+            return a < 3 ? sinc(x) * sinc(x / 3) : 0;
+    }
+
+    return 0;
+}
+
+/* taps outside of the source fold onto its edge samples */
+static Weight_Table weight_table(int source_count, int target_count, Resample_Filter filter)
+{
+    double ratio = (double) source_count / target_count;
+    double widening = ratio > 1 ? ratio : 1;
+    double support = filter_support(filter) * widening;
+
+    Weight_Table table;
+    table.taps = (int) ceil(2 * support) + 1;
+    if (table.taps > source_count)
+        table.taps = source_count;
+
+    table.first = malloc_array(int, target_count);
+    table.weights = calloc_array(float, (size_t) target_count * table.taps);
+
+    for (int i = 0; i != target_count; ++ i)
+    {
+        double center = (i + 0.5) * ratio - 0.5;
+        int low  = (int) ceil(center - support);
+        int high = (int) floor(center + support);
+        int first = low < 0 ? 0 : low;
+        float * weights = &table.weights[(size_t) i * table.taps];
+        double sum = 0;
+
+        if (first > source_count - table.taps)
+            first = source_count - table.taps;
+
+        for (int j = low; j <= high; ++ j)
+        {
+            double weight = filter_weight(filter, (j - center) / widening);
+            int k = j < 0 ? 0 : j >= source_count ? source_count - 1 : j;
+
+            if (k - first >= table.taps)
+                continue;
+
+            weights[k - first] += weight;
+            sum += weight;
+        }
+
+        if (sum == 0)
+        {
+            int nearest = (int) floor(center + 0.5);
+            nearest = nearest < 0 ? 0 : nearest >= source_count ? source_count - 1 : nearest;
+            weights[nearest - first] = 1;
+            sum = 1;
+        }
+
+        for (int t = 0; t != table.taps; ++ t)
+            weights[t] /= sum;
+
+        table.first[i] = first;
+    }
+
+    return table;
+}
+
+static void weight_table_destroy(Weight_Table * table)
+{
+    free(table->first);
+    free(table->weights);
+}
+
+/* constant channel counts let the compiler turn the channel loop into vector lanes */
+static inline void row_channels(float const * source, float * target, Weight_Table const * table, int count, int channels)
+{
+    int taps = table->taps;
+
+    for (int x = 0; x != count; ++ x)
+    {
+        float const * s = &source[(size_t) table->first[x] * channels];
+        float const * w = &table->weights[(size_t) x * taps];
+        float accumulator[4] = {0, 0, 0, 0};
+
+        for (int t = 0; t != taps; ++ t)
+        for (int c = 0; c != channels; ++ c)
+            accumulator[c] += w[t] * s[t * channels + c];
+
+        for (int c = 0; c != channels; ++ c)
+            target[x * channels + c] = accumulator[c];
+    }
+}
+
+static void resample_row(float const * source, float * target, Weight_Table const * table, int count, int channels)
+{
+    switch (channels)
+    {
+        case 1:  row_channels(source, target, table, count, 1); break;
+        case 2:  row_channels(source, target, table, count, 2); break;
+        case 3:  row_channels(source, target, table, count, 3); break;
+        default: row_channels(source, target, table, count, 4); break;
+    }
+}
+
+/* target[i] = sum of weights[k] * rows[k][i] */
+static void rows_portable(float const * const rows[], float const weights[], int size, float * target, int count)
+{
+    for (int i = 0; i != count; ++ i)
+        target[i] = 0;
+
+    for (int k = 0; k != size; ++ k)
+    {
+        float weight = weights[k];
+        float const * row = rows[k];
+
+        if (weight == 0)
+            continue;
+
+        for (int i = 0; i != count; ++ i)
+            target[i] += weight * row[i];
+    }
+}
+
+#ifdef X86
+TARGET("avx2,fma") static void rows_fma(float const * const rows[], float const weights[], int size, float * target, int count)
+{
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256 a0 = _mm256_setzero_ps();
+        __m256 a1 = _mm256_setzero_ps();
+
+        for (int k = 0; k != size; ++ k)
+        {
+            __m256 w = _mm256_set1_ps(weights[k]);
+
+            a0 = _mm256_fmadd_ps(w, _mm256_loadu_ps(&rows[k][i + 0]), a0);
+            a1 = _mm256_fmadd_ps(w, _mm256_loadu_ps(&rows[k][i + 8]), a1);
+        }
+
+        _mm256_storeu_ps(&target[i + 0], a0);
+        _mm256_storeu_ps(&target[i + 8], a1);
+    }
+
+    for (; i != count; ++ i)
+    {
+        float accumulator = 0;
+
+        for (int k = 0; k != size; ++ k)
+            accumulator += weights[k] * rows[k][i];
+
+        target[i] = accumulator;
+    }
+}
+#endif
+
+static void detect(void)
+{
+    use_fma = 0;
+#ifdef X86
+    __builtin_cpu_init();
+    use_fma = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+static void rows(float const * const rows_[], float const weights[], int size, float * target, int count)
+{
+#ifdef X86
+    if (use_fma)
+    {
+        rows_fma(rows_, weights, size, target, count);
+        return;
+    }
+#endif
+    rows_portable(rows_, weights, size, target, count);
+}
+
+typedef struct
+{
+    Image const * source;
+    Image * target;
+    Weight_Table columns, lines;
+    int band_count;
+}
+Resample_Task;
+
+/* output rows [first, last) of one layer, from the source rows they need */
+static void resample_band(Resample_Task const * task, int layer, int first, int last)
+{
+    Image const * source = task->source;
+    Image * target = task->target;
+    Weight_Table const * lines = &task->lines;
+    int channels = format_to_size(source->format.format);
+    int source_width = source->format.size.x;
+    int count = target->format.size.x * channels;
+
+    int band_first = lines->first[first];
+    int band_count = lines->first[last - 1] + lines->taps - band_first;
+
+    float * line = malloc_array(float, (size_t) source_width * channels);
+    float * buffer = malloc_array(float, (size_t) (band_count + 1) * count);
+    float * output = &buffer[(size_t) band_count * count];
+    float const ** taps = malloc_array(float const *, lines->taps);
+
+    for (int i = 0; i != band_count; ++ i)
+    {
+        pixel_convert(image_row(source, layer, band_first + i), source->format.type, line, GL_FLOAT, source_width * channels);
+        resample_row(line, &buffer[(size_t) i * count], &task->columns, target->format.size.x, channels);
+    }
+
+    for (int y = first; y != last; ++ y)
+    {
+        for (int t = 0; t != lines->taps; ++ t)
+            taps[t] = &buffer[(size_t) (lines->first[y] - band_first + t) * count];
+
+        rows(taps, &lines->weights[(size_t) y * lines->taps], lines->taps, output, count);
+
+        pixel_convert(output, GL_FLOAT, image_row(target, layer, y), target->format.type, count);
+    }
+
+    free(taps);
+    free(buffer);
+    free(line);
+}
+
+static void resample_bands(void * context, int first_task, int last_task)
+{
+    Resample_Task const * task = (Resample_Task const *) context;
+    int height = task->target->format.size.y;
+
+    for (int i = first_task; i != last_task; ++ i)
+    {
+        int layer = i / task->band_count;
+        int first = i % task->band_count * BAND_ROWS;
+        int last  = first + BAND_ROWS < height ? first + BAND_ROWS : height;
+
+        resample_band(task, layer, first, last);
+    }
+}
+
+void image_resample_into(Image const * source, Image * target, Resample_Filter filter)
+{
+    Size source_size = source->format.size;
+    Size target_size = target->format.size;
+
+    error_check(source->format.format != target->format.format, "resampled images must have same format");
+    error_check(source_size.z != target_size.z, "resampled images must have same layer count");
+    error_check(format_to_size(source->format.format) > 4, "resampling supports up to four channels");
+    error_check(source->format.layout != IMAGE_INTERLEAVED || target->format.layout != IMAGE_INTERLEAVED, "resampling needs interleaved images");
+
+    if (! size_volume(source_size) || ! size_volume(target_size))
+        return;
+
+    if (use_fma < 0)
+        detect();
+
+    pixel_convert_isa();
+
+    Resample_Task task =
+    {
+        source, target,
+        weight_table(source_size.x, target_size.x, filter),
+        weight_table(source_size.y, target_size.y, filter),
+        (target_size.y + BAND_ROWS - 1) / BAND_ROWS,
+    };
+
+    parallel_for(task.band_count * target_size.z, 1, resample_bands, &task);
+
+    weight_table_destroy(&task.columns);
+    weight_table_destroy(&task.lines);
+}
+
+Image * image_resample(Image const * source, int width, int height, Resample_Filter filter)
+{
+    Image_Format format = source->format;
+    format.size.x = width;
+    format.size.y = height;
+    format.row_stride = 0;
+
+    Image * target = image_new_uninitialized(format);
+    image_resample_into(source, target, filter);
+
+    return target;
+}
@@ -0,0 +1,18 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include "image.h"
+
+typedef enum {RESAMPLE_BOX, RESAMPLE_BILINEAR, RESAMPLE_BICUBIC, RESAMPLE_LANCZOS} Resample_Filter;
+
+/*
+ * Separable resampling to any width and height; layers are kept. Filters
+ * widen with the reduction when shrinking, so they also prefilter.
+ * Bicubic is Catmull-Rom, Lanczos has three lobes. Borders are clamped.
+ * Any pixel type is accepted and the target may have another type than
+ * the source; arithmetic is done in float, integer targets are rounded.
+ */
+void    image_resample_into(Image const * source, Image * target, Resample_Filter);
+Image * image_resample(Image const *, int width, int height, Resample_Filter);
+
+#endif
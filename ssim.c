@@ -0,0 +1,326 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "convolve.h"
+#include "error.h"
+#include "kernel.h"
+#include "memory.h"
+#include "parallel.h"
+#include "pixel_convert.h"
+#include "ssim.h"
+
+/* Wang, Simoncelli and Bovik, Multi-scale structural similarity, 2003 */
+static double const scale_weights[MS_SSIM_SCALES] = {0.0448, 0.2856, 0.3001, 0.2363, 0.1333};
+
+Ssim_Parameters ssim_parameters(void)
+{
+    Ssim_Parameters parameters = {1, 0.01, 0.03, 1, 1, 1, 1.5, 11};
+    return parameters;
+}
+
+float image_dmssim(float mssim) { return 1.0 / mssim - 1.0; }
+
+/* one layer as packed float */
+static Image * float_layer(Image const * image, int layer)
+{
+    Size size = image->format.size;
+    Image_Format format = {GL_FLOAT, image->format.format, {size.x, size.y, 1}};
+    Image * target = image_new_uninitialized(format);
+    int count = size.x * format_to_size(format.format);
+
+    for (int i = 0; i != size.y; ++ i)
+        pixel_convert(image_row(image, layer, i), image->format.type, image_row(target, 0, i), GL_FLOAT, count);
+
+    return target;
+}
+
+typedef struct
+{
+    Image const * image;
+    Image * target;
+}
+Halve_Task;
+
+static void halve_rows(void * context, int first, int last)
+{
+    Halve_Task const * task = (Halve_Task const *) context;
+    Size size = task->image->format.size, half = task->target->format.size;
+    int channels = format_to_size(task->image->format.format);
+
+    for (int i = first; i != last; ++ i)
+    {
+        float const * row_1 = (float const *) task->image->pixels + (size_t) (2 * i + 0) * size.x * channels;
+        float const * row_2 = (float const *) task->image->pixels + (size_t) (2 * i + 1) * size.x * channels;
+        float * target_row = (float *) task->target->pixels + (size_t) i * half.x * channels;
+
+        for (int j = 0; j != half.x; ++ j)
+        for (int c = 0; c != channels; ++ c)
+        {
+            int k = 2 * j * channels + c;
+            target_row[j * channels + c] = (row_1[k] + row_1[k + channels] + row_2[k] + row_2[k + channels]) / 4;
+        }
+    }
+}
+
+/* 2x2 average, odd edges dropped */
+static Image * halve(Image const * image)
+{
+    Size size = image->format.size;
+    Image_Format format = {GL_FLOAT, image->format.format, {size.x / 2, size.y / 2, 1}};
+    Image * target = image_new_uninitialized(format);
+
+    Halve_Task task = {image, target};
+    parallel_for(format.size.y, 16, halve_rows, &task);
+
+    return target;
+}
+
+static Image * blurred_product(Image const * image_1, Image const * image_2, float const weights[], int width)
+{
+    Image * product = image_new_uninitialized(image_1->format);
+    float const * pixels_1 = (float const *) image_1->pixels;
+    float const * pixels_2 = (float const *) image_2->pixels;
+    float * pixels = (float *) product->pixels;
+    size_t count = (size_t) size_volume(image_1->format.size) * format_to_size(image_1->format.format);
+
+    for (size_t i = 0; i != count; ++ i)
+        pixels[i] = pixels_1[i] * pixels_2[i];
+
+    Image * blurred = image_convolve_separable(product, weights, width, weights, width, BORDER_MIRROR);
+    image_destroy(product);
+
+    return blurred;
+}
+
+typedef struct
+{
+    Image const * mean_x, * mean_y, * xx, * yy, * xy;
+    Ssim_Parameters const * parameters;
+    float * map;
+    double * row_sums;
+    int channels, simple;
+    double c_1, c_2, c_3;
+    int first_x, last_x, first_y, last_y;
+}
+Ssim_Task;
+
+static void ssim_rows(void * context, int first, int last)
+{
+    Ssim_Task const * task = (Ssim_Task const *) context;
+    Ssim_Parameters const * parameters = task->parameters;
+    int channels = task->channels, simple = task->simple;
+    int row_floats = task->mean_x->format.size.x * channels;
+    double c_1 = task->c_1, c_2 = task->c_2, c_3 = task->c_3;
+    int first_x = task->first_x, last_x = task->last_x;
+
+    for (int i = first; i != last; ++ i)
+    {
+        size_t offset = (size_t) i * row_floats;
+        float const * m_x = (float const *) task->mean_x->pixels + offset;
+        float const * m_y = (float const *) task->mean_y->pixels + offset;
+        float const * e_xx = (float const *) task->xx->pixels + offset;
+        float const * e_yy = (float const *) task->yy->pixels + offset;
+        float const * e_xy = (float const *) task->xy->pixels + offset;
+        float * target = task->map ? task->map + offset : NULL;
+        double * ssim_row = &task->row_sums[(size_t) i * 2 * channels];
+        double * cs_row = ssim_row + channels;
+        int valid_row = i >= task->first_y && i < task->last_y;
+
+        for (int j = 0; j != row_floats; ++ j)
+        {
+            double mx = m_x[j], my = m_y[j];
+            double sxx = fmax(e_xx[j] - mx * mx, 0);
+            double syy = fmax(e_yy[j] - my * my, 0);
+            double sxy = e_xy[j] - mx * my;
+            double l, cs;
+
+            if (simple)
+            {
+                l  = (2 * mx * my + c_1) / (mx * mx + my * my + c_1);
+                cs = (2 * sxy + c_2) / (sxx + syy + c_2);
+            }
+            else
+            {
+                double sx = sqrt(sxx), sy = sqrt(syy);
+
+                l = pow((2 * mx * my + c_1) / (mx * mx + my * my + c_1), parameters->alpha);
+                cs = pow((2 * sx * sy + c_2) / (sxx + syy + c_2), parameters->beta)
+                   * pow((sxy + c_3) / (sx * sy + c_3), parameters->gamma);
+            }
+
+            if (target)
+                target[j] = l * cs;
+
+            int column = j / channels;
+            if (valid_row && column >= first_x && column < last_x)
+            {
+                ssim_row[j % channels] += l * cs;
+                cs_row[j % channels] += cs;
+            }
+        }
+    }
+}
+
+/*
+ * SSIM of one float layer from blurred first and second moments. Adds the
+ * valid-region sums of the full index and of contrast times structure and
+ * returns the number of pixels they cover.
+ */
+static int ssim_layer(Image const * x, Image const * y, Ssim_Parameters const * parameters, float * map, double ssim_sums[], double cs_sums[])
+{
+    int width = parameters->width;
+    int radius = width / 2;
+    float * weights = malloc_array(float, width);
+    kernel_gaussian_1d(weights, width, parameters->sigma);
+
+    Image * mean_x = image_convolve_separable(x, weights, width, weights, width, BORDER_MIRROR);
+    Image * mean_y = image_convolve_separable(y, weights, width, weights, width, BORDER_MIRROR);
+    Image * xx = blurred_product(x, x, weights, width);
+    Image * yy = blurred_product(y, y, weights, width);
+    Image * xy = blurred_product(x, y, weights, width);
+
+    free(weights);
+
+    Size size = x->format.size;
+    int channels = format_to_size(x->format.format);
+    int simple = parameters->alpha == 1 && parameters->beta == 1 && parameters->gamma == 1;
+
+    double c_1 = pow(parameters->k_1 * parameters->L, 2);
+    double c_2 = pow(parameters->k_2 * parameters->L, 2);
+    double c_3 = c_2 / 2;
+
+    /* the valid region shrinks to the whole image when the window does not fit */
+    int first_x = size.x > width ? radius : 0, last_x = size.x > width ? size.x - radius : size.x;
+    int first_y = size.y > width ? radius : 0, last_y = size.y > width ? size.y - radius : size.y;
+
+    double * row_sums = calloc((size_t) size.y * 2 * channels, sizeof(double));
+
+    Ssim_Task task = {mean_x, mean_y, xx, yy, xy, parameters, map, row_sums, channels, simple, c_1, c_2, c_3, first_x, last_x, first_y, last_y};
+    parallel_for(size.y, 4, ssim_rows, &task);
+
+    for (int i = 0; i != size.y; ++ i)
+    for (int c = 0; c != channels; ++ c)
+    {
+        ssim_sums[c] += row_sums[(size_t) i * 2 * channels + c];
+        cs_sums[c] += row_sums[(size_t) i * 2 * channels + channels + c];
+    }
+
+    free(row_sums);
+    image_destroy(mean_x);
+    image_destroy(mean_y);
+    image_destroy(xx);
+    image_destroy(yy);
+    image_destroy(xy);
+
+    return (last_x - first_x) * (last_y - first_y);
+}
+
+static void check(Image const * image, Image const * reference)
+{
+    error_check(! size_equal(image->format.size, reference->format.size), "SSIM requires both images to have same size");
+    error_check(image->format.format != reference->format.format, "SSIM requires both images to have same format");
+    error_check(format_to_size(image->format.format) > SSIM_CHANNELS, "SSIM supports up to four channels");
+    error_check(image->format.layout != IMAGE_INTERLEAVED || reference->format.layout != IMAGE_INTERLEAVED, "SSIM needs interleaved images");
+}
+
+static Image * ssim(Image const * image, Image const * reference, Ssim_Parameters const * parameters, int with_map, double means[])
+{
+    check(image, reference);
+
+    Size size = image->format.size;
+    int channels = format_to_size(image->format.format);
+    Image_Format format = {GL_FLOAT, image->format.format, size};
+    Image * map = with_map ? image_new_uninitialized(format) : NULL;
+
+    double ssim_sums[SSIM_CHANNELS] = {0}, cs_sums[SSIM_CHANNELS] = {0};
+    int count = 0;
+
+    for (int z = 0; z != size.z; ++ z)
+    {
+        Image * x = float_layer(image, z);
+        Image * y = float_layer(reference, z);
+        float * layer_map = map ? (float *) map->pixels + (size_t) z * size.x * size.y * channels : NULL;
+
+        count += ssim_layer(x, y, parameters, layer_map, ssim_sums, cs_sums);
+
+        image_destroy(x);
+        image_destroy(y);
+    }
+
+    for (int c = 0; c != channels; ++ c)
+        means[c] = count ? ssim_sums[c] / count : 1;
+
+    return map;
+}
+
+Image * image_ssim(Image const * image, Image const * reference, Ssim_Parameters const * parameters, double means[])
+{
+    return ssim(image, reference, parameters, 1, means);
+}
+
+void image_ssim_mean(Image const * image, Image const * reference, Ssim_Parameters const * parameters, double means[])
+{
+    ssim(image, reference, parameters, 0, means);
+}
+
+void image_ms_ssim(Image const * image, Image const * reference, Ssim_Parameters const * parameters, int scale_count, double means[])
+{
+    check(image, reference);
+    error_check(scale_count < 1 || scale_count > MS_SSIM_SCALES, "MS-SSIM scale count out of range");
+
+    Size size = image->format.size;
+    int channels = format_to_size(image->format.format);
+
+    /* fewer scales for small images, weights renormalized */
+    int smallest = size.x < size.y ? size.x : size.y;
+    while (scale_count > 1 && (smallest >> (scale_count - 1)) < parameters->width)
+        -- scale_count;
+
+    double weight_sum = 0;
+    for (int s = 0; s != scale_count; ++ s)
+        weight_sum += scale_weights[s];
+
+    double products[SSIM_CHANNELS] = {0};
+
+    for (int z = 0; z != size.z; ++ z)
+    {
+        Image * x = float_layer(image, z);
+        Image * y = float_layer(reference, z);
+        double product[SSIM_CHANNELS] = {1, 1, 1, 1};
+
+        for (int s = 0; s != scale_count; ++ s)
+        {
+            double ssim_sums[SSIM_CHANNELS] = {0}, cs_sums[SSIM_CHANNELS] = {0};
+            int count = ssim_layer(x, y, parameters, NULL, ssim_sums, cs_sums);
+            double weight = scale_weights[s] / weight_sum;
+
+            for (int c = 0; c != channels; ++ c)
+            {
+                double value = (s == scale_count - 1 ? ssim_sums[c] : cs_sums[c]) / count;
+                product[c] *= pow(fmax(value, 0), weight);
+            }
+
+            if (s == scale_count - 1)
+                break;
+
+            Image * x_half = halve(x);
+            Image * y_half = halve(y);
+
+            image_destroy(x);
+            image_destroy(y);
+
+            x = x_half;
+            y = y_half;
+        }
+
+        image_destroy(x);
+        image_destroy(y);
+
+        for (int c = 0; c != channels; ++ c)
+            products[c] += product[c];
+    }
+
+    for (int c = 0; c != channels; ++ c)
+        means[c] = products[c] / size.z;
+}
@@ -0,0 +1,30 @@
+#ifndef SSIM_H
+#define SSIM_H
+
+#include "image.h"
+
+#define SSIM_CHANNELS 4
+#define MS_SSIM_SCALES 5
+
+typedef struct
+{
+    float L, k_1, k_2;          /* dynamic range and stabilizing constants */
+    float alpha, beta, gamma;   /* luminance, contrast and structure exponents */
+    float sigma;                /* gaussian window */
+    int width;
+}
+Ssim_Parameters;
+
+Ssim_Parameters ssim_parameters(void);
+
+/*
+ * Both images must have the same size and channel count, any type. The
+ * map has their size and channels as float, means are per channel over
+ * the pixels whose window lies inside the image.
+ */
+Image * image_ssim(Image const *, Image const * reference, Ssim_Parameters const *, double means[]);
+void    image_ssim_mean(Image const *, Image const * reference, Ssim_Parameters const *, double means[]);
+void    image_ms_ssim(Image const *, Image const * reference, Ssim_Parameters const *, int scale_count, double means[]);
+float   image_dmssim(float mssim);
+
+#endif
@@ -2,6 +2,7 @@
 #include <stdio.h>
 
 #include "error.h"
+#include "image_layout.h"
 #include "math_.h"
 #include "memory.h"
 #include "opengl.h"
@@ -32,49 +33,157 @@ Color texture_checker(Vector v)
     return n % 2 ? WHITE : BLACK;
 }
 
+/* one tile of packed pixels into the bound 2D texture, which already has its storage; edge tiles are clipped */
+void texture_download_tile(Image_Format format, int tile_x, int tile_y, void const * pixels)
+{
+    Size size = format.size;
+    int x = tile_x * IMAGE_TILE, y = tile_y * IMAGE_TILE;
+    int width  = x + IMAGE_TILE < size.x ? IMAGE_TILE : size.x - x;
+    int height = y + IMAGE_TILE < size.y ? IMAGE_TILE : size.y - y;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, IMAGE_TILE);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, format.format, format.type, pixels);
+    image_store_unpack_reset();
+}
+
+/* a layer of a tiled image goes up tile by tile, without an interleaved copy */
+static void download_tiles(Image const * image, int layer, GLenum internal_format)
+{
+    Image_Format format = image->format;
+    Size tiles = image_format_tiles(format);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, format.size.x, format.size.y, 0, format.format, format.type, NULL);
+
+    for (int i = 0; i != tiles.y; ++ i)
+    for (int j = 0; j != tiles.x; ++ j)
+        texture_download_tile(format, j, i, image_tile(image, layer, j, i));
+}
+
 void texture_download(Image const * image)
 {
     Image_Format format = image->format;
+
+    if (format.layout == IMAGE_TILED && image_format_dimension(format) == 2)
+    {
+        download_tiles(image, 0, format.format);
+        return;
+    }
+
+    if (format.layout != IMAGE_INTERLEAVED)
+    {
+        Image * interleaved = image_to_layout(image, IMAGE_INTERLEAVED);
+        texture_download(interleaved);
+        image_destroy(interleaved);
+        return;
+    }
     Size size = format.size;
     GLenum internal_format = format.format;
     unsigned dimension = image_format_dimension(format);
 
+    image_store_unpack(image);
+
     switch (dimension)
     {
         case 1: glTexImage1D(GL_TEXTURE_1D, 0, internal_format, size.x,                 0, format.format, format.type, image->pixels); break;
         case 2: glTexImage2D(GL_TEXTURE_2D, 0, internal_format, size.x, size.y,         0, format.format, format.type, image->pixels); break;
         case 3: glTexImage3D(GL_TEXTURE_3D, 0, internal_format, size.x, size.y, size.z, 0, format.format, format.type, image->pixels); break;
     }
+
+    image_store_unpack_reset();
 }
 
 void texture_download_target(Image const * image, GLenum target)
 {
     Image_Format format = image->format;
+
+    if (format.layout != IMAGE_INTERLEAVED)
+    {
+        Image * interleaved = image_to_layout(image, IMAGE_INTERLEAVED);
+        texture_download_target(interleaved, target);
+        image_destroy(interleaved);
+        return;
+    }
     Size size = format.size;
     GLenum internal_format = format.format;
     unsigned dimension = image_format_dimension(format);
 
+    image_store_unpack(image);
+
     switch (dimension)
     {
         case 1: glTexImage1D(target, 0, internal_format, size.x,                 0, format.format, format.type, image->pixels); break;
         case 2: glTexImage2D(target, 0, internal_format, size.x, size.y,         0, format.format, format.type, image->pixels); break;
         case 3: glTexImage3D(target, 0, internal_format, size.x, size.y, size.z, 0, format.format, format.type, image->pixels); break;
     }
+
+    image_store_unpack_reset();
 }
 
-void texture_download_layer(Image const * image, int layer)
+/* reads the view in place when GL can address it, otherwise through a packed copy */
+static void download_view(Image_View const * view, GLenum internal_format)
 {
-    Image_Format format = image->format;
+    if (! image_view_packed(view))
+    {
+        Image * image = image_view_copy(view);
+        Image_View packed = image_view(image);
+        download_view(&packed, internal_format);
+        image_destroy(image);
+        return;
+    }
+
+    Image_Format format = view->format;
     Size size = format.size;
-    GLenum internal_format = format.format;
-    unsigned dimension = image_format_dimension(format);
+    void const * pixels = image_view_pixel(view, 0, 0, 0);
+
+    image_view_store_unpack(view);
+
+    switch (image_format_dimension(format))
+    {
+        case 1: glTexImage1D(GL_TEXTURE_1D, 0, internal_format, size.x,                 0, format.format, format.type, pixels); break;
+        case 2: glTexImage2D(GL_TEXTURE_2D, 0, internal_format, size.x, size.y,         0, format.format, format.type, pixels); break;
+        case 3: glTexImage3D(GL_TEXTURE_3D, 0, internal_format, size.x, size.y, size.z, 0, format.format, format.type, pixels); break;
+    }
+
+    image_store_unpack_reset();
+}
+
+void texture_download_layer(Image const * image, int layer)
+{
+    unsigned dimension = image_format_dimension(image->format);
 
     error_check(dimension != 2 && dimension != 3, "dimension must be 2 or 3");
 
-    GLubyte const * pixels = (GLubyte const *) image->pixels;
-    int stride_z = size.x * size.y * image_format_pixel_size(format);
+    if (image->format.layout == IMAGE_TILED)
+    {
+        download_tiles(image, layer, image->format.format);
+        return;
+    }
+
+    Image_View view = image_view_layer(image_view(image), layer);
+    download_view(&view, view.format.format);
+}
+
+/* keeps full float precision and range, for shaders that work on the data itself */
+void texture_download_layer_float(Image const * image, int layer)
+{
+    unsigned dimension = image_format_dimension(image->format);
+
+    error_check(dimension != 2 && dimension != 3, "dimension must be 2 or 3");
 
-    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, size.x, size.y, 0, format.format, format.type, &pixels[layer * stride_z]);
+    if (image->format.layout == IMAGE_TILED)
+    {
+        download_tiles(image, layer, GL_RGBA32F_ARB);
+        return;
+    }
+
+    Image_View view = image_view_layer(image_view(image), layer);
+    download_view(&view, GL_RGBA32F_ARB);
+}
+
+void texture_download_view(Image_View const * view)
+{
+    download_view(view, view->format.format);
 }
 
 float luminance_overcast_sky(Vector omega)
@@ -3,6 +3,7 @@
 
 #include "color.h"
 #include "image.h"
+#include "image_view.h"
 #include "vector.h"
 #include "volume.h"
 
@@ -12,6 +13,9 @@ Color texture_checker(Vector);
 void  texture_download(Image const *);
 void  texture_download_target(Image const *, GLenum target);
 void  texture_download_layer(Image const *, int layer);
+void  texture_download_layer_float(Image const *, int layer);
+void  texture_download_view(Image_View const *);
+void  texture_download_tile(Image_Format, int tile_x, int tile_y, void const * pixels);
 
 Brick * brick_from_image(Image const *);
 
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "memory.h"
+#include "tile_cache.h"
+
+#define LOCK(cache)   pthread_mutex_lock(&(cache)->mutex)
+#define UNLOCK(cache) pthread_mutex_unlock(&(cache)->mutex)
+
+static unsigned hash(Tile_Key key)
+{
+    unsigned h = key.level;
+    h = h * 0x9e3779b1u ^ key.layer;
+    h = h * 0x9e3779b1u ^ key.x;
+    h = h * 0x9e3779b1u ^ key.y;
+
+    return h ^ h >> 15;
+}
+
+static int key_equal(Tile_Key a, Tile_Key b)
+{
+    return a.level == b.level && a.layer == b.layer && a.x == b.x && a.y == b.y;
+}
+
+Tile_Cache * tile_cache_new(int tile_bytes, size_t byte_limit, Tile_Loader load, void * context)
+{
+    Tile_Cache * cache = calloc_size(Tile_Cache);
+    int bucket_count = 16;
+
+    cache->tile_bytes = tile_bytes;
+    cache->limit = byte_limit / tile_bytes > 0 ? (int) (byte_limit / tile_bytes) : 1;
+    cache->capacity = cache->limit;
+    cache->slots = malloc_array(Tile_Slot, cache->capacity);
+    cache->load = load;
+    cache->context = context;
+
+    while (bucket_count < 2 * cache->capacity)
+        bucket_count *= 2;
+
+    cache->bucket_mask = bucket_count - 1;
+    cache->buckets = malloc_array(int, bucket_count);
+    for (int i = 0; i != bucket_count; ++ i)
+        cache->buckets[i] = -1;
+
+    pthread_mutex_init(&cache->mutex, NULL);
+    pthread_cond_init(&cache->loaded, NULL);
+
+    return cache;
+}
+
+void tile_cache_destroy(Tile_Cache * cache)
+{
+    if (! cache)
+        return;
+
+    for (int i = 0; i != cache->count; ++ i)
+        free(cache->slots[i].pixels);
+
+    pthread_cond_destroy(&cache->loaded);
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache->buckets);
+    free(cache->slots);
+    free(cache);
+}
+
+static int find(Tile_Cache const * cache, Tile_Key key)
+{
+    int i = cache->buckets[hash(key) & cache->bucket_mask];
+
+    while (i >= 0 && ! key_equal(cache->slots[i].key, key))
+        i = cache->slots[i].next;
+
+    return i;
+}
+
+static void unlink_slot(Tile_Cache * cache, int index)
+{
+    int * link = &cache->buckets[hash(cache->slots[index].key) & cache->bucket_mask];
+
+    while (* link != index)
+        link = &cache->slots[* link].next;
+
+    * link = cache->slots[index].next;
+}
+
+static int least_recent(Tile_Cache const * cache)
+{
+    int oldest = -1;
+
+    for (int i = 0; i != cache->count; ++ i)
+    {
+        Tile_Slot const * slot = &cache->slots[i];
+
+        if (slot->pins || slot->loading)
+            continue;
+
+        if (oldest < 0 || slot->stamp < cache->slots[oldest].stamp)
+            oldest = i;
+    }
+
+    return oldest;
+}
+
+/* a fresh slot while under the limit, then the least recently used one nobody holds */
+static int free_slot(Tile_Cache * cache)
+{
+    if (cache->count >= cache->limit)
+    {
+        int oldest = least_recent(cache);
+
+        if (oldest >= 0)
+        {
+            unlink_slot(cache, oldest);
+            ++ cache->evictions;
+            return oldest;
+        }
+    }
+
+    if (cache->count == cache->capacity)
+    {
+        cache->capacity *= 2;
+        cache->slots = (Tile_Slot *) realloc(cache->slots, cache->capacity * sizeof(Tile_Slot));
+        error_check(! cache->slots, "failed to grow tile cache");
+    }
+
+    cache->slots[cache->count].pixels = malloc(cache->tile_bytes);
+    error_check(! cache->slots[cache->count].pixels, "failed to allocate tile");
+
+    return cache->count ++;
+}
+
+/* the tile stays resident until the matching release */
+void * tile_cache_acquire(Tile_Cache * cache, Tile_Key key)
+{
+    LOCK(cache);
+
+    int index;
+    while ((index = find(cache, key)) >= 0 && cache->slots[index].loading)
+        pthread_cond_wait(&cache->loaded, &cache->mutex);
+
+    if (index >= 0)
+    {
+        Tile_Slot * slot = &cache->slots[index];
+
+        ++ slot->pins;
+        slot->stamp = ++ cache->stamp;
+        ++ cache->hits;
+
+        // the slots may move once the lock is given up
+        void * pixels = slot->pixels;
+        UNLOCK(cache);
+        return pixels;
+    }
+
+    ++ cache->misses;
+    index = free_slot(cache);
+
+    Tile_Slot * slot = &cache->slots[index];
+    int * bucket = &cache->buckets[hash(key) & cache->bucket_mask];
+
+    slot->key = key;
+    slot->pins = 1;
+    slot->loading = 1;
+    slot->stamp = ++ cache->stamp;
+    slot->next = * bucket;
+    * bucket = index;
+
+    void * pixels = slot->pixels;
+    UNLOCK(cache);
+
+    cache->load(cache->context, key, pixels);
+
+    LOCK(cache);
+    cache->slots[find(cache, key)].loading = 0;
+    pthread_cond_broadcast(&cache->loaded);
+    UNLOCK(cache);
+
+    return pixels;
+}
+
+/* frees the tiles grown past the limit, the last slot moves into the gap */
+static void shrink(Tile_Cache * cache)
+{
+    int index;
+
+    while (cache->count > cache->limit && (index = least_recent(cache)) >= 0)
+    {
+        int last = -- cache->count;
+
+        unlink_slot(cache, index);
+        free(cache->slots[index].pixels);
+        ++ cache->evictions;
+
+        if (index != last)
+        {
+            int * bucket = &cache->buckets[hash(cache->slots[last].key) & cache->bucket_mask];
+
+            unlink_slot(cache, last);
+            cache->slots[index] = cache->slots[last];
+            cache->slots[index].next = * bucket;
+            * bucket = index;
+        }
+    }
+}
+
+void tile_cache_release(Tile_Cache * cache, Tile_Key key)
+{
+    LOCK(cache);
+
+    int index = find(cache, key);
+    if (index >= 0 && cache->slots[index].pins > 0)
+        -- cache->slots[index].pins;
+
+    if (cache->count > cache->limit)
+        shrink(cache);
+
+    UNLOCK(cache);
+}
+
+/* without loading, for callers that draw something coarser meanwhile */
+int tile_cache_resident(Tile_Cache * cache, Tile_Key key)
+{
+    LOCK(cache);
+
+    int index = find(cache, key);
+    int resident = index >= 0 && ! cache->slots[index].loading;
+
+    UNLOCK(cache);
+    return resident;
+}
+
+void tile_cache_print(Tile_Cache * cache)
+{
+    LOCK(cache);
+
+    printf("tile cache: %d tiles of %d bytes resident, %lu hits, %lu misses, %lu evictions\n",
+        cache->count, cache->tile_bytes, cache->hits, cache->misses, cache->evictions);
+
+    UNLOCK(cache);
+}
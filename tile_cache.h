@@ -0,0 +1,49 @@
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* level counts down a pyramid from the full resolution image at 0 */
+typedef struct {int level, layer, x, y;} Tile_Key;
+
+/* fills the pixels of one tile, called without the cache lock held */
+typedef void (* Tile_Loader)(void * context, Tile_Key, void * pixels);
+
+typedef struct
+{
+    Tile_Key key;
+    void * pixels;
+    int pins, loading, next;
+    unsigned long stamp;
+}
+Tile_Slot;
+
+/*
+ * Resident set of equally sized tiles under a byte limit. A miss calls
+ * the loader into a free or the least recently used slot. Acquired tiles
+ * stay pinned until released, so several threads may page at once; when
+ * every slot is pinned the cache grows past its limit instead of waiting,
+ * and the releases evict back down to the limit.
+ */
+typedef struct
+{
+    int tile_bytes, limit, capacity, count;
+    Tile_Slot * slots;
+    int * buckets, bucket_mask;
+    Tile_Loader load;
+    void * context;
+    unsigned long stamp, hits, misses, evictions;
+    pthread_mutex_t mutex;
+    pthread_cond_t loaded;
+}
+Tile_Cache;
+
+Tile_Cache * tile_cache_new(int tile_bytes, size_t byte_limit, Tile_Loader, void * context);
+void         tile_cache_destroy(Tile_Cache *);
+void *       tile_cache_acquire(Tile_Cache *, Tile_Key);
+void         tile_cache_release(Tile_Cache *, Tile_Key);
+int          tile_cache_resident(Tile_Cache *, Tile_Key);
+void         tile_cache_print(Tile_Cache *);
+
+#endif